@@ -30,7 +30,11 @@ const int AudioVisualWaveform::kSumSampleRate = 200;
 
 void AudioVisualWaveform::AddSum(const float *samples, int nb_samples, int nb_channels)
 {
+  int old_size = data_.size();
+
   data_.append(SumSamples(samples, nb_samples, nb_channels));
+
+  UpdateMipmaps(old_size, data_.size());
 }
 
 void AudioVisualWaveform::OverwriteSamples(SampleBufferPtr samples, int sample_rate, const rational &start)
@@ -61,6 +65,8 @@ void AudioVisualWaveform::OverwriteSamples(SampleBufferPtr samples, int sample_r
         summary.constData(),
         summary.size() * sizeof(SamplePerChannel));
   }
+
+  UpdateMipmaps(start_index, end_index);
 }
 
 void AudioVisualWaveform::OverwriteSums(const AudioVisualWaveform &sums, const rational &dest, const rational& offset, const rational& length)
@@ -86,6 +92,8 @@ void AudioVisualWaveform::OverwriteSums(const AudioVisualWaveform &sums, const r
   memcpy(reinterpret_cast<char*>(data_.data()) + start_index * sizeof(SamplePerChannel),
          reinterpret_cast<const char*>(sums.data_.constData()) + time_to_samples(offset) * sizeof(SamplePerChannel),
          copy_len * sizeof(SamplePerChannel));
+
+  UpdateMipmaps(start_index, end_index);
 }
 
 AudioVisualWaveform AudioVisualWaveform::Mid(const rational &time) const
@@ -95,23 +103,34 @@ AudioVisualWaveform AudioVisualWaveform::Mid(const rational &time) const
   // Create a copy of this waveform chop the early section off
   AudioVisualWaveform copy = *this;
   copy.data_ = data_.mid(sample_index);
+  copy.UpdateMipmaps(0, copy.data_.size());
 
   return copy;
 }
 
 void AudioVisualWaveform::Append(const AudioVisualWaveform &waveform)
 {
+  int old_size = data_.size();
+
   data_.append(waveform.data_);
+
+  UpdateMipmaps(old_size, data_.size());
 }
 
 void AudioVisualWaveform::TrimIn(const rational &time)
 {
   data_ = data_.mid(time_to_samples(time));
+
+  // Everything moved, so every level needs to be redone
+  UpdateMipmaps(0, data_.size());
 }
 
 void AudioVisualWaveform::TrimOut(const rational &time)
 {
   data_.resize(data_.size() - time_to_samples(time));
+
+  // Only the last entry of each level can have changed
+  UpdateMipmaps(qMax(0, data_.size() - channels_), data_.size());
 }
 
 void AudioVisualWaveform::PrependSilence(const rational &time)
@@ -128,6 +147,8 @@ void AudioVisualWaveform::PrependSilence(const rational &time)
 
   // Fill remainder with silence
   memset(reinterpret_cast<char*>(data_.data()), 0, added_samples * sizeof(SamplePerChannel));
+
+  UpdateMipmaps(0, data_.size());
 }
 
 void AudioVisualWaveform::AppendSilence(const rational &time)
@@ -140,6 +161,8 @@ void AudioVisualWaveform::AppendSilence(const rational &time)
 
   // Fill remainder with silence
   memset(reinterpret_cast<char*>(&data_[old_size]), 0, (data_.size() - old_size) * sizeof(SamplePerChannel));
+
+  UpdateMipmaps(old_size, data_.size());
 }
 
 void AudioVisualWaveform::Shift(const rational &from, const rational &to)
@@ -180,6 +203,8 @@ void AudioVisualWaveform::Shift(const rational &from, const rational &to)
 
     memset(reinterpret_cast<char*>(&data_[from_index]), 0, distance * sizeof(SamplePerChannel));
   }
+
+  UpdateMipmaps(qMin(from_index, to_index), data_.size());
 }
 
 QVector<AudioVisualWaveform::SamplePerChannel> AudioVisualWaveform::SumSamples(const float *samples, int nb_samples, int nb_channels)
@@ -261,17 +286,33 @@ void AudioVisualWaveform::DrawSample(QPainter *painter, const QVector<SamplePerC
 
 void AudioVisualWaveform::DrawWaveform(QPainter *painter, const QRect& rect, const double& scale, const AudioVisualWaveform &samples, const rational& start_time)
 {
-  int start_sample_index = samples.time_to_samples(start_time);
+  int channels = samples.channel_count();
+
+  if (!channels) {
+    return;
+  }
+
+  int total_frames = samples.nb_samples() / channels;
+  int start_frame = samples.time_to_samples(start_time) / channels;
 
-  if (start_sample_index >= samples.nb_samples()) {
+  if (start_frame >= total_frames) {
     return;
   }
 
-  int next_sample_index = start_sample_index;
-  int sample_index;
+  double frames_per_pixel = static_cast<double>(kSumSampleRate) / scale;
+
+  // Use the lowest resolution that still has at least one entry per pixel
+  int level = 0;
+  while (level < samples.mipmaps_.size() && static_cast<double>(2 << level) <= frames_per_pixel) {
+    level++;
+  }
+
+  const QVector<SamplePerChannel>& level_data = (level == 0) ? samples.data_ : samples.mipmaps_.at(level - 1);
+  int level_frames = level_data.size() / channels;
 
   QVector<SamplePerChannel> summary;
-  int summary_index = -1;
+  int summary_start = -1;
+  int summary_end = -1;
 
   const QRect& viewport = painter->viewport();
   QPoint top_left = painter->transform().map(viewport.topLeft());
@@ -280,20 +321,25 @@ void AudioVisualWaveform::DrawWaveform(QPainter *painter, const QRect& rect, con
   int end = qMin(rect.right(), -top_left.x() + viewport.width());
 
   for (int i=start;i<end;i++) {
-    sample_index = next_sample_index;
+    int frame_start = start_frame + qFloor(frames_per_pixel * static_cast<double>(i - rect.x()));
 
-    if (sample_index == samples.nb_samples()) {
+    if (frame_start >= total_frames) {
       break;
     }
 
-    next_sample_index = qMin(samples.nb_samples(),
-                             start_sample_index + qFloor(static_cast<double>(kSumSampleRate) * static_cast<double>(i - rect.x() + 1) / scale) * samples.channel_count());
+    int frame_end = start_frame + qFloor(frames_per_pixel * static_cast<double>(i - rect.x() + 1));
+    frame_end = qMin(total_frames, qMax(frame_start + 1, frame_end));
+
+    // Convert to this level's entries, rounding outwards
+    int level_start = frame_start >> level;
+    int level_end = qMin(level_frames, ((frame_end - 1) >> level) + 1);
 
-    if (summary_index != sample_index) {
-      summary = AudioVisualWaveform::ReSumSamples(&samples.data_.at(sample_index),
-                                                  qMax(samples.channel_count(), next_sample_index - sample_index),
-                                                  samples.channel_count());
-      summary_index = sample_index;
+    if (level_start != summary_start || level_end != summary_end) {
+      summary = AudioVisualWaveform::ReSumSamples(&level_data.at(level_start * channels),
+                                                  (level_end - level_start) * channels,
+                                                  channels);
+      summary_start = level_start;
+      summary_end = level_end;
     }
 
     DrawSample(painter, summary, i, rect.y(), rect.height());
@@ -334,4 +380,64 @@ void AudioVisualWaveform::ExpandMinMax(AudioVisualWaveform::SamplePerChannel &su
   }
 }
 
+void AudioVisualWaveform::UpdateMipmaps(int start_index, int end_index)
+{
+  if (!channels_) {
+    mipmaps_.clear();
+    return;
+  }
+
+  int prev_frames = data_.size() / channels_;
+
+  // Size the pyramid first so references to earlier levels stay valid while we fill it
+  int levels = 0;
+  for (int f=prev_frames; f>1; f=(f+1)/2) {
+    levels++;
+  }
+  mipmaps_.resize(levels);
+
+  // Work in whole frames (one SamplePerChannel per channel)
+  int start = start_index / channels_;
+  int end = (end_index + channels_ - 1) / channels_;
+
+  const QVector<SamplePerChannel>* prev = &data_;
+
+  for (int level=0; level<levels; level++) {
+    int frames = (prev_frames + 1) / 2;
+
+    QVector<SamplePerChannel>& mip = mipmaps_[level];
+    mip.resize(frames * channels_);
+
+    start /= 2;
+    end = qMin(frames, (end + 1) / 2);
+
+    for (int i=start; i<end; i++) {
+      int a = (i * 2) * channels_;
+      int b = a + channels_;
+      bool has_b = (i * 2 + 1 < prev_frames);
+
+      for (int j=0; j<channels_; j++) {
+        SamplePerChannel s = prev->at(a + j);
+
+        if (has_b) {
+          const SamplePerChannel& other = prev->at(b + j);
+
+          if (other.min < s.min) {
+            s.min = other.min;
+          }
+
+          if (other.max > s.max) {
+            s.max = other.max;
+          }
+        }
+
+        mip[i * channels_ + j] = s;
+      }
+    }
+
+    prev = &mip;
+    prev_frames = frames;
+  }
+}
+
 }
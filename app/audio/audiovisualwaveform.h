@@ -34,6 +34,11 @@ namespace olive {
  *
  * This differs from a SampleBuffer as the data in an AudioVisualWaveform has been reduced
  * significantly and optimized for visual display.
+ *
+ * Alongside the summary itself, a mipmap pyramid is kept where each level halves the resolution of
+ * the one before it. It's updated incrementally whenever the summary changes so that
+ * DrawWaveform() can read from the level matching the current zoom and only has to look at a
+ * couple of entries per pixel.
  */
 class AudioVisualWaveform {
 public:
@@ -53,7 +58,10 @@ public:
 
   void set_channel_count(int channels)
   {
-    channels_ = channels;
+    if (channels_ != channels) {
+      channels_ = channels;
+      UpdateMipmaps(0, data_.size());
+    }
   }
 
   int nb_samples() const
@@ -102,10 +110,20 @@ private:
   int time_to_samples(const rational& time) const;
   int time_to_samples(const double& time) const;
 
+  /**
+   * @brief Recalculates the mipmaps covering `data_` between `start_index` and `end_index`
+   *
+   * Also resizes every level to match the current size of `data_`.
+   */
+  void UpdateMipmaps(int start_index, int end_index);
+
   int channels_ = 0;
 
   QVector<SamplePerChannel> data_;
 
+  /// Level N holds the min/max of every 2^(N+1) frames of `data_`
+  QVector< QVector<SamplePerChannel> > mipmaps_;
+
 };
 
 }
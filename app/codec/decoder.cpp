@@ -23,6 +23,8 @@
 #include <QCoreApplication>
 #include <QDebug>
 #include <QFileInfo>
+#include <QTextStream>
+#include <QtConcurrent/QtConcurrent>
 
 #include "codec/ffmpeg/ffmpegdecoder.h"
 #include "codec/oiio/oiiodecoder.h"
@@ -41,7 +43,14 @@ namespace olive {
 
 QMutex Decoder::currently_conforming_mutex_;
 QWaitCondition Decoder::currently_conforming_wait_cond_;
-QVector<Decoder::CurrentlyConforming> Decoder::currently_conforming_;
+QVector<Decoder::ConformStatePtr> Decoder::currently_conforming_;
+QMutex Decoder::conform_mappings_mutex_;
+QHash<QString, Decoder::ConformMappingPtr> Decoder::conform_mappings_;
+quint64 Decoder::conform_mappings_clock_ = 0;
+const int Decoder::kMaxConformMappings = 32;
+QThreadPool Decoder::conform_pool_;
+const rational Decoder::kConformUnbounded = rational(INT32_MAX);
+const rational Decoder::kConformSeekThreshold = rational(30);
 
 Decoder::Decoder() :
   stream_(nullptr)
@@ -131,50 +140,130 @@ SampleBufferPtr Decoder::RetrieveAudio(const TimeRange &range, const AudioParams
 
   // Determine if we already have a conformed version
   QString conform_filename = GetConformedFilename(params);
-  CurrentlyConforming want_conform = {stream_, params};
 
-  currently_conforming_mutex_.lock();
+  SampleBufferPtr buffer = RetrieveAudioFromConform(conform_filename, range);
+  if (buffer) {
+    return buffer;
+  }
+
+  QMutexLocker conform_locker(&currently_conforming_mutex_);
+
+  ConformStatePtr state = nullptr;
+  forever {
+    state = nullptr;
+    foreach (ConformStatePtr s, currently_conforming_) {
+      if (s->stream == stream_ && s->params == params) {
+        state = s;
+        break;
+      }
+    }
+
+    if (!state || !state->stopped) {
+      break;
+    }
+
+    // A stopped worker is still saving its progress, wait for it to exit and resume from there
+    if (cancelled && *cancelled) {
+      return nullptr;
+    }
 
-  // Wait for conform to complete
-  while (currently_conforming_.contains(want_conform)) {
     currently_conforming_wait_cond_.wait(&currently_conforming_mutex_);
   }
 
-  // See if we got the conform
-  SampleBufferPtr buffer = RetrieveAudioFromConform(conform_filename, range);
+  if (!state) {
+    // The conform may have finished since we last checked
+    buffer = RetrieveAudioFromConform(conform_filename, range);
+    if (buffer) {
+      return buffer;
+    }
 
-  if (!buffer) {
-    // We'll need to conform this ourselves
-    currently_conforming_.append(want_conform);
-    currently_conforming_mutex_.unlock();
+    // Start conforming in the background. We conform to a different filename until it's done to
+    // make it clear even across sessions whether this conform is ready or not.
+    state = std::make_shared<ConformState>();
+    state->stream = stream_;
+    state->params = params;
+    state->filename = conform_filename;
+    state->working_filename = conform_filename;
+    state->working_filename.append(QStringLiteral(".working"));
+    state->stream_end_known = false;
+    state->finished = false;
+    state->failed = false;
+    state->stopped = false;
 
-    // We conform to a different filename until it's done to make it clear even across sessions
-    // whether this conform is ready or not
-    QString working_fn = conform_filename;
-    working_fn.append(QStringLiteral(".working"));
+    LoadConformProgress(state.get());
 
-    if (ConformAudioInternal(working_fn, params, cancelled)) {
-      // Move file to standard conform name, making it clear this conform is ready for use
-      QFile::remove(conform_filename);
-      QFile::rename(working_fn, conform_filename);
+    currently_conforming_.append(state);
 
-      // Return audio as planned
-      buffer = RetrieveAudioFromConform(conform_filename, range);
-    } else {
-      // Failed
-      qCritical() << "Failed to conform audio";
+    QtConcurrent::run(&conform_pool_, &Decoder::ConformWorker, state);
+  }
+
+  // Wait until the conform covers the range we want
+  state->requested.append(range);
+
+  while (!state->finished && FindConformGap(state.get(), range, nullptr)) {
+    if (cancelled && *cancelled) {
+      break;
     }
 
-    currently_conforming_mutex_.lock();
-    currently_conforming_.removeOne(want_conform);
-    currently_conforming_wait_cond_.wakeAll();
+    currently_conforming_wait_cond_.wait(&currently_conforming_mutex_);
   }
 
-  currently_conforming_mutex_.unlock();
+  state->requested.removeOne(range);
+
+  if (cancelled && *cancelled && state->requested.isEmpty() && !state->finished) {
+    // Nobody wants this audio anymore, don't keep resampling the rest of the stream for nothing
+    state->stopped = true;
+  }
+
+  if (state->failed) {
+    return nullptr;
+  }
+
+  if (state->finished) {
+    conform_locker.unlock();
+
+    return RetrieveAudioFromConform(conform_filename, range);
+  }
+
+  if (FindConformGap(state.get(), range, nullptr)) {
+    // Must have been cancelled
+    return nullptr;
+  }
+
+  // Open the working file while we still hold the lock so the worker can't rename it under us,
+  // the handle stays valid after that
+  QFile working_file(state->working_filename);
+  if (!working_file.open(QFile::ReadOnly)) {
+    qCritical() << "Failed to open working conform" << state->working_filename;
+    return nullptr;
+  }
+
+  conform_locker.unlock();
+
+  buffer = RetrieveAudioFromWorkingConform(&working_file, params, range);
 
   return buffer;
 }
 
+bool Decoder::Index(const QAtomicInt *cancelled)
+{
+  QMutexLocker locker(&mutex_);
+
+  if (!stream_) {
+    qWarning() << "Tried to index a decoder that wasn't open";
+    return false;
+  }
+
+  return IndexInternal(cancelled);
+}
+
+int64_t Decoder::GetVideoDistance(const rational &timecode)
+{
+  Q_UNUSED(timecode)
+
+  return -1;
+}
+
 void Decoder::Close()
 {
   QMutexLocker locker(&mutex_);
@@ -348,33 +437,412 @@ FramePtr Decoder::RetrieveVideoInternal(const rational &timecode, const int &div
   return nullptr;
 }
 
-bool Decoder::ConformAudioInternal(const QString& filename, const AudioParams &params, const QAtomicInt* cancelled)
+bool Decoder::ConformAudioInternal(WaveOutput *output, const TimeRange &range, const ConformProgressFunction &progress, bool *eof)
 {
-  Q_UNUSED(filename)
-  Q_UNUSED(cancelled)
-  Q_UNUSED(params)
+  Q_UNUSED(output)
+  Q_UNUSED(range)
+  Q_UNUSED(progress)
+  Q_UNUSED(eof)
   return false;
 }
 
+bool Decoder::IndexInternal(const QAtomicInt *cancelled)
+{
+  Q_UNUSED(cancelled)
+
+  // Nothing to index by default
+  return true;
+}
+
 SampleBufferPtr Decoder::RetrieveAudioFromConform(const QString &conform_filename, const TimeRange& range)
 {
-  WaveInput input(conform_filename);
+  ConformMappingPtr mapping = GetConformMapping(conform_filename);
 
-  if (input.open()) {
-    const AudioParams& input_params = input.params();
+  if (!mapping) {
+    return nullptr;
+  }
+
+  const AudioParams& params = mapping->params;
+
+  qint64 offset = qBound(qint64(0), params.time_to_bytes(range.in()), mapping->size);
+  qint64 length = qMin(params.time_to_bytes(range.length()), mapping->size - offset);
 
-    // Read bytes from wav
-    QByteArray packed_data = input.read(input_params.time_to_bytes(range.in()),
-                                        input_params.time_to_bytes(range.length()));
-    input.close();
+  // Deinterleave straight out of the mapping
+  return SampleBuffer::CreateFromPackedData(params,
+                                            mapping->data + offset,
+                                            params.bytes_to_samples(length));
+}
+
+Decoder::ConformMappingPtr Decoder::GetConformMapping(const QString &filename)
+{
+  QMutexLocker locker(&conform_mappings_mutex_);
 
-    // Create sample buffer
-    SampleBufferPtr sample_buffer = SampleBuffer::CreateFromPackedData(input_params, packed_data);
+  ConformMappingPtr mapping = conform_mappings_.value(filename);
 
-    return sample_buffer;
+  if (mapping) {
+    mapping->last_used = ++conform_mappings_clock_;
+    return mapping;
   }
 
-  return nullptr;
+  // Don't remember files that don't exist since they will once their conform finishes
+  if (!QFileInfo::exists(filename)) {
+    return nullptr;
+  }
+
+  WaveInput input(filename);
+
+  if (!input.open()) {
+    return nullptr;
+  }
+
+  mapping = std::make_shared<ConformMapping>();
+  mapping->params = input.params();
+  mapping->size = input.data_length();
+
+  qint64 data_position = input.data_position();
+
+  input.close();
+
+  mapping->file.setFileName(filename);
+
+  if (mapping->size == 0) {
+    mapping->data = nullptr;
+  } else {
+    uchar* map = nullptr;
+
+    if (mapping->file.open(QFile::ReadOnly)) {
+      map = mapping->file.map(data_position, mapping->size);
+    }
+
+    if (!map) {
+      qCritical() << "Failed to map conformed audio" << filename << mapping->file.errorString();
+      return nullptr;
+    }
+
+    mapping->data = reinterpret_cast<const char*>(map);
+  }
+
+  if (conform_mappings_.size() >= kMaxConformMappings) {
+    // Drop the least recently used mapping, readers still holding it keep it mapped until they're done
+    QHash<QString, ConformMappingPtr>::iterator oldest = conform_mappings_.begin();
+
+    for (QHash<QString, ConformMappingPtr>::iterator it=conform_mappings_.begin(); it!=conform_mappings_.end(); it++) {
+      if (it.value()->last_used < oldest.value()->last_used) {
+        oldest = it;
+      }
+    }
+
+    conform_mappings_.erase(oldest);
+  }
+
+  mapping->last_used = ++conform_mappings_clock_;
+  conform_mappings_.insert(filename, mapping);
+
+  return mapping;
+}
+
+void Decoder::ReleaseConformMappingsInFolder(const QString &folder)
+{
+  QString dir = QDir(folder).absolutePath();
+
+  QMutexLocker locker(&conform_mappings_mutex_);
+
+  QHash<QString, ConformMappingPtr>::iterator it = conform_mappings_.begin();
+
+  while (it != conform_mappings_.end()) {
+    if (QFileInfo(it.key()).absolutePath() == dir) {
+      it = conform_mappings_.erase(it);
+    } else {
+      it++;
+    }
+  }
+}
+
+void Decoder::StopConformsOfFootage(const QString &footage_filename)
+{
+  // Conform filenames start with the footage's unique identifier, see GetIndexFilename()
+  QString id = FileFunctions::GetUniqueFileIdentifier(footage_filename);
+
+  if (id.isEmpty()) {
+    return;
+  }
+
+  QMutexLocker locker(&currently_conforming_mutex_);
+
+  foreach (ConformStatePtr state, currently_conforming_) {
+    if (QFileInfo(state->filename).fileName().startsWith(id)) {
+      state->stopped = true;
+    }
+  }
+
+  currently_conforming_wait_cond_.wakeAll();
+}
+
+void Decoder::StopAllConforms()
+{
+  currently_conforming_mutex_.lock();
+
+  foreach (ConformStatePtr state, currently_conforming_) {
+    state->stopped = true;
+  }
+
+  currently_conforming_wait_cond_.wakeAll();
+
+  currently_conforming_mutex_.unlock();
+
+  conform_pool_.waitForDone();
+}
+
+void Decoder::ReleaseConformMappingsOfFootage(const QString &footage_filename)
+{
+  // Conform filenames start with the footage's unique identifier, see GetIndexFilename()
+  QString id = FileFunctions::GetUniqueFileIdentifier(footage_filename);
+
+  if (id.isEmpty()) {
+    return;
+  }
+
+  QMutexLocker locker(&conform_mappings_mutex_);
+
+  QHash<QString, ConformMappingPtr>::iterator it = conform_mappings_.begin();
+
+  while (it != conform_mappings_.end()) {
+    if (QFileInfo(it.key()).fileName().startsWith(id)) {
+      it = conform_mappings_.erase(it);
+    } else {
+      it++;
+    }
+  }
+}
+
+SampleBufferPtr Decoder::RetrieveAudioFromWorkingConform(QFile *file, const AudioParams &params, const TimeRange &range)
+{
+  // The header of a working file isn't filled in yet, but we already know where everything is
+  if (!file->seek(WaveOutput::kHeaderSize + params.time_to_bytes(range.in()))) {
+    return nullptr;
+  }
+
+  QByteArray packed_data = file->read(params.time_to_bytes(range.length()));
+
+  return SampleBuffer::CreateFromPackedData(params, packed_data);
+}
+
+void Decoder::ConformWorker(ConformStatePtr state)
+{
+  DecoderPtr decoder = CreateFromID(state->stream->footage()->decoder());
+
+  WaveOutput output(state->working_filename, state->params);
+
+  bool resume;
+  {
+    QMutexLocker locker(&currently_conforming_mutex_);
+    resume = !state->conformed.isEmpty();
+  }
+
+  bool success = decoder && decoder->Open(state->stream) && output.open(resume);
+  bool stopped = false;
+
+  while (success) {
+    TimeRange run;
+
+    {
+      QMutexLocker locker(&currently_conforming_mutex_);
+
+      if (state->stopped) {
+        stopped = true;
+        break;
+      }
+
+      if (!GetNextConformRange(state.get(), &run)) {
+        break;
+      }
+    }
+
+    bool eof = false;
+    rational reached = run.in();
+
+    success = decoder->ConformAudioInternal(&output, run, [&state, &run, &reached](const rational& t){
+      QMutexLocker locker(&currently_conforming_mutex_);
+
+      // Publish what we've written so far
+      reached = t;
+      if (reached > run.in()) {
+        state->conformed.insert(TimeRange(run.in(), reached));
+        currently_conforming_wait_cond_.wakeAll();
+      }
+
+      if (state->stopped) {
+        return false;
+      }
+
+      // Keep going unless GetNextConformRange() would now start somewhere we won't reach soon
+      TimeRange gap;
+      if (FindRequestedConformGap(state.get(), &gap)) {
+        return gap.in() >= reached && gap.in() <= reached + kConformSeekThreshold;
+      }
+
+      return true;
+    }, &eof);
+
+    // Make sure everything we're about to publish is readable
+    output.flush();
+
+    QMutexLocker locker(&currently_conforming_mutex_);
+
+    if (reached > run.in()) {
+      state->conformed.insert(TimeRange(run.in(), reached));
+    }
+
+    if (eof) {
+      // Nothing exists beyond this point
+      rational end = qMax(reached, run.in());
+
+      if (!state->stream_end_known || end < state->stream_end) {
+        state->stream_end = end;
+        state->stream_end_known = true;
+      }
+    }
+
+    currently_conforming_wait_cond_.wakeAll();
+  }
+
+  output.close();
+
+  if (decoder) {
+    decoder->Close();
+  }
+
+  QMutexLocker locker(&currently_conforming_mutex_);
+
+  if (stopped) {
+    // Leave the working file where it is so the next conform of this stream can pick up from here
+    SaveConformProgress(state.get());
+  } else if (success) {
+    // Move file to standard conform name, making it clear this conform is ready for use
+    QFile::remove(state->filename);
+    QFile::rename(state->working_filename, state->filename);
+    QFile::remove(GetConformProgressFilename(state.get()));
+  } else {
+    qCritical() << "Failed to conform audio";
+  }
+
+  state->finished = true;
+  state->failed = !success;
+  currently_conforming_.removeOne(state);
+  currently_conforming_wait_cond_.wakeAll();
+}
+
+QString Decoder::GetConformProgressFilename(const ConformState *state)
+{
+  QString filename = state->working_filename;
+  filename.append(QStringLiteral(".progress"));
+  return filename;
+}
+
+void Decoder::SaveConformProgress(const ConformState *state)
+{
+  QFile file(GetConformProgressFilename(state));
+
+  if (!file.open(QFile::WriteOnly | QFile::Text)) {
+    qWarning() << "Failed to save conform progress" << file.fileName();
+    return;
+  }
+
+  QTextStream ts(&file);
+
+  foreach (const TimeRange& r, state->conformed) {
+    ts << r.in().toString() << ' ' << r.out().toString() << '\n';
+  }
+}
+
+void Decoder::LoadConformProgress(ConformState *state)
+{
+  QFile file(GetConformProgressFilename(state));
+
+  if (!QFileInfo::exists(state->working_filename) || !file.open(QFile::ReadOnly | QFile::Text)) {
+    return;
+  }
+
+  QTextStream ts(&file);
+
+  while (!ts.atEnd()) {
+    QStringList parts = ts.readLine().split(' ');
+
+    if (parts.size() == 2) {
+      rational in = rational::fromString(parts.at(0));
+      rational out = rational::fromString(parts.at(1));
+
+      if (in >= 0 && out > in) {
+        state->conformed.insert(TimeRange(in, out));
+      }
+    }
+  }
+}
+
+bool Decoder::GetNextConformRange(const ConformState *state, TimeRange *range)
+{
+  rational end = state->stream_end_known ? state->stream_end : kConformUnbounded;
+
+  TimeRange gap;
+  if (FindRequestedConformGap(state, &gap)) {
+    // Continue until we run into something already conformed
+    return FindConformGap(state, TimeRange(gap.in(), end), range);
+  }
+
+  // Otherwise continue from the earliest point we haven't conformed
+  return FindConformGap(state, TimeRange(0, end), range);
+}
+
+bool Decoder::FindRequestedConformGap(const ConformState *state, TimeRange *gap)
+{
+  // Ranges being waited on come first, most recently requested first since that's most likely
+  // where the user is looking right now
+  for (int i=state->requested.size()-1; i>=0; i--) {
+    if (FindConformGap(state, state->requested.at(i), gap)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool Decoder::FindConformGap(const ConformState *state, const TimeRange &within, TimeRange *gap)
+{
+  TimeRange clipped = within;
+
+  if (state->stream_end_known) {
+    if (clipped.in() >= state->stream_end) {
+      return false;
+    }
+
+    if (clipped.out() > state->stream_end) {
+      clipped.set_out(state->stream_end);
+    }
+  }
+
+  if (clipped.length() <= 0) {
+    return false;
+  }
+
+  TimeRangeList remaining = {clipped};
+  foreach (const TimeRange& r, state->conformed) {
+    remaining.remove(r);
+  }
+
+  bool found = false;
+  TimeRange earliest;
+  foreach (const TimeRange& r, remaining) {
+    if (r.length() > 0 && (!found || r.in() < earliest.in())) {
+      earliest = r;
+      found = true;
+    }
+  }
+
+  if (found && gap) {
+    *gap = earliest;
+  }
+
+  return found;
 }
 
 }
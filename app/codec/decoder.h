@@ -25,8 +25,11 @@ extern "C" {
 #include <libswresample/swresample.h>
 }
 
+#include <functional>
+#include <QHash>
 #include <QMutex>
 #include <QObject>
+#include <QThreadPool>
 #include <QWaitCondition>
 #include <stdint.h>
 
@@ -34,6 +37,7 @@ extern "C" {
 #include "codec/samplebuffer.h"
 #include "codec/waveoutput.h"
 #include "common/rational.h"
+#include "common/timerange.h"
 #include "project/item/footage/footage.h"
 
 namespace olive {
@@ -106,10 +110,40 @@ public:
    * This function will always return a sample buffer unless a fatal error occurs (in such case,
    * nullptr will return). The SampleBuffer should always have enough audio for the range provided.
    *
+   * Audio is read from a copy of the stream conformed to `params`. If there's no such copy yet,
+   * one is conformed in the background and this function only waits until the range requested is
+   * covered rather than for the whole file. Ranges that are being waited on are conformed first.
+   *
    * This function is thread safe and can only run while the decoder is open. \see Open()
    */
   SampleBufferPtr RetrieveAudio(const TimeRange& range, const AudioParams& params, const QAtomicInt *cancelled);
 
+  /**
+   * @brief Build any index this decoder uses to speed up retrieval
+   *
+   * Indexes are stored as sidecar files in the project's cache folder, so this only has to be done
+   * once per file and is usually run in the background by an IndexTask after import. Progress is
+   * reported through IndexProgress().
+   *
+   * This function is thread safe and can only run while the decoder is open. \see Open()
+   *
+   * Returns TRUE if the index was built (or already existed, or this decoder doesn't need one).
+   */
+  bool Index(const QAtomicInt* cancelled);
+
+  /**
+   * @brief Estimate how far this decoder is from being able to return video at a given time
+   *
+   * Returns 0 if the frame is already cached, a positive value if the decoder can reach it by
+   * decoding forward (larger is further), or -1 if it would have to seek or can't tell. Values are
+   * only comparable between decoders of the same stream. DecoderPool uses this to route requests to
+   * the decoder with the best locality.
+   *
+   * This function is thread safe and, unlike the functions above, doesn't wait for a retrieval
+   * already in progress, so the result may be slightly out of date.
+   */
+  virtual int64_t GetVideoDistance(const rational& timecode);
+
   /**
    * @brief Try to probe a Footage file by passing it through all available Decoders
    *
@@ -166,6 +200,30 @@ public:
 
   static int64_t GetImageSequenceIndex(const QString& filename);
 
+  /**
+   * @brief Unmaps any finished conforms stored in `folder`
+   *
+   * Call before deleting files from a cache folder so the mappings don't hold them open.
+   */
+  static void ReleaseConformMappingsInFolder(const QString& folder);
+
+  /**
+   * @brief Unmaps any finished conforms made from the file `footage_filename`
+   */
+  static void ReleaseConformMappingsOfFootage(const QString& footage_filename);
+
+  /**
+   * @brief Stops any background conforms of the file `footage_filename`
+   *
+   * Their working files are left in place so conforming can resume if the audio is requested again.
+   */
+  static void StopConformsOfFootage(const QString& footage_filename);
+
+  /**
+   * @brief Stops every background conform and waits for their workers to exit
+   */
+  static void StopAllConforms();
+
 protected:
   /**
    * @brief Internal open function
@@ -197,7 +255,31 @@ protected:
    */
   virtual FramePtr RetrieveVideoInternal(const rational& timecode, const int& divider);
 
-  virtual bool ConformAudioInternal(const QString& filename, const AudioParams &params, const QAtomicInt* cancelled);
+  using ConformProgressFunction = std::function<bool(const rational&)>;
+
+  /**
+   * @brief Internal audio conform function
+   *
+   * Sub-classes must override this function IF they support audio. Resamples the stream into
+   * `output` starting at `range.in()`, writing each sample at the byte offset matching its time so
+   * that a conform can be done out of order over several calls. Conforming stops at `range.out()`,
+   * at the end of the stream (in which case `eof` is set to TRUE) or when `progress`, which should
+   * be called regularly with the time audio has been written up to, returns FALSE. `output` must be
+   * flushed before calling `progress` since readers may read up to that time straight away.
+   *
+   * Runs on a decoder dedicated to conforming so it doesn't need to worry about thread safety.
+   * Returns FALSE if an error occurred.
+   */
+  virtual bool ConformAudioInternal(WaveOutput* output, const TimeRange& range,
+                                    const ConformProgressFunction& progress, bool* eof);
+
+  /**
+   * @brief Internal index function
+   *
+   * Sub-classes that can make use of an index should override this. Function is already mutexed
+   * so sub-classes don't need to worry about thread safety.
+   */
+  virtual bool IndexInternal(const QAtomicInt* cancelled);
 
   void SignalProcessingProgress(const int64_t& ts);
 
@@ -208,16 +290,37 @@ protected:
 
   QString GetIndexFilename();
 
-  struct CurrentlyConforming {
+  /**
+   * @brief State of a conform in progress, shared between the conform worker and its readers
+   *
+   * All members are protected by `currently_conforming_mutex_`.
+   */
+  struct ConformState {
     StreamPtr stream;
     AudioParams params;
 
-    bool operator==(const CurrentlyConforming& rhs) const
-    {
-      return this->stream == rhs.stream && this->params == rhs.params;
-    }
+    QString filename;
+    QString working_filename;
+
+    /// Ranges that have been written to `working_filename` so far
+    TimeRangeList conformed;
+
+    /// Ranges readers are currently waiting for, most recent last
+    QList<TimeRange> requested;
+
+    /// Once found, the time the stream ends at
+    rational stream_end;
+    bool stream_end_known;
+
+    bool finished;
+    bool failed;
+
+    /// Set to stop the worker early, its progress is saved so a later conform can resume from it
+    bool stopped;
   };
 
+  using ConformStatePtr = std::shared_ptr<ConformState>;
+
   /**
    * @brief Return currently open stream
    *
@@ -230,7 +333,7 @@ protected:
 
   static QMutex currently_conforming_mutex_;
   static QWaitCondition currently_conforming_wait_cond_;
-  static QVector<CurrentlyConforming> currently_conforming_;
+  static QVector<ConformStatePtr> currently_conforming_;
 
 signals:
   /**
@@ -242,6 +345,94 @@ signals:
 private:
   SampleBufferPtr RetrieveAudioFromConform(const QString& conform_filename, const TimeRange &range);
 
+  /**
+   * @brief A finished conform file, memory-mapped while it's in use
+   *
+   * The registry holds at most kMaxConformMappings, dropping the least recently used. The file is
+   * unmapped and closed once the last reader holding it is done.
+   */
+  struct ConformMapping {
+    QFile file;
+    AudioParams params;
+    const char* data;
+    qint64 size;
+    quint64 last_used;
+  };
+
+  using ConformMappingPtr = std::shared_ptr<ConformMapping>;
+
+  /**
+   * @brief Returns the mapping of a finished conform file, mapping it first if necessary
+   *
+   * Returns nullptr if the file doesn't exist (yet) or couldn't be mapped.
+   */
+  static ConformMappingPtr GetConformMapping(const QString& filename);
+
+  static QMutex conform_mappings_mutex_;
+  static QHash<QString, ConformMappingPtr> conform_mappings_;
+  static quint64 conform_mappings_clock_;
+
+  /// Most finished conforms kept mapped at once
+  static const int kMaxConformMappings;
+
+  static SampleBufferPtr RetrieveAudioFromWorkingConform(QFile* file, const AudioParams& params, const TimeRange &range);
+
+  /**
+   * @brief Filename the conformed ranges of a stopped conform are saved to
+   */
+  static QString GetConformProgressFilename(const ConformState* state);
+
+  /**
+   * @brief Saves `state`'s conformed ranges so a later conform can resume its working file
+   */
+  static void SaveConformProgress(const ConformState* state);
+
+  /**
+   * @brief Restores the conformed ranges saved by a stopped conform, if its working file still exists
+   */
+  static void LoadConformProgress(ConformState* state);
+
+  /**
+   * @brief Runs a conform in the background until the whole stream has been conformed
+   */
+  static void ConformWorker(ConformStatePtr state);
+
+  /**
+   * @brief Threads that conform workers run on
+   *
+   * Kept apart from the global pool since workers run for a whole stream, and render tasks on the
+   * global pool block in RetrieveAudio() waiting for them. If they shared a pool, enough waiting
+   * tasks could leave no thread free for the worker they're waiting on.
+   */
+  static QThreadPool conform_pool_;
+
+  /**
+   * @brief Finds where the conform should continue from, giving priority to requested ranges
+   *
+   * Returns FALSE if there's nothing left to conform.
+   */
+  static bool GetNextConformRange(const ConformState* state, TimeRange* range);
+
+  /**
+   * @brief Finds the unconformed part of the requested range GetNextConformRange() gives priority to
+   *
+   * Returns FALSE if no requested range is waiting on anything.
+   */
+  static bool FindRequestedConformGap(const ConformState* state, TimeRange* gap);
+
+  /**
+   * @brief Finds the earliest part of `within` that hasn't been conformed yet
+   *
+   * `gap` is optional. Returns FALSE if all of `within` has been conformed.
+   */
+  static bool FindConformGap(const ConformState* state, const TimeRange& within, TimeRange* gap);
+
+  /// Time used as the end of a conform range when the stream's end isn't known yet
+  static const rational kConformUnbounded;
+
+  /// How far ahead of the current conform position a request can be before conforming jumps to it
+  static const rational kConformSeekThreshold;
+
   StreamPtr stream_;
 
   QMutex mutex_;
@@ -36,6 +36,16 @@ const EncodingParams &Encoder::params() const
   return params_;
 }
 
+QVariant Encoder::PrepareFrame(FramePtr frame)
+{
+  return QVariant::fromValue(frame);
+}
+
+bool Encoder::WritePreparedFrame(const QVariant &prepared, const rational &time)
+{
+  return WriteFrame(prepared.value<FramePtr>(), time);
+}
+
 void Encoder::WriteAudio(AudioParams pcm_info, const QString &pcm_filename)
 {
   QFile f(pcm_filename);
@@ -28,6 +28,7 @@
 #include "codec/exportcodec.h"
 #include "codec/exportformat.h"
 #include "codec/frame.h"
+#include "codec/samplebuffer.h"
 #include "common/timerange.h"
 #include "render/audioparams.h"
 #include "render/videoparams.h"
@@ -126,11 +127,34 @@ public:
   virtual bool Open() = 0;
 
   virtual bool WriteFrame(olive::FramePtr frame, olive::rational time) = 0;
+
+  /**
+   * @brief Convert a frame into whatever the encoder compresses, ahead of WritePreparedFrame()
+   *
+   * Splitting conversion (e.g. pixel format and scaling) from compression allows the two to run on separate threads.
+   * The returned value is opaque and only meaningful to WritePreparedFrame(), and may be written several times if the
+   * same image appears at several times. This may be called from a different thread than WritePreparedFrame() and
+   * concurrently with it, but never concurrently with itself. Close() must only be called once neither is running.
+   *
+   * The default implementation does no conversion and leaves everything to WriteFrame().
+   */
+  virtual QVariant PrepareFrame(olive::FramePtr frame);
+
+  virtual bool WritePreparedFrame(const QVariant& prepared, const olive::rational& time);
   virtual void WriteAudio(olive::AudioParams pcm_info,
                           QIODevice *file) = 0;
   void WriteAudio(olive::AudioParams pcm_info,
                   const QString& pcm_filename);
 
+  /**
+   * @brief Encode the next chunk of audio
+   *
+   * Chunks must be sent in presentation order with no gaps, but may be any length. Together with WriteFrame(), this
+   * allows audio and video to be encoded (and interleaved in the output) as they're rendered rather than writing the
+   * entire soundtrack at the end. Any audio held back to fill a whole codec frame is written on Close().
+   */
+  virtual bool WriteAudio(olive::SampleBufferPtr audio) = 0;
+
   virtual void Close() = 0;
 
   virtual VideoParams::Format GetDesiredPixelFormat() const
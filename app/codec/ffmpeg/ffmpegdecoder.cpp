@@ -27,7 +27,9 @@ extern "C" {
 #include <libavutil/pixdesc.h>
 }
 
+#include <limits>
 #include <OpenImageIO/imagebuf.h>
+#include <QDateTime>
 #include <QDebug>
 #include <QFile>
 #include <QFileInfo>
@@ -47,13 +49,19 @@ extern "C" {
 
 namespace olive {
 
+const qint64 FFmpegDecoder::kIndexRetryInterval = 5000;
+
 FFmpegDecoder::FFmpegDecoder() :
-  scale_ctx_(nullptr),
   scale_divider_(0),
-  pool_(QThread::idealThreadCount()*2),
+  scale_passthrough_(false),
+  pool_(std::make_shared<FFmpegFramePool>(QThread::idealThreadCount()*2)),
   is_working_(false),
   cache_at_zero_(false),
-  cache_at_eof_(false)
+  cache_at_eof_(false),
+  cache_window_start_(0),
+  cache_window_end_(-1),
+  cache_window_next_keyframe_(std::numeric_limits<int64_t>::max()),
+  index_last_attempt_(0)
 {
 }
 
@@ -71,6 +79,10 @@ bool FFmpegDecoder::OpenInternal()
     second_ts_ = qRound64(av_q2d(av_inv_q(s->time_base)));
 
     if (stream()->type() == Stream::kVideo) {
+      // Use the packet index for seeking if one has been built
+      index_last_attempt_ = 0;
+      TryLoadIndex();
+
       // Get an Olive compatible AVPixelFormat
       ideal_pix_fmt_ = FFmpegUtils::GetCompatiblePixelFormat(static_cast<AVPixelFormat>(s->codecpar->format));
 
@@ -169,34 +181,35 @@ FramePtr FFmpegDecoder::RetrieveVideoInternal(const rational &timecode, const in
     int divided_width = VideoParams::GetScaledDimension(vs->width(), divider);
     int divided_height = VideoParams::GetScaledDimension(vs->height(), divider);
 
-    if (pool_.width() != divided_width || pool_.height() != divided_height) {
+    if (pool_->width() != divided_width || pool_->height() != divided_height) {
       // Clear all instance queues
       ClearFrameCache();
 
-      // Set new frame pool parameters
-      pool_.SetParameters(divided_width, divided_height, native_pix_fmt_, native_channel_count_);
+      // Frames we've returned may still be using the old pool, so leave it to them to destroy it
+      pool_ = std::make_shared<FFmpegFramePool>(QThread::idealThreadCount()*2);
+      pool_->SetParameters(divided_width, divided_height, native_pix_fmt_, native_channel_count_);
     }
 
     // Retrieve frame
     FFmpegFramePool::ElementPtr return_frame = RetrieveFrame(target_ts, divider);
 
-    // We found the frame, we'll return a copy
     if (return_frame) {
-      FramePtr copy = Frame::Create();
-      copy->set_video_params(VideoParams(vs->width(),
-                                         vs->height(),
-                                         native_pix_fmt_,
-                                         native_channel_count_,
-                                         std::static_pointer_cast<VideoStream>(stream())->pixel_aspect_ratio(),
-                                         std::static_pointer_cast<VideoStream>(stream())->interlacing(),
-                                         divider));
-      copy->set_timestamp(timecode);
-      copy->allocate();
-
-      // This data will already match the frame
-      memcpy(copy->data(), return_frame->data(), copy->allocated_size());
-
-      return copy;
+      FramePtr frame = Frame::Create();
+      frame->set_video_params(VideoParams(vs->width(),
+                                          vs->height(),
+                                          native_pix_fmt_,
+                                          native_channel_count_,
+                                          std::static_pointer_cast<VideoStream>(stream())->pixel_aspect_ratio(),
+                                          std::static_pointer_cast<VideoStream>(stream())->interlacing(),
+                                          divider));
+      frame->set_timestamp(timecode);
+
+      // Cached frames are never written to again, so rather than copying we can return the cached
+      // data directly. The element stays out of the pool for as long as the frame holds onto it.
+      frame->set_external_data(reinterpret_cast<char*>(return_frame->data()),
+                               std::make_shared<CachedFrameReference>(pool_, return_frame));
+
+      return frame;
     }
 
   }
@@ -210,6 +223,8 @@ void FFmpegDecoder::CloseInternal()
 
   instance_.Close();
 
+  index_.Unload();
+
   FreeScaler();
 }
 
@@ -466,96 +481,133 @@ QString FFmpegDecoder::FFmpegError(int error_code)
   return QStringLiteral("%1 %2").arg(QString::number(error_code), err);
 }
 
-bool FFmpegDecoder::ConformAudioInternal(const QString &filename, const AudioParams &params, const QAtomicInt *cancelled)
+bool FFmpegDecoder::ConformAudioInternal(WaveOutput *output, const TimeRange &range, const ConformProgressFunction &progress, bool *eof)
 {
-  // Iterate through each audio frame and extract the PCM data
-  AudioStreamPtr audio_stream = std::static_pointer_cast<AudioStream>(stream());
+  const AudioParams& params = output->params();
+  AVStream* avstream = instance_.avstream();
 
-  // Seek to starting point
-  instance_.Seek(0);
+  *eof = false;
 
   // Handle NULL channel layout
-  uint64_t channel_layout = ValidateChannelLayout(instance_.avstream());
+  uint64_t channel_layout = ValidateChannelLayout(avstream);
   if (!channel_layout) {
     qCritical() << "Failed to determine channel layout of audio file, could not conform";
     return false;
   }
 
+  // Timestamps are made relative to the start of the stream so the conform always begins at 0
+  int64_t stream_start = (avstream->start_time == AV_NOPTS_VALUE) ? 0 : avstream->start_time;
+  AVRational output_timebase = {1, params.sample_rate()};
+
+  int64_t start_sample = params.time_to_samples(range.in());
+  int64_t end_sample = params.time_to_samples(range.out());
+
+  // Seek to starting point
+  if (start_sample == 0) {
+    instance_.Seek(0);
+  } else {
+    instance_.Seek(stream_start + av_rescale_q(start_sample, output_timebase, avstream->time_base));
+  }
+
   // Create resampling context
   SwrContext* resampler = swr_alloc_set_opts(nullptr,
                                              params.channel_layout(),
                                              FFmpegUtils::GetFFmpegSampleFormat(params.format()),
                                              params.sample_rate(),
                                              channel_layout,
-                                             static_cast<AVSampleFormat>(instance_.avstream()->codecpar->format),
-                                             instance_.avstream()->codecpar->sample_rate,
+                                             static_cast<AVSampleFormat>(avstream->codecpar->format),
+                                             avstream->codecpar->sample_rate,
                                              0,
                                              nullptr);
 
   swr_init(resampler);
 
-  WaveOutput wave_out(filename, params);
-
   AVPacket* pkt = av_packet_alloc();
   AVFrame* frame = av_frame_alloc();
   int ret;
 
+  // Position in the output of the next sample the resampler gives us
+  int64_t next_sample = -1;
+
   bool success = false;
 
-  if (wave_out.open()) {
-    while (true) {
-      // Check if we have a `cancelled` ptr and its value
-      if (cancelled && *cancelled) {
-        break;
+  while (true) {
+    ret = instance_.GetFrame(pkt, frame);
+
+    if (ret < 0) {
+
+      if (ret == AVERROR_EOF) {
+        success = true;
+        *eof = true;
+      } else {
+        char err_str[50];
+        av_strerror(ret, err_str, 50);
+        qWarning() << "Failed to conform:" << ret << err_str;
       }
+      break;
 
-      ret = instance_.GetFrame(pkt, frame);
+    }
 
-      if (ret < 0) {
+    if (next_sample < 0) {
+      // First frame since seeking, determine where its audio belongs
+      int64_t pts = (frame->pts == AV_NOPTS_VALUE) ? stream_start : frame->pts;
+      next_sample = qMax(int64_t(0), av_rescale_q(pts - stream_start, avstream->time_base, output_timebase));
+    }
 
-        if (ret == AVERROR_EOF) {
-          success = true;
-        } else {
-          char err_str[50];
-          av_strerror(ret, err_str, 50);
-          qWarning() << "Failed to conform:" << ret << err_str;
-        }
-        break;
+    // Allocate buffers
+    int nb_samples = swr_get_out_samples(resampler, frame->nb_samples);
+    char* data = new char[params.samples_to_bytes(nb_samples)];
+
+    // Resample audio to our destination parameters
+    nb_samples = swr_convert(resampler,
+                             reinterpret_cast<uint8_t**>(&data),
+                             nb_samples,
+                             const_cast<const uint8_t**>(frame->data),
+                             frame->nb_samples);
+
+    if (nb_samples < 0) {
+      char err_str[50];
+      av_strerror(nb_samples, err_str, 50);
+      qWarning() << "libswresample failed with error:" << nb_samples << err_str;
+      delete [] data;
+      break;
+    }
 
-      }
+    // Write only the part of this audio that falls inside the range, seeking may have put us
+    // slightly before it
+    int64_t write_start = qMax(next_sample, start_sample);
+    int64_t write_end = qMin(next_sample + nb_samples, end_sample);
 
-      // Allocate buffers
-      int nb_samples = swr_get_out_samples(resampler, frame->nb_samples);
-      char* data = new char[params.samples_to_bytes(nb_samples)];
+    if (write_end > write_start) {
+      output->write(params.samples_to_bytes(write_start),
+                    data + params.samples_to_bytes(write_start - next_sample),
+                    params.samples_to_bytes(write_end - write_start));
+    }
 
-      // Resample audio to our destination parameters
-      nb_samples = swr_convert(resampler,
-                               reinterpret_cast<uint8_t**>(&data),
-                               nb_samples,
-                               const_cast<const uint8_t**>(frame->data),
-                               frame->nb_samples);
+    next_sample += nb_samples;
 
-      if (nb_samples < 0) {
-        char err_str[50];
-        av_strerror(nb_samples, err_str, 50);
-        qWarning() << "libswresample failed with error:" << nb_samples << err_str;
-        break;
-      }
+    delete [] data;
 
-      // Write packed WAV data to the disk cache
-      wave_out.write(data, params.samples_to_bytes(nb_samples));
+    SignalProcessingProgress(frame->pts);
 
-      // If we allocated an output for the resampler, delete it here
-      if (data != reinterpret_cast<char*>(frame->data[0])) {
-        delete [] data;
-      }
+    if (next_sample >= end_sample) {
+      success = true;
+      break;
+    }
 
-      SignalProcessingProgress(frame->pts);
+    // Readers of the working file open their own handle, so they can only see what's been flushed
+    if (next_sample > start_sample) {
+      output->flush();
     }
 
-    wave_out.close();
-  } else {
-    qWarning() << "Failed to open WAVE output for indexing";
+    if (next_sample > start_sample && !progress(params.samples_to_time(next_sample))) {
+      success = true;
+      break;
+    }
+  }
+
+  if (next_sample > start_sample) {
+    progress(params.samples_to_time(qMin(next_sample, end_sample)));
   }
 
   swr_free(&resampler);
@@ -605,13 +657,22 @@ uint64_t FFmpegDecoder::ValidateChannelLayout(AVStream* stream)
 
 void FFmpegDecoder::FFmpegBufferToNativeBuffer(uint8_t **input_data, int *input_linesize, uint8_t** output_buffer, int* output_linesize)
 {
-  sws_scale(scale_ctx_,
-            input_data,
-            input_linesize,
-            0,
-            instance_.avstream()->codecpar->height,
-            output_buffer,
-            output_linesize);
+  if (scale_passthrough_) {
+    // Already in the right format and size, a straight copy is much cheaper than sws_scale
+    av_image_copy(output_buffer,
+                  output_linesize,
+                  const_cast<const uint8_t**>(input_data),
+                  input_linesize,
+                  ideal_pix_fmt_,
+                  instance_.avstream()->codecpar->width,
+                  instance_.avstream()->codecpar->height);
+    return;
+  }
+
+  uint8_t* dst[4] = {*output_buffer, nullptr, nullptr, nullptr};
+  int dst_linesize[4] = {*output_linesize, 0, 0, 0};
+
+  scaler_.Scale(input_data, input_linesize, dst, dst_linesize);
 }
 
 /* OLD UNUSED CODE: Keeping this around in case the code proves useful
@@ -676,6 +737,66 @@ void FFmpegDecoder::ClearFrameCache()
   cached_frames_.clear();
   cache_at_eof_ = false;
   cache_at_zero_ = false;
+
+  UpdateCacheWindow();
+}
+
+void FFmpegDecoder::UpdateCacheWindow()
+{
+  QMutexLocker locker(&cache_window_mutex_);
+
+  if (cached_frames_.isEmpty()) {
+    cache_window_start_ = 0;
+    cache_window_end_ = -1;
+  } else {
+    // If the cache reaches either end of the stream, it can serve anything beyond that end too
+    cache_window_start_ = cache_at_zero_ ? std::numeric_limits<int64_t>::min() : cached_frames_.first()->timestamp();
+    cache_window_end_ = cache_at_eof_ ? std::numeric_limits<int64_t>::max() : cached_frames_.last()->timestamp();
+  }
+
+  // The index is only loaded on this thread, so it's looked up here rather than in
+  // GetVideoDistance()
+  const FFmpegIndex::Entry* next_keyframe = nullptr;
+
+  if (index_.IsLoaded() && !cached_frames_.isEmpty()) {
+    next_keyframe = index_.GetKeyframeAfter(cached_frames_.last()->timestamp());
+  }
+
+  cache_window_next_keyframe_ = next_keyframe ? next_keyframe->pts : std::numeric_limits<int64_t>::max();
+}
+
+int64_t FFmpegDecoder::GetVideoDistance(const rational &timecode)
+{
+  if (!stream() || stream()->type() != Stream::kVideo) {
+    return -1;
+  }
+
+  VideoStreamPtr vs = std::static_pointer_cast<VideoStream>(stream());
+
+  if (vs->video_type() != VideoStream::kVideoTypeVideo) {
+    return -1;
+  }
+
+  int64_t target_ts = vs->get_time_in_timebase_units(timecode);
+
+  QMutexLocker locker(&cache_window_mutex_);
+
+  if (cache_window_start_ > cache_window_end_ || target_ts < cache_window_start_) {
+    // Empty cache or we'd have to seek backwards
+    return -1;
+  }
+
+  if (target_ts <= cache_window_end_) {
+    // Already cached
+    return 0;
+  }
+
+  // Matches the rules RetrieveFrame() uses to decide between decoding forward and seeking
+  if (target_ts <= cache_window_end_ + 2*second_ts_ && target_ts < cache_window_next_keyframe_) {
+    return target_ts - cache_window_end_;
+  }
+
+  return -1;
 }
 
 FFmpegFramePool::ElementPtr FFmpegDecoder::RetrieveFrame(const int64_t& target_ts, int divider)
@@ -683,11 +804,20 @@ FFmpegFramePool::ElementPtr FFmpegDecoder::RetrieveFrame(const int64_t& target_t
   int64_t seek_ts = target_ts;
   bool still_seeking = false;
 
+  // If the index shows a keyframe between the end of our cache and the target, seeking to it will
+  // always be quicker than decoding forward
+  const FFmpegIndex::Entry* keyframe = index_.IsLoaded() ? index_.GetKeyframeAtOrBefore(target_ts) : nullptr;
+
   // If the frame wasn't in the frame cache, see if this frame cache is too old to use
   if (cached_frames_.isEmpty()
-      || (target_ts < cached_frames_.first()->timestamp() || target_ts > cached_frames_.last()->timestamp() + 2*second_ts_)) {
+      || (target_ts < cached_frames_.first()->timestamp() || target_ts > cached_frames_.last()->timestamp() + 2*second_ts_)
+      || (keyframe && keyframe->pts > cached_frames_.last()->timestamp())) {
     ClearFrameCache();
 
+    // Pick up an index that was built since we opened, seeking is where it helps
+    TryLoadIndex();
+
+    seek_ts = GetSeekTimestamp(target_ts);
     instance_.Seek(seek_ts);
     if (seek_ts == 0) {
       cache_at_zero_ = true;
@@ -725,7 +855,12 @@ FFmpegFramePool::ElementPtr FFmpegDecoder::RetrieveFrame(const int64_t& target_t
       // We'll only be here if the frame cache was emptied earlier
       if (!cache_at_zero_ && (ret == AVERROR_EOF || working_frame->pts > target_ts)) {
 
-        seek_ts = qMax(static_cast<int64_t>(0), seek_ts - second_ts_);
+        if (index_.IsLoaded()) {
+          // Index was wrong or the demuxer didn't land on the keyframe, try the one before it
+          seek_ts = GetSeekTimestamp(seek_ts - 1);
+        } else {
+          seek_ts = qMax(static_cast<int64_t>(0), seek_ts - second_ts_);
+        }
         instance_.Seek(seek_ts);
         if (seek_ts == 0) {
           cache_at_zero_ = true;
@@ -760,7 +895,7 @@ FFmpegFramePool::ElementPtr FFmpegDecoder::RetrieveFrame(const int64_t& target_t
         RemoveFirstFrame();
       }
 
-      FFmpegFramePool::ElementPtr cached = pool_.Get();
+      FFmpegFramePool::ElementPtr cached = pool_->Get();
 
       if (!cached) {
         qCritical() << "Frame pool failed to return a valid frame - out of memory?";
@@ -805,9 +940,125 @@ FFmpegFramePool::ElementPtr FFmpegDecoder::RetrieveFrame(const int64_t& target_t
   av_frame_free(&working_frame);
   av_packet_free(&pkt);
 
+  UpdateCacheWindow();
+
   return return_frame;
 }
 
+QString FFmpegDecoder::GetPacketIndexFilename()
+{
+  return GetIndexFilename().append(QStringLiteral(".index"));
+}
+
+void FFmpegDecoder::TryLoadIndex()
+{
+  if (index_.IsLoaded()) {
+    return;
+  }
+
+  qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+  if (now - index_last_attempt_ < kIndexRetryInterval) {
+    return;
+  }
+
+  index_last_attempt_ = now;
+
+  index_.Load(GetPacketIndexFilename());
+}
+
+int64_t FFmpegDecoder::GetSeekTimestamp(int64_t target_ts) const
+{
+  if (index_.IsLoaded()) {
+    // Seek straight to the keyframe this frame depends on
+    const FFmpegIndex::Entry* keyframe = index_.GetKeyframeAtOrBefore(target_ts);
+
+    return keyframe ? keyframe->pts : 0;
+  }
+
+  // Without an index, rely on AVSEEK_FLAG_BACKWARD to find the keyframe
+  return target_ts;
+}
+
+bool FFmpegDecoder::IndexInternal(const QAtomicInt *cancelled)
+{
+  // Only video streams benefit from an index, still images and sequences are always "keyframes"
+  if (stream()->type() != Stream::kVideo
+      || std::static_pointer_cast<VideoStream>(stream())->video_type() != VideoStream::kVideoTypeVideo) {
+    return true;
+  }
+
+  QString index_fn = GetPacketIndexFilename();
+
+  if (index_.IsLoaded() || index_.Load(index_fn)) {
+    // Already indexed, registering it again marks it as recently used (and picks up indexes written
+    // before they were tracked by the disk manager)
+    RegisterIndexWithDiskManager(index_fn);
+    return true;
+  }
+
+  // Read with a separate instance so we don't disturb the current decode position
+  Instance instance;
+
+  if (!instance.Open(stream()->footage()->filename().toUtf8(), stream()->index())) {
+    return false;
+  }
+
+  QVector<FFmpegIndex::Entry> entries;
+  AVPacket* pkt = av_packet_alloc();
+  int ret;
+
+  // We only need packet metadata, so nothing is actually decoded here
+  while ((ret = av_read_frame(instance.fmt_ctx(), pkt)) >= 0) {
+    if (cancelled && *cancelled) {
+      break;
+    }
+
+    if (pkt->stream_index == instance.avstream()->index) {
+      int64_t ts = (pkt->pts == AV_NOPTS_VALUE) ? pkt->dts : pkt->pts;
+
+      if (ts != AV_NOPTS_VALUE) {
+        FFmpegIndex::Entry e;
+        e.pts = ts;
+        e.pos = pkt->pos;
+        e.flags = (pkt->flags & AV_PKT_FLAG_KEY) ? FFmpegIndex::kKeyframe : 0;
+        e.reserved = 0;
+        entries.append(e);
+
+        SignalProcessingProgress(ts);
+      }
+    }
+
+    av_packet_unref(pkt);
+  }
+
+  av_packet_free(&pkt);
+
+  if ((cancelled && *cancelled) || (ret < 0 && ret != AVERROR_EOF)) {
+    return false;
+  }
+
+  if (!FFmpegIndex::Write(index_fn, entries)) {
+    return false;
+  }
+
+  RegisterIndexWithDiskManager(index_fn);
+
+  return index_.Load(index_fn);
+}
+
+void FFmpegDecoder::RegisterIndexWithDiskManager(const QString &index_fn)
+{
+  // The index is stored in the disk cache, so it's registered like a cached frame (keyed by its
+  // filename) to count towards the cache limit and be removed when the cache is cleared
+  QMetaObject::invokeMethod(DiskManager::instance(),
+                            "CreatedFile",
+                            Qt::QueuedConnection,
+                            Q_ARG(QString, stream()->footage()->project()->cache_path()),
+                            Q_ARG(QString, index_fn),
+                            Q_ARG(QByteArray, index_fn.toUtf8()));
+}
+
 void FFmpegDecoder::InitScaler(int divider)
 {
   VideoStream* vs = static_cast<VideoStream*>(stream().get());
@@ -815,31 +1066,29 @@ void FFmpegDecoder::InitScaler(int divider)
   int scaled_width = VideoParams::GetScaledDimension(vs->width(), divider);
   int scaled_height = VideoParams::GetScaledDimension(vs->height(), divider);
 
-  scale_ctx_ = sws_getContext(vs->width(),
-                              vs->height(),
-                              static_cast<AVPixelFormat>(instance_.avstream()->codecpar->format),
-                              scaled_width,
-                              scaled_height,
-                              ideal_pix_fmt_,
-                              SWS_FAST_BILINEAR,
-                              nullptr,
-                              nullptr,
-                              nullptr);
-
-  if (scale_ctx_) {
+  if (scaler_.Init(vs->width(),
+                   vs->height(),
+                   static_cast<AVPixelFormat>(instance_.avstream()->codecpar->format),
+                   scaled_width,
+                   scaled_height,
+                   ideal_pix_fmt_,
+                   SWS_FAST_BILINEAR)) {
     scale_divider_ = divider;
+    scale_passthrough_ = (divider == 1
+                          && instance_.avstream()->codecpar->format == ideal_pix_fmt_);
   } else {
     scale_divider_ = 0;
+    scale_passthrough_ = false;
   }
 }
 
 void FFmpegDecoder::FreeScaler()
 {
-  if (scale_ctx_) {
-    sws_freeContext(scale_ctx_);
-    scale_ctx_ = nullptr;
+  if (scaler_.IsValid()) {
+    scaler_.Free();
 
     scale_divider_ = 0;
+    scale_passthrough_ = false;
   }
 }
 
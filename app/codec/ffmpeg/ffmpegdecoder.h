@@ -35,6 +35,8 @@ extern "C" {
 #include "codec/decoder.h"
 #include "codec/waveoutput.h"
 #include "ffmpegframepool.h"
+#include "ffmpegindex.h"
+#include "ffmpegscaler.h"
 #include "project/item/footage/videostream.h"
 
 namespace olive {
@@ -59,10 +61,14 @@ public:
 
   virtual FootagePtr Probe(const QString& filename, const QAtomicInt* cancelled) const override;
 
+  virtual int64_t GetVideoDistance(const rational& timecode) override;
+
 protected:
   virtual bool OpenInternal() override;
   virtual FramePtr RetrieveVideoInternal(const rational &timecode, const int& divider) override;
-  virtual bool ConformAudioInternal(const QString& filename, const AudioParams &params, const QAtomicInt* cancelled) override;
+  virtual bool ConformAudioInternal(WaveOutput* output, const TimeRange& range,
+                                    const ConformProgressFunction& progress, bool* eof) override;
+  virtual bool IndexInternal(const QAtomicInt* cancelled) override;
   virtual void CloseInternal() override;
 
 private:
@@ -119,9 +125,27 @@ private:
    */
   static QString FFmpegError(int error_code);
 
+  /**
+   * @brief Keeps a cached frame and the pool it came from alive while a returned Frame uses it
+   */
+  struct CachedFrameReference {
+    CachedFrameReference(std::shared_ptr<FFmpegFramePool> p, FFmpegFramePool::ElementPtr e) :
+      pool(p),
+      element(e)
+    {
+    }
+
+    // Members are destroyed in reverse order, so the element goes back to the pool before the pool
+    // itself is released
+    std::shared_ptr<FFmpegFramePool> pool;
+    FFmpegFramePool::ElementPtr element;
+  };
+
   void InitScaler(int divider);
   void FreeScaler();
 
+  void RegisterIndexWithDiskManager(const QString& index_fn);
+
   FramePtr RetrieveStillImage(const rational& timecode, const int& divider);
 
   static VideoParams::Format GetNativePixelFormat(AVPixelFormat pix_fmt);
@@ -139,13 +163,42 @@ private:
 
   void RemoveFirstFrame();
 
-  SwsContext* scale_ctx_;
+  void UpdateCacheWindow();
+
+  QString GetPacketIndexFilename();
+
+  /**
+   * @brief Load the packet index if it exists, retrying at most every kIndexRetryInterval
+   *
+   * The index may be built after we've opened, but checking for it on every frame would mean a file
+   * stat per frame for footage that never gets one.
+   */
+  void TryLoadIndex();
+
+  /// Milliseconds between attempts to load a packet index that wasn't there
+  static const qint64 kIndexRetryInterval;
+
+  int64_t GetSeekTimestamp(int64_t target_ts) const;
+
+  FFmpegScaler scaler_;
   int scale_divider_;
+
+  /**
+   * @brief Set if decoded frames are already in our native format and size so sws_scale can be skipped
+   */
+  bool scale_passthrough_;
+
   AVPixelFormat ideal_pix_fmt_;
   VideoParams::Format native_pix_fmt_;
   int native_channel_count_;
 
-  FFmpegFramePool pool_;
+  /**
+   * @brief Pool for the frame cache
+   *
+   * Frames returned from RetrieveVideo() point straight into this pool's memory, so it's shared
+   * with them and replaced rather than cleared when its parameters change.
+   */
+  std::shared_ptr<FFmpegFramePool> pool_;
 
   int64_t second_ts_;
 
@@ -157,8 +210,24 @@ private:
   bool cache_at_zero_;
   bool cache_at_eof_;
 
+  /**
+   * @brief Copy of the cached frame range that can be read without locking the whole decoder
+   *
+   * Used by GetVideoDistance(). Start is greater than end when the cache is empty. The next
+   * keyframe is the first one the index knows of after the end of the cache, since reaching a
+   * frame beyond it means seeking rather than decoding forward.
+   */
+  int64_t cache_window_start_;
+  int64_t cache_window_end_;
+  int64_t cache_window_next_keyframe_;
+  QMutex cache_window_mutex_;
+
   Instance instance_;
 
+  FFmpegIndex index_;
+
+  qint64 index_last_attempt_;
+
 };
 
 }
@@ -35,12 +35,13 @@ FFmpegEncoder::FFmpegEncoder(const EncodingParams &params) :
   fmt_ctx_(nullptr),
   video_stream_(nullptr),
   video_codec_ctx_(nullptr),
-  video_alpha_scale_ctx_(nullptr),
-  video_noalpha_scale_ctx_(nullptr),
   audio_stream_(nullptr),
   audio_codec_ctx_(nullptr),
   audio_resample_ctx_(nullptr),
-  open_(false)
+  audio_fifo_(nullptr),
+  audio_pts_(0),
+  open_(false),
+  failed_(false)
 {
 }
 
@@ -94,27 +95,21 @@ bool FFmpegEncoder::Open()
 
     // Set up a scaling context - if the native pixel format is not equal to the encoder's, we'll need to convert it
     // before encoding. Even if we don't, this may be useful for converting between linesizes, etc.
-    video_alpha_scale_ctx_ = sws_getContext(params().video_params().width(),
-                                            params().video_params().height(),
-                                            src_alpha_pix_fmt,
-                                            params().video_params().width(),
-                                            params().video_params().height(),
-                                            encoder_pix_fmt,
-                                            0,
-                                            nullptr,
-                                            nullptr,
-                                            nullptr);
-
-    video_noalpha_scale_ctx_ = sws_getContext(params().video_params().width(),
-                                              params().video_params().height(),
-                                              src_noalpha_pix_fmt,
-                                              params().video_params().width(),
-                                              params().video_params().height(),
-                                              encoder_pix_fmt,
-                                              0,
-                                              nullptr,
-                                              nullptr,
-                                              nullptr);
+    video_alpha_scaler_.Init(params().video_params().width(),
+                             params().video_params().height(),
+                             src_alpha_pix_fmt,
+                             params().video_params().width(),
+                             params().video_params().height(),
+                             encoder_pix_fmt,
+                             0);
+
+    video_noalpha_scaler_.Init(params().video_params().width(),
+                               params().video_params().height(),
+                               src_noalpha_pix_fmt,
+                               params().video_params().width(),
+                               params().video_params().height(),
+                               encoder_pix_fmt,
+                               0);
   }
 
   // Initialize an audio stream if it's enabled
@@ -145,13 +140,19 @@ bool FFmpegEncoder::Open()
 
 bool FFmpegEncoder::WriteFrame(FramePtr frame, rational time)
 {
-  bool success = false;
+  return WritePreparedFrame(PrepareFrame(frame), time);
+}
+
+QVariant FFmpegEncoder::PrepareFrame(FramePtr frame)
+{
+  // NOTE: This may run in parallel with WritePreparedFrame() and WriteAudio(), so it must not call Error() (which
+  //       marks the whole encoder as failed) or touch anything but the scalers
 
   AVFrame* encoded_frame = av_frame_alloc();
 
   int error_code;
-  const char* input_data;
-  int input_linesize;
+  const uint8_t* input_data[4] = {nullptr, nullptr, nullptr, nullptr};
+  int input_linesize[4] = {0, 0, 0, 0};
 
   // Frame must be video
   encoded_frame->width = frame->width();
@@ -171,8 +172,9 @@ bool FFmpegEncoder::WriteFrame(FramePtr frame, rational time)
 
   error_code = av_frame_get_buffer(encoded_frame, 0);
   if (error_code < 0) {
-    FFmpegError("Failed to create AVFrame buffer", error_code);
-    goto fail;
+    qWarning() << "Failed to create AVFrame buffer for" << params().filename() << "-" << error_code;
+    av_frame_free(&encoded_frame);
+    return QVariant();
   }
 
   // We may need to convert this frame to a frame that swscale will understand
@@ -181,31 +183,39 @@ bool FFmpegEncoder::WriteFrame(FramePtr frame, rational time)
   }
 
   // Use swscale context to convert formats/linesizes
-  input_data = frame->const_data();
-  input_linesize = frame->linesize_bytes();
-
-  error_code = sws_scale((frame->channel_count() == VideoParams::kRGBAChannelCount) ? video_alpha_scale_ctx_ : video_noalpha_scale_ctx_,
-                         reinterpret_cast<const uint8_t**>(&input_data),
-                         &input_linesize,
-                         0,
-                         frame->height(),
-                         encoded_frame->data,
-                         encoded_frame->linesize);
+  input_data[0] = reinterpret_cast<const uint8_t*>(frame->const_data());
+  input_linesize[0] = frame->linesize_bytes();
 
+  if (frame->channel_count() == VideoParams::kRGBAChannelCount) {
+    error_code = video_alpha_scaler_.Scale(input_data, input_linesize, encoded_frame->data, encoded_frame->linesize);
+  } else {
+    error_code = video_noalpha_scaler_.Scale(input_data, input_linesize, encoded_frame->data, encoded_frame->linesize);
+  }
 
   if (error_code < 0) {
-    FFmpegError("Failed to scale frame", error_code);
-    goto fail;
+    qWarning() << "Failed to scale frame for" << params().filename() << "-" << error_code;
+    av_frame_free(&encoded_frame);
+    return QVariant();
   }
 
-  encoded_frame->pts = qRound64(time.toDouble() / av_q2d(video_codec_ctx_->time_base));
+  return QVariant::fromValue(AVFramePtr(encoded_frame, [](AVFrame* f){
+    av_frame_free(&f);
+  }));
+}
 
-  success = WriteAVFrame(encoded_frame, video_codec_ctx_, video_stream_);
+bool FFmpegEncoder::WritePreparedFrame(const QVariant &prepared, const rational &time)
+{
+  AVFramePtr encoded_frame = prepared.value<AVFramePtr>();
 
-fail:
-  av_frame_free(&encoded_frame);
+  if (!open_ || failed_ || !encoded_frame) {
+    return false;
+  }
+
+  // The encoder takes its own reference to the frame's buffers, so changing the timestamp to send the same frame again
+  // later is safe
+  encoded_frame->pts = qRound64(time.toDouble() / av_q2d(video_codec_ctx_->time_base));
 
-  return success;
+  return WriteAVFrame(encoded_frame.get(), video_codec_ctx_, video_stream_);
 }
 
 void FFmpegEncoder::WriteAudio(AudioParams pcm_info, QIODevice* file)
@@ -213,18 +223,7 @@ void FFmpegEncoder::WriteAudio(AudioParams pcm_info, QIODevice* file)
   if (file->open(QFile::ReadOnly)) {
     // Divide PCM stream into AVFrames
 
-    // See if the codec defines a number of samples per frame
-    int maximum_frame_samples = audio_codec_ctx_->frame_size;
-    if (!maximum_frame_samples) {
-      // If not, use another frame size
-      if (params().video_enabled()) {
-        // If we're encoding video, use enough samples to cover roughly one frame of video
-        maximum_frame_samples = params().audio_params().time_to_samples(params().video_params().time_base());
-      } else {
-        // If no video, just use an arbitrary number
-        maximum_frame_samples = 256;
-      }
-    }
+    int maximum_frame_samples = GetAudioFrameSize();
 
     SwrContext* swr_ctx = swr_alloc_set_opts(nullptr,
                                              static_cast<int64_t>(audio_codec_ctx_->channel_layout),
@@ -310,11 +309,61 @@ void FFmpegEncoder::WriteAudio(AudioParams pcm_info, QIODevice* file)
   }
 }
 
+bool FFmpegEncoder::WriteAudio(SampleBufferPtr audio)
+{
+  if (!open_ || failed_ || !audio_codec_ctx_ || !audio || !audio->is_allocated()) {
+    return false;
+  }
+
+  if (!audio_resample_ctx_ && !InitializeAudioResampler(audio->audio_params())) {
+    return false;
+  }
+
+  // Convert to the encoder's format and buffer it, the encoder may want a different number of samples per frame than
+  // the chunks we receive
+  int max_converted = swr_get_out_samples(audio_resample_ctx_, audio->sample_count());
+
+  uint8_t** converted_data = nullptr;
+  int error_code = av_samples_alloc_array_and_samples(&converted_data, nullptr, audio_codec_ctx_->channels,
+                                                      max_converted, audio_codec_ctx_->sample_fmt, 0);
+  if (error_code < 0) {
+    FFmpegError("Failed to allocate audio conversion buffer", error_code);
+    return false;
+  }
+
+  int converted = swr_convert(audio_resample_ctx_,
+                              converted_data,
+                              max_converted,
+                              reinterpret_cast<const uint8_t**>(audio->const_data()),
+                              audio->sample_count());
+
+  if (converted > 0) {
+    av_audio_fifo_write(audio_fifo_, reinterpret_cast<void**>(converted_data), converted);
+  }
+
+  av_freep(&converted_data[0]);
+  av_freep(&converted_data);
+
+  if (converted < 0) {
+    FFmpegError("Failed to resample audio", converted);
+    return false;
+  }
+
+  return WriteAudioFromFifo(false);
+}
+
 void FFmpegEncoder::Close()
 {
+  if (open_ && !failed_) {
+    // Write any audio that was waiting for a full frame
+    FlushAudio();
+  }
+
   if (open_) {
-    // Flush encoders
-    FlushEncoders();
+    // Flush encoders, unless one of them has already failed
+    if (!failed_) {
+      FlushEncoders();
+    }
 
     // We've written a header, so we'll write a trailer
     av_write_trailer(fmt_ctx_);
@@ -323,16 +372,22 @@ void FFmpegEncoder::Close()
     open_ = false;
   }
 
-  if (video_alpha_scale_ctx_) {
-    sws_freeContext(video_alpha_scale_ctx_);
-    video_alpha_scale_ctx_ = nullptr;
+  failed_ = false;
+
+  video_alpha_scaler_.Free();
+  video_noalpha_scaler_.Free();
+
+  if (audio_resample_ctx_) {
+    swr_free(&audio_resample_ctx_);
   }
 
-  if (video_noalpha_scale_ctx_) {
-    sws_freeContext(video_noalpha_scale_ctx_);
-    video_noalpha_scale_ctx_ = nullptr;
+  if (audio_fifo_) {
+    av_audio_fifo_free(audio_fifo_);
+    audio_fifo_ = nullptr;
   }
 
+  audio_pts_ = 0;
+
   if (video_codec_ctx_) {
     avcodec_free_context(&video_codec_ctx_);
     video_codec_ctx_ = nullptr;
@@ -601,6 +656,121 @@ bool FFmpegEncoder::SetupCodecContext(AVStream* stream, AVCodecContext* codec_ct
   return true;
 }
 
+bool FFmpegEncoder::InitializeAudioResampler(const AudioParams &input_params)
+{
+  // SampleBuffers are always planar float
+  audio_resample_ctx_ = swr_alloc_set_opts(nullptr,
+                                           static_cast<int64_t>(audio_codec_ctx_->channel_layout),
+                                           audio_codec_ctx_->sample_fmt,
+                                           audio_codec_ctx_->sample_rate,
+                                           static_cast<int64_t>(input_params.channel_layout()),
+                                           AV_SAMPLE_FMT_FLTP,
+                                           input_params.sample_rate(),
+                                           0,
+                                           nullptr);
+
+  if (!audio_resample_ctx_ || swr_init(audio_resample_ctx_) < 0) {
+    Error(QStringLiteral("Failed to initialize audio resampler"));
+    return false;
+  }
+
+  audio_fifo_ = av_audio_fifo_alloc(audio_codec_ctx_->sample_fmt, audio_codec_ctx_->channels, GetAudioFrameSize());
+
+  if (!audio_fifo_) {
+    Error(QStringLiteral("Failed to allocate audio FIFO"));
+    return false;
+  }
+
+  return true;
+}
+
+int FFmpegEncoder::GetAudioFrameSize() const
+{
+  // See if the codec defines a number of samples per frame
+  int maximum_frame_samples = audio_codec_ctx_->frame_size;
+
+  if (!maximum_frame_samples) {
+    // If not, use another frame size
+    if (params().video_enabled()) {
+      // If we're encoding video, use enough samples to cover roughly one frame of video
+      maximum_frame_samples = params().audio_params().time_to_samples(params().video_params().time_base());
+    } else {
+      // If no video, just use an arbitrary number
+      maximum_frame_samples = 256;
+    }
+  }
+
+  return maximum_frame_samples;
+}
+
+bool FFmpegEncoder::WriteAudioFromFifo(bool flush)
+{
+  int frame_size = GetAudioFrameSize();
+
+  while (av_audio_fifo_size(audio_fifo_) >= frame_size
+         || (flush && av_audio_fifo_size(audio_fifo_) > 0)) {
+    AVFrame* frame = av_frame_alloc();
+
+    frame->channel_layout = audio_codec_ctx_->channel_layout;
+    frame->nb_samples = qMin(frame_size, av_audio_fifo_size(audio_fifo_));
+    frame->format = audio_codec_ctx_->sample_fmt;
+
+    int error_code = av_frame_get_buffer(frame, 0);
+    if (error_code < 0) {
+      FFmpegError("Failed to create AVFrame buffer", error_code);
+      av_frame_free(&frame);
+      return false;
+    }
+
+    av_audio_fifo_read(audio_fifo_, reinterpret_cast<void**>(frame->data), frame->nb_samples);
+
+    // Use sample count as each frame's timestamp
+    frame->pts = audio_pts_;
+    audio_pts_ += frame->nb_samples;
+
+    bool success = WriteAVFrame(frame, audio_codec_ctx_, audio_stream_);
+
+    av_frame_free(&frame);
+
+    if (!success) {
+      qCritical() << "Failed to write audio AVFrame";
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void FFmpegEncoder::FlushAudio()
+{
+  if (!audio_resample_ctx_) {
+    return;
+  }
+
+  // Retrieve whatever the resampler is still holding on to
+  int max_converted = swr_get_out_samples(audio_resample_ctx_, 0);
+
+  if (max_converted > 0) {
+    uint8_t** converted_data = nullptr;
+
+    if (av_samples_alloc_array_and_samples(&converted_data, nullptr, audio_codec_ctx_->channels,
+                                           max_converted, audio_codec_ctx_->sample_fmt, 0) >= 0) {
+      int converted = swr_convert(audio_resample_ctx_, converted_data, max_converted, nullptr, 0);
+
+      if (converted > 0) {
+        av_audio_fifo_write(audio_fifo_, reinterpret_cast<void**>(converted_data), converted);
+      }
+
+      av_freep(&converted_data[0]);
+      av_freep(&converted_data);
+    }
+  }
+
+  swr_free(&audio_resample_ctx_);
+
+  WriteAudioFromFifo(true);
+}
+
 void FFmpegEncoder::FlushEncoders()
 {
   if (video_codec_ctx_) {
@@ -638,7 +808,12 @@ void FFmpegEncoder::Error(const QString &s)
 {
   qWarning() << s;
 
-  Close();
+  if (open_) {
+    // Another thread may still be converting frames with our contexts, leave freeing them to Close()
+    failed_ = true;
+  } else {
+    Close();
+  }
 }
 
 }
@@ -23,15 +23,19 @@
 
 extern "C" {
 #include <libavformat/avformat.h>
+#include <libavutil/audio_fifo.h>
 #include <libswscale/swscale.h>
 #include <libswresample/swresample.h>
 #include <libavutil/opt.h>
 }
 
 #include "codec/encoder.h"
+#include "ffmpegscaler.h"
 
 namespace olive {
 
+using AVFramePtr = std::shared_ptr<AVFrame>;
+
 class FFmpegEncoder : public Encoder
 {
   Q_OBJECT
@@ -42,9 +46,15 @@ public:
 
   virtual bool WriteFrame(olive::FramePtr frame, olive::rational time) override;
 
+  virtual QVariant PrepareFrame(olive::FramePtr frame) override;
+
+  virtual bool WritePreparedFrame(const QVariant& prepared, const olive::rational& time) override;
+
   virtual void WriteAudio(olive::AudioParams pcm_info,
                           QIODevice *file) override;
 
+  virtual bool WriteAudio(olive::SampleBufferPtr audio) override;
+
   virtual void Close() override;
 
   virtual VideoParams::Format GetDesiredPixelFormat() const override
@@ -56,9 +66,9 @@ private:
   /**
    * @brief Handle an error
    *
-   * Immediately closes the Decoder (freeing memory resources) and sends the string provided to the warning stream.
-   * As this function closes the Decoder, no further Decoder functions should be performed after this is called
-   * (unless the Decoder is opened again first).
+   * Sends the string provided to the warning stream. While opening, this also closes the Encoder (freeing memory
+   * resources). Once open, the Encoder may be in use by several threads (see PrepareFrame()), so instead it's only
+   * marked as failed and every further write returns false until the owner calls Close().
    */
   void Error(const QString& s);
 
@@ -78,6 +88,23 @@ private:
   bool InitializeCodecContext(AVStream** stream, AVCodecContext** codec_ctx, AVCodec* codec);
   bool SetupCodecContext(AVStream *stream, AVCodecContext *codec_ctx, AVCodec *codec);
 
+  /**
+   * @brief Set up resampling from the format of the first chunk passed to WriteAudio(SampleBufferPtr)
+   */
+  bool InitializeAudioResampler(const AudioParams& input_params);
+
+  /**
+   * @brief Returns the number of samples per audio frame we'll send to the encoder
+   */
+  int GetAudioFrameSize() const;
+
+  /**
+   * @brief Encode whole frames from the audio FIFO, or everything left in it if `flush` is true
+   */
+  bool WriteAudioFromFifo(bool flush);
+
+  void FlushAudio();
+
   void FlushEncoders();
   void FlushCodecCtx(AVCodecContext* codec_ctx, AVStream *stream);
 
@@ -85,18 +112,24 @@ private:
 
   AVStream* video_stream_;
   AVCodecContext* video_codec_ctx_;
-  SwsContext* video_alpha_scale_ctx_;
-  SwsContext* video_noalpha_scale_ctx_;
+  FFmpegScaler video_alpha_scaler_;
+  FFmpegScaler video_noalpha_scaler_;
   VideoParams::Format video_conversion_fmt_;
 
   AVStream* audio_stream_;
   AVCodecContext* audio_codec_ctx_;
   SwrContext* audio_resample_ctx_;
+  AVAudioFifo* audio_fifo_;
+  int64_t audio_pts_;
 
   bool open_;
 
+  bool failed_;
+
 };
 
 }
 
+Q_DECLARE_METATYPE(olive::AVFramePtr)
+
 #endif // FFMPEGENCODER_H
@@ -0,0 +1,202 @@
+/***
+
+  Olive - Non-Linear Video Editor
+  Copyright (C) 2020 Olive Team
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+***/
+
+#include "ffmpegindex.h"
+
+#include <algorithm>
+#include <cstring>
+#include <QDebug>
+
+namespace olive {
+
+const uint32_t FFmpegIndex::kVersion = 1;
+
+FFmpegIndex::FFmpegIndex() :
+  map_(nullptr),
+  entries_(nullptr),
+  count_(0),
+  keyframes_(nullptr),
+  keyframe_count_(0)
+{
+}
+
+FFmpegIndex::~FFmpegIndex()
+{
+  Unload();
+}
+
+bool FFmpegIndex::Load(const QString &filename)
+{
+  Unload();
+
+  file_.setFileName(filename);
+
+  if (!file_.exists() || !file_.open(QFile::ReadOnly)) {
+    return false;
+  }
+
+  qint64 file_size = file_.size();
+
+  if (file_size >= static_cast<qint64>(sizeof(Header))) {
+    map_ = file_.map(0, file_size);
+
+    if (map_) {
+      const Header* header = reinterpret_cast<const Header*>(map_);
+
+      // Bound both counts by what could fit in the file before multiplying so they can't overflow
+      qint64 body_size = file_size - static_cast<qint64>(sizeof(Header));
+
+      if (!memcmp(header->magic, "OIDX", 4)
+          && header->version == kVersion
+          && header->entry_count >= 0
+          && header->keyframe_count >= 0
+          && header->entry_count <= body_size / static_cast<qint64>(sizeof(Entry))
+          && header->keyframe_count <= body_size / static_cast<qint64>(sizeof(int64_t))
+          && body_size == static_cast<qint64>(header->entry_count * sizeof(Entry)
+                                              + header->keyframe_count * sizeof(int64_t))) {
+        count_ = header->entry_count;
+        entries_ = reinterpret_cast<const Entry*>(map_ + sizeof(Header));
+        keyframe_count_ = header->keyframe_count;
+        keyframes_ = reinterpret_cast<const int64_t*>(map_ + sizeof(Header) + count_ * sizeof(Entry));
+
+        // GetKeyframeAtOrBefore() indexes entries through this list, so a damaged one must not point outside them
+        bool keyframes_valid = true;
+        for (int64_t i=0; i<keyframe_count_; i++) {
+          if (keyframes_[i] < 0 || keyframes_[i] >= count_ || (i > 0 && keyframes_[i] <= keyframes_[i-1])) {
+            keyframes_valid = false;
+            break;
+          }
+        }
+
+        if (keyframes_valid) {
+          return true;
+        }
+      }
+
+      qWarning() << "Ignoring invalid or outdated index" << filename;
+    }
+  }
+
+  Unload();
+
+  return false;
+}
+
+void FFmpegIndex::Unload()
+{
+  if (map_) {
+    file_.unmap(map_);
+    map_ = nullptr;
+    entries_ = nullptr;
+    keyframes_ = nullptr;
+    count_ = 0;
+    keyframe_count_ = 0;
+  }
+
+  file_.close();
+}
+
+const FFmpegIndex::Entry *FFmpegIndex::GetKeyframeAtOrBefore(int64_t ts) const
+{
+  int64_t after = FindKeyframeAfter(ts);
+
+  if (after == 0) {
+    return nullptr;
+  }
+
+  return &entries_[keyframes_[after - 1]];
+}
+
+const FFmpegIndex::Entry *FFmpegIndex::GetKeyframeAfter(int64_t ts) const
+{
+  int64_t after = FindKeyframeAfter(ts);
+
+  if (after == keyframe_count_) {
+    return nullptr;
+  }
+
+  return &entries_[keyframes_[after]];
+}
+
+int64_t FFmpegIndex::FindKeyframeAfter(int64_t ts) const
+{
+  // Binary search the keyframe list for the first keyframe > ts
+  int64_t low = 0;
+  int64_t high = keyframe_count_;
+
+  while (low < high) {
+    int64_t mid = low + (high - low) / 2;
+
+    if (entries_[keyframes_[mid]].pts <= ts) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+
+  return low;
+}
+
+bool FFmpegIndex::Write(const QString &filename, QVector<Entry> entries)
+{
+  std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b){ return a.pts < b.pts; });
+
+  QVector<int64_t> keyframes;
+  for (int i=0; i<entries.size(); i++) {
+    if (entries.at(i).flags & kKeyframe) {
+      keyframes.append(i);
+    }
+  }
+
+  Header header;
+  memcpy(header.magic, "OIDX", 4);
+  header.version = kVersion;
+  header.entry_count = entries.size();
+  header.keyframe_count = keyframes.size();
+
+  QString working_filename = filename;
+  working_filename.append(QStringLiteral(".tmp"));
+
+  QFile f(working_filename);
+  if (!f.open(QFile::WriteOnly)) {
+    qWarning() << "Failed to open index file for writing" << working_filename;
+    return false;
+  }
+
+  bool success = f.write(reinterpret_cast<const char*>(&header), sizeof(Header)) == sizeof(Header)
+      && f.write(reinterpret_cast<const char*>(entries.constData()), entries.size() * sizeof(Entry)) == static_cast<qint64>(entries.size() * sizeof(Entry))
+      && f.write(reinterpret_cast<const char*>(keyframes.constData()), keyframes.size() * sizeof(int64_t)) == static_cast<qint64>(keyframes.size() * sizeof(int64_t));
+
+  f.close();
+
+  if (success) {
+    QFile::remove(filename);
+    success = QFile::rename(working_filename, filename);
+  }
+
+  if (!success) {
+    qWarning() << "Failed to write index file" << filename;
+    QFile::remove(working_filename);
+  }
+
+  return success;
+}
+
+}
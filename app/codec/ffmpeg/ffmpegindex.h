@@ -0,0 +1,140 @@
+/***
+
+  Olive - Non-Linear Video Editor
+  Copyright (C) 2020 Olive Team
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+***/
+
+#ifndef FFMPEGINDEX_H
+#define FFMPEGINDEX_H
+
+#include <QFile>
+#include <QVector>
+#include <stdint.h>
+
+#include "common/define.h"
+
+namespace olive {
+
+/**
+ * @brief Memory-mapped packet index of a single FFmpeg stream
+ *
+ * Stores the timestamp, keyframe flag and byte offset of every packet in a stream so that seeking
+ * can jump straight to the keyframe before a given time rather than stepping backwards until a
+ * usable frame turns up.
+ *
+ * The sidecar file is a small header followed by every packet sorted by timestamp and then the
+ * indices of the keyframe packets, all in native byte order. It's only ever written once by
+ * Write() and then mapped read-only by Load(), so a loaded index is safe to read from any thread.
+ */
+class FFmpegIndex
+{
+public:
+  FFmpegIndex();
+
+  ~FFmpegIndex();
+
+  DISABLE_COPY_MOVE(FFmpegIndex)
+
+  enum Flag {
+    kKeyframe = 0x1
+  };
+
+  struct Entry {
+    int64_t pts;
+    int64_t pos;
+    uint32_t flags;
+    uint32_t reserved;
+  };
+
+  /**
+   * @brief Map an index file written by Write()
+   *
+   * Returns FALSE if the file doesn't exist or isn't a valid index.
+   */
+  bool Load(const QString& filename);
+
+  void Unload();
+
+  bool IsLoaded() const
+  {
+    return entries_ != nullptr;
+  }
+
+  int64_t count() const
+  {
+    return count_;
+  }
+
+  const Entry& at(int64_t i) const
+  {
+    return entries_[i];
+  }
+
+  /**
+   * @brief Find the last keyframe with a timestamp at or before `ts`
+   *
+   * Returns nullptr if there's no such keyframe.
+   */
+  const Entry* GetKeyframeAtOrBefore(int64_t ts) const;
+
+  /**
+   * @brief Find the first keyframe with a timestamp after `ts`
+   *
+   * Returns nullptr if there's no such keyframe.
+   */
+  const Entry* GetKeyframeAfter(int64_t ts) const;
+
+  /**
+   * @brief Sort `entries` and write them to a new index file
+   *
+   * The file is written to a temporary name first and renamed when complete, so readers never see
+   * a partial index.
+   */
+  static bool Write(const QString& filename, QVector<Entry> entries);
+
+private:
+  struct Header {
+    char magic[4];
+    uint32_t version;
+    int64_t entry_count;
+    int64_t keyframe_count;
+  };
+
+  /**
+   * @brief Position in `keyframes_` of the first keyframe with a timestamp after `ts`
+   */
+  int64_t FindKeyframeAfter(int64_t ts) const;
+
+  static const uint32_t kVersion;
+
+  QFile file_;
+
+  uchar* map_;
+
+  const Entry* entries_;
+
+  int64_t count_;
+
+  const int64_t* keyframes_;
+
+  int64_t keyframe_count_;
+
+};
+
+}
+
+#endif // FFMPEGINDEX_H
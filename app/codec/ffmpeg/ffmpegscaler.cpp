@@ -0,0 +1,335 @@
+/***
+
+  Olive - Non-Linear Video Editor
+  Copyright (C) 2020 Olive Team
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+***/
+
+#include "ffmpegscaler.h"
+
+extern "C" {
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+}
+
+#include <cstring>
+#include <QThread>
+#include <QtConcurrent/QtConcurrent>
+
+namespace olive {
+
+// Below this many rows per slice, the overhead of threading outweighs the gain
+const int kMinimumSliceHeight = 64;
+
+// Extra chroma rows converted either side of a slice so vertical filters see the same neighbors
+// they would in a single context
+const int kSliceMargin = 16;
+
+// Ordered dithering repeats every 8 rows, slices must start on the same phase as a whole image
+const int kDitherPeriod = 8;
+
+FFmpegScaler::FFmpegScaler() :
+  dst_width_(0),
+  dst_height_(0),
+  src_fmt_(AV_PIX_FMT_NONE),
+  dst_fmt_(AV_PIX_FMT_NONE)
+{
+}
+
+FFmpegScaler::~FFmpegScaler()
+{
+  Free();
+}
+
+bool FFmpegScaler::Init(int src_width, int src_height, AVPixelFormat src_fmt, int dst_width, int dst_height, AVPixelFormat dst_fmt, int flags, int threads)
+{
+  Free();
+
+  const AVPixFmtDescriptor* src_desc = av_pix_fmt_desc_get(src_fmt);
+  const AVPixFmtDescriptor* dst_desc = av_pix_fmt_desc_get(dst_fmt);
+
+  if (!src_desc || !dst_desc) {
+    return false;
+  }
+
+  src_fmt_ = src_fmt;
+  dst_fmt_ = dst_fmt;
+  dst_width_ = dst_width;
+  dst_height_ = dst_height;
+
+  if (threads <= 0) {
+    threads = QThread::idealThreadCount();
+  }
+
+  int slice_count = 1;
+
+  // Paletted formats keep their palette in a plane that can't be split
+  if (src_height == dst_height
+      && !(src_desc->flags & AV_PIX_FMT_FLAG_PAL)
+      && !(dst_desc->flags & AV_PIX_FMT_FLAG_PAL)) {
+    slice_count = qMax(1, qMin(threads, src_height / kMinimumSliceHeight));
+  }
+
+  if (slice_count > 1) {
+    if (InitSlices(src_width, src_height, src_fmt, dst_width, dst_fmt, flags, slice_count)
+        && VerifySlices(src_width, src_height, src_fmt, dst_width, dst_fmt, flags)) {
+      return true;
+    }
+
+    Free();
+  }
+
+  return InitSingle(src_width, src_height, src_fmt, dst_width, dst_height, dst_fmt, flags);
+}
+
+void FFmpegScaler::Free()
+{
+  for (int i=0; i<slices_.size(); i++) {
+    Slice& s = slices_[i];
+
+    sws_freeContext(s.ctx);
+
+    if (s.scratch[0]) {
+      av_freep(&s.scratch[0]);
+    }
+  }
+
+  slices_.clear();
+}
+
+int FFmpegScaler::Scale(const uint8_t * const src[], const int src_linesize[], uint8_t * const dst[], const int dst_linesize[])
+{
+  if (slices_.isEmpty()) {
+    return AVERROR(EINVAL);
+  }
+
+  if (slices_.size() == 1) {
+    return sws_scale(slices_.first().ctx, src, src_linesize, 0, slices_.first().height, dst, dst_linesize);
+  }
+
+  QAtomicInt error(0);
+
+  QtConcurrent::blockingMap(slices_, [&](const Slice& s){
+    const uint8_t* slice_src[4];
+
+    OffsetPlanes(src_fmt_, s.src_y, src, src_linesize, const_cast<uint8_t**>(slice_src));
+
+    int ret = sws_scale(s.ctx, slice_src, src_linesize, 0, s.src_height, s.scratch, s.scratch_linesize);
+
+    if (ret < 0) {
+      error.testAndSetRelaxed(0, ret);
+      return;
+    }
+
+    // Only our own rows go to the destination, the rest belong to the neighboring slices
+    CopyRows(dst_fmt_, dst_width_,
+             s.scratch, s.scratch_linesize, s.y - s.src_y,
+             dst, dst_linesize, s.y,
+             s.height);
+  });
+
+  if (error.load()) {
+    return error.load();
+  }
+
+  return dst_height_;
+}
+
+bool FFmpegScaler::InitSlices(int src_width, int src_height, AVPixelFormat src_fmt, int dst_width, AVPixelFormat dst_fmt, int flags, int slice_count)
+{
+  const AVPixFmtDescriptor* src_desc = av_pix_fmt_desc_get(src_fmt);
+  const AVPixFmtDescriptor* dst_desc = av_pix_fmt_desc_get(dst_fmt);
+
+  int chroma_shift = qMax(src_desc->log2_chroma_h, dst_desc->log2_chroma_h);
+
+  // Slices must start on a row that exists in every chroma plane and on the same dither phase
+  int alignment = qMax(kDitherPeriod, 1 << chroma_shift);
+  int margin = kSliceMargin << chroma_shift;
+
+  int rows_per_slice = (src_height + slice_count - 1) / slice_count;
+  rows_per_slice = (rows_per_slice + alignment - 1) / alignment * alignment;
+
+  for (int y=0; y<src_height; y+=rows_per_slice) {
+    Slice s;
+
+    memset(s.scratch, 0, sizeof(s.scratch));
+    memset(s.scratch_linesize, 0, sizeof(s.scratch_linesize));
+
+    s.y = y;
+    s.height = qMin(rows_per_slice, src_height - y);
+    s.src_y = qMax(0, y - margin);
+    s.src_height = qMin(src_height, y + s.height + margin) - s.src_y;
+
+    s.ctx = sws_getContext(src_width,
+                           s.src_height,
+                           src_fmt,
+                           dst_width,
+                           s.src_height,
+                           dst_fmt,
+                           flags,
+                           nullptr,
+                           nullptr,
+                           nullptr);
+
+    if (!s.ctx) {
+      return false;
+    }
+
+    // Add before allocating so Free() cleans up after a failure
+    slices_.append(s);
+
+    Slice& added = slices_.last();
+    if (av_image_alloc(added.scratch, added.scratch_linesize, dst_width, added.src_height, dst_fmt, 32) < 0) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool FFmpegScaler::InitSingle(int src_width, int src_height, AVPixelFormat src_fmt, int dst_width, int dst_height, AVPixelFormat dst_fmt, int flags)
+{
+  Slice s;
+
+  memset(s.scratch, 0, sizeof(s.scratch));
+  memset(s.scratch_linesize, 0, sizeof(s.scratch_linesize));
+
+  s.y = 0;
+  s.height = src_height;
+  s.src_y = 0;
+  s.src_height = src_height;
+
+  s.ctx = sws_getContext(src_width,
+                         src_height,
+                         src_fmt,
+                         dst_width,
+                         dst_height,
+                         dst_fmt,
+                         flags,
+                         nullptr,
+                         nullptr,
+                         nullptr);
+
+  if (!s.ctx) {
+    return false;
+  }
+
+  slices_.append(s);
+
+  return true;
+}
+
+bool FFmpegScaler::VerifySlices(int src_width, int src_height, AVPixelFormat src_fmt, int dst_width, AVPixelFormat dst_fmt, int flags)
+{
+  uint8_t* src_data[4] = {nullptr, nullptr, nullptr, nullptr};
+  int src_linesize[4];
+  uint8_t* ref_data[4] = {nullptr, nullptr, nullptr, nullptr};
+  int ref_linesize[4];
+  uint8_t* out_data[4] = {nullptr, nullptr, nullptr, nullptr};
+  int out_linesize[4];
+
+  bool identical = false;
+
+  SwsContext* ref_ctx = sws_getContext(src_width, src_height, src_fmt,
+                                       dst_width, src_height, dst_fmt,
+                                       flags, nullptr, nullptr, nullptr);
+
+  int src_size = av_image_alloc(src_data, src_linesize, src_width, src_height, src_fmt, 32);
+
+  if (ref_ctx
+      && src_size >= 0
+      && av_image_alloc(ref_data, ref_linesize, dst_width, src_height, dst_fmt, 32) >= 0
+      && av_image_alloc(out_data, out_linesize, dst_width, src_height, dst_fmt, 32) >= 0) {
+    // Noise gives every filter tap something different to work with, unlike a flat or smooth image
+    quint32 seed = 1;
+    for (int i=0; i<src_size; i++) {
+      seed = seed * 1664525u + 1013904223u;
+      src_data[0][i] = static_cast<uint8_t>(seed >> 24);
+    }
+
+    if (sws_scale(ref_ctx, src_data, src_linesize, 0, src_height, ref_data, ref_linesize) >= 0
+        && Scale(src_data, src_linesize, out_data, out_linesize) >= 0) {
+      const AVPixFmtDescriptor* dst_desc = av_pix_fmt_desc_get(dst_fmt);
+      int plane_count = av_pix_fmt_count_planes(dst_fmt);
+
+      identical = true;
+
+      for (int i=0; i<plane_count && identical; i++) {
+        int shift = (i == 1 || i == 2) ? dst_desc->log2_chroma_h : 0;
+        int rows = -((-src_height) >> shift);
+        int bytes = av_image_get_linesize(dst_fmt, dst_width, i);
+
+        for (int j=0; j<rows; j++) {
+          if (memcmp(ref_data[i] + static_cast<ptrdiff_t>(j) * ref_linesize[i],
+                     out_data[i] + static_cast<ptrdiff_t>(j) * out_linesize[i],
+                     bytes)) {
+            identical = false;
+            break;
+          }
+        }
+      }
+    }
+  }
+
+  av_freep(&src_data[0]);
+  av_freep(&ref_data[0]);
+  av_freep(&out_data[0]);
+  sws_freeContext(ref_ctx);
+
+  return identical;
+}
+
+void FFmpegScaler::OffsetPlanes(const AVPixelFormat fmt, int y, const uint8_t * const in[], const int linesize[], uint8_t *out[])
+{
+  const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(fmt);
+  int plane_count = av_pix_fmt_count_planes(fmt);
+
+  for (int i=0; i<4; i++) {
+    if (i >= plane_count || !in[i]) {
+      out[i] = const_cast<uint8_t*>(in[i]);
+      continue;
+    }
+
+    // Planes 1 and 2 hold chroma in planar/semi-planar YUV, alpha is always full resolution
+    int plane_y = (i == 1 || i == 2) ? (y >> desc->log2_chroma_h) : y;
+
+    out[i] = const_cast<uint8_t*>(in[i]) + static_cast<ptrdiff_t>(plane_y) * linesize[i];
+  }
+}
+
+void FFmpegScaler::CopyRows(const AVPixelFormat fmt, int width,
+                            uint8_t * const src[], const int src_linesize[], int src_y,
+                            uint8_t * const dst[], const int dst_linesize[], int dst_y,
+                            int height)
+{
+  const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(fmt);
+  int plane_count = av_pix_fmt_count_planes(fmt);
+
+  for (int i=0; i<plane_count; i++) {
+    int shift = (i == 1 || i == 2) ? desc->log2_chroma_h : 0;
+
+    // Slice starts are aligned to the chroma height so only the end of the image needs rounding up
+    int plane_src_y = src_y >> shift;
+    int plane_dst_y = dst_y >> shift;
+    int plane_rows = -((-(dst_y + height)) >> shift) - plane_dst_y;
+
+    av_image_copy_plane(dst[i] + static_cast<ptrdiff_t>(plane_dst_y) * dst_linesize[i], dst_linesize[i],
+                        src[i] + static_cast<ptrdiff_t>(plane_src_y) * src_linesize[i], src_linesize[i],
+                        av_image_get_linesize(fmt, width, i), plane_rows);
+  }
+}
+
+}
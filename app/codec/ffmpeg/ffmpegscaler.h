@@ -0,0 +1,137 @@
+/***
+
+  Olive - Non-Linear Video Editor
+  Copyright (C) 2020 Olive Team
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+***/
+
+#ifndef FFMPEGSCALER_H
+#define FFMPEGSCALER_H
+
+extern "C" {
+#include <libswscale/swscale.h>
+}
+
+#include <QVector>
+
+#include "common/define.h"
+
+namespace olive {
+
+/**
+ * @brief Wrapper around sws_scale() that splits a conversion into horizontal slices run in parallel
+ *
+ * sws_scale() only ever uses one thread, which at high resolutions makes pixel format conversion a
+ * significant part of the time spent per frame. When the image isn't being resized vertically,
+ * this creates one SwsContext per band of rows and runs them on the global thread pool. Resizing
+ * conversions (e.g. proxy dividers) use a single context.
+ *
+ * Vertical filters (e.g. chroma interpolation from 4:2:0) need rows from either side of a band, so
+ * each band converts a few extra rows above and below into its own scratch buffer and only copies
+ * the rows it owns into the destination. Since that's only as good as our guess of how far
+ * swscale's filters reach, Init() converts a test image both ways and falls back to a single
+ * context if the results aren't bit-identical.
+ */
+class FFmpegScaler
+{
+public:
+  FFmpegScaler();
+
+  ~FFmpegScaler();
+
+  DISABLE_COPY_MOVE(FFmpegScaler)
+
+  /**
+   * @brief Create the conversion contexts, freeing any that already exist
+   *
+   * @param threads
+   *
+   * Maximum number of slices to split the image into, 0 for the ideal thread count.
+   */
+  bool Init(int src_width, int src_height, AVPixelFormat src_fmt,
+            int dst_width, int dst_height, AVPixelFormat dst_fmt,
+            int flags, int threads = 0);
+
+  void Free();
+
+  bool IsValid() const
+  {
+    return !slices_.isEmpty();
+  }
+
+  /**
+   * @brief Convert a whole image, same arguments as sws_scale() without the slice position
+   *
+   * As with sws_scale(), all arrays must have at least 4 entries even if the format uses fewer
+   * planes. Returns the number of output rows written, or a negative AVERROR on failure.
+   */
+  int Scale(const uint8_t* const src[], const int src_linesize[],
+            uint8_t* const dst[], const int dst_linesize[]);
+
+private:
+  struct Slice {
+    SwsContext* ctx;
+
+    /// Rows of the destination this slice is responsible for
+    int y;
+    int height;
+
+    /// Rows actually converted, including the extra rows either side
+    int src_y;
+    int src_height;
+
+    /// Where the converted rows go before the owned ones are copied out, unused with one slice
+    uint8_t* scratch[4];
+    int scratch_linesize[4];
+  };
+
+  bool InitSlices(int src_width, int src_height, AVPixelFormat src_fmt,
+                  int dst_width, AVPixelFormat dst_fmt, int flags, int slice_count);
+
+  bool InitSingle(int src_width, int src_height, AVPixelFormat src_fmt,
+                  int dst_width, int dst_height, AVPixelFormat dst_fmt, int flags);
+
+  /**
+   * @brief Check that the slices produce exactly what one context over the whole image would
+   */
+  bool VerifySlices(int src_width, int src_height, AVPixelFormat src_fmt,
+                    int dst_width, AVPixelFormat dst_fmt, int flags);
+
+  static void OffsetPlanes(const AVPixelFormat fmt, int y, const uint8_t* const in[], const int linesize[], uint8_t* out[]);
+
+  /**
+   * @brief Copy `height` rows starting at `src_y` in `src` to rows starting at `dst_y` in `dst`
+   */
+  static void CopyRows(const AVPixelFormat fmt, int width,
+                       uint8_t* const src[], const int src_linesize[], int src_y,
+                       uint8_t* const dst[], const int dst_linesize[], int dst_y,
+                       int height);
+
+  QVector<Slice> slices_;
+
+  int dst_width_;
+
+  int dst_height_;
+
+  AVPixelFormat src_fmt_;
+
+  AVPixelFormat dst_fmt_;
+
+};
+
+}
+
+#endif // FFMPEGSCALER_H
@@ -25,15 +25,24 @@
 #include <QtGlobal>
 #include <QtMath>
 
+#include "common/bufferpool.h"
 #include "common/oiioutils.h"
 
 namespace olive {
 
 Frame::Frame() :
+  data_(nullptr),
+  data_size_(0),
+  external_data_(nullptr),
   timestamp_(0)
 {
 }
 
+Frame::~Frame()
+{
+  destroy();
+}
+
 FramePtr Frame::Create()
 {
   return std::make_shared<Frame>();
@@ -66,7 +75,7 @@ Color Frame::get_pixel(int x, int y) const
 
   int byte_offset = y * linesize_bytes() + x * video_params().GetBytesPerPixel();
 
-  return Color(data_.data() + byte_offset, video_params().format(), video_params().channel_count());
+  return Color(const_data() + byte_offset, video_params().format(), video_params().channel_count());
 }
 
 bool Frame::contains_pixel(int x, int y) const
@@ -82,7 +91,7 @@ void Frame::set_pixel(int x, int y, const Color &c)
 
   int byte_offset = y * linesize_bytes() + x * video_params().GetBytesPerPixel();
 
-  c.toData(data_.data() + byte_offset, video_params().format(), video_params().channel_count());
+  c.toData(data() + byte_offset, video_params().format(), video_params().channel_count());
 }
 
 bool Frame::allocate()
@@ -93,11 +102,39 @@ bool Frame::allocate()
     return false;
   }
 
-  data_.resize(VideoParams::GetBufferSize(linesize_, height(), params_.format(), params_.channel_count()));
+  destroy();
+
+  // Rows are linesize_ bytes apart, so that's all the buffer needs to hold
+  int size = linesize_ * height();
+
+  data_ = static_cast<char*>(BufferPool::Allocate(size));
+  if (!data_) {
+    return false;
+  }
+
+  data_size_ = size;
 
   return true;
 }
 
+void Frame::set_external_data(char *data, std::shared_ptr<void> owner)
+{
+  destroy();
+
+  external_data_ = data;
+  external_owner_ = owner;
+}
+
+void Frame::destroy()
+{
+  BufferPool::Release(data_);
+  data_ = nullptr;
+  data_size_ = 0;
+
+  external_data_ = nullptr;
+  external_owner_ = nullptr;
+}
+
 FramePtr Frame::convert(VideoParams::Format format) const
 {
   // Create new params with destination format
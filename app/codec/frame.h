@@ -24,6 +24,7 @@
 #include <memory>
 #include <QVector>
 
+#include "common/define.h"
 #include "common/rational.h"
 #include "render/color.h"
 #include "render/videoparams.h"
@@ -35,12 +36,19 @@ using FramePtr = std::shared_ptr<Frame>;
 
 /**
  * @brief Video frame data or audio sample data from a Decoder
+ *
+ * Memory from allocate() comes from BufferPool and is recycled for the next frame of a similar size once this frame
+ * is destroyed (i.e. when the last FramePtr to it goes out of scope).
  */
 class Frame
 {
 public:
   Frame();
 
+  ~Frame();
+
+  DISABLE_COPY_MOVE(Frame)
+
   static FramePtr Create();
 
   const VideoParams& video_params() const;
@@ -102,7 +110,7 @@ public:
    */
   char* data()
   {
-    return data_.data();
+    return external_data_ ? external_data_ : data_;
   }
 
   /**
@@ -110,7 +118,7 @@ public:
    */
   const char* const_data() const
   {
-    return data_.constData();
+    return external_data_ ? external_data_ : data_;
   }
 
   /**
@@ -122,21 +130,27 @@ public:
    */
   bool allocate();
 
+  /**
+   * @brief Use memory owned by someone else rather than allocating
+   *
+   * Avoids a copy when the data already exists somewhere in the right layout (e.g. a decoder's
+   * frame cache). `data` must match the video params and linesize of this frame. `owner` is kept
+   * alive for as long as this frame uses the data, and the data must not change during that time.
+   */
+  void set_external_data(char* data, std::shared_ptr<void> owner);
+
   /**
    * @brief Return whether the frame is allocated or not
    */
   bool is_allocated() const
   {
-    return !data_.isEmpty();
+    return external_data_ || data_;
   }
 
   /**
    * @brief Destroy a memory buffer allocated with allocate()
    */
-  void destroy()
-  {
-    data_.clear();
-  }
+  void destroy();
 
   /**
    * @brief Returns the size of the array returned in data() in bytes
@@ -145,7 +159,7 @@ public:
    */
   int allocated_size() const
   {
-    return data_.size();
+    return external_data_ ? linesize_ * height() : data_size_;
   }
 
   FramePtr convert(VideoParams::Format format) const;
@@ -153,7 +167,13 @@ public:
 private:
   VideoParams params_;
 
-  QByteArray data_;
+  char* data_;
+
+  int data_size_;
+
+  char* external_data_;
+
+  std::shared_ptr<void> external_owner_;
 
   rational timestamp_;
 
@@ -20,6 +20,8 @@
 
 #include "samplebuffer.h"
 
+#include "common/bufferpool.h"
+
 namespace olive {
 
 SampleBuffer::SampleBuffer() :
@@ -55,24 +57,31 @@ SampleBufferPtr SampleBuffer::CreateAllocated(const AudioParams &audio_params, i
 }
 
 SampleBufferPtr SampleBuffer::CreateFromPackedData(const AudioParams &audio_params, const QByteArray &bytes)
+{
+  return CreateFromPackedData(audio_params, bytes.constData(), audio_params.bytes_to_samples(bytes.size()));
+}
+
+SampleBufferPtr SampleBuffer::CreateFromPackedData(const AudioParams &audio_params, const char *data, int samples_per_channel)
 {
   if (!audio_params.is_valid()) {
     qWarning() << "Tried to create from packed data with invalid parameters";
     return nullptr;
   }
 
-  int samples_per_channel = audio_params.bytes_to_samples(bytes.size());
   SampleBufferPtr buffer = CreateAllocated(audio_params, samples_per_channel);
 
-  int total_samples = samples_per_channel * audio_params.channel_count();
+  int channel_count = audio_params.channel_count();
 
-  const float* packed_data = reinterpret_cast<const float*>(bytes.constData());
+  const float* packed_data = reinterpret_cast<const float*>(data);
 
-  for (int i=0;i<total_samples;i++) {
-    int channel = i % audio_params.channel_count();
-    int index = i / audio_params.channel_count();
+  // Deinterleave one channel at a time so each write stays sequential
+  for (int channel=0; channel<channel_count; channel++) {
+    float* dst = buffer->data_[channel];
+    const float* src = packed_data + channel;
 
-    buffer->data_[channel][index] = packed_data[i];
+    for (int i=0; i<samples_per_channel; i++) {
+      dst[i] = src[i * channel_count];
+    }
   }
 
   return buffer;
@@ -291,21 +300,32 @@ void SampleBuffer::allocate_sample_buffer(float ***data, int nb_channels, int nb
 {
   Q_ASSERT(nb_samples > 0);
 
-  *data = new float* [nb_channels];
+  // Channel pointers and every channel's samples share one pooled block. Each section is padded to 64 bytes so
+  // channels start cache line aligned relative to the block.
+  const size_t kPad = 64;
+  size_t pointer_sz = (nb_channels * sizeof(float*) + kPad - 1) & ~(kPad - 1);
+  size_t channel_sz = (nb_samples * sizeof(float) + kPad - 1) & ~(kPad - 1);
+
+  char* block = static_cast<char*>(BufferPool::Allocate(pointer_sz + channel_sz * nb_channels));
+
+  if (!block) {
+    *data = nullptr;
+    return;
+  }
+
+  *data = reinterpret_cast<float**>(block);
 
   for (int i=0;i<nb_channels;i++) {
-    (*data)[i] = new float[nb_samples];
+    (*data)[i] = reinterpret_cast<float*>(block + pointer_sz + channel_sz * i);
   }
 }
 
 void SampleBuffer::destroy_sample_buffer(float ***data, int nb_channels)
 {
-  if (*data) {
-    for (int i=0;i<nb_channels;i++) {
-      delete [] (*data)[i];
-    }
+  Q_UNUSED(nb_channels)
 
-    delete [] *data;
+  if (*data) {
+    BufferPool::Release(*data);
     *data = nullptr;
   }
 }
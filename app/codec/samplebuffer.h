@@ -37,6 +37,8 @@ using SampleBufferPtr = std::shared_ptr<SampleBuffer>;
  * rendering code. This replaces the old system of using QByteArrays (containing packed audio) and while SampleBuffer
  * replaces many of those in the rendering/processing side of things, QByteArrays are currently still in use for
  * playback, including reading to and from the cache.
+ *
+ * Sample memory comes from BufferPool and is recycled once the buffer is destroyed.
  */
 class SampleBuffer
 {
@@ -49,6 +51,7 @@ public:
   static SampleBufferPtr CreateAllocated(const AudioParams& audio_params, const rational& length);
   static SampleBufferPtr CreateAllocated(const AudioParams& audio_params, int samples_per_channel);
   static SampleBufferPtr CreateFromPackedData(const AudioParams& audio_params, const QByteArray& bytes);
+  static SampleBufferPtr CreateFromPackedData(const AudioParams& audio_params, const char* data, int samples_per_channel);
 
   DISABLE_COPY_MOVE(SampleBuffer)
 
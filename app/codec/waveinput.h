@@ -54,6 +54,14 @@ public:
 
   const quint32& data_length() const;
 
+  /**
+   * @brief File offset that the audio data starts at
+   */
+  qint64 data_position() const
+  {
+    return data_position_;
+  }
+
   int sample_count() const;
 
 private:
@@ -27,6 +27,8 @@ namespace olive {
 const int16_t kWAVIntegerFormat = 1;
 const int16_t kWAVFloatFormat = 3;
 
+const int WaveOutput::kHeaderSize = 44;
+
 WaveOutput::WaveOutput(const QString &f,
                        const AudioParams& params) :
   file_(f),
@@ -40,11 +42,16 @@ WaveOutput::~WaveOutput()
   close();
 }
 
-bool WaveOutput::open()
+bool WaveOutput::open(bool keep_existing)
 {
   data_length_ = 0;
 
-  if (file_.open(QFile::WriteOnly)) {
+  if (file_.open(keep_existing ? QFile::ReadWrite : QFile::WriteOnly)) {
+    if (keep_existing) {
+      data_length_ = static_cast<int>(qMax(Q_INT64_C(0), file_.size() - kHeaderSize));
+      file_.seek(0);
+    }
+
     // RIFF header
     file_.write("RIFF");
 
@@ -124,6 +131,23 @@ void WaveOutput::write(const char *bytes, int length)
   }
 }
 
+void WaveOutput::write(qint64 offset, const char *bytes, int length)
+{
+  if (file_.isOpen()) {
+    file_.seek(kHeaderSize + offset);
+    file_.write(bytes, length);
+
+    data_length_ = qMax(data_length_, static_cast<int>(offset + length));
+  }
+}
+
+void WaveOutput::flush()
+{
+  if (file_.isOpen()) {
+    file_.flush();
+  }
+}
+
 void WaveOutput::close()
 {
   if (file_.isOpen()) {
@@ -38,17 +38,38 @@ public:
 
   DISABLE_COPY_MOVE(WaveOutput)
 
-  bool open();
+  /**
+   * @brief Open the file and write the header
+   *
+   * If `keep_existing` is TRUE, audio data already in the file is kept so more can be written
+   * around it, otherwise the file is truncated.
+   */
+  bool open(bool keep_existing = false);
 
   void write(const QByteArray& bytes);
   void write(const char* bytes, int length);
 
+  /**
+   * @brief Write PCM data at a byte offset from the start of the audio data
+   *
+   * Allows audio to be written out of order. Any region that's skipped over reads as silence.
+   */
+  void write(qint64 offset, const char* bytes, int length);
+
+  /**
+   * @brief Push anything buffered out to the file so other handles to it can read it
+   */
+  void flush();
+
   void close();
 
   const int& data_length() const;
 
   const AudioParams& params() const;
 
+  /// Size of the header written by open(), i.e. the file offset the audio data starts at
+  static const int kHeaderSize;
+
 private:
   template<typename T>
   void write_int(QFile* file, T integer);
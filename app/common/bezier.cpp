@@ -68,4 +68,47 @@ double Bezier::CubicTtoY(double a, double b, double c, double d, double t)
   return qPow(1.0 - t, 3)*a + 3*qPow(1.0 - t, 2)*t*b + 3*(1.0 - t)*qPow(t, 2)*c + qPow(t, 3)*d;
 }
 
+void Bezier::CubicToCoefficients(double a, double b, double c, double d, double *coeffs)
+{
+  coeffs[0] = -a + 3*b - 3*c + d;
+  coeffs[1] = 3*a - 6*b + 3*c;
+  coeffs[2] = -3*a + 3*b;
+  coeffs[3] = a;
+}
+
+double Bezier::CubicCoefficientsTtoY(const double *coeffs, double t)
+{
+  return ((coeffs[0]*t + coeffs[1])*t + coeffs[2])*t + coeffs[3];
+}
+
+double Bezier::CubicCoefficientsXtoT(double x_target, const double *coeffs)
+{
+  const double tolerance = 0.0001;
+
+  // Enough halvings to exhaust double precision, in case tolerance can never be reached
+  const int max_iterations = 64;
+
+  // Clamp to prevent deadlocks
+  x_target = clamp(x_target, coeffs[3], coeffs[0] + coeffs[1] + coeffs[2] + coeffs[3]);
+
+  double lower = 0.0;
+  double upper = 1.0;
+
+  double percent = 0.5;
+  double x = CubicCoefficientsTtoY(coeffs, percent);
+
+  for (int i=0; i<max_iterations && qAbs(x_target - x) > tolerance; i++) {
+    if (x_target > x) {
+      lower = percent;
+    } else {
+      upper = percent;
+    }
+
+    percent = (upper + lower) * 0.5;
+    x = CubicCoefficientsTtoY(coeffs, percent);
+  }
+
+  return percent;
+}
+
 }
@@ -35,6 +35,21 @@ public:
   static double CubicXtoT(double x_target, double a, double b, double c, double d);
 
   static double CubicTtoY(double a, double b, double c, double d, double t);
+
+  /**
+   * @brief Convert the four points of a cubic bezier into polynomial coefficients
+   *
+   * Writes 4 doubles to `coeffs` (highest power first). Evaluating them with CubicCoefficientsTtoY() gives the same
+   * result as CubicTtoY() without the pow() calls, which adds up when the same curve is evaluated many times.
+   */
+  static void CubicToCoefficients(double a, double b, double c, double d, double* coeffs);
+
+  static double CubicCoefficientsTtoY(const double* coeffs, double t);
+
+  /**
+   * @brief Equivalent to CubicXtoT() using coefficients from CubicToCoefficients()
+   */
+  static double CubicCoefficientsXtoT(double x_target, const double* coeffs);
 };
 
 }
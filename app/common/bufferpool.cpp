@@ -0,0 +1,216 @@
+/***
+
+  Olive - Non-Linear Video Editor
+  Copyright (C) 2020 Olive Team
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+***/
+
+#include "bufferpool.h"
+
+#include <new>
+#include <QAtomicInteger>
+#include <QDebug>
+#include <QMutex>
+#include <QVector>
+
+#include "common/memorypool.h"
+
+namespace olive {
+
+namespace {
+
+// Smallest size class, anything smaller is rounded up to this
+const int kMinClassShift = 12;
+
+// Four classes per power of two up to 2^48 bytes, larger requests are never recycled
+const int kStepsPerShift = 4;
+const int kMaxClassShift = 48;
+const int kClassCount = (kMaxClassShift - kMinClassShift) * kStepsPerShift + 1;
+
+// Bookkeeping stored in front of every block. Padded so the data that follows keeps the alignment new[] gave us.
+struct BlockHeader {
+  int size_class;
+  size_t size;
+};
+
+const size_t kHeaderSize = 64;
+static_assert(sizeof(BlockHeader) <= kHeaderSize, "Block header doesn't fit in its padding");
+
+struct SizeClass {
+  QMutex lock;
+  QVector<char*> free_blocks;
+};
+
+SizeClass size_classes[kClassCount];
+
+QAtomicInteger<quint64> pool_hits(0);
+QAtomicInteger<quint64> pool_misses(0);
+QAtomicInteger<quint64> pool_idle_bytes(0);
+QAtomicInteger<quint64> pool_lent_bytes(0);
+
+/**
+ * @brief Returns the class index for a requested size and writes the rounded-up size to `class_size`
+ *
+ * Returns -1 if the size is too large to be recycled.
+ */
+int GetSizeClass(size_t size, size_t* class_size)
+{
+  const size_t min_size = size_t(1) << kMinClassShift;
+
+  if (size <= min_size) {
+    *class_size = min_size;
+    return 0;
+  }
+
+  // Find the power of two just below the size, i.e. 2^shift < size <= 2^(shift+1)
+  int shift = kMinClassShift;
+  while (shift < kMaxClassShift && (size_t(1) << (shift + 1)) < size) {
+    shift++;
+  }
+
+  if (shift == kMaxClassShift) {
+    *class_size = size;
+    return -1;
+  }
+
+  size_t base = size_t(1) << shift;
+  size_t step = base / kStepsPerShift;
+  size_t steps = (size - base + step - 1) / step;
+
+  *class_size = base + steps * step;
+  return (shift - kMinClassShift) * kStepsPerShift + int(steps);
+}
+
+void AdjustConsumption(size_t bytes, bool add)
+{
+  QMutexLocker locker(&memory_pool_consumption_lock);
+
+  if (add) {
+    memory_pool_consumption += bytes;
+  } else {
+    memory_pool_consumption -= bytes;
+  }
+}
+
+void FreeBlock(char* block)
+{
+  size_t size = reinterpret_cast<BlockHeader*>(block)->size;
+
+  delete [] block;
+
+  AdjustConsumption(kHeaderSize + size, false);
+}
+
+}
+
+void *BufferPool::Allocate(size_t size)
+{
+  size_t class_size;
+  int size_class = GetSizeClass(size, &class_size);
+
+  if (size_class >= 0) {
+    SizeClass& c = size_classes[size_class];
+
+    QMutexLocker locker(&c.lock);
+
+    if (!c.free_blocks.isEmpty()) {
+      char* block = c.free_blocks.takeLast();
+      locker.unlock();
+
+      pool_hits.ref();
+      pool_idle_bytes.fetchAndSubRelaxed(class_size);
+      pool_lent_bytes.fetchAndAddRelaxed(class_size);
+
+      return block + kHeaderSize;
+    }
+  }
+
+  // Make room in the budget with blocks nobody is using before asking the system for more
+  if (MemoryPoolLimitReached()) {
+    Clear();
+  }
+
+  char* block = new (std::nothrow) char[kHeaderSize + class_size];
+
+  if (!block) {
+    qCritical() << "Failed to allocate" << class_size << "byte buffer. Out of memory?";
+    return nullptr;
+  }
+
+  BlockHeader* header = reinterpret_cast<BlockHeader*>(block);
+  header->size_class = size_class;
+  header->size = class_size;
+
+  AdjustConsumption(kHeaderSize + class_size, true);
+
+  pool_misses.ref();
+  pool_lent_bytes.fetchAndAddRelaxed(class_size);
+
+  return block + kHeaderSize;
+}
+
+void BufferPool::Release(void *data)
+{
+  if (!data) {
+    return;
+  }
+
+  char* block = static_cast<char*>(data) - kHeaderSize;
+  BlockHeader* header = reinterpret_cast<BlockHeader*>(block);
+
+  pool_lent_bytes.fetchAndSubRelaxed(header->size);
+
+  if (header->size_class < 0 || MemoryPoolLimitReached()) {
+    FreeBlock(block);
+    return;
+  }
+
+  SizeClass& c = size_classes[header->size_class];
+
+  pool_idle_bytes.fetchAndAddRelaxed(header->size);
+
+  QMutexLocker locker(&c.lock);
+  c.free_blocks.append(block);
+}
+
+void BufferPool::Clear()
+{
+  for (int i=0;i<kClassCount;i++) {
+    QVector<char*> blocks;
+
+    {
+      QMutexLocker locker(&size_classes[i].lock);
+      blocks.swap(size_classes[i].free_blocks);
+    }
+
+    foreach (char* b, blocks) {
+      pool_idle_bytes.fetchAndSubRelaxed(reinterpret_cast<BlockHeader*>(b)->size);
+      FreeBlock(b);
+    }
+  }
+}
+
+BufferPool::Statistics BufferPool::GetStatistics()
+{
+  Statistics s;
+  s.hits = pool_hits.load();
+  s.misses = pool_misses.load();
+  s.idle_bytes = pool_idle_bytes.load();
+  s.lent_bytes = pool_lent_bytes.load();
+  return s;
+}
+
+}
@@ -0,0 +1,85 @@
+/***
+
+  Olive - Non-Linear Video Editor
+  Copyright (C) 2020 Olive Team
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+***/
+
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <QtGlobal>
+#include <stddef.h>
+
+namespace olive {
+
+/**
+ * @brief Process-wide recycler for large short-lived buffers such as frame pixels and audio samples
+ *
+ * Requested sizes are rounded up to a size class (four classes per power of two, so at most 25% of a block is
+ * wasted). When a block is released it's kept on its class's free list and handed to the next request of the same
+ * class rather than returned to the system, which keeps page faults and allocator locking out of steady-state
+ * rendering where the same frame and audio sizes are requested over and over.
+ *
+ * Every block the pool owns, idle or lent, counts towards memory_pool_consumption so this pool shares one budget
+ * with decoder frame pools. When MemoryPoolLimitReached(), released blocks are freed instead of kept and idle blocks
+ * are trimmed before any new block is allocated.
+ */
+class BufferPool
+{
+public:
+  /**
+   * @brief Returns a buffer of at least `size` bytes, or nullptr if allocation failed
+   *
+   * The buffer's contents are undefined. It must be returned with Release() rather than deleted.
+   */
+  static void* Allocate(size_t size);
+
+  /**
+   * @brief Returns a buffer retrieved from Allocate() to the pool
+   *
+   * Passing nullptr does nothing.
+   */
+  static void Release(void* data);
+
+  /**
+   * @brief Frees every idle block back to the system
+   *
+   * Buffers that are currently lent out are unaffected.
+   */
+  static void Clear();
+
+  struct Statistics {
+    /// Allocations served by a recycled block
+    quint64 hits;
+
+    /// Allocations that needed a new block from the system
+    quint64 misses;
+
+    /// Bytes held on free lists waiting to be reused
+    quint64 idle_bytes;
+
+    /// Bytes currently lent out
+    quint64 lent_bytes;
+  };
+
+  static Statistics GetStatistics();
+
+};
+
+}
+
+#endif // BUFFERPOOL_H
@@ -0,0 +1,171 @@
+/***
+
+  Olive - Non-Linear Video Editor
+  Copyright (C) 2020 Olive Team
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+***/
+
+#include "hash128.h"
+
+#include <cstring>
+
+namespace olive {
+
+namespace {
+
+const uint64_t kC1 = 0x87c37b91114253d5ULL;
+const uint64_t kC2 = 0x4cf5ad432745937fULL;
+
+inline uint64_t rotl64(uint64_t x, int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t fmix64(uint64_t k)
+{
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  k ^= k >> 33;
+  return k;
+}
+
+inline uint64_t mix_k1(uint64_t k1)
+{
+  k1 *= kC1;
+  k1 = rotl64(k1, 31);
+  k1 *= kC2;
+  return k1;
+}
+
+inline uint64_t mix_k2(uint64_t k2)
+{
+  k2 *= kC2;
+  k2 = rotl64(k2, 33);
+  k2 *= kC1;
+  return k2;
+}
+
+}
+
+Hash128::Hash128() :
+  h1_(0),
+  h2_(0),
+  tail_length_(0),
+  total_length_(0)
+{
+}
+
+void Hash128::addData(const char *data, int length)
+{
+  if (length <= 0) {
+    return;
+  }
+
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+
+  total_length_ += length;
+
+  // Complete a partial block from a previous call first
+  if (tail_length_ > 0) {
+    int copy = qMin(kLength - tail_length_, length);
+
+    memcpy(tail_ + tail_length_, bytes, copy);
+    tail_length_ += copy;
+    bytes += copy;
+    length -= copy;
+
+    if (tail_length_ < kLength) {
+      return;
+    }
+
+    ProcessBlock(tail_);
+    tail_length_ = 0;
+  }
+
+  while (length >= kLength) {
+    ProcessBlock(bytes);
+    bytes += kLength;
+    length -= kLength;
+  }
+
+  if (length > 0) {
+    memcpy(tail_, bytes, length);
+    tail_length_ = length;
+  }
+}
+
+QByteArray Hash128::result() const
+{
+  uint64_t h1 = h1_;
+  uint64_t h2 = h2_;
+
+  uint64_t k1 = 0;
+  uint64_t k2 = 0;
+
+  for (int i=tail_length_-1; i>=8; i--) {
+    k2 ^= static_cast<uint64_t>(tail_[i]) << ((i - 8) * 8);
+  }
+
+  for (int i=qMin(tail_length_, 8)-1; i>=0; i--) {
+    k1 ^= static_cast<uint64_t>(tail_[i]) << (i * 8);
+  }
+
+  if (tail_length_ > 8) {
+    h2 ^= mix_k2(k2);
+  }
+
+  if (tail_length_ > 0) {
+    h1 ^= mix_k1(k1);
+  }
+
+  h1 ^= total_length_;
+  h2 ^= total_length_;
+
+  h1 += h2;
+  h2 += h1;
+
+  h1 = fmix64(h1);
+  h2 = fmix64(h2);
+
+  h1 += h2;
+  h2 += h1;
+
+  QByteArray out(kLength, Qt::Uninitialized);
+  memcpy(out.data(), &h1, sizeof(uint64_t));
+  memcpy(out.data() + sizeof(uint64_t), &h2, sizeof(uint64_t));
+  return out;
+}
+
+void Hash128::ProcessBlock(const uint8_t *block)
+{
+  uint64_t k1, k2;
+  memcpy(&k1, block, sizeof(uint64_t));
+  memcpy(&k2, block + sizeof(uint64_t), sizeof(uint64_t));
+
+  h1_ ^= mix_k1(k1);
+  h1_ = rotl64(h1_, 27);
+  h1_ += h2_;
+  h1_ = h1_ * 5 + 0x52dce729;
+
+  h2_ ^= mix_k2(k2);
+  h2_ = rotl64(h2_, 31);
+  h2_ += h1_;
+  h2_ = h2_ * 5 + 0x38495ab5;
+}
+
+}
@@ -0,0 +1,72 @@
+/***
+
+  Olive - Non-Linear Video Editor
+  Copyright (C) 2020 Olive Team
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+***/
+
+#ifndef HASH128_H
+#define HASH128_H
+
+#include <QByteArray>
+#include <stdint.h>
+
+#include "common/define.h"
+
+namespace olive {
+
+/**
+ * @brief Fast non-cryptographic 128-bit hash (MurmurHash3 x64)
+ *
+ * Drop-in replacement for QCryptographicHash where hashes only need to identify data rather than
+ * resist tampering, e.g. frame hashes for the disk cache. Data can be added incrementally and
+ * produces the same result as hashing it all at once.
+ */
+class Hash128
+{
+public:
+  Hash128();
+
+  void addData(const char* data, int length);
+
+  void addData(const QByteArray& data)
+  {
+    addData(data.constData(), data.size());
+  }
+
+  /**
+   * @brief Get the 16-byte hash of all data added so far
+   */
+  QByteArray result() const;
+
+  static const int kLength = 16;
+
+private:
+  void ProcessBlock(const uint8_t* block);
+
+  uint64_t h1_;
+  uint64_t h2_;
+
+  uint8_t tail_[kLength];
+  int tail_length_;
+
+  uint64_t total_length_;
+
+};
+
+}
+
+#endif // HASH128_H
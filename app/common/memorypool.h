@@ -21,13 +21,16 @@
 #ifndef MEMORYPOOL_H
 #define MEMORYPOOL_H
 
-#include <memory>
+#include <cstddef>
+#include <new>
+#include <QAtomicInteger>
 #include <QDateTime>
 #include <QDebug>
-#include <QLinkedList>
 #include <QMutex>
 #include <stdint.h>
+#include <utility>
 
+#include "common/bufferpool.h"
 #include "common/define.h"
 
 namespace olive {
@@ -44,11 +47,16 @@ template <typename T>
  * allocations). Improves performance and memory consumption.
  *
  * As a class, this base is usable by setting the template to an object of your choosing. The pool will then allocate
- * `(element_count * sizeof(T))` per arena. Arenas are allocated and destroyed on the fly - when an arena fills up,
- * another is allocated.
+ * `(element_count * sizeof(T))` per arena. When every arena is full, another is allocated, and once none of an
+ * arena's elements are in use its memory is freed again.
  *
  * `Get()` will return an ElementPtr. The original desired data can be accessed through ElementPtr::data(). This data
- * will belong to the caller until ElementPtr goes out of scope and the memory is freed back into the pool.
+ * will belong to the caller until the last ElementPtr referencing it goes out of scope and the memory is returned to
+ * the pool.
+ *
+ * Getting and returning elements is lock-free: each arena keeps its free slots in an atomic index stack, and
+ * ElementPtr is reference counted intrusively so no control block is allocated per element. Only allocating or
+ * freeing an arena's memory takes a lock.
  */
 class MemoryPool
 {
@@ -59,9 +67,15 @@ public:
    *
    * Number of elements per arena
    */
-  MemoryPool(int element_count) {
-    element_count_ = element_count;
-    ignore_arena_empty_signal_ = false;
+  MemoryPool(int element_count) :
+    element_count_(element_count),
+    arena_blocks_(),
+    arena_count_(0),
+    live_count_(0),
+    arena_hint_(0),
+    sweep_pending_(0),
+    in_use_(0)
+  {
   }
 
   /**
@@ -80,58 +94,64 @@ public:
    *
    * Note that this function is not safe, any elements that are still out there will be invalid
    * and accessing them will cause a crash. You'll need to make sure all elements are already
-   * relinquished before then.
+   * relinquished and that no other thread is calling Get() before then.
    */
   void Clear()
   {
-    ignore_arena_empty_signal_ = true;
-    qDeleteAll(arenas_);
-    ignore_arena_empty_signal_ = false;
+    QMutexLocker locker(&grow_lock_);
+
+    if (in_use_.load()) {
+      qWarning() << "Clearing memory pool while" << in_use_.load() << "elements are still in use";
+    }
+
+    int count = arena_count_.fetchAndStoreOrdered(0);
+    for (int i=0;i<count;i++) {
+      delete ArenaAt(i);
+    }
+
+    for (int i=0;i<kMaxArenaBlocks;i++) {
+      delete [] arena_blocks_[i];
+      arena_blocks_[i] = nullptr;
+    }
+
+    live_count_.store(0);
+    arena_hint_.store(0);
+    in_use_.store(0);
   }
 
   /**
    * @brief Returns whether any arenas are successfully allocated
    */
   inline bool IsAllocated() const {
-    return !arenas_.isEmpty();
+    return live_count_.load() > 0;
   }
 
   /**
    * @brief Returns current number of allocated arenas
    */
   inline int GetArenaCount() const {
-    return arenas_.size();
+    return live_count_.load();
   }
 
   class Arena;
+  class ElementPtr;
 
   /**
    * @brief A handle for a chunk of memory in an arena
    *
-   * Calling Get() on the pool or arena will return a shared pointer to an element which will contain a pointer to
-   * the desired object/data in data(). When Element is destroyed (i.e. when ElementPtr goes out of scope), the memory
-   * is released back into the pool so it can be used by another class.
+   * Elements are created once per slot when an arena is allocated and are reused for the lifetime of the arena.
+   * Calling Get() on the pool returns an ElementPtr referencing an element, and when the last ElementPtr
+   * referencing it goes out of scope, the memory is released back into the pool so it can be used by another class.
    */
   class Element {
   public:
-    /**
-     * @brief Element Constructor
-     *
-     * There is no need to use this outside of the memory pool's internal functions.
-     */
-    Element(Arena* parent, T* data) {
-      parent_ = parent;
-      data_ = data;
-      accessed_ = QDateTime::currentMSecsSinceEpoch();
-    }
-
-    /**
-     * @brief Element Destructor
-     *
-     * Automatically releases this element's memory back to the arena it was retrieved from.
-     */
-    ~Element() {
-      release();
+    Element() :
+      parent_(nullptr),
+      data_(nullptr),
+      index_(0),
+      timestamp_(0),
+      accessed_(0)
+    {
     }
 
     DISABLE_COPY_MOVE(Element)
@@ -170,149 +190,339 @@ public:
       return accessed_;
     }
 
-    void release() {
-      if (data_) {
-        parent_->Release(this);
-        data_ = nullptr;
-      }
-    }
-
   private:
+    friend class Arena;
+    friend class ElementPtr;
+
     Arena* parent_;
 
     T* data_;
 
+    quint32 index_;
+
+    QAtomicInt ref_;
+
     int64_t timestamp_;
 
     int64_t accessed_;
 
   };
 
-  using ElementPtr = std::shared_ptr<Element>;
+  /**
+   * @brief Reference counted handle to an Element
+   *
+   * Behaves like a shared pointer, but the count lives inside the Element itself so copying or dropping a handle
+   * never allocates.
+   */
+  class ElementPtr {
+  public:
+    ElementPtr() :
+      element_(nullptr)
+    {
+    }
+
+    ElementPtr(std::nullptr_t) :
+      element_(nullptr)
+    {
+    }
+
+    ElementPtr(const ElementPtr& other) :
+      element_(other.element_)
+    {
+      if (element_) {
+        element_->ref_.ref();
+      }
+    }
+
+    ElementPtr(ElementPtr&& other) :
+      element_(other.element_)
+    {
+      other.element_ = nullptr;
+    }
+
+    ~ElementPtr() {
+      reset();
+    }
+
+    ElementPtr& operator=(ElementPtr other) {
+      std::swap(element_, other.element_);
+      return *this;
+    }
+
+    void reset() {
+      if (element_ && !element_->ref_.deref()) {
+        element_->parent_->Release(element_);
+      }
+
+      element_ = nullptr;
+    }
+
+    inline Element* get() const {
+      return element_;
+    }
+
+    inline Element* operator->() const {
+      return element_;
+    }
+
+    inline Element& operator*() const {
+      return *element_;
+    }
+
+    inline explicit operator bool() const {
+      return element_;
+    }
+
+    inline bool operator==(const ElementPtr& other) const {
+      return element_ == other.element_;
+    }
+
+    inline bool operator!=(const ElementPtr& other) const {
+      return element_ != other.element_;
+    }
+
+  private:
+    friend class MemoryPool;
+
+    /**
+     * @brief Adopt an element whose reference count has already been set to 1
+     */
+    explicit ElementPtr(Element* e) :
+      element_(e)
+    {
+    }
+
+    Element* element_;
+
+  };
 
   /**
    * @brief A memory pool arena - a subsection of memory
    *
    * The pool itself does not store memory, it stores "arenas". This is so that the pool can handle the situation of
    * an arena becoming full with no more memory to lend. A pool can automatically allocate another arena and continue
-   * providing memory (and freeing arenas when they're no longer in use).
+   * providing memory, and free an arena's memory again once none of its elements are in use.
+   *
+   * Free slots are kept in a singly linked stack of indices. The head stores the top index in its low 32 bits and a
+   * counter in its high 32 bits that changes on every push and pop, which prevents a stale compare-and-swap from
+   * succeeding after the same index was popped and pushed again in between (the ABA problem).
+   *
+   * Freeing an arena only releases its data. The arena itself stays in the pool with an empty free stack, since other
+   * threads may be looking at it without a lock, and is refilled by Allocate() the next time the pool needs to grow.
    */
   class Arena {
   public:
-    Arena(MemoryPool* parent) {
-      parent_ = parent;
-      data_ = nullptr;
-      allocated_sz_ = 0;
+    Arena(MemoryPool* parent) :
+      parent_(parent),
+      data_(nullptr),
+      allocated_sz_(0),
+      element_sz_(0),
+      element_count_(0),
+      elements_(nullptr),
+      next_(nullptr),
+      free_head_(kEmptyIndex),
+      free_count_(0)
+    {
     }
 
     ~Arena() {
-      std::list<Element*> copy = lent_elements_;
-      foreach (Element* e, copy) {
-        e->release();
-      }
-
       delete [] data_;
 
       memory_pool_consumption_lock.lock();
       memory_pool_consumption -= allocated_sz_;
       memory_pool_consumption_lock.unlock();
+
+      delete [] elements_;
+      delete [] next_;
     }
 
     DISABLE_COPY_MOVE(Arena)
 
     /**
-     * @brief Returns an element if there is free memory to do so
+     * @brief Returns a free element if there is one, or nullptr if this arena is full
+     *
+     * The returned element's reference count is set to 1.
      */
-    ElementPtr Get() {
-      QMutexLocker locker(&lock_);
+    Element* Get() {
+      quint64 head = free_head_.loadAcquire();
+
+      forever {
+        quint32 index = static_cast<quint32>(head);
 
-      for (int i=0;i<available_.size();i++) {
-        if (available_.at(i)) {
-          // This buffer is available
-          available_.replace(i, false);
+        if (index == kEmptyIndex) {
+          return nullptr;
+        }
+
+        quint32 next = static_cast<quint32>(next_[index].load());
 
-          ElementPtr e = std::make_shared<Element>(this,
-                                                   reinterpret_cast<T*>(data_ + i * element_sz_));
-          lent_elements_.push_back(e.get());
+        if (free_head_.testAndSetOrdered(head, MakeHead(head, next))) {
+          free_count_.deref();
 
+          Element* e = &elements_[index];
+          e->ref_.store(1);
+          e->access();
           return e;
         }
-      }
 
-      return nullptr;
+        head = free_head_.loadAcquire();
+      }
     }
 
     /**
-     * @brief Releases an element back into the pool for use elsewhere
+     * @brief Releases an element back into the arena for use elsewhere
      */
     void Release(Element* e) {
-      QMutexLocker locker(&lock_);
-      quintptr diff = reinterpret_cast<quintptr>(e->data()) - reinterpret_cast<quintptr>(data_);
+      quint64 head = free_head_.loadAcquire();
 
-      int index = diff / element_sz_;
+      forever {
+        next_[e->index_].store(static_cast<int>(static_cast<quint32>(head)));
 
-      available_.replace(index, true);
-
-      lent_elements_.remove(e);
+        if (free_head_.testAndSetOrdered(head, MakeHead(head, e->index_))) {
+          break;
+        }
 
-      if (lent_elements_.empty()) {
-        locker.unlock();
-        parent_->ArenaIsEmpty(this);
+        head = free_head_.loadAcquire();
       }
-    }
 
-    int GetUsageCount() {
-      QMutexLocker locker(&lock_);
-      return lent_elements_.size();
+      parent_->in_use_.deref();
+
+      if (free_count_.fetchAndAddOrdered(1) + 1 == static_cast<int>(element_count_)) {
+        parent_->ArenaIsIdle();
+      }
     }
 
-    bool Allocate(size_t ele_sz, size_t nb_elements) {
+    /**
+     * @brief Allocates this arena's data and lends out its first element
+     *
+     * The first element is taken before any of the others become available so another thread can't drain the arena
+     * before the caller gets one. Returns nullptr if the arena is already allocated or allocation failed.
+     */
+    Element* Allocate(size_t ele_sz, size_t nb_elements) {
       if (IsAllocated()) {
-        return true;
+        return nullptr;
       }
 
       element_sz_ = ele_sz;
 
       allocated_sz_ = element_sz_ * nb_elements;
 
-      if ((data_ = new char[allocated_sz_])) {
-        available_.resize(nb_elements);
-        available_.fill(true);
+      data_ = new (std::nothrow) char[allocated_sz_];
+      if (!data_) {
+        allocated_sz_ = 0;
+        return nullptr;
+      }
 
-        memory_pool_consumption_lock.lock();
-        memory_pool_consumption += allocated_sz_;
-        memory_pool_consumption_lock.unlock();
+      // Other threads may still be reading these from before the arena was last freed, so they're only created once
+      if (!elements_) {
+        element_count_ = nb_elements;
+        elements_ = new Element[nb_elements];
+        next_ = new QAtomicInt[nb_elements];
+      }
 
-        return true;
-      } else {
-        available_.clear();
+      // Chain every slot but the first into the free stack, lowest index on top
+      for (size_t i=0;i<nb_elements;i++) {
+        elements_[i].parent_ = this;
+        elements_[i].data_ = reinterpret_cast<T*>(data_ + i * element_sz_);
+        elements_[i].index_ = static_cast<quint32>(i);
 
+        next_[i].store(static_cast<int>((i + 1 < nb_elements) ? static_cast<quint32>(i + 1) : kEmptyIndex));
+      }
+
+      Element* first = &elements_[0];
+      first->ref_.store(1);
+      first->access();
+
+      free_count_.store(static_cast<int>(nb_elements) - 1);
+      free_head_.storeRelease(MakeHead(free_head_.load(), (nb_elements > 1) ? 1 : kEmptyIndex));
+
+      memory_pool_consumption_lock.lock();
+      memory_pool_consumption += allocated_sz_;
+      memory_pool_consumption_lock.unlock();
+
+      return first;
+    }
+
+    /**
+     * @brief Frees this arena's data if none of its elements are in use
+     *
+     * Every slot is checked to be in the free stack and the stack is emptied in a single compare-and-swap, so any
+     * Get() or Release() racing with this makes it fail rather than lose an element. Must not be called concurrently
+     * with Allocate() or another Free(). Returns TRUE if the data was freed.
+     */
+    bool Free() {
+      if (!IsAllocated()) {
         return false;
       }
+
+      quint64 head = free_head_.loadAcquire();
+
+      quint32 index = static_cast<quint32>(head);
+      size_t free_slots = 0;
+      while (index != kEmptyIndex && index < element_count_ && free_slots < element_count_) {
+        free_slots++;
+        index = static_cast<quint32>(next_[index].load());
+      }
+
+      if (free_slots != element_count_ || index != kEmptyIndex
+          || !free_head_.testAndSetOrdered(head, MakeHead(head, kEmptyIndex))) {
+        return false;
+      }
+
+      free_count_.store(0);
+
+      delete [] data_;
+      data_ = nullptr;
+
+      memory_pool_consumption_lock.lock();
+      memory_pool_consumption -= allocated_sz_;
+      memory_pool_consumption_lock.unlock();
+
+      allocated_sz_ = 0;
+
+      return true;
     }
 
     inline int GetElementCount() const {
-      return available_.size();
+      return static_cast<int>(element_count_);
     }
 
     inline bool IsAllocated() const {
       return data_;
     }
 
+    /**
+     * @brief Returns whether none of this arena's elements appear to be in use
+     *
+     * Only a hint, Free() makes the final decision.
+     */
+    inline bool IsIdle() const {
+      return IsAllocated() && free_count_.load() == static_cast<int>(element_count_);
+    }
+
   private:
+    static const quint32 kEmptyIndex = 0xFFFFFFFF;
+
+    static inline quint64 MakeHead(quint64 old_head, quint32 index) {
+      return (((old_head >> 32) + 1) << 32) | index;
+    }
+
     MemoryPool* parent_;
 
     char* data_;
 
     size_t allocated_sz_;
 
-    QVector<bool> available_;
+    size_t element_sz_;
 
-    QMutex lock_;
+    size_t element_count_;
 
-    size_t element_sz_;
+    Element* elements_;
 
-    std::list<Element*> lent_elements_;
+    QAtomicInt* next_;
+
+    QAtomicInteger<quint64> free_head_;
+
+    QAtomicInt free_count_;
 
   };
 
@@ -320,24 +530,94 @@ public:
    * @brief Retrieves an element from an available arena
    */
   ElementPtr Get() {
-    QMutexLocker locker(&lock_);
+    // Fast path, try the arena that served the last request first and then the rest
+    Element* e = GetFromExistingArenas();
+
+    if (e) {
+      return ElementPtr(e);
+    }
+
+    // All arenas were full, we'll need to allocate another
+    e = GetFromNewArena();
+
+    // Arenas that went idle while we held the lock couldn't be freed then
+    SweepIdleArenas();
+
+    return ElementPtr(e);
+  }
+
+protected:
+  /**
+   * @brief The size of each element
+   *
+   * Override this to use a custom size (e.g. a char array where T = char but the element size is > 1)
+   */
+  virtual size_t GetElementSize() {
+    return sizeof(T);
+  }
+
+private:
+  // Arenas are stored in blocks that are never moved, so other threads can look them up without a lock while the pool
+  // grows
+  static const int kArenasPerBlock = 64;
+  static const int kMaxArenaBlocks = 64;
+  static const int kMaxArenas = kArenasPerBlock * kMaxArenaBlocks;
+
+  inline Arena* ArenaAt(int index) const {
+    return arena_blocks_[index / kArenasPerBlock][index % kArenasPerBlock];
+  }
+
+  Element* GetFromExistingArenas() {
+    int count = arena_count_.loadAcquire();
+
+    if (!count) {
+      return nullptr;
+    }
 
-    // Attempt to get an element from an arena
-    foreach (Arena* a, arenas_) {
-      ElementPtr e = a->Get();
+    int hint = arena_hint_.load();
+
+    for (int i=0;i<count;i++) {
+      int index = (hint + i) % count;
+      Element* e = ArenaAt(index)->Get();
 
       if (e) {
+        if (index != hint) {
+          arena_hint_.store(index);
+        }
+
+        OnElementLent();
         return e;
       }
     }
 
-    // All arenas were empty, we'll need to create a new one
-    if (arenas_.empty()) {
+    return nullptr;
+  }
+
+  /**
+   * @brief Lends an element from a newly allocated arena
+   */
+  Element* GetFromNewArena() {
+    QMutexLocker locker(&grow_lock_);
+
+    // Another thread may have added an arena while we were waiting for the lock
+    Element* e = GetFromExistingArenas();
+    if (e) {
+      return e;
+    }
+
+    int count = arena_count_.load();
+
+    if (live_count_.load() == 0) {
       qDebug() << "No arenas, creating new...";
     } else {
       qDebug() << "All arenas are full, creating new...";
     }
 
+    // Frame and sample buffers share this budget, give back whatever they aren't using before growing
+    if (MemoryPoolLimitReached()) {
+      BufferPool::Clear();
+    }
+
     size_t ele_sz = GetElementSize();
 
     if (!ele_sz) {
@@ -350,50 +630,104 @@ public:
       return nullptr;
     }
 
+    // Refill an arena whose data was freed before adding a new one
+    for (int i=0;i<count;i++) {
+      Arena* a = ArenaAt(i);
+
+      if (!a->IsAllocated()) {
+        e = a->Allocate(ele_sz, element_count_);
+
+        if (!e) {
+          qCritical() << "Failed to create arena, allocation failed. Out of memory?";
+          return nullptr;
+        }
+
+        live_count_.ref();
+        arena_hint_.store(i);
+        OnElementLent();
+        return e;
+      }
+    }
+
+    if (count == kMaxArenas) {
+      qWarning() << "Memory pool already has" << count << "arenas in use, unable to lend another element";
+      return nullptr;
+    }
+
     Arena* a = new Arena(this);
-    if (!a->Allocate(ele_sz, element_count_)) {
+    e = a->Allocate(ele_sz, element_count_);
+    if (!e) {
       qCritical() << "Failed to create arena, allocation failed. Out of memory?";
       delete a;
       return nullptr;
     }
 
-    arenas_.push_back(a);
-    return a->Get();
-  }
-
-  void ArenaIsEmpty(Arena* a) {
-    // FIXME: Does this need to be mutexed?
-    if (ignore_arena_empty_signal_) {
-      return;
+    Arena** block = arena_blocks_[count / kArenasPerBlock];
+    if (!block) {
+      block = new Arena*[kArenasPerBlock];
+      arena_blocks_[count / kArenasPerBlock] = block;
     }
 
-    QMutexLocker locker(&lock_);
+    block[count % kArenasPerBlock] = a;
+    live_count_.ref();
+    arena_count_.storeRelease(count + 1);
+    arena_hint_.store(count);
+    OnElementLent();
 
-    if (!a->GetUsageCount()) {
-      qDebug() << "Removing an empty arena";
-      arenas_.remove(a);
-      delete a;
-    }
+    return e;
   }
 
-protected:
   /**
-   * @brief The size of each element
+   * @brief Called by an arena when its last element in use is released
+   */
+  void ArenaIsIdle() {
+    sweep_pending_.storeRelease(1);
+    SweepIdleArenas();
+  }
+
+  /**
+   * @brief Frees the data of every idle arena if a sweep was requested
    *
-   * Override this to use a custom size (e.g. a char array where T = char but the element size is > 1)
+   * Never waits on the grow lock so releasing an element can't block. If another thread holds it, that thread runs
+   * the sweep once it lets go instead.
    */
-  virtual size_t GetElementSize() {
-    return sizeof(T);
+  void SweepIdleArenas() {
+    while (sweep_pending_.loadAcquire() && grow_lock_.tryLock()) {
+      sweep_pending_.storeRelease(0);
+
+      int count = arena_count_.load();
+      for (int i=0;i<count;i++) {
+        Arena* a = ArenaAt(i);
+
+        if (a->IsIdle() && a->Free()) {
+          qDebug() << "Freed an idle arena";
+          live_count_.deref();
+        }
+      }
+
+      grow_lock_.unlock();
+    }
+  }
+
+  void OnElementLent() {
+    in_use_.ref();
   }
 
-private:
   int element_count_;
 
-  std::list<Arena*> arenas_;
+  Arena** arena_blocks_[kMaxArenaBlocks];
+
+  QAtomicInt arena_count_;
+
+  QAtomicInt live_count_;
+
+  QAtomicInt arena_hint_;
+
+  QMutex grow_lock_;
 
-  QMutex lock_;
+  QAtomicInt sweep_pending_;
 
-  bool ignore_arena_empty_signal_;
+  QAtomicInt in_use_;
 
 };
 
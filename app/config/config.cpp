@@ -31,6 +31,7 @@
 #include "common/filefunctions.h"
 #include "common/xmlutils.h"
 #include "core.h"
+#include "render/rendermanager.h"
 #include "ui/style/style.h"
 #include "window/mainwindow/mainwindow.h"
 
@@ -68,6 +69,7 @@ void Config::SetDefaults()
   SetEntryInternal(QStringLiteral("AudioScrubbing"), NodeParam::kBoolean, true);
   SetEntryInternal(QStringLiteral("AutorecoveryInterval"), NodeParam::kInt, 1);
   SetEntryInternal(QStringLiteral("DiskCacheSaveInterval"), NodeParam::kInt, 10000);
+  SetEntryInternal(QStringLiteral("DiskCachePacked"), NodeParam::kBoolean, false);
   SetEntryInternal(QStringLiteral("Language"), NodeParam::kString, QString());
   SetEntryInternal(QStringLiteral("ScrollZooms"), NodeParam::kBoolean, false);
   SetEntryInternal(QStringLiteral("EnableSeekToImport"), NodeParam::kBoolean, false);
@@ -92,6 +94,10 @@ void Config::SetDefaults()
   SetEntryInternal(QStringLiteral("SplitClipsCopyNodes"), NodeParam::kBoolean, true);
 
   SetEntryInternal(QStringLiteral("AutoCacheDelay"), NodeParam::kInt, 1000);
+  SetEntryInternal(QStringLiteral("PlaybackReadahead"), NodeParam::kInt, 16);
+
+  SetEntryInternal(QStringLiteral("RenderBackend"), NodeParam::kInt, RenderManager::kOpenGL);
+  SetEntryInternal(QStringLiteral("TexturePoolSize"), NodeParam::kInt, 512);
 
   SetEntryInternal(QStringLiteral("NodeCatColor0"), NodeParam::kColor, QVariant::fromValue(Color(0.75, 0.75, 0.75)));
   SetEntryInternal(QStringLiteral("NodeCatColor1"), NodeParam::kColor, QVariant::fromValue(Color(0.25, 0.25, 0.25)));
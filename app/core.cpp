@@ -52,6 +52,7 @@
 #include "render/colormanager.h"
 #include "render/diskmanager.h"
 #include "render/rendermanager.h"
+#include "task/index/index.h"
 #ifdef USE_OTIO
 #include "task/project/loadotio/loadotio.h"
 #include "task/project/saveotio/saveotio.h"
@@ -178,6 +179,9 @@ void Core::Stop()
     }
   }
 
+  // Don't let background conforms keep the application alive, they'll resume next time
+  Decoder::StopAllConforms();
+
   RenderManager::DestroyInstance();
 
   MenuShared::DestroyInstance();
@@ -463,6 +467,12 @@ void Core::AddOpenProjectFromTask(Task *task)
   if (ValidateFootageInLoadedProject(project, load_task->GetFilenameProjectWasSavedAs())) {
     AddOpenProject(project);
     main_window_->LoadLayout(layout);
+
+    // Footage in projects saved before indexing existed (or whose index was cleared from the cache)
+    // has no index yet
+    foreach (ItemPtr item, project->get_items_of_type(Item::kFootage)) {
+      IndexFootage(std::static_pointer_cast<Footage>(item));
+    }
   } else {
     delete project;
   }
@@ -480,6 +490,25 @@ void Core::ImportTaskComplete(Task* task)
   }
 
   undo_stack_.pushIfHasChildren(command);
+
+  // Now that the footage belongs to a project, build seek indexes for it in the background
+  foreach (FootagePtr footage, import_task->GetImportedFootage()) {
+    IndexFootage(footage);
+  }
+}
+
+void Core::IndexFootage(FootagePtr footage)
+{
+  if (!footage->IsValid()) {
+    return;
+  }
+
+  foreach (StreamPtr stream, footage->streams()) {
+    if (stream->type() == Stream::kVideo
+        && std::static_pointer_cast<VideoStream>(stream)->video_type() == VideoStream::kVideoTypeVideo) {
+      TaskManager::instance()->AddTask(new IndexTask(stream));
+    }
+  }
 }
 
 bool Core::ConfirmImageSequence(const QString& filename)
@@ -589,6 +618,7 @@ bool Core::StartHeadlessExport()
     CLITaskDialog export_dialog(&export_task);
     if (export_dialog.Run()) {
       qInfo().noquote() << tr("Export succeeded");
+      qInfo().noquote() << export_task.GetStatisticsReport();
       return true;
     } else {
       qInfo().noquote() << tr("Export failed: %1").arg(export_task.GetError());
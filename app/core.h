@@ -490,6 +490,14 @@ private:
    */
   ViewerOutput* GetSequenceToExport();
 
+  /**
+   * @brief Queues a background task building a seek index for each of this footage's video streams
+   *
+   * Streams that already have an index on disk finish immediately, so this is safe to call every
+   * time footage is imported or a project is opened.
+   */
+  static void IndexFootage(FootagePtr footage);
+
   /**
    * @brief Internal main window object
    */
@@ -29,6 +29,7 @@
 #include <QScrollArea>
 #include <QSplitter>
 #include <QStandardPaths>
+#include <QStatusBar>
 
 #include "common/qtutils.h"
 #include "core.h"
@@ -36,6 +37,7 @@
 #include "project/item/sequence/sequence.h"
 #include "project/project.h"
 #include "ui/icons/icons.h"
+#include "window/mainwindow/mainwindow.h"
 
 namespace olive {
 
@@ -330,6 +332,11 @@ void ExportDialog::ExportFinished()
   if (td->GetTask()->IsCancelled()) {
     // If this task was cancelled, we stay open so the user can potentially queue another export
   } else {
+    // Let the user know how each stage of the encoder kept up
+    if (Core::instance()->main_window()) {
+      Core::instance()->main_window()->statusBar()->showMessage(static_cast<ExportTask*>(td->GetTask())->GetStatisticsReport());
+    }
+
     // Accept this dialog and close
     this->accept();
   }
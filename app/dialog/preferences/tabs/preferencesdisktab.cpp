@@ -28,6 +28,7 @@
 #include <QMessageBox>
 
 #include "common/filefunctions.h"
+#include "render/framecachepack.h"
 
 namespace olive {
 
@@ -60,6 +61,15 @@ PreferencesDiskTab::PreferencesDiskTab()
 
   row++;
 
+  packed_cache_checkbox_ = new QCheckBox(tr("Store cached frames in packed segment files"));
+  packed_cache_checkbox_->setToolTip(tr("Appends uncompressed frames to a few large files rather than "
+                                        "writing one image file per frame. Faster to read and write, "
+                                        "but uses more disk space per frame."));
+  packed_cache_checkbox_->setChecked(Config::Current()["DiskCachePacked"].toBool());
+  disk_management_layout->addWidget(packed_cache_checkbox_, row, 1);
+
+  row++;
+
   QGroupBox* cache_behavior = new QGroupBox(tr("Cache Behavior"));
   outer_layout->addWidget(cache_behavior);
   QGridLayout* cache_behavior_layout = new QGridLayout(cache_behavior);
@@ -115,6 +125,9 @@ void PreferencesDiskTab::Accept()
 
   Config::Current()["DiskCacheBehind"] = QVariant::fromValue(rational::fromDouble(cache_behind_slider_->GetValue()));
   Config::Current()["DiskCacheAhead"] = QVariant::fromValue(rational::fromDouble(cache_ahead_slider_->GetValue()));
+
+  Config::Current()["DiskCachePacked"] = packed_cache_checkbox_->isChecked();
+  FrameCachePack::SetEnabled(packed_cache_checkbox_->isChecked());
 }
 
 }
@@ -49,6 +49,8 @@ private:
 
   FloatSlider* cache_behind_slider_;
 
+  QCheckBox* packed_cache_checkbox_;
+
   DiskCacheFolder* default_disk_cache_folder_;
 
 };
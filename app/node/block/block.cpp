@@ -370,7 +370,7 @@ NodeInput *Block::speed_input() const
   return speed_input_;
 }
 
-void Block::Hash(QCryptographicHash &, const rational &) const
+void Block::Hash(Hash128 &, const rational &, HashCache *) const
 {
   // A block does nothing by default, so we hash nothing
 }
@@ -83,7 +83,7 @@ public:
   NodeInput* media_in_input() const;
   NodeInput* speed_input() const;
 
-  virtual void Hash(QCryptographicHash &hash, const rational &time) const override;
+  virtual void Hash(Hash128 &hash, const rational &time, HashCache* cache) const override;
 
 public slots:
 
@@ -138,9 +138,9 @@ double TransitionBlock::GetInProgress(const double &time) const
   return clamp((GetInternalTransitionTime(time) - out_offset().toDouble()) / in_offset().toDouble(), 0.0, 1.0);
 }
 
-void TransitionBlock::Hash(QCryptographicHash &hash, const rational &time) const
+void TransitionBlock::Hash(Hash128 &hash, const rational &time, HashCache *cache) const
 {
-  Node::Hash(hash, time);
+  Node::Hash(hash, time, cache);
 
   double time_dbl = time.toDouble();
   double all_prog = GetTotalProgress(time_dbl);
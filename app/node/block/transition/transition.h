@@ -48,7 +48,12 @@ public:
   double GetOutProgress(const double &time) const;
   double GetInProgress(const double &time) const;
 
-  virtual void Hash(QCryptographicHash& hash, const rational &time) const override;
+  virtual void Hash(Hash128& hash, const rational &time, HashCache* cache) const override;
+
+  virtual bool HashDependsOnTime() const override
+  {
+    return true;
+  }
 
   virtual NodeValueTable Value(NodeValueDatabase &value) const override;
 
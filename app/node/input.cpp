@@ -20,6 +20,8 @@
 
 #include "input.h"
 
+#include <algorithm>
+
 #include <QMatrix4x4>
 #include <QVector2D>
 #include <QVector3D>
@@ -174,6 +176,8 @@ void NodeInput::Load(QXmlStreamReader *reader, XMLNodeData &xml_node_data, const
             }
           }
 
+          UpdateKeyframeSegments(track);
+
           track++;
         } else {
           reader->skipCurrentElement();
@@ -324,6 +328,7 @@ void NodeInput::Init(DataType type)
   }
 
   keyframe_tracks_.resize(track_size);
+  keyframe_segments_.resize(track_size);
   standard_value_.resize(track_size);
 }
 
@@ -552,91 +557,194 @@ QVector<QVariant> NodeInput::get_split_values_at_time(const rational &time) cons
 QVariant NodeInput::get_value_at_time_for_track(const rational& time, int track) const
 {
   if (!is_using_standard_value(track)) {
-    const KeyframeTrack& key_track = keyframe_tracks_.at(track);
+    const KeyframeSegmentTrack& segment_track = keyframe_segments_.at(track);
 
-    if (key_track.first()->time() >= time) {
-      // This time precedes any keyframe, so we just return the first value
-      return key_track.first()->value();
-    }
+    int segment = segment_track.last_segment.load();
+    QVariant value = get_value_from_keyframes(time, track, &segment);
+    segment_track.last_segment.store(segment);
+
+    return value;
+  }
 
-    if (key_track.last()->time() <= time) {
-      // This time is after any keyframes so we return the last value
-      return key_track.last()->value();
+  return standard_value_.at(track);
+}
+
+QVector<QVariant> NodeInput::get_values_over_range(const TimeRange &range, const rational &timebase) const
+{
+  QVector<QVariant> values;
+
+  if (timebase <= rational()) {
+    return values;
+  }
+
+  int track_count = get_number_of_keyframe_tracks();
+
+  // Each track keeps its own position so consecutive frames only ever step forward through the
+  // segments
+  QVector<int> segments(track_count, 0);
+  QVector<QVariant> split(track_count);
+
+  for (rational time=range.in(); time<range.out(); time+=timebase) {
+    for (int i=0;i<track_count;i++) {
+      if (is_using_standard_value(i)) {
+        split.replace(i, standard_value_.at(i));
+      } else {
+        split.replace(i, get_value_from_keyframes(time, i, &segments[i]));
+      }
     }
 
-    // If we're here, the time must be somewhere in between the keyframes
-    for (int i=0;i<key_track.size()-1;i++) {
-      NodeKeyframePtr before = key_track.at(i);
-      NodeKeyframePtr after = key_track.at(i+1);
+    values.append(combine_track_values_into_normal_value(split));
+  }
 
-      if (before->time() == time
-          || !type_can_be_interpolated(data_type())
-          || (before->time() < time && before->type() == NodeKeyframe::kHold)) {
+  return values;
+}
 
-        // Time == keyframe time, so value is precise
-        return before->value();
+QVariant NodeInput::get_value_from_keyframes(const rational &time, int track, int *segment_hint) const
+{
+  const KeyframeTrack& key_track = keyframe_tracks_.at(track);
 
-      } else if (after->time() == time) {
+  if (key_track.first()->time() >= time) {
+    // This time precedes any keyframe, so we just return the first value
+    return key_track.first()->value();
+  }
 
-        // Time == keyframe time, so value is precise
-        return after->value();
+  if (key_track.last()->time() <= time) {
+    // This time is after any keyframes so we return the last value
+    return key_track.last()->value();
+  }
 
-      } else if (before->time() < time && after->time() > time) {
-        // We must interpolate between these keyframes
+  // If we're here, the time must be somewhere in between the keyframes
+  const QVector<KeyframeSegment>& segments = keyframe_segments_.at(track).segments;
 
-        if (before->type() == NodeKeyframe::kBezier && after->type() == NodeKeyframe::kBezier) {
-          // Perform a cubic bezier with two control points
+  int index = *segment_hint;
 
-          double t = Bezier::CubicXtoT(time.toDouble(),
-                                       before->time().toDouble(),
-                                       before->time().toDouble() + before->bezier_control_out().x(),
-                                       after->time().toDouble() + after->bezier_control_in().x(),
-                                       after->time().toDouble());
+  if (index < 0 || index >= segments.size()
+      || !(segments.at(index).in <= time && segments.at(index).out > time)) {
+    if (index + 1 < segments.size()
+        && index >= 0
+        && segments.at(index + 1).in <= time
+        && segments.at(index + 1).out > time) {
+      // Sequential access will usually land in the segment after the last one
+      index++;
+    } else {
+      // Find the first segment that ends after this time
+      QVector<KeyframeSegment>::const_iterator it = std::upper_bound(segments.cbegin(), segments.cend(), time,
+                                                                     [](const rational& t, const KeyframeSegment& s) {
+        return t < s.out;
+      });
 
-          double y = Bezier::CubicTtoY(before->value().toDouble(),
-                                       before->value().toDouble() + before->bezier_control_out().y(),
-                                       after->value().toDouble() + after->bezier_control_in().y(),
-                                       after->value().toDouble(),
-                                       t);
+      index = it - segments.cbegin();
+    }
 
-          return y;
+    *segment_hint = index;
+  }
 
-        } else if (before->type() == NodeKeyframe::kBezier || after->type() == NodeKeyframe::kBezier) {
-          // Perform a quadratic bezier with only one control point
+  const KeyframeSegment& segment = segments.at(index);
 
-          QPointF control_point;
-          double control_point_time;
-          double control_point_value;
+  if (segment.in == time) {
+    // Time == keyframe time, so value is precise
+    return segment.in_value;
+  }
 
-          if (before->type() == NodeKeyframe::kBezier) {
-            control_point = before->bezier_control_out();
-            control_point_time = before->time().toDouble() + control_point.x();
-            control_point_value = before->value().toDouble() + control_point.y();
-          } else {
-            control_point = after->bezier_control_in();
-            control_point_time = after->time().toDouble() + control_point.x();
-            control_point_value = after->value().toDouble() + control_point.y();
-          }
+  double x = time.toDouble();
 
-          // Generate T from time values - used to determine bezier progress
-          double t = Bezier::QuadraticXtoT(time.toDouble(), before->time().toDouble(), control_point_time, after->time().toDouble());
+  switch (segment.mode) {
+  case KeyframeSegment::kHold:
+    break;
+  case KeyframeSegment::kLinear:
+    return lerp(segment.y[0], segment.y[1], (x - segment.x[0]) / (segment.x[1] - segment.x[0]));
+  case KeyframeSegment::kQuadratic:
+  {
+    // Generate T from time values - used to determine bezier progress
+    double t = Bezier::QuadraticXtoT(x, segment.x[0], segment.x[1], segment.x[2]);
 
-          // Generate value using T
-          double y = Bezier::QuadraticTtoY(before->value().toDouble(), control_point_value, after->value().toDouble(), t);
+    // Generate value using T
+    return Bezier::QuadraticTtoY(segment.y[0], segment.y[1], segment.y[2], t);
+  }
+  case KeyframeSegment::kCubic:
+    return Bezier::CubicCoefficientsTtoY(segment.y, Bezier::CubicCoefficientsXtoT(x, segment.x));
+  }
 
-          return y;
+  return segment.in_value;
+}
 
-        } else {
-          // To have arrived here, the keyframes must both be linear
-          qreal period_progress = (time.toDouble() - before->time().toDouble()) / (after->time().toDouble() - before->time().toDouble());
+void NodeInput::UpdateKeyframeSegments(int track)
+{
+  const KeyframeTrack& key_track = keyframe_tracks_.at(track);
+  KeyframeSegmentTrack& segment_track = keyframe_segments_[track];
 
-          return lerp(before->value().toDouble(), after->value().toDouble(), period_progress);
-        }
+  segment_track.segments.resize(qMax(0, key_track.size() - 1));
+  segment_track.last_segment.store(0);
+
+  bool interpolatable = type_can_be_interpolated(data_type());
+
+  for (int i=0;i<segment_track.segments.size();i++) {
+    NodeKeyframePtr before = key_track.at(i);
+    NodeKeyframePtr after = key_track.at(i+1);
+
+    KeyframeSegment& segment = segment_track.segments[i];
+
+    segment.in = before->time();
+    segment.out = after->time();
+    segment.in_value = before->value();
+
+    if (!interpolatable || before->type() == NodeKeyframe::kHold) {
+      segment.mode = KeyframeSegment::kHold;
+      continue;
+    }
+
+    double before_time = before->time().toDouble();
+    double before_value = before->value().toDouble();
+    double after_time = after->time().toDouble();
+    double after_value = after->value().toDouble();
+
+    if (before->type() == NodeKeyframe::kBezier && after->type() == NodeKeyframe::kBezier) {
+      // Perform a cubic bezier with two control points
+      segment.mode = KeyframeSegment::kCubic;
+
+      Bezier::CubicToCoefficients(before_time,
+                                  before_time + before->bezier_control_out().x(),
+                                  after_time + after->bezier_control_in().x(),
+                                  after_time,
+                                  segment.x);
+
+      Bezier::CubicToCoefficients(before_value,
+                                  before_value + before->bezier_control_out().y(),
+                                  after_value + after->bezier_control_in().y(),
+                                  after_value,
+                                  segment.y);
+
+    } else if (before->type() == NodeKeyframe::kBezier || after->type() == NodeKeyframe::kBezier) {
+      // Perform a quadratic bezier with only one control point
+      segment.mode = KeyframeSegment::kQuadratic;
+
+      QPointF control_point;
+
+      if (before->type() == NodeKeyframe::kBezier) {
+        control_point = before->bezier_control_out();
+        segment.x[1] = before_time + control_point.x();
+        segment.y[1] = before_value + control_point.y();
+      } else {
+        control_point = after->bezier_control_in();
+        segment.x[1] = after_time + control_point.x();
+        segment.y[1] = after_value + control_point.y();
       }
+
+      segment.x[0] = before_time;
+      segment.y[0] = before_value;
+      segment.x[2] = after_time;
+      segment.y[2] = after_value;
+
+    } else {
+      // To have arrived here, the keyframes must both be linear
+      segment.mode = KeyframeSegment::kLinear;
+
+      segment.x[0] = before_time;
+      segment.y[0] = before_value;
+      segment.x[1] = after_time;
+      segment.y[1] = after_value;
     }
   }
-
-  return standard_value_.at(track);
 }
 
 QList<NodeKeyframePtr> NodeInput::get_keyframe_at_time(const rational &time) const
@@ -657,10 +765,15 @@ QList<NodeKeyframePtr> NodeInput::get_keyframe_at_time(const rational &time) con
 NodeKeyframePtr NodeInput::get_keyframe_at_time_on_track(const rational &time, int track) const
 {
   if (!is_using_standard_value(track)) {
-    foreach (NodeKeyframePtr key, keyframe_tracks_.at(track)) {
-      if (key->time() == time) {
-        return key;
-      }
+    const KeyframeTrack& key_track = keyframe_tracks_.at(track);
+
+    KeyframeTrack::const_iterator it = std::lower_bound(key_track.cbegin(), key_track.cend(), time,
+                                                        [](const NodeKeyframePtr& key, const rational& t) {
+      return key->time() < t;
+    });
+
+    if (it != key_track.cend() && (*it)->time() == time) {
+      return *it;
     }
   }
 
@@ -683,24 +796,24 @@ NodeKeyframePtr NodeInput::get_closest_keyframe_to_time_on_track(const rational
     return key_track.last();
   }
 
-  for (int i=1;i<key_track.size();i++) {
-    NodeKeyframePtr prev_key = key_track.at(i-1);
-    NodeKeyframePtr next_key = key_track.at(i);
+  // Find the first key at or after this time, the key before it is the other candidate
+  KeyframeTrack::const_iterator it = std::lower_bound(key_track.cbegin(), key_track.cend(), time,
+                                                      [](const NodeKeyframePtr& key, const rational& t) {
+    return key->time() < t;
+  });
 
-    if (prev_key->time() <= time && next_key->time() >= time) {
-      // Return whichever is closer
-      rational prev_diff = time - prev_key->time();
-      rational next_diff = next_key->time() - time;
+  NodeKeyframePtr prev_key = *(it - 1);
+  NodeKeyframePtr next_key = *it;
 
-      if (next_diff < prev_diff) {
-        return next_key;
-      } else {
-        return prev_key;
-      }
-    }
-  }
+  // Return whichever is closer
+  rational prev_diff = time - prev_key->time();
+  rational next_diff = next_key->time() - time;
 
-  return nullptr;
+  if (next_diff < prev_diff) {
+    return next_key;
+  } else {
+    return prev_key;
+  }
 }
 
 NodeKeyframePtr NodeInput::get_closest_keyframe_before_time(const rational &time) const
@@ -796,6 +909,7 @@ void NodeInput::insert_keyframe(NodeKeyframePtr key)
   Q_ASSERT(is_keyframable());
 
   insert_keyframe_internal(key);
+  UpdateKeyframeSegments(key->track());
 
   connect(key.get(), &NodeKeyframe::TimeChanged, this, &NodeInput::KeyframeTimeChanged);
   connect(key.get(), &NodeKeyframe::ValueChanged, this, &NodeInput::KeyframeValueChanged);
@@ -821,6 +935,7 @@ void NodeInput::remove_keyframe(NodeKeyframePtr key)
   disconnect(key.get(), &NodeKeyframe::BezierControlOutChanged, this, &NodeInput::KeyframeBezierOutChanged);
 
   keyframe_tracks_[key->track()].removeOne(key);
+  UpdateKeyframeSegments(key->track());
   key->set_parent(nullptr);
 
   emit KeyframeRemoved(key);
@@ -857,9 +972,12 @@ void NodeInput::KeyframeTimeChanged()
 
     // Automatically insertion sort
     insert_keyframe_internal(key_shared_ptr);
+    UpdateKeyframeSegments(key->track());
 
     // Invalidate new area that the keyframe has been moved to
     emit_time_range(get_range_around_index(FindIndexOfKeyframeFromRawPtr(key), key->track()));
+  } else {
+    UpdateKeyframeSegments(key->track());
   }
 
   // Invalidate entire area surrounding the keyframe (either where it currently is, or where it used to be before it
@@ -869,7 +987,11 @@ void NodeInput::KeyframeTimeChanged()
 
 void NodeInput::KeyframeValueChanged()
 {
-  emit_range_affected_by_keyframe(static_cast<NodeKeyframe*>(sender()));
+  NodeKeyframe* key = static_cast<NodeKeyframe*>(sender());
+
+  UpdateKeyframeSegments(key->track());
+
+  emit_range_affected_by_keyframe(key);
 }
 
 void NodeInput::KeyframeTypeChanged()
@@ -877,6 +999,8 @@ void NodeInput::KeyframeTypeChanged()
   NodeKeyframe* key = static_cast<NodeKeyframe*>(sender());
   int keyframe_index = FindIndexOfKeyframeFromRawPtr(key);
 
+  UpdateKeyframeSegments(key->track());
+
   if (keyframe_tracks_.at(key->track()).size() == 1) {
     // If there are no other frames, the interpolation won't do anything
     return;
@@ -891,6 +1015,8 @@ void NodeInput::KeyframeBezierInChanged()
   NodeKeyframe* key = static_cast<NodeKeyframe*>(sender());
   int keyframe_index = FindIndexOfKeyframeFromRawPtr(key);
 
+  UpdateKeyframeSegments(key->track());
+
   rational start = RATIONAL_MIN;
   rational end = key->time();
 
@@ -906,6 +1032,8 @@ void NodeInput::KeyframeBezierOutChanged()
   NodeKeyframe* key = static_cast<NodeKeyframe*>(sender());
   int keyframe_index = FindIndexOfKeyframeFromRawPtr(key);
 
+  UpdateKeyframeSegments(key->track());
+
   rational start = key->time();
   rational end = RATIONAL_MAX;
 
@@ -1090,6 +1218,8 @@ void NodeInput::CopyValues(NodeInput *source, NodeInput *dest, bool include_conn
       key_copy->set_parent(dest);
       dest->keyframe_tracks_[i].append(key_copy);
     }
+
+    dest->UpdateKeyframeSegments(i);
   }
 
   // Copy keyframing state
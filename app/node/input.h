@@ -21,6 +21,8 @@
 #ifndef NODEINPUT_H
 #define NODEINPUT_H
 
+#include <QAtomicInt>
+
 #include "common/timerange.h"
 #include "keyframe.h"
 #include "param.h"
@@ -105,6 +107,14 @@ public:
    */
   QVariant get_value_at_time_for_track(const rational& time, int track) const;
 
+  /**
+   * @brief Calculate the stored value at every frame in a range
+   *
+   * Equivalent to calling get_value_at_time() at `range.in()`, `range.in() + timebase`, and so on up to (but not
+   * including) `range.out()`, except the keyframes are walked once rather than searched for every frame.
+   */
+  QVector<QVariant> get_values_over_range(const TimeRange& range, const rational& timebase) const;
+
   /**
    * @brief Retrieve a list of keyframe objects for all tracks at a given time
    *
@@ -308,6 +318,19 @@ private:
    */
   void insert_keyframe_internal(NodeKeyframePtr key);
 
+  /**
+   * @brief Regenerate the interpolation segments for a track, must be called whenever its keyframes change
+   */
+  void UpdateKeyframeSegments(int track);
+
+  /**
+   * @brief Calculate a value from keyframe data
+   *
+   * Assumes `is_using_standard_value(track)` is false. `segment_hint` is the segment index to check first and is
+   * updated to the segment that was actually used, so sequential calls with the same hint avoid searching.
+   */
+  QVariant get_value_from_keyframes(const rational& time, int track, int* segment_hint) const;
+
   /**
    * @brief Return whether the standard value should be used over keyframe data
    */
@@ -328,6 +351,38 @@ private:
    */
   void emit_time_range(const TimeRange& range);
 
+  /**
+   * @brief Interpolation data between two adjacent keyframes
+   *
+   * Everything needed to interpolate is converted up front so that a lookup never has to unbox the keyframes'
+   * QVariants or recompute control points.
+   */
+  struct KeyframeSegment {
+    enum Mode {
+      kHold,
+      kLinear,
+      kQuadratic,
+      kCubic
+    };
+
+    rational in;
+    rational out;
+    QVariant in_value;
+    Mode mode;
+
+    // Linear: start and end points. Quadratic: the three bezier points. Cubic: polynomial coefficients from
+    // Bezier::CubicToCoefficients().
+    double x[4];
+    double y[4];
+  };
+
+  struct KeyframeSegmentTrack {
+    QVector<KeyframeSegment> segments;
+
+    // Segment found by the most recent lookup, tried first by the next one
+    mutable QAtomicInt last_segment;
+  };
+
   /**
    * @brief Convenience function - equivalent to calling `emit_time_range(get_range_affected_by_keyframe(key))`
    */
@@ -362,6 +417,11 @@ private:
    */
   QVector< QList<NodeKeyframePtr> > keyframe_tracks_;
 
+  /**
+   * @brief Interpolation segments between each pair of keyframes, one list per track
+   */
+  QVector<KeyframeSegmentTrack> keyframe_segments_;
+
   /**
    * @brief Internal keyframing enabled setting
    */
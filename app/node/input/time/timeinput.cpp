@@ -63,9 +63,9 @@ NodeValueTable TimeInput::Value(NodeValueDatabase &value) const
   return table;
 }
 
-void TimeInput::Hash(QCryptographicHash &hash, const rational &time) const
+void TimeInput::Hash(Hash128 &hash, const rational &time, HashCache *cache) const
 {
-  Node::Hash(hash, time);
+  Node::Hash(hash, time, cache);
 
   // Make sure time is hashed
   hash.addData(NodeParam::ValueToBytes(NodeParam::kRational, QVariant::fromValue(time)));
@@ -106,14 +106,14 @@ NodeInput *MergeNode::blend_in() const
   return blend_in_;
 }
 
-void MergeNode::Hash(QCryptographicHash &hash, const rational &time) const
+void MergeNode::Hash(Hash128 &hash, const rational &time, HashCache *cache) const
 {
   if (base_in_->is_connected()) {
-    base_in_->get_connected_node()->Hash(hash, time);
+    HashNode(base_in_->get_connected_node(), hash, time, cache);
   }
 
   if (blend_in_->is_connected()) {
-    blend_in_->get_connected_node()->Hash(hash, time);
+    HashNode(blend_in_->get_connected_node(), hash, time, cache);
   }
 }
 
@@ -46,7 +46,7 @@ public:
   NodeInput* base_in() const;
   NodeInput* blend_in() const;
 
-  virtual void Hash(QCryptographicHash &hash, const rational &time) const override;
+  virtual void Hash(Hash128 &hash, const rational &time, HashCache* cache) const override;
 
 private:
   NodeInput* base_in_;
@@ -405,7 +405,7 @@ void Node::SetLabel(const QString &s)
   }
 }
 
-void Node::Hash(QCryptographicHash &hash, const rational& time) const
+void Node::Hash(Hash128 &hash, const rational& time, HashCache *cache) const
 {
   // Add this Node's ID
   hash.addData(id().toUtf8());
@@ -421,7 +421,7 @@ void Node::Hash(QCryptographicHash &hash, const rational& time) const
 
     if (input->is_connected()) {
       // Traverse down this edge
-      input->get_connected_node()->Hash(hash, input_time);
+      HashNode(input->get_connected_node(), hash, input_time, cache);
     } else {
       // Grab the value at this time
       QVariant value = input->get_value_at_time(input_time);
@@ -475,6 +475,60 @@ void Node::Hash(QCryptographicHash &hash, const rational& time) const
   }
 }
 
+void Node::HashNode(const Node *n, Hash128 &hash, const rational &time, HashCache *cache)
+{
+  if (cache) {
+    QByteArray static_hash = ResolveStaticHash(n, cache);
+
+    if (!static_hash.isEmpty()) {
+      hash.addData(static_hash);
+      return;
+    }
+  }
+
+  n->Hash(hash, time, cache);
+}
+
+QByteArray Node::ResolveStaticHash(const Node *n, HashCache *cache)
+{
+  HashCache::const_iterator it = cache->constFind(n);
+
+  if (it != cache->constEnd()) {
+    return it.value();
+  }
+
+  // A node's hash is static if nothing it hashes can change over time, i.e. it has no keyframes
+  // or footage and everything connected to it is static too
+  bool is_static = !n->HashDependsOnTime();
+
+  if (is_static) {
+    foreach (NodeInput* input, n->GetInputsToHash()) {
+      if (input->data_type() == NodeParam::kFootage) {
+        is_static = false;
+      } else if (input->is_connected()) {
+        is_static = !ResolveStaticHash(input->get_connected_node(), cache).isEmpty();
+      } else {
+        is_static = !input->is_keyframing();
+      }
+
+      if (!is_static) {
+        break;
+      }
+    }
+  }
+
+  QByteArray result;
+
+  if (is_static) {
+    // Time is irrelevant here, so any will do
+    Hash128 sub_hash;
+    n->Hash(sub_hash, rational(), cache);
+    result = sub_hash.result();
+  }
+
+  return cache->insert(n, result).value();
+}
+
 void Node::CopyInputs(Node *source, Node *destination, bool include_connections)
 {
   Q_ASSERT(source->id() == destination->id());
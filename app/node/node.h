@@ -21,7 +21,6 @@
 #ifndef NODE_H
 #define NODE_H
 
-#include <QCryptographicHash>
 #include <QObject>
 #include <QPainter>
 #include <QPointF>
@@ -29,6 +28,7 @@
 
 #include "codec/frame.h"
 #include "codec/samplebuffer.h"
+#include "common/hash128.h"
 #include "common/rational.h"
 #include "common/xmlutils.h"
 #include "node/input.h"
@@ -429,7 +429,38 @@ public:
   const QString& GetLabel() const;
   void SetLabel(const QString& s);
 
-  virtual void Hash(QCryptographicHash& hash, const rational &time) const;
+  /**
+   * @brief Sub-hashes of nodes whose hash doesn't change over time
+   *
+   * Shared between Hash() calls in one batch so that static parts of the graph are only hashed once
+   * rather than once per frame. Nodes that do vary over time are stored with an empty hash. Only
+   * valid while the graph is unchanged, so a cache shouldn't outlive the batch it was made for.
+   */
+  using HashCache = QHash<const Node*, QByteArray>;
+
+  /**
+   * @brief Add this node's contribution to a frame hash
+   *
+   * Connected nodes must be hashed with HashNode() rather than by calling their Hash() directly,
+   * so that their sub-hashes can be reused through `cache`.
+   */
+  virtual void Hash(Hash128& hash, const rational &time, HashCache* cache) const;
+
+  /**
+   * @brief Hash a node into `hash`, reusing its sub-hash from `cache` if it doesn't vary over time
+   */
+  static void HashNode(const Node* n, Hash128& hash, const rational& time, HashCache* cache);
+
+  /**
+   * @brief Whether Hash() adds anything that depends on time other than this node's inputs
+   *
+   * Nodes whose Hash() override uses the time directly (rather than only passing it to their
+   * inputs) must return TRUE, otherwise their hash may be reused across frames.
+   */
+  virtual bool HashDependsOnTime() const
+  {
+    return false;
+  }
 
 protected:
   void AddInput(NodeInput* input);
@@ -520,6 +551,8 @@ private:
 
   QVector<Node *> GetDependenciesInternal(bool traverse, bool exclusive_only) const;
 
+  static QByteArray ResolveStaticHash(const Node* n, HashCache* cache);
+
   QVector<NodeParam *> params_;
 
   /**
@@ -20,6 +20,7 @@
 
 #include "track.h"
 
+#include <algorithm>
 #include <QApplication>
 #include <QDebug>
 #include <QFontMetrics>
@@ -145,12 +146,10 @@ void TrackOutput::SetIndex(const int &index)
 
 Block *TrackOutput::BlockContainingTime(const rational &time) const
 {
-  foreach (Block* block, block_cache_) {
-    if (block->in() < time && block->out() > time) {
-      return block;
-    } else if (block->out() == time) {
-      break;
-    }
+  int index = GetBlockIndexEndingAfter(time, false);
+
+  if (index < block_cache_.size() && block_ins_.at(index) < time) {
+    return block_cache_.at(index);
   }
 
   return nullptr;
@@ -158,50 +157,34 @@ Block *TrackOutput::BlockContainingTime(const rational &time) const
 
 Block *TrackOutput::NearestBlockBefore(const rational &time) const
 {
-  foreach (Block* block, block_cache_) {
-    // Blocks are sorted by time, so the first Block who's out point is at/after this time is the correct Block
-    if (block->out() >= time) {
-      return block;
-    }
-  }
+  // Blocks are sorted by time, so the first Block who's out point is at/after this time is the correct Block
+  int index = GetBlockIndexEndingAfter(time, true);
 
-  return nullptr;
+  return (index < block_cache_.size()) ? block_cache_.at(index) : nullptr;
 }
 
 Block *TrackOutput::NearestBlockBeforeOrAt(const rational &time) const
 {
-  foreach (Block* block, block_cache_) {
-    // Blocks are sorted by time, so the first Block who's out point is at/after this time is the correct Block
-    if (block->out() > time) {
-      return block;
-    }
-  }
+  // Blocks are sorted by time, so the first Block who's out point is after this time is the correct Block
+  int index = GetBlockIndexEndingAfter(time, false);
 
-  return nullptr;
+  return (index < block_cache_.size()) ? block_cache_.at(index) : nullptr;
 }
 
 Block *TrackOutput::NearestBlockAfterOrAt(const rational &time) const
 {
-  foreach (Block* block, block_cache_) {
-    // Blocks are sorted by time, so the first Block after this time is the correct Block
-    if (block->in() >= time) {
-      return block;
-    }
-  }
+  // Blocks are sorted by time, so the first Block after this time is the correct Block
+  int index = GetBlockIndexStartingAfter(time, true);
 
-  return nullptr;
+  return (index < block_cache_.size()) ? block_cache_.at(index) : nullptr;
 }
 
 Block *TrackOutput::NearestBlockAfter(const rational &time) const
 {
-  foreach (Block* block, block_cache_) {
-    // Blocks are sorted by time, so the first Block after this time is the correct Block
-    if (block->in() > time) {
-      return block;
-    }
-  }
+  // Blocks are sorted by time, so the first Block after this time is the correct Block
+  int index = GetBlockIndexStartingAfter(time, false);
 
-  return nullptr;
+  return (index < block_cache_.size()) ? block_cache_.at(index) : nullptr;
 }
 
 Block *TrackOutput::BlockAtTime(const rational &time) const
@@ -210,15 +193,13 @@ Block *TrackOutput::BlockAtTime(const rational &time) const
     return nullptr;
   }
 
-  foreach (Block* block, block_cache_) {
-    if (block
-        && block->in() <= time
-        && block->out() > time) {
-      if (block->is_enabled()) {
-        return block;
-      } else {
-        break;
-      }
+  int index = GetBlockIndexEndingAfter(time, false);
+
+  if (index < block_cache_.size() && block_ins_.at(index) <= time) {
+    Block* block = block_cache_.at(index);
+
+    if (block->is_enabled()) {
+      return block;
     }
   }
 
@@ -233,11 +214,12 @@ QList<Block *> TrackOutput::BlocksAtTimeRange(const TimeRange &range) const
     return list;
   }
 
-  foreach (Block* block, block_cache_) {
-    if (block
-        && block->is_enabled()
-        && block->out() > range.in()
-        && block->in() < range.out()) {
+  for (int i=GetBlockIndexEndingAfter(range.in(), false);
+       i<block_cache_.size() && block_ins_.at(i) < range.out();
+       i++) {
+    Block* block = block_cache_.at(i);
+
+    if (block->is_enabled()) {
       list.append(block);
     }
   }
@@ -422,13 +404,13 @@ NodeInputArray *TrackOutput::block_input() const
   return block_input_;
 }
 
-void TrackOutput::Hash(QCryptographicHash &hash, const rational &time) const
+void TrackOutput::Hash(Hash128 &hash, const rational &time, HashCache *cache) const
 {
   Block* b = BlockAtTime(time);
 
   // Defer to block at this time, don't add any of our own information to the hash
   if (b) {
-    b->Hash(hash, time);
+    HashNode(b, hash, time, cache);
   }
 }
 
@@ -448,15 +430,20 @@ void TrackOutput::UpdateInOutFrom(int index)
   // Find block just before this one to find the last out point
   rational last_out = (index == 0) ? 0 : block_cache_.at(index - 1)->out();
 
+  block_ins_.resize(block_cache_.size());
+  block_outs_.resize(block_cache_.size());
+
   // Iterate through all blocks updating their in/outs
   for (int i=index; i<block_cache_.size(); i++) {
     Block* b = block_cache_.at(i);
 
     b->set_in(last_out);
+    block_ins_[i] = last_out;
 
     last_out += b->length();
 
     b->set_out(last_out);
+    block_outs_[i] = last_out;
 
     emit b->Refreshed();
   }
@@ -465,6 +452,24 @@ void TrackOutput::UpdateInOutFrom(int index)
   SetLengthInternal(last_out);
 }
 
+int TrackOutput::GetBlockIndexEndingAfter(const rational &time, bool inclusive) const
+{
+  QVector<rational>::const_iterator it = inclusive
+      ? std::lower_bound(block_outs_.cbegin(), block_outs_.cend(), time)
+      : std::upper_bound(block_outs_.cbegin(), block_outs_.cend(), time);
+
+  return static_cast<int>(it - block_outs_.cbegin());
+}
+
+int TrackOutput::GetBlockIndexStartingAfter(const rational &time, bool inclusive) const
+{
+  QVector<rational>::const_iterator it = inclusive
+      ? std::lower_bound(block_ins_.cbegin(), block_ins_.cend(), time)
+      : std::upper_bound(block_ins_.cbegin(), block_ins_.cend(), time);
+
+  return static_cast<int>(it - block_ins_.cbegin());
+}
+
 int TrackOutput::GetInputIndexFromCacheIndex(int cache_index)
 {
   return GetInputIndexFromCacheIndex(block_cache_.at(cache_index));
@@ -549,8 +554,12 @@ void TrackOutput::BlockDisconnected(NodeEdgePtr edge)
 {
   Block* b = static_cast<Block*>(edge->output_node());
 
-  if (block_cache_.contains(b)) {
-    block_cache_.removeOne(b);
+  int removed_index = block_cache_.indexOf(b);
+
+  if (removed_index >= 0) {
+    block_cache_.removeAt(removed_index);
+    block_ins_.remove(removed_index);
+    block_outs_.remove(removed_index);
 
     Block* previous = b->previous();
     Block* next = b->next();
@@ -210,7 +210,12 @@ public:
 
   NodeInputArray* block_input() const;
 
-  virtual void Hash(QCryptographicHash& hash, const rational &time) const override;
+  virtual void Hash(Hash128& hash, const rational &time, HashCache* cache) const override;
+
+  virtual bool HashDependsOnTime() const override
+  {
+    return true;
+  }
 
   AudioVisualWaveform& waveform()
   {
@@ -270,6 +275,18 @@ protected:
 private:
   void UpdateInOutFrom(int index);
 
+  /**
+   * @brief Index of the first block whose out point is after `time` (or equal if `inclusive`)
+   *
+   * Binary searches `block_outs_`, returns the number of blocks if there's no such block.
+   */
+  int GetBlockIndexEndingAfter(const rational& time, bool inclusive) const;
+
+  /**
+   * @brief Index of the first block whose in point is after `time` (or equal if `inclusive`)
+   */
+  int GetBlockIndexStartingAfter(const rational& time, bool inclusive) const;
+
   int GetInputIndexFromCacheIndex(int cache_index);
   int GetInputIndexFromCacheIndex(Block* block);
 
@@ -277,6 +294,10 @@ private:
 
   QList<Block*> block_cache_;
 
+  /// In/out points of each block in `block_cache_`, kept sorted for binary searching
+  QVector<rational> block_ins_;
+  QVector<rational> block_outs_;
+
   NodeInputArray* block_input_;
 
   NodeInput* muted_input_;
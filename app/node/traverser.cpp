@@ -20,10 +20,41 @@
 
 #include "traverser.h"
 
+#include <QSemaphore>
+#include <QtConcurrent/QtConcurrent>
+
 #include "node.h"
 
 namespace olive {
 
+const int NodeTraverser::kMaxMemoizedTables = 256;
+
+namespace {
+
+/**
+ * @brief One connected input being evaluated as part of GenerateDatabase()
+ *
+ * Whichever thread claims the task first runs it. The thread that created it claims any task the
+ * pool hasn't started yet instead of waiting, so nested waits can never exhaust the pool.
+ */
+struct InputTask {
+  NodeInput* input;
+  TimeRange range;
+  NodeValueTable table;
+  QAtomicInt claimed;
+  QSemaphore done;
+};
+
+using InputTaskPtr = std::shared_ptr<InputTask>;
+
+}
+
+NodeTraverser::NodeTraverser() :
+  memo_count_(0),
+  concurrent_inputs_(false)
+{
+}
+
 NodeValueDatabase NodeTraverser::GenerateDatabase(const Node* node, const TimeRange &range)
 {
   NodeValueDatabase database;
@@ -31,6 +62,12 @@ NodeValueDatabase NodeTraverser::GenerateDatabase(const Node* node, const TimeRa
   // We need to insert tables into the database for each input
   QVector<NodeInput*> inputs = node->GetInputsIncludingArrays();
 
+  // Connected inputs lead to independent subgraphs (anything shared between them is memoized), so
+  // they can be evaluated in parallel. Unconnected inputs are just a value lookup and aren't worth
+  // dispatching. Zero-length ranges are single samples, too small to be worth dispatching either.
+  QVector<InputTaskPtr> tasks;
+  bool concurrent = concurrent_inputs_ && range.length() > 0;
+
   foreach (NodeInput* input, inputs) {
     if (IsCancelled()) {
       return NodeValueDatabase();
@@ -38,7 +75,45 @@ NodeValueDatabase NodeTraverser::GenerateDatabase(const Node* node, const TimeRa
 
     TimeRange input_time = node->InputTimeAdjustment(input, range);
 
-    database.Insert(input, ProcessInput(input, input_time));
+    if (concurrent && input->is_connected()) {
+      InputTaskPtr task = std::make_shared<InputTask>();
+      task->input = input;
+      task->range = input_time;
+      tasks.append(task);
+    } else {
+      database.Insert(input, ProcessInput(input, input_time));
+    }
+  }
+
+  if (!tasks.isEmpty()) {
+    auto run_task = [this](const InputTaskPtr& task) {
+      if (task->claimed.testAndSetOrdered(0, 1)) {
+        task->table = ProcessInput(task->input, task->range);
+        task->done.release();
+      }
+    };
+
+    // Hand everything but the first task to the pool, this thread will run the first one itself
+    for (int i=1;i<tasks.size();i++) {
+      InputTaskPtr task = tasks.at(i);
+
+      QtConcurrent::run([run_task, task]{
+        run_task(task);
+      });
+    }
+
+    foreach (const InputTaskPtr& task, tasks) {
+      // Run the task here if no pool thread got to it, otherwise wait for the thread that did
+      run_task(task);
+      task->done.acquire();
+      task->done.release();
+
+      database.Insert(task->input, task->table);
+    }
+
+    if (IsCancelled()) {
+      return NodeValueDatabase();
+    }
   }
 
   AddGlobalsToDatabase(database, range);
@@ -65,20 +140,68 @@ NodeValueTable NodeTraverser::ProcessInput(NodeInput* input, const TimeRange& ra
 
 NodeValueTable NodeTraverser::GenerateTable(const Node *n, const TimeRange& range)
 {
+  // Only nodes that are reached through more than one edge can be visited twice
+  bool memoize = (n->output()->edges().size() > 1);
+  QPair<const Node*, TimeRange> memo_key(n, range);
+
+  if (memoize) {
+    QMutexLocker locker(&memo_lock_);
+
+    while (true) {
+      QHash<const Node*, QHash<TimeRange, NodeValueTable> >::const_iterator node_memo = memo_.constFind(n);
+
+      if (node_memo != memo_.constEnd()) {
+        QHash<TimeRange, NodeValueTable>::const_iterator cached = node_memo->constFind(range);
+
+        if (cached != node_memo->constEnd()) {
+          return cached.value();
+        }
+      }
+
+      if (!memo_working_.contains(memo_key)) {
+        // Nobody else is generating this, so we will
+        memo_working_.append(memo_key);
+        break;
+      }
+
+      // Another input is already generating this table on another thread, wait for it
+      memo_wait_.wait(&memo_lock_);
+    }
+  }
+
+  NodeValueTable table;
+
   if (n->IsTrack()) {
     // If the range is not wholly contained in this Block, we'll need to do some extra processing
-    return GenerateBlockTable(static_cast<const TrackOutput*>(n), range);
+    table = GenerateBlockTable(static_cast<const TrackOutput*>(n), range);
+  } else {
+    // Generate database of input values of node
+    NodeValueDatabase database = GenerateDatabase(n, range);
+
+    // By this point, the node should have all the inputs it needs to render correctly
+    table = n->Value(database);
+
+    PostProcessTable(n, range, table);
   }
 
-  // FIXME: Cache certain values here if we've already processed them before
+  // Sample buffers may be modified in place by whatever receives them (e.g. PanNode), so tables
+  // containing them can't be shared. Textures are never written to once rendered.
+  if (memoize) {
+    QMutexLocker locker(&memo_lock_);
 
-  // Generate database of input values of node
-  NodeValueDatabase database = GenerateDatabase(n, range);
+    memo_working_.removeOne(memo_key);
 
-  // By this point, the node should have all the inputs it needs to render correctly
-  NodeValueTable table = n->Value(database);
+    if (!IsCancelled()
+        && memo_count_ < kMaxMemoizedTables
+        && !table.Has(NodeParam::kSamples)
+        && !table.Has(NodeParam::kSampleJob)) {
+      memo_[n].insert(range, table);
+      memo_count_++;
+    }
 
-  PostProcessTable(n, range, table);
+    // Anyone waiting will either find the table now or generate it themselves
+    memo_wait_.wakeAll();
+  }
 
   return table;
 }
@@ -21,7 +21,9 @@
 #ifndef NODETRAVERSER_H
 #define NODETRAVERSER_H
 
+#include <QMutex>
 #include <QVector2D>
+#include <QWaitCondition>
 
 #include "codec/decoder.h"
 #include "common/cancelableobject.h"
@@ -34,7 +36,7 @@ namespace olive {
 class NodeTraverser : public CancelableObject
 {
 public:
-  NodeTraverser() = default;
+  NodeTraverser();
 
   NodeValueTable GenerateTable(const Node *n, const TimeRange &range);
   NodeValueTable GenerateTable(const Node *n, const rational &in, const rational& out);
@@ -44,6 +46,17 @@ public:
 protected:
   NodeValueTable ProcessInput(NodeInput *input, const TimeRange &range);
 
+  /**
+   * @brief Set whether connected inputs of a node are evaluated in parallel
+   *
+   * Inputs run on the global thread pool. Off by default. Only enable this if every virtual function the derived class overrides is safe
+   * to call from several threads at once.
+   */
+  void SetConcurrentInputs(bool e)
+  {
+    concurrent_inputs_ = e;
+  }
+
   virtual NodeValueTable GenerateBlockTable(const TrackOutput *track, const TimeRange& range);
 
   virtual QVariant ProcessVideoFootage(StreamPtr stream, const rational &input_time);
@@ -68,6 +81,38 @@ protected:
 private:
   void PostProcessTable(const Node *node, const TimeRange &range, NodeValueTable &output_params);
 
+  /**
+   * @brief Tables already generated by nodes whose output is connected to more than one input
+   *
+   * Without this, a node feeding several inputs (e.g. one clip feeding both a blur and a merge)
+   * would have its whole upstream graph evaluated, decoded and rendered again for each input.
+   * Tables are only kept for the lifetime of the traverser, which for rendering is a single ticket,
+   * so the graph can't change underneath them.
+   */
+  QHash<const Node*, QHash<TimeRange, NodeValueTable> > memo_;
+
+  int memo_count_;
+
+  /**
+   * @brief Memo entries currently being generated
+   *
+   * Other threads wait for these rather than duplicating the work.
+   */
+  QVector< QPair<const Node*, TimeRange> > memo_working_;
+
+  QMutex memo_lock_;
+
+  QWaitCondition memo_wait_;
+
+  bool concurrent_inputs_;
+
+  /**
+   * @brief Upper bound on memoized tables
+   *
+   * Audio evaluates inputs per sample and would otherwise fill the memo.
+   */
+  static const int kMaxMemoizedTables;
+
 };
 
 }
@@ -40,6 +40,9 @@ Footage::Footage()
 Footage::~Footage()
 {
   ClearStreams();
+
+  Decoder::StopConformsOfFootage(filename_);
+  Decoder::ReleaseConformMappingsOfFootage(filename_);
 }
 
 void Footage::Load(QXmlStreamReader *reader, XMLNodeData &xml_node_data, uint version, const QAtomicInt* cancelled)
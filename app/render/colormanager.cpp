@@ -26,6 +26,7 @@
 
 #include "common/define.h"
 #include "common/filefunctions.h"
+#include "colorprocessorcache.h"
 #include "config/config.h"
 #include "core.h"
 
@@ -43,6 +44,10 @@ ColorManager::ColorManager()
 
   // Default reference space is scene linear
   reference_space_ = OCIO::ROLE_SCENE_LINEAR;
+
+  // Processors built from the old config must not be handed out anymore. This is connected first so it runs before
+  // anything else reacts to the change and tries to create new processors.
+  connect(this, &ColorManager::ConfigChanged, &ColorProcessorCache::Clear);
 }
 
 OCIO::ConstConfigRcPtr ColorManager::GetConfig() const
@@ -23,10 +23,12 @@
 #include "common/define.h"
 #include "common/ocioutils.h"
 #include "colormanager.h"
+#include "colorprocessorcache.h"
 
 namespace olive {
 
-ColorProcessor::ColorProcessor(ColorManager *config, const QString &input, const ColorTransform &transform)
+ColorProcessor::ColorProcessor(ColorManager *config, const QString &input, const ColorTransform &transform) :
+  generation_(0)
 {
   QMutexLocker locker(config->mutex());
 
@@ -120,7 +122,16 @@ QString ColorProcessor::GenerateID(ColorManager *config, const QString &input, c
 
 ColorProcessorPtr ColorProcessor::Create(ColorManager *config, const QString& input, const ColorTransform &transform)
 {
-  return std::make_shared<ColorProcessor>(config, input, transform);
+  quint64 generation;
+  ColorProcessorPtr processor = ColorProcessorCache::Get(GenerateID(config, input, transform), &generation);
+
+  if (!processor) {
+    processor = std::make_shared<ColorProcessor>(config, input, transform);
+    processor->generation_ = generation;
+    processor = ColorProcessorCache::Insert(processor, generation);
+  }
+
+  return processor;
 }
 
 OCIO::ConstProcessorRcPtr ColorProcessor::GetProcessor()
@@ -128,6 +139,11 @@ OCIO::ConstProcessorRcPtr ColorProcessor::GetProcessor()
   return processor_;
 }
 
+OCIO::ConstCPUProcessorRcPtr ColorProcessor::GetCPUProcessor()
+{
+  return cpu_processor_;
+}
+
 void ColorProcessor::ConvertFrame(FramePtr f)
 {
   ConvertFrame(f.get());
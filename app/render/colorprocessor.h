@@ -49,6 +49,8 @@ public:
 
   OCIO::ConstProcessorRcPtr GetProcessor();
 
+  OCIO::ConstCPUProcessorRcPtr GetCPUProcessor();
+
   void ConvertFrame(FramePtr f);
   void ConvertFrame(Frame* f);
 
@@ -59,6 +61,17 @@ public:
     return id_;
   }
 
+  /**
+   * @brief ColorProcessorCache generation this processor was built in
+   *
+   * A processor with a higher generation was built from a more recent config than one with the
+   * same ID and a lower generation.
+   */
+  quint64 generation() const
+  {
+    return generation_;
+  }
+
   static QString GenerateID(ColorManager* config, const QString& input, const ColorTransform& dest_space);
 
 private:
@@ -68,6 +81,8 @@ private:
 
   QString id_;
 
+  quint64 generation_;
+
 };
 
 using ColorProcessorChain = QVector<ColorProcessorPtr>;
@@ -0,0 +1,65 @@
+/***
+
+  Olive - Non-Linear Video Editor
+  Copyright (C) 2020 Olive Team
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+***/
+
+#include "colorprocessorcache.h"
+
+namespace olive {
+
+QHash<QString, ColorProcessorPtr> ColorProcessorCache::cache_;
+quint64 ColorProcessorCache::generation_ = 0;
+QMutex ColorProcessorCache::mutex_;
+
+ColorProcessorPtr ColorProcessorCache::Get(const QString &id, quint64 *generation)
+{
+  QMutexLocker locker(&mutex_);
+
+  *generation = generation_;
+
+  return cache_.value(id);
+}
+
+ColorProcessorPtr ColorProcessorCache::Insert(ColorProcessorPtr processor, quint64 generation)
+{
+  QMutexLocker locker(&mutex_);
+
+  if (generation != generation_) {
+    return processor;
+  }
+
+  ColorProcessorPtr existing = cache_.value(processor->id());
+
+  if (existing) {
+    return existing;
+  }
+
+  cache_.insert(processor->id(), processor);
+
+  return processor;
+}
+
+void ColorProcessorCache::Clear()
+{
+  QMutexLocker locker(&mutex_);
+
+  cache_.clear();
+  generation_++;
+}
+
+}
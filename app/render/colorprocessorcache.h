@@ -21,12 +21,49 @@
 #ifndef COLORPROCESSORCACHE_H
 #define COLORPROCESSORCACHE_H
 
-#include "project/item/footage/stream.h"
+#include <QHash>
+#include <QMutex>
+
 #include "render/colorprocessor.h"
 
 namespace olive {
 
-using ColorProcessorCache = QHash<QString, ColorProcessorPtr>;
+/**
+ * @brief Process-wide cache of compiled ColorProcessors
+ *
+ * Building an OCIO processor is expensive and rendering asks for the same few transforms on every frame, so
+ * ColorProcessor::Create() goes through this cache. Processors are keyed by ColorProcessor::GenerateID() and the
+ * whole cache is cleared whenever a ColorManager's config changes.
+ */
+class ColorProcessorCache
+{
+public:
+  /**
+   * @brief Retrieve a cached processor or nullptr if there isn't one
+   *
+   * `generation` receives the cache's current generation, which must be passed to Insert() for any processor built
+   * because this returned nullptr.
+   */
+  static ColorProcessorPtr Get(const QString& id, quint64* generation);
+
+  /**
+   * @brief Add a processor to the cache
+   *
+   * If another thread cached a processor with the same ID first, that one is returned instead. If the cache was
+   * cleared since `generation` was retrieved, the processor may have been built from a stale config and isn't cached.
+   */
+  static ColorProcessorPtr Insert(ColorProcessorPtr processor, quint64 generation);
+
+  static void Clear();
+
+private:
+  static QHash<QString, ColorProcessorPtr> cache_;
+
+  static quint64 generation_;
+
+  static QMutex mutex_;
+
+};
 
 }
 
@@ -0,0 +1,170 @@
+/***
+
+  Olive - Non-Linear Video Editor
+  Copyright (C) 2020 Olive Team
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+***/
+
+#include "decoderpool.h"
+
+#include <QDateTime>
+#include <QDebug>
+
+namespace olive {
+
+const qint64 DecoderPool::kIdleTimeout = 30000;
+const int DecoderPool::kMaxPerStream = 4;
+
+DecoderPool::DecoderPool(int max_per_stream) :
+  max_per_stream_(qBound(1, max_per_stream, kMaxPerStream))
+{
+}
+
+DecoderPtr DecoderPool::Acquire(StreamPtr stream, const rational &time)
+{
+  return AcquireInternal(stream, &time);
+}
+
+DecoderPtr DecoderPool::Acquire(StreamPtr stream)
+{
+  return AcquireInternal(stream, nullptr);
+}
+
+DecoderPtr DecoderPool::AcquireInternal(StreamPtr stream, const rational *time)
+{
+  if (!stream) {
+    qWarning() << "Attempted to resolve the decoder of a null stream";
+    return nullptr;
+  }
+
+  QMutexLocker locker(&mutex_);
+
+  qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+  QVector<Entry>& entries = decoders_[stream.get()];
+
+  EvictIdle(entries, now);
+
+  Entry* closest_idle = nullptr;
+  int64_t closest_idle_distance = 0;
+  Entry* closest_busy = nullptr;
+  int64_t closest_busy_distance = 0;
+  Entry* oldest_idle = nullptr;
+  Entry* oldest = nullptr;
+
+  for (int i=0; i<entries.size(); i++) {
+    Entry& e = entries[i];
+
+    int64_t distance = time ? e.decoder->GetVideoDistance(*time) : -1;
+
+    if (IsBusy(e)) {
+      if (distance >= 0 && (!closest_busy || distance < closest_busy_distance)) {
+        closest_busy = &e;
+        closest_busy_distance = distance;
+      }
+    } else {
+      if (distance >= 0 && (!closest_idle || distance < closest_idle_distance)) {
+        closest_idle = &e;
+        closest_idle_distance = distance;
+      }
+
+      if (!oldest_idle || e.last_used < oldest_idle->last_used) {
+        oldest_idle = &e;
+      }
+    }
+
+    if (!oldest || e.last_used < oldest->last_used) {
+      oldest = &e;
+    }
+  }
+
+  Entry* chosen;
+
+  if (closest_idle) {
+    // An idle decoder can serve this without seeking
+    chosen = closest_idle;
+  } else if (closest_busy) {
+    // Another thread is already decoding around this time. Waiting for it is cheaper than seeking
+    // a second decoder to the same GOP and decoding it all over again.
+    chosen = closest_busy;
+  } else if (!time && oldest_idle) {
+    // With no time to route by there's no locality to gain from another decoder, only another
+    // file handle, so reuse any idle one
+    chosen = oldest_idle;
+  } else if (entries.size() + opening_.value(stream.get()) < max_per_stream_) {
+    // Any existing decoder would have to seek, so open another one for this region if we can. The
+    // slot is reserved so we can open without holding up acquisition for every other stream.
+    opening_[stream.get()]++;
+
+    locker.unlock();
+
+    DecoderPtr decoder = Decoder::CreateFromID(stream->footage()->decoder());
+
+    bool opened = decoder && decoder->Open(stream);
+
+    locker.relock();
+
+    opening_[stream.get()]--;
+
+    // The hash may have changed while we were unlocked
+    QVector<Entry>& current_entries = decoders_[stream.get()];
+
+    if (opened) {
+      current_entries.append({decoder, QDateTime::currentMSecsSinceEpoch()});
+      return decoder;
+    }
+
+    qWarning() << "Failed to open decoder for" << stream->footage()->filename()
+               << "::" << stream->index();
+
+    // Fall back to sharing an existing decoder if there is one
+    chosen = nullptr;
+
+    for (int i=0; i<current_entries.size(); i++) {
+      if (!chosen || current_entries.at(i).last_used < chosen->last_used) {
+        chosen = &current_entries[i];
+      }
+    }
+
+    if (!chosen) {
+      return nullptr;
+    }
+  } else if (oldest_idle) {
+    // At capacity, seek whichever idle decoder has gone unused the longest
+    chosen = oldest_idle;
+  } else {
+    // Every decoder is busy, queue behind the one that was handed out the longest time ago
+    chosen = oldest;
+  }
+
+  chosen->last_used = now;
+
+  return chosen->decoder;
+}
+
+void DecoderPool::EvictIdle(QVector<Entry> &entries, qint64 now)
+{
+  // Always keep at least one decoder per stream so it doesn't need to be re-opened
+  for (int i=entries.size()-1; i>=0 && entries.size()>1; i--) {
+    const Entry& e = entries.at(i);
+
+    if (!IsBusy(e) && now - e.last_used > kIdleTimeout) {
+      entries.removeAt(i);
+    }
+  }
+}
+
+}
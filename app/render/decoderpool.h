@@ -0,0 +1,110 @@
+/***
+
+  Olive - Non-Linear Video Editor
+  Copyright (C) 2020 Olive Team
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+***/
+
+#ifndef DECODERPOOL_H
+#define DECODERPOOL_H
+
+#include <QHash>
+#include <QMutex>
+#include <QVector>
+
+#include "codec/decoder.h"
+#include "project/item/footage/stream.h"
+
+namespace olive {
+
+/**
+ * @brief Thread-safe pool of open decoders, several per stream
+ *
+ * A decoder can only retrieve one frame at a time, so sharing a single decoder per stream between
+ * render threads serializes them. Instead, this keeps up to `max_per_stream` decoders for each
+ * stream and routes each request to the one with the best locality, i.e. the idle decoder that
+ * already has the frame cached or can reach it by decoding forward rather than seeking. Requests
+ * that would require a seek either open another decoder or reuse the one that's been idle the
+ * longest, so each decoder tends to settle on its own region (GOP) of the stream.
+ *
+ * A decoder is considered busy for as long as someone other than the pool holds a reference to
+ * it, so callers should simply let the DecoderPtr returned by Acquire() go out of scope when
+ * they're done with it. Extra decoders that stay idle for longer than kIdleTimeout are closed.
+ *
+ * Every decoder keeps its own cache and pool of decoded frames, so `max_per_stream` is clamped to
+ * kMaxPerStream to keep memory usage from scaling with the number of render threads.
+ */
+class DecoderPool
+{
+public:
+  DecoderPool(int max_per_stream);
+
+  /**
+   * @brief Get an open decoder for retrieving video from `stream` at `time`
+   *
+   * Returns nullptr if no decoder could be opened for this stream.
+   */
+  DecoderPtr Acquire(StreamPtr stream, const rational& time);
+
+  /**
+   * @brief Get an open decoder for `stream` when there's no time to route by (e.g. audio)
+   *
+   * Reuses an idle decoder if there is one, another is only opened if they're all busy.
+   */
+  DecoderPtr Acquire(StreamPtr stream);
+
+  /**
+   * @brief Milliseconds an extra decoder can stay idle before it's closed
+   */
+  static const qint64 kIdleTimeout;
+
+  /**
+   * @brief Upper limit on decoders open for a single stream
+   */
+  static const int kMaxPerStream;
+
+private:
+  struct Entry {
+    DecoderPtr decoder;
+    qint64 last_used;
+  };
+
+  DecoderPtr AcquireInternal(StreamPtr stream, const rational* time);
+
+  static bool IsBusy(const Entry& e)
+  {
+    // The pool holds one reference, anything beyond that is a caller still using it
+    return e.decoder.use_count() > 1;
+  }
+
+  void EvictIdle(QVector<Entry>& entries, qint64 now);
+
+  QHash<Stream*, QVector<Entry> > decoders_;
+
+  /**
+   * @brief Decoders currently being opened for each stream, which count towards `max_per_stream`
+   */
+  QHash<Stream*, int> opening_;
+
+  int max_per_stream_;
+
+  QMutex mutex_;
+
+};
+
+}
+
+#endif // DECODERPOOL_H
@@ -27,11 +27,14 @@
 #include <QFileInfo>
 #include <QMessageBox>
 #include <QStandardPaths>
+#include <QtConcurrent/QtConcurrent>
 
+#include "codec/decoder.h"
 #include "common/filefunctions.h"
 #include "config/config.h"
 #include "core.h"
 #include "dialog/diskcache/diskcachedialog.h"
+#include "render/framecachepack.h"
 
 namespace olive {
 
@@ -39,6 +42,8 @@ DiskManager* DiskManager::instance_ = nullptr;
 
 DiskManager::DiskManager()
 {
+  FrameCachePack::SetEnabled(Config::Current()[QStringLiteral("DiskCachePacked")].toBool());
+
   // Add default cache location
   QFile default_disk_cache_file(GetDefaultDiskCacheConfigFile());
   if (default_disk_cache_file.open(QFile::ReadOnly)) {
@@ -118,6 +123,13 @@ void DiskManager::CreatedFile(const QString &cache_folder, const QString &file_n
   f->CreatedFile(file_name, hash);
 }
 
+void DiskManager::CreatedPackedFrame(const QString &cache_folder, const QByteArray &hash, qint64 size)
+{
+  DiskCacheFolder* f = GetOpenFolder(cache_folder);
+
+  f->CreatedPackedFrame(hash, size);
+}
+
 bool DiskManager::ClearDiskCache(const QString &cache_folder)
 {
   DiskCacheFolder* f = GetOpenFolder(cache_folder);
@@ -186,7 +198,10 @@ void DiskManager::ShowDiskCacheSettingsDialog(const QString &path, QWidget *pare
 }
 
 DiskCacheFolder::DiskCacheFolder(const QString &path, QObject *parent) :
-  QObject(parent)
+  QObject(parent),
+  journal_entries_(0),
+  deletion_running_(false),
+  eviction_counter_(0)
 {
   SetPath(path);
 
@@ -202,15 +217,30 @@ DiskCacheFolder::~DiskCacheFolder()
 
 bool DiskCacheFolder::ClearCache()
 {
+  // Conformed audio may be stored here too, don't hold it open while the cache is cleared
+  Decoder::ReleaseConformMappingsInFolder(path_);
+
   bool deleted_files = true;
 
-  std::list<HashTime>::iterator i = disk_data_.begin();
+  HashTimeList::iterator i = disk_data_.begin();
 
   while (i != disk_data_.end()) {
+    if (i->file_name.isEmpty()) {
+      // Frame is in a pack, delete the pack's files once they're empty
+      foreach (const QString& fn, FrameCachePack::Get(path_)->Remove(i->hash)) {
+        QFile::remove(fn);
+      }
+    }
+
     // We return a false result if any of the files fail to delete, but still try to delete as many as we can
-    if (QFile::remove(i->file_name) || !QFileInfo::exists(i->file_name)) {
+    if (i->file_name.isEmpty() || QFile::remove(i->file_name) || !QFileInfo::exists(i->file_name)) {
       emit DeletedFrame(path_, i->hash);
-      i = disk_data_.erase(i);
+
+      AppendToJournal(kJournalRemoved, *i);
+
+      HashTimeList::iterator next = std::next(i);
+      RemoveEntry(i);
+      i = next;
     } else {
       qWarning() << "Failed to delete" << i->file_name;
       deleted_files = false;
@@ -223,42 +253,36 @@ bool DiskCacheFolder::ClearCache()
 
 void DiskCacheFolder::Accessed(const QByteArray &hash)
 {
-  std::list<HashTime>::iterator i = disk_data_.begin();
-
-  while (i != disk_data_.end()) {
-    if (i->hash == hash) {
-      // Copy access data and erase from list
-      HashTime accessed_hash = *i;
-      disk_data_.erase(i);
+  QHash<QByteArray, HashTimeList::iterator>::const_iterator it = disk_data_index_.constFind(hash);
 
-      // Add it to the end
-      disk_data_.push_back(accessed_hash);
+  if (it != disk_data_index_.constEnd()) {
+    // Move to the end of the list, splicing keeps the iterator in the index valid
+    disk_data_.splice(disk_data_.end(), disk_data_, it.value());
 
-      // End loop
-      break;
-    } else {
-      i++;
-    }
+    AppendToJournal(kJournalAccessed, *it.value());
   }
 }
 
 void DiskCacheFolder::CreatedFile(const QString &file_name, const QByteArray &hash)
 {
-  qint64 file_size = QFile(file_name).size();
+  HashTime entry = {file_name, hash, QFile(file_name).size()};
 
-  disk_data_.push_back({file_name, hash, file_size});
+  InsertEntry(entry);
 
-  consumption_ += file_size;
+  AppendToJournal(kJournalCreated, entry);
 
-  QList<QByteArray> deleted_hashes;
+  EnforceLimit();
+}
 
-  while (consumption_ > limit_) {
-    deleted_hashes.append(DeleteLeastRecent());
-  }
+void DiskCacheFolder::CreatedPackedFrame(const QByteArray &hash, qint64 size)
+{
+  HashTime entry = {QString(), hash, size};
 
-  foreach (const QByteArray& h, deleted_hashes) {
-    emit DeletedFrame(path_, h);
-  }
+  InsertEntry(entry);
+
+  AppendToJournal(kJournalCreated, entry);
+
+  EnforceLimit();
 }
 
 void DiskCacheFolder::SetPath(const QString &path)
@@ -272,6 +296,7 @@ void DiskCacheFolder::SetPath(const QString &path)
       emit DeletedFrame(path_, h.hash);
     }
     disk_data_.clear();
+    disk_data_index_.clear();
   }
 
   // Set defaults
@@ -304,28 +329,71 @@ void DiskCacheFolder::SetPath(const QString &path)
       ds >> h.hash;
       ds >> h.file_size;
 
-      if (QFileInfo::exists(h.file_name)) {
-        consumption_ += h.file_size;
-        disk_data_.push_back(h);
-      }
+      InsertEntry(h);
     }
 
     cache_index_file.close();
   }
+
+  saved_limit_ = limit_;
+  saved_clear_on_close_ = clear_on_close_;
+
+  // Apply any changes made since the index was last written
+  ReplayJournal();
+
+  // Drop any entries whose files have disappeared
+  HashTimeList::iterator i = disk_data_.begin();
+  while (i != disk_data_.end()) {
+    HashTimeList::iterator next = std::next(i);
+
+    if (!EntryExists(*i)) {
+      RemoveEntry(i);
+    }
+
+    i = next;
+  }
+
+  journal_file_.setFileName(path_dir.filePath(QStringLiteral("index.journal")));
+
+  if (journal_file_.open(QFile::WriteOnly | QFile::Append)) {
+    journal_stream_.setDevice(&journal_file_);
+  } else {
+    qWarning() << "Failed to open cache journal:" << journal_file_.fileName();
+  }
 }
 
 QByteArray DiskCacheFolder::DeleteLeastRecent()
 {
   HashTime h = disk_data_.front();
-  disk_data_.pop_front();
 
-  QFile::remove(h.file_name);
+  RemoveEntry(disk_data_.begin());
 
-  consumption_ -= h.file_size;
+  AppendToJournal(kJournalRemoved, h);
+
+  if (h.file_name.isEmpty()) {
+    foreach (const QString& fn, FrameCachePack::Get(path_)->Remove(h.hash)) {
+      RemoveFileInBackground(fn);
+    }
+  } else {
+    RemoveFileInBackground(h.file_name);
+  }
 
   return h.hash;
 }
 
+void DiskCacheFolder::EnforceLimit()
+{
+  QList<QByteArray> deleted_hashes;
+
+  while (consumption_ > limit_ && !disk_data_.empty()) {
+    deleted_hashes.append(DeleteLeastRecent());
+  }
+
+  foreach (const QByteArray& h, deleted_hashes) {
+    emit DeletedFrame(path_, h);
+  }
+}
+
 void DiskCacheFolder::CloseCacheFolder()
 {
   if (path_.isEmpty()) {
@@ -338,11 +406,137 @@ void DiskCacheFolder::CloseCacheFolder()
     ClearCache();
   }
 
-  // Save current cache index
-  SaveDiskCacheIndex();
+  // Wait for any evicted files to finish deleting
+  deletion_future_.waitForFinished();
+
+  // Save current cache index in full, which also empties the journal
+  WriteDiskCacheIndex();
+
+  journal_stream_.setDevice(nullptr);
+  journal_file_.close();
+
+  FrameCachePack::Close(path_);
+}
+
+void DiskCacheFolder::InsertEntry(const HashTime &h)
+{
+  QHash<QByteArray, HashTimeList::iterator>::iterator existing = disk_data_index_.find(h.hash);
+
+  if (existing != disk_data_index_.end()) {
+    // File was overwritten, update it and treat it as an access
+    consumption_ -= existing.value()->file_size;
+    *existing.value() = h;
+    disk_data_.splice(disk_data_.end(), disk_data_, existing.value());
+  } else {
+    disk_data_index_.insert(h.hash, disk_data_.insert(disk_data_.end(), h));
+  }
+
+  consumption_ += h.file_size;
+}
+
+void DiskCacheFolder::RemoveEntry(HashTimeList::iterator it)
+{
+  consumption_ -= it->file_size;
+  disk_data_index_.remove(it->hash);
+  disk_data_.erase(it);
+}
+
+void DiskCacheFolder::ReplayJournal()
+{
+  QFile journal(QDir(path_).filePath(QStringLiteral("index.journal")));
+
+  if (!journal.open(QFile::ReadOnly)) {
+    return;
+  }
+
+  QDataStream ds(&journal);
+
+  // End of the last complete record
+  qint64 good_offset = 0;
+  bool truncated = false;
+
+  while (!journal.atEnd()) {
+    qint8 op;
+    HashTime h;
+
+    ds >> op;
+    ds >> h.hash;
+
+    if (op == kJournalCreated) {
+      ds >> h.file_name;
+      ds >> h.file_size;
+    }
+
+    if (ds.status() != QDataStream::Ok) {
+      // Probably a partial write from a crash, ignore the rest
+      truncated = true;
+      break;
+    }
+
+    good_offset = journal.pos();
+
+    switch (static_cast<JournalOperation>(op)) {
+    case kJournalCreated:
+      InsertEntry(h);
+      break;
+    case kJournalAccessed:
+      Accessed(h.hash);
+      break;
+    case kJournalRemoved:
+    {
+      QHash<QByteArray, HashTimeList::iterator>::iterator it = disk_data_index_.find(h.hash);
+      if (it != disk_data_index_.end()) {
+        RemoveEntry(it.value());
+      }
+      break;
+    }
+    }
+
+    journal_entries_++;
+  }
+
+  journal.close();
+
+  if (truncated) {
+    // Cut off the partial record, otherwise everything we append after it would be lost the next
+    // time the journal is replayed too
+    if (!QFile::resize(journal.fileName(), good_offset)) {
+      qWarning() << "Failed to truncate damaged cache journal:" << journal.fileName();
+    }
+  }
+}
+
+void DiskCacheFolder::AppendToJournal(JournalOperation op, const HashTime &h)
+{
+  if (!journal_stream_.device()) {
+    return;
+  }
+
+  journal_stream_ << static_cast<qint8>(op);
+  journal_stream_ << h.hash;
+
+  if (op == kJournalCreated) {
+    journal_stream_ << h.file_name;
+    journal_stream_ << h.file_size;
+  }
+
+  journal_entries_++;
 }
 
 void DiskCacheFolder::SaveDiskCacheIndex()
+{
+  // Rewrite the index once the journal has grown to about its size, or if the settings stored in
+  // it changed. Otherwise the journal alone is enough.
+  if (journal_entries_ > qMax(static_cast<int>(disk_data_.size()), 1024)
+      || limit_ != saved_limit_
+      || clear_on_close_ != saved_clear_on_close_) {
+    WriteDiskCacheIndex();
+  } else {
+    journal_file_.flush();
+  }
+}
+
+void DiskCacheFolder::WriteDiskCacheIndex()
 {
   QFile cache_index_file(index_path_);
 
@@ -359,9 +553,69 @@ void DiskCacheFolder::SaveDiskCacheIndex()
     }
 
     cache_index_file.close();
+
+    saved_limit_ = limit_;
+    saved_clear_on_close_ = clear_on_close_;
+
+    // Everything in the journal is in the index now
+    if (journal_file_.isOpen()) {
+      journal_file_.resize(0);
+    }
+    journal_entries_ = 0;
   } else {
     qWarning() << "Failed to write cache index:" << index_path_;
   }
 }
 
+void DiskCacheFolder::RemoveFileInBackground(const QString &file_name)
+{
+  // Renaming is cheap compared to deleting a large file and means the original name is free to be
+  // re-used straight away, so a frame re-rendered with this hash can't get deleted by mistake
+  QString evicted_name = QStringLiteral("%1.%2.evicted").arg(file_name, QString::number(eviction_counter_++));
+
+  if (!QFile::rename(file_name, evicted_name)) {
+    QFile::remove(file_name);
+    return;
+  }
+
+  QMutexLocker locker(&deletion_lock_);
+
+  pending_deletions_.append(evicted_name);
+
+  if (!deletion_running_) {
+    deletion_running_ = true;
+    deletion_future_ = QtConcurrent::run(this, &DiskCacheFolder::ProcessPendingDeletions);
+  }
+}
+
+bool DiskCacheFolder::EntryExists(const HashTime &h) const
+{
+  if (h.file_name.isEmpty()) {
+    return FrameCachePack::Get(path_)->Contains(h.hash);
+  } else {
+    return QFileInfo::exists(h.file_name);
+  }
+}
+
+void DiskCacheFolder::ProcessPendingDeletions()
+{
+  forever {
+    deletion_lock_.lock();
+
+    if (pending_deletions_.isEmpty()) {
+      deletion_running_ = false;
+      deletion_lock_.unlock();
+      break;
+    }
+
+    QString file_name = pending_deletions_.takeFirst();
+
+    deletion_lock_.unlock();
+
+    if (!QFile::remove(file_name)) {
+      qWarning() << "Failed to delete evicted cache file" << file_name;
+    }
+  }
+}
+
 }
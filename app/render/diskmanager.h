@@ -21,6 +21,11 @@
 #ifndef DISKMANAGER_H
 #define DISKMANAGER_H
 
+#include <list>
+#include <QDataStream>
+#include <QFile>
+#include <QFuture>
+#include <QHash>
 #include <QMap>
 #include <QMutex>
 #include <QObject>
@@ -45,6 +50,8 @@ public:
 
   void CreatedFile(const QString& file_name, const QByteArray& hash);
 
+  void CreatedPackedFrame(const QByteArray& hash, qint64 size);
+
   const QString& GetPath() const
   {
     return path_;
@@ -76,21 +83,84 @@ signals:
   void DeletedFrame(const QString& path, const QByteArray& hash);
 
 private:
+  /**
+   * @brief A cached frame, either a file of its own or (if `file_name` is empty) in a FrameCachePack
+   */
+  struct HashTime {
+    QString file_name;
+    QByteArray hash;
+    qint64 file_size;
+  };
+
+  using HashTimeList = std::list<HashTime>;
+
+  enum JournalOperation {
+    kJournalCreated,
+    kJournalAccessed,
+    kJournalRemoved
+  };
+
   QByteArray DeleteLeastRecent();
 
+  void EnforceLimit();
+
   void CloseCacheFolder();
 
+  void InsertEntry(const HashTime& h);
+
+  void RemoveEntry(HashTimeList::iterator it);
+
+  void ReplayJournal();
+
+  void AppendToJournal(JournalOperation op, const HashTime& h);
+
+  void WriteDiskCacheIndex();
+
+  void RemoveFileInBackground(const QString& file_name);
+
+  bool EntryExists(const HashTime& h) const;
+
+  void ProcessPendingDeletions();
+
   QString path_;
 
   QString index_path_;
 
-  struct HashTime {
-    QString file_name;
-    QByteArray hash;
-    qint64 file_size;
-  };
+  /**
+   * @brief Cache entries in order of access, least recently used first
+   */
+  HashTimeList disk_data_;
+
+  /**
+   * @brief Lookup of entries in `disk_data_` by hash so accesses don't need to search the list
+   */
+  QHash<QByteArray, HashTimeList::iterator> disk_data_index_;
+
+  /**
+   * @brief Append-only log of changes since the index was last written in full
+   *
+   * Replayed on top of the index when the folder is opened. Rewriting the whole index for every
+   * save gets slow with millions of entries, so it's only done once the journal gets long.
+   */
+  QFile journal_file_;
+
+  QDataStream journal_stream_;
 
-  std::list<HashTime> disk_data_;
+  int journal_entries_;
+
+  qint64 saved_limit_;
+
+  bool saved_clear_on_close_;
+
+  QStringList pending_deletions_;
+
+  bool deletion_running_;
+
+  QMutex deletion_lock_;
+
+  QFuture<void> deletion_future_;
+
+  quint64 eviction_counter_;
 
   qint64 consumption_;
 
@@ -149,6 +219,8 @@ public slots:
 
   void CreatedFile(const QString& cache_folder, const QString& file_name, const QByteArray& hash);
 
+  void CreatedPackedFrame(const QString& cache_folder, const QByteArray& hash, qint64 size);
+
 signals:
   void DeletedFrame(const QString& path, const QByteArray& hash);
 
@@ -0,0 +1,656 @@
+/***
+
+  Olive - Non-Linear Video Editor
+  Copyright (C) 2020 Olive Team
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+***/
+
+#include "framecachepack.h"
+
+#include <algorithm>
+#include <cstring>
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QtConcurrent/QtConcurrent>
+
+namespace olive {
+
+const qint64 FrameCachePack::kSegmentSize = 268435456; // 256 MB
+
+QAtomicInt FrameCachePack::enabled_(0);
+QMutex FrameCachePack::packs_lock_;
+QMap<QString, FrameCachePackPtr> FrameCachePack::packs_;
+
+FrameCachePack::FrameCachePack(const QString &cache_path) :
+  pack_path_(QDir(cache_path).filePath(QStringLiteral("packs"))),
+  active_segment_(0),
+  compaction_running_(false),
+  closing_(0)
+{
+  Load();
+}
+
+FrameCachePack::~FrameCachePack()
+{
+  // Compaction can pick up where it left off next time the pack is opened
+  closing_.store(1);
+  compaction_future_.waitForFinished();
+
+  writer_.close();
+
+  foreach (Segment* s, segments_) {
+    CloseSegment(s);
+  }
+}
+
+FrameCachePackPtr FrameCachePack::Get(const QString &cache_path)
+{
+  QMutexLocker locker(&packs_lock_);
+
+  FrameCachePackPtr pack = packs_.value(cache_path);
+
+  if (!pack) {
+    pack = std::make_shared<FrameCachePack>(cache_path);
+    packs_.insert(cache_path, pack);
+  }
+
+  return pack;
+}
+
+void FrameCachePack::Close(const QString &cache_path)
+{
+  QMutexLocker locker(&packs_lock_);
+
+  packs_.remove(cache_path);
+}
+
+bool FrameCachePack::Contains(const QByteArray &hash)
+{
+  QReadLocker locker(&lock_);
+
+  return index_.contains(hash);
+}
+
+bool FrameCachePack::Write(const QByteArray &hash, const char *data, const VideoParams &vparam, int linesize_bytes, qint64 *written_size)
+{
+  if (hash.isEmpty() || hash.size() > static_cast<int>(sizeof(IndexEntry::hash))) {
+    qWarning() << "Tried to pack frame with invalid hash size" << hash.size();
+    return false;
+  }
+
+  QMutexLocker write_locker(&write_lock_);
+
+  {
+    QReadLocker locker(&lock_);
+
+    if (index_.contains(hash)) {
+      // Frames are keyed by the hash of their contents so there's no need to write it again
+      *written_size = 0;
+      return true;
+    }
+  }
+
+  return Append(hash, data, vparam, linesize_bytes, nullptr, written_size);
+}
+
+bool FrameCachePack::Append(const QByteArray &hash, const char *data, const VideoParams &vparam, int linesize_bytes, const Location *moved_from, qint64 *written_size)
+{
+  Segment* active;
+  int active_id;
+
+  {
+    QReadLocker locker(&lock_);
+    active = segments_.value(active_segment_);
+    active_id = active_segment_;
+  }
+
+  if (active && active->size >= kSegmentSize) {
+    // Seal this segment, from now on it'll only be read from
+    writer_.close();
+
+    QWriteLocker locker(&lock_);
+
+    if (active->live_entries == 0) {
+      // Everything in it was already evicted
+      QFile::remove(active->file.fileName());
+      QFile::remove(active->index_file.fileName());
+      CloseSegment(active);
+      segments_.remove(active_id);
+    }
+
+    active_segment_++;
+
+    if (SegmentNeedsCompaction(active_id)) {
+      QueueCompaction(active_id);
+    }
+
+    active_id = active_segment_;
+    active = nullptr;
+  }
+
+  if (!active) {
+    writer_.setFileName(GetSegmentFilename(active_id));
+
+    if (!writer_.open(QFile::WriteOnly | QFile::Append)) {
+      qWarning() << "Failed to open cache pack segment" << writer_.fileName();
+      return false;
+    }
+
+    active = OpenSegment(active_id);
+
+    if (!active) {
+      writer_.close();
+      return false;
+    }
+
+    QWriteLocker locker(&lock_);
+    segments_.insert(active_id, active);
+  }
+
+  int width = vparam.effective_width();
+  int height = vparam.effective_height();
+  int row_size = width * VideoParams::GetBytesPerPixel(vparam.format(), vparam.channel_count());
+
+  RecordHeader header;
+  memcpy(header.magic, "OFRM", sizeof(header.magic));
+  header.width = width;
+  header.height = height;
+  header.format = vparam.format();
+  header.channel_count = vparam.channel_count();
+  header.pixel_aspect_num = static_cast<qint32>(vparam.pixel_aspect_ratio().numerator());
+  header.pixel_aspect_den = static_cast<qint32>(vparam.pixel_aspect_ratio().denominator());
+  header.row_size = row_size;
+  header.data_size = static_cast<qint64>(row_size) * height;
+
+  qint64 offset = active->size;
+  bool write_ok = (writer_.write(reinterpret_cast<const char*>(&header), sizeof(header)) == sizeof(header));
+
+  if (write_ok) {
+    if (linesize_bytes == row_size) {
+      // No padding, write the whole image at once
+      write_ok = (writer_.write(data, header.data_size) == header.data_size);
+    } else {
+      for (int i=0; i<height && write_ok; i++) {
+        write_ok = (writer_.write(data + i * linesize_bytes, row_size) == row_size);
+      }
+    }
+  }
+
+  if (write_ok) {
+    // Readers use their own file handle so this must actually reach the file before the frame is
+    // added to the index
+    write_ok = writer_.flush();
+  }
+
+  if (!write_ok) {
+    qWarning() << "Failed to write frame to cache pack segment" << writer_.fileName();
+    writer_.resize(offset);
+    return false;
+  }
+
+  qint64 record_size = sizeof(header) + header.data_size;
+
+  QWriteLocker locker(&lock_);
+
+  if (moved_from) {
+    QHash<QByteArray, Location>::const_iterator existing = index_.constFind(hash);
+
+    if (existing == index_.constEnd()
+        || existing->segment != moved_from->segment
+        || existing->offset != moved_from->offset) {
+      // Frame was removed while it was being copied, the copy isn't needed
+      writer_.resize(offset);
+      return false;
+    }
+  }
+
+  if (!AppendToIndex(active, hash, offset, false)) {
+    qWarning() << "Failed to write cache pack index" << active->index_file.fileName();
+
+    // Drop the unindexed record so the next write still lands at active->size
+    writer_.resize(offset);
+    return false;
+  }
+
+  active->size = offset + record_size;
+  active->live_entries++;
+  active->live_bytes += record_size;
+
+  index_.insert(hash, {active_id, offset, record_size});
+
+  if (moved_from) {
+    // No tombstone is needed for the old record, on load the newer segment supersedes it
+    Segment* old = segments_.value(moved_from->segment);
+
+    old->live_entries--;
+    old->live_bytes -= moved_from->size;
+
+    if (old->live_entries == 0) {
+      QString segment_fn = old->file.fileName();
+      QString index_fn = old->index_file.fileName();
+
+      CloseSegment(old);
+      segments_.remove(moved_from->segment);
+
+      QFile::remove(segment_fn);
+      QFile::remove(index_fn);
+    }
+  }
+
+  *written_size = record_size;
+
+  return true;
+}
+
+FramePtr FrameCachePack::Read(const QByteArray &hash)
+{
+  QReadLocker locker(&lock_);
+
+  QHash<QByteArray, Location>::const_iterator it = index_.constFind(hash);
+
+  if (it == index_.constEnd()) {
+    return nullptr;
+  }
+
+  Segment* s = segments_.value(it->segment);
+
+  if (!s) {
+    return nullptr;
+  }
+
+  FramePtr frame = ReadRecord(s, it->offset, it->segment != active_segment_);
+
+  if (!frame) {
+    qWarning() << "Failed to read frame from cache pack segment" << s->file.fileName();
+  }
+
+  return frame;
+}
+
+QStringList FrameCachePack::Remove(const QByteArray &hash)
+{
+  QStringList unused_files;
+
+  QWriteLocker locker(&lock_);
+
+  QHash<QByteArray, Location>::iterator it = index_.find(hash);
+
+  if (it == index_.end()) {
+    return unused_files;
+  }
+
+  Location loc = *it;
+  index_.erase(it);
+
+  Segment* s = segments_.value(loc.segment);
+
+  if (!s) {
+    return unused_files;
+  }
+
+  AppendToIndex(s, hash, loc.offset, true);
+
+  s->live_entries--;
+  s->live_bytes -= loc.size;
+
+  // The active segment is still being written to, it'll be cleaned up when it's sealed instead
+  if (loc.segment != active_segment_) {
+    if (s->live_entries == 0) {
+      unused_files.append(s->file.fileName());
+      unused_files.append(s->index_file.fileName());
+
+      CloseSegment(s);
+      segments_.remove(loc.segment);
+    } else if (SegmentNeedsCompaction(loc.segment)) {
+      QueueCompaction(loc.segment);
+    }
+  }
+
+  return unused_files;
+}
+
+void FrameCachePack::Load()
+{
+  QDir pack_dir(pack_path_);
+  pack_dir.mkpath(".");
+
+  // Segments must be replayed in the order they were written, which isn't necessarily the order
+  // their names sort in
+  QList<int> ids;
+
+  foreach (const QFileInfo& info, pack_dir.entryInfoList({QStringLiteral("*.pack")}, QDir::Files)) {
+    bool ok;
+    int id = info.completeBaseName().toInt(&ok);
+
+    if (ok) {
+      ids.append(id);
+    }
+  }
+
+  std::sort(ids.begin(), ids.end());
+
+  // Records are written back-to-back, so each one's size is the distance to the next
+  QHash<int, QVector<qint64> > record_offsets;
+
+  foreach (int id, ids) {
+    Segment* s = OpenSegment(id);
+
+    if (!s) {
+      continue;
+    }
+
+    segments_.insert(id, s);
+
+    QFile index_file(GetSegmentIndexFilename(id));
+
+    if (index_file.open(QFile::ReadOnly)) {
+      IndexEntry entry;
+
+      while (index_file.read(reinterpret_cast<char*>(&entry), sizeof(entry)) == sizeof(entry)) {
+        if (entry.hash_length <= 0 || entry.hash_length > static_cast<qint32>(sizeof(entry.hash))) {
+          // Probably a partial write from a crash, ignore the rest
+          break;
+        }
+
+        QByteArray hash(entry.hash, entry.hash_length);
+        QHash<QByteArray, Location>::iterator existing = index_.find(hash);
+
+        if (entry.removed) {
+          if (existing != index_.end()
+              && existing->segment == id
+              && existing->offset == entry.offset) {
+            index_.erase(existing);
+            s->live_entries--;
+          }
+        } else if (entry.offset + static_cast<qint64>(sizeof(RecordHeader)) <= s->size) {
+          if (existing != index_.end()) {
+            // Superseded by this entry
+            segments_.value(existing->segment)->live_entries--;
+          }
+
+          index_.insert(hash, {id, entry.offset, 0});
+          s->live_entries++;
+          record_offsets[id].append(entry.offset);
+        }
+      }
+
+      index_file.close();
+    }
+  }
+
+  // Always start a new segment rather than appending to one from a previous session
+  if (!ids.isEmpty()) {
+    active_segment_ = ids.last() + 1;
+  }
+
+  for (QHash<int, QVector<qint64> >::iterator it=record_offsets.begin(); it!=record_offsets.end(); it++) {
+    std::sort(it->begin(), it->end());
+  }
+
+  for (QHash<QByteArray, Location>::iterator it=index_.begin(); it!=index_.end(); it++) {
+    const QVector<qint64>& offsets = record_offsets[it->segment];
+    QVector<qint64>::const_iterator next = std::upper_bound(offsets.constBegin(), offsets.constEnd(), it->offset);
+
+    it->size = ((next == offsets.constEnd()) ? segments_.value(it->segment)->size : *next) - it->offset;
+    segments_.value(it->segment)->live_bytes += it->size;
+  }
+
+  // Delete any segments that no longer have any frames in them
+  for (QMap<int, Segment*>::iterator it=segments_.begin(); it!=segments_.end(); ) {
+    Segment* s = it.value();
+
+    if (s->live_entries == 0) {
+      QString segment_fn = s->file.fileName();
+      QString index_fn = s->index_file.fileName();
+
+      CloseSegment(s);
+      QFile::remove(segment_fn);
+      QFile::remove(index_fn);
+
+      it = segments_.erase(it);
+    } else {
+      it++;
+    }
+  }
+
+  // Pick up compactions that were cut short or never started last session
+  foreach (int id, segments_.keys()) {
+    if (SegmentNeedsCompaction(id)) {
+      QueueCompaction(id);
+    }
+  }
+}
+
+FrameCachePack::Segment *FrameCachePack::OpenSegment(int id)
+{
+  Segment* s = new Segment();
+
+  s->file.setFileName(GetSegmentFilename(id));
+  s->index_file.setFileName(GetSegmentIndexFilename(id));
+  s->map = nullptr;
+  s->live_entries = 0;
+  s->live_bytes = 0;
+
+  // Unbuffered because the active segment keeps growing underneath this handle
+  if (!s->file.open(QFile::ReadOnly | QFile::Unbuffered)
+      || !s->index_file.open(QFile::WriteOnly | QFile::Append)) {
+    qWarning() << "Failed to open cache pack segment" << s->file.fileName();
+    delete s;
+    return nullptr;
+  }
+
+  s->size = s->file.size();
+
+  return s;
+}
+
+void FrameCachePack::CloseSegment(Segment *s)
+{
+  if (s->map) {
+    s->file.unmap(s->map);
+  }
+
+  s->file.close();
+  s->index_file.close();
+
+  delete s;
+}
+
+bool FrameCachePack::AppendToIndex(Segment *s, const QByteArray &hash, qint64 offset, bool removed)
+{
+  IndexEntry entry;
+
+  memset(&entry, 0, sizeof(entry));
+  memcpy(entry.hash, hash.constData(), hash.size());
+  entry.hash_length = hash.size();
+  entry.removed = removed;
+  entry.offset = offset;
+
+  return s->index_file.write(reinterpret_cast<const char*>(&entry), sizeof(entry)) == sizeof(entry)
+      && s->index_file.flush();
+}
+
+FramePtr FrameCachePack::ReadRecord(Segment *s, qint64 offset, bool sealed)
+{
+  QMutexLocker locker(&s->read_lock);
+
+  if (sealed && !s->map) {
+    // Sealed segments will never change again so they can be mapped once and read without locking
+    s->map = s->file.map(0, s->size);
+  }
+
+  const uchar* mapped = s->map;
+
+  if (mapped) {
+    locker.unlock();
+  }
+
+  RecordHeader header;
+
+  if (offset + static_cast<qint64>(sizeof(header)) > s->size) {
+    return nullptr;
+  }
+
+  if (mapped) {
+    memcpy(&header, mapped + offset, sizeof(header));
+  } else if (!s->file.seek(offset)
+             || s->file.read(reinterpret_cast<char*>(&header), sizeof(header)) != sizeof(header)) {
+    return nullptr;
+  }
+
+  if (memcmp(header.magic, "OFRM", sizeof(header.magic))
+      || header.width <= 0
+      || header.height <= 0
+      || header.row_size != header.width * VideoParams::GetBytesPerPixel(static_cast<VideoParams::Format>(header.format), header.channel_count)
+      || header.data_size != static_cast<qint64>(header.row_size) * header.height
+      || offset + static_cast<qint64>(sizeof(header)) + header.data_size > s->size) {
+    return nullptr;
+  }
+
+  FramePtr frame = Frame::Create();
+  frame->set_video_params(VideoParams(header.width,
+                                      header.height,
+                                      static_cast<VideoParams::Format>(header.format),
+                                      header.channel_count,
+                                      rational(header.pixel_aspect_num, header.pixel_aspect_den)));
+  frame->allocate();
+
+  const qint64 data_offset = offset + sizeof(header);
+
+  if (mapped) {
+    const uchar* src = mapped + data_offset;
+
+    for (int i=0; i<header.height; i++) {
+      memcpy(frame->data() + i * frame->linesize_bytes(), src + i * header.row_size, header.row_size);
+    }
+  } else if (frame->linesize_bytes() == header.row_size) {
+    if (s->file.read(frame->data(), header.data_size) != header.data_size) {
+      return nullptr;
+    }
+  } else {
+    for (int i=0; i<header.height; i++) {
+      if (s->file.read(frame->data() + i * frame->linesize_bytes(), header.row_size) != header.row_size) {
+        return nullptr;
+      }
+    }
+  }
+
+  return frame;
+}
+
+bool FrameCachePack::SegmentNeedsCompaction(int id) const
+{
+  Segment* s = segments_.value(id);
+
+  return s && id != active_segment_ && s->live_entries > 0 && s->live_bytes < s->size / 2;
+}
+
+void FrameCachePack::QueueCompaction(int id)
+{
+  QMutexLocker locker(&compaction_lock_);
+
+  if (!pending_compactions_.contains(id)) {
+    pending_compactions_.append(id);
+  }
+
+  if (!compaction_running_) {
+    compaction_running_ = true;
+    compaction_future_ = QtConcurrent::run(this, &FrameCachePack::ProcessPendingCompactions);
+  }
+}
+
+void FrameCachePack::ProcessPendingCompactions()
+{
+  forever {
+    compaction_lock_.lock();
+
+    if (pending_compactions_.isEmpty() || closing_.load()) {
+      compaction_running_ = false;
+      compaction_lock_.unlock();
+      break;
+    }
+
+    int id = pending_compactions_.takeFirst();
+
+    compaction_lock_.unlock();
+
+    CompactSegment(id);
+  }
+}
+
+void FrameCachePack::CompactSegment(int id)
+{
+  QVector<QPair<QByteArray, Location> > records;
+
+  {
+    QReadLocker locker(&lock_);
+
+    // Frames may have been removed or the segment emptied since this was queued
+    if (!SegmentNeedsCompaction(id)) {
+      return;
+    }
+
+    for (QHash<QByteArray, Location>::const_iterator it=index_.constBegin(); it!=index_.constEnd(); it++) {
+      if (it->segment == id) {
+        records.append({it.key(), it.value()});
+      }
+    }
+  }
+
+  foreach (const auto& r, records) {
+    if (closing_.load()) {
+      break;
+    }
+
+    FramePtr frame;
+
+    {
+      QReadLocker locker(&lock_);
+
+      Segment* s = segments_.value(id);
+
+      if (!s) {
+        // Everything left in it was removed while we were copying
+        break;
+      }
+
+      frame = ReadRecord(s, r.second.offset, true);
+    }
+
+    if (!frame) {
+      continue;
+    }
+
+    // Copying each frame is its own write so regular cache writes aren't held up for long
+    QMutexLocker write_locker(&write_lock_);
+
+    qint64 written_size;
+    Append(r.first, frame->const_data(), frame->video_params(), frame->linesize_bytes(), &r.second, &written_size);
+  }
+}
+
+QString FrameCachePack::GetSegmentFilename(int id) const
+{
+  return QDir(pack_path_).filePath(QStringLiteral("%1.pack").arg(id));
+}
+
+QString FrameCachePack::GetSegmentIndexFilename(int id) const
+{
+  return QDir(pack_path_).filePath(QStringLiteral("%1.idx").arg(id));
+}
+
+}
@@ -0,0 +1,232 @@
+/***
+
+  Olive - Non-Linear Video Editor
+  Copyright (C) 2020 Olive Team
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+***/
+
+#ifndef FRAMECACHEPACK_H
+#define FRAMECACHEPACK_H
+
+#include <memory>
+#include <QAtomicInt>
+#include <QFile>
+#include <QFuture>
+#include <QHash>
+#include <QMap>
+#include <QMutex>
+#include <QReadWriteLock>
+
+#include "codec/frame.h"
+#include "common/define.h"
+#include "render/videoparams.h"
+
+namespace olive {
+
+class FrameCachePack;
+using FrameCachePackPtr = std::shared_ptr<FrameCachePack>;
+
+/**
+ * @brief Disk cache store that packs many frames into a few large segment files
+ *
+ * The regular disk cache writes one EXR per frame hash, which means a file open/create/close (and
+ * a DWAA encode/decode) for every frame and millions of small files in a long project. When
+ * enabled, frames are instead appended as raw uncompressed pixels to segment files in the "packs"
+ * folder of the cache, and a small per-segment index maps each hash to its offset. Once a segment
+ * reaches kSegmentSize it's sealed and new frames go to a new one. Sealed segments are
+ * memory-mapped for reading so loading a frame is a single copy.
+ *
+ * Segments are append-only. Removing a frame only writes a tombstone to the segment's index, and
+ * the segment file itself is deleted once none of its frames are left. Since evictions rarely empty
+ * a whole segment, a sealed segment that drops below half of its size in live frames is compacted
+ * in the background: its remaining frames are copied to the active segment and the old one is
+ * deleted. DiskCacheFolder is still responsible for deciding what to evict, so frames are
+ * registered with it through DiskManager::CreatedPackedFrame() rather than as files.
+ *
+ * All functions are thread-safe.
+ */
+class FrameCachePack
+{
+public:
+  FrameCachePack(const QString& cache_path);
+
+  ~FrameCachePack();
+
+  DISABLE_COPY_MOVE(FrameCachePack)
+
+  /**
+   * @brief Get the pack for a cache folder, opening it if it isn't open yet
+   */
+  static FrameCachePackPtr Get(const QString& cache_path);
+
+  /**
+   * @brief Close a cache folder's pack
+   *
+   * Anyone still holding a reference from Get() can keep using it until they let it go.
+   */
+  static void Close(const QString& cache_path);
+
+  /**
+   * @brief Whether cache frames are written to and read from packs rather than individual files
+   *
+   * While disabled, packs aren't opened at all. Frames left in them are still tracked by
+   * DiskCacheFolder and are removed as they're evicted.
+   */
+  static bool IsEnabled()
+  {
+    return enabled_.load();
+  }
+
+  static void SetEnabled(bool e)
+  {
+    enabled_.store(e);
+  }
+
+  bool Contains(const QByteArray& hash);
+
+  /**
+   * @brief Append a frame to the pack
+   *
+   * If successful, `written_size` is set to the number of bytes the frame takes up on disk. This
+   * will be 0 if the pack already had a frame with this hash, since nothing new was written.
+   */
+  bool Write(const QByteArray& hash, const char* data, const VideoParams& vparam, int linesize_bytes, qint64* written_size);
+
+  /**
+   * @brief Read a frame from the pack, returns nullptr if it isn't here
+   */
+  FramePtr Read(const QByteArray& hash);
+
+  /**
+   * @brief Remove a frame from the pack
+   *
+   * @return Files that are no longer in use because of this removal. They've already been closed
+   * and it's up to the caller to delete them.
+   */
+  QStringList Remove(const QByteArray& hash);
+
+  static const qint64 kSegmentSize;
+
+private:
+  struct RecordHeader {
+    char magic[4];
+    qint32 width;
+    qint32 height;
+    qint32 format;
+    qint32 channel_count;
+    qint32 pixel_aspect_num;
+    qint32 pixel_aspect_den;
+    qint32 row_size;
+    qint64 data_size;
+  };
+
+  struct IndexEntry {
+    char hash[32];
+    qint32 hash_length;
+    qint32 removed;
+    qint64 offset;
+  };
+
+  struct Segment {
+    QFile file;
+    QFile index_file;
+    QMutex read_lock;
+    uchar* map;
+    qint64 size;
+    int live_entries;
+    qint64 live_bytes;
+  };
+
+  struct Location {
+    int segment;
+    qint64 offset;
+    qint64 size;
+  };
+
+  void Load();
+
+  /**
+   * @brief Append a record to the active segment, `write_lock_` must be held
+   *
+   * If `moved_from` is set, the record is a copy of one being compacted and only replaces it if the
+   * frame hasn't been removed in the meantime.
+   */
+  bool Append(const QByteArray& hash, const char* data, const VideoParams& vparam, int linesize_bytes, const Location* moved_from, qint64* written_size);
+
+  /**
+   * @brief Queue a sealed segment to be compacted, `lock_` must be held
+   */
+  void QueueCompaction(int id);
+
+  void ProcessPendingCompactions();
+
+  void CompactSegment(int id);
+
+  bool SegmentNeedsCompaction(int id) const;
+
+  Segment* OpenSegment(int id);
+
+  static void CloseSegment(Segment* s);
+
+  bool AppendToIndex(Segment* s, const QByteArray& hash, qint64 offset, bool removed);
+
+  static FramePtr ReadRecord(Segment* s, qint64 offset, bool sealed);
+
+  QString GetSegmentFilename(int id) const;
+
+  QString GetSegmentIndexFilename(int id) const;
+
+  QString pack_path_;
+
+  /**
+   * @brief Protects `index_`, `segments_` and `active_segment_`
+   */
+  QReadWriteLock lock_;
+
+  QHash<QByteArray, Location> index_;
+
+  QMap<int, Segment*> segments_;
+
+  int active_segment_;
+
+  /**
+   * @brief Serializes appending to the active segment
+   */
+  QMutex write_lock_;
+
+  QFile writer_;
+
+  QMutex compaction_lock_;
+
+  QList<int> pending_compactions_;
+
+  bool compaction_running_;
+
+  QFuture<void> compaction_future_;
+
+  QAtomicInt closing_;
+
+  static QAtomicInt enabled_;
+
+  static QMutex packs_lock_;
+
+  static QMap<QString, FrameCachePackPtr> packs_;
+
+};
+
+}
+
+#endif // FRAMECACHEPACK_H
@@ -31,6 +31,7 @@
 #include "common/filefunctions.h"
 #include "common/timecodefunctions.h"
 #include "render/diskmanager.h"
+#include "render/framecachepack.h"
 
 namespace olive {
 
@@ -183,6 +184,31 @@ bool FrameHashCache::SaveCacheFrame(const QByteArray& hash,
                                     const VideoParams& vparam,
                                     int linesize_bytes) const
 {
+  if (FrameCachePack::IsEnabled()) {
+    if (!VideoParams::FormatIsFloat(vparam.format())) {
+      qCritical() << "Tried to cache frame with non-float pixel format";
+      return false;
+    }
+
+    qint64 written_size;
+
+    if (!FrameCachePack::Get(GetCacheDirectory())->Write(hash, data, vparam, linesize_bytes, &written_size)) {
+      return false;
+    }
+
+    if (written_size > 0) {
+      // Register frame with the disk manager
+      QMetaObject::invokeMethod(DiskManager::instance(),
+                                "CreatedPackedFrame",
+                                Qt::QueuedConnection,
+                                Q_ARG(QString, GetCacheDirectory()),
+                                Q_ARG(QByteArray, hash),
+                                Q_ARG(qint64, written_size));
+    }
+
+    return true;
+  }
+
   QString fn = CachePathName(hash);
 
   if (SaveCacheFrame(fn, data, vparam, linesize_bytes)) {
@@ -212,12 +238,26 @@ bool FrameHashCache::SaveCacheFrame(const QByteArray &hash, FramePtr frame) cons
 
 FramePtr FrameHashCache::LoadCacheFrame(const QString &cache_path, const QByteArray &hash)
 {
+  if (FrameCachePack::IsEnabled()) {
+    FramePtr frame = FrameCachePack::Get(cache_path)->Read(hash);
+
+    if (frame) {
+      QMetaObject::invokeMethod(DiskManager::instance(),
+                                "Accessed",
+                                Qt::QueuedConnection,
+                                Q_ARG(QString, cache_path),
+                                Q_ARG(QByteArray, hash));
+
+      return frame;
+    }
+  }
+
   return LoadCacheFrame(CachePathName(cache_path, hash));
 }
 
 FramePtr FrameHashCache::LoadCacheFrame(const QByteArray &hash) const
 {
-  return LoadCacheFrame(CachePathName(hash));
+  return LoadCacheFrame(GetCacheDirectory(), hash);
 }
 
 FramePtr FrameHashCache::LoadCacheFrame(const QString &fn)
@@ -371,13 +411,6 @@ QString FrameHashCache::CachePathName(const QByteArray& hash) const
 
 QString FrameHashCache::CachePathName(const QString &cache_path, const QByteArray &hash)
 {
-  QString ext = GetFormatExtension();
-
-  QDir cache_dir(QDir(cache_path).filePath(QString(hash.left(1).toHex())));
-  cache_dir.mkpath(".");
-
-  QString filename = QStringLiteral("%1%2").arg(QString(hash.mid(1).toHex()), ext);
-
   // Register that in some way this hash has been accessed
   QMetaObject::invokeMethod(DiskManager::instance(),
                             "Accessed",
@@ -385,9 +418,40 @@ QString FrameHashCache::CachePathName(const QString &cache_path, const QByteArra
                             Q_ARG(QString, cache_path),
                             Q_ARG(QByteArray, hash));
 
+  return GetCacheFilePath(cache_path, hash);
+}
+
+QString FrameHashCache::GetCacheFilePath(const QString &cache_path, const QByteArray &hash)
+{
+  QString ext = GetFormatExtension();
+
+  QDir cache_dir(QDir(cache_path).filePath(QString(hash.left(1).toHex())));
+  cache_dir.mkpath(".");
+
+  QString filename = QStringLiteral("%1%2").arg(QString(hash.mid(1).toHex()), ext);
+
   return cache_dir.filePath(filename);
 }
 
+bool FrameHashCache::HasCachedFrame(const QByteArray &hash) const
+{
+  return HasCachedFrame(GetCacheDirectory(), hash);
+}
+
+bool FrameHashCache::HasCachedFrame(const QString &cache_path, const QByteArray &hash)
+{
+  if (hash.isEmpty()) {
+    return false;
+  }
+
+  // Accesses are only registered when the frame is actually loaded
+  if (FrameCachePack::IsEnabled() && FrameCachePack::Get(cache_path)->Contains(hash)) {
+    return true;
+  }
+
+  return QFileInfo::exists(GetCacheFilePath(cache_path, hash));
+}
+
 bool FrameHashCache::SaveCacheFrame(const QString &filename, char *data, const VideoParams &vparam, int linesize_bytes) const
 {
   if (!VideoParams::FormatIsFloat(vparam.format())) {
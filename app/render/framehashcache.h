@@ -61,6 +61,12 @@ public:
   QString CachePathName(const QByteArray &hash) const;
   static QString CachePathName(const QString& cache_path, const QByteArray &hash);
 
+  /**
+   * @brief Return whether a frame with this hash is in the disk cache, either as a file or packed
+   */
+  bool HasCachedFrame(const QByteArray &hash) const;
+  static bool HasCachedFrame(const QString& cache_path, const QByteArray &hash);
+
   bool SaveCacheFrame(const QString& filename, char *data, const VideoParams &vparam, int linesize_bytes) const;
   bool SaveCacheFrame(const QByteArray& hash, char *data, const VideoParams &vparam, int linesize_bytes) const;
   bool SaveCacheFrame(const QByteArray& hash, FramePtr frame) const;
@@ -86,6 +92,11 @@ protected:
   virtual void InvalidateEvent(const TimeRange& range) override;
 
 private:
+  /**
+   * @brief Same as CachePathName() without registering an access with the disk manager
+   */
+  static QString GetCacheFilePath(const QString& cache_path, const QByteArray &hash);
+
   QMap<rational, QByteArray> time_hash_map_;
 
   rational timebase_;
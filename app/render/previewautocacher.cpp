@@ -13,9 +13,11 @@ namespace olive {
 PreviewAutoCacher::PreviewAutoCacher() :
   viewer_node_(nullptr),
   paused_(false),
+  playhead_direction_(1),
   has_changed_(false),
   use_custom_range_(false),
   single_frame_render_(nullptr),
+  max_video_tasks_(QThread::idealThreadCount()),
   last_update_time_(0),
   ignore_next_mouse_button_(false),
   video_params_changed_(false),
@@ -118,15 +120,19 @@ void PreviewAutoCacher::GenerateHashes(ViewerOutput *viewer, FrameHashCache* cac
 {
   std::vector<QByteArray> existing_hashes;
 
-  foreach (const rational& time, times) {
+  QVector<QByteArray> hashes = RenderManager::HashFrames(viewer->texture_input()->get_connected_node(), viewer->video_params(), times);
+
+  for (int i=0; i<times.size(); i++) {
+    const rational& time = times.at(i);
+    const QByteArray& hash = hashes.at(i);
+
     // See if hash already exists in disk cache
-    QByteArray hash = RenderManager::Hash(viewer->texture_input()->get_connected_node(), viewer->video_params(), time);
 
     // Check memory list since disk checking is slow
     bool hash_exists = (std::find(existing_hashes.begin(), existing_hashes.end(), hash) != existing_hashes.end());
 
     if (!hash_exists) {
-      hash_exists = QFileInfo::exists(cache->CachePathName(hash));
+      hash_exists = cache->HasCachedFrame(hash);
 
       if (hash_exists) {
         existing_hashes.push_back(hash);
@@ -244,7 +250,7 @@ void PreviewAutoCacher::VideoRendered()
   if (video_tasks_.contains(watcher)) {
     if (watcher->WasCancelled()) {
       // We didn't get this hash
-      currently_caching_hashes_.removeOne(watcher->property("hash").toByteArray());
+      currently_caching_hashes_.remove(watcher->property("hash").toByteArray());
     } else {
       const QByteArray& hash = video_tasks_.value(watcher);
 
@@ -264,6 +270,8 @@ void PreviewAutoCacher::VideoRendered()
   // The cacher might be waiting for this job to finish
   if (!graph_update_queue_.isEmpty()) {
     TryRender();
+  } else {
+    DispatchVideoQueue();
   }
 
   delete watcher;
@@ -278,7 +286,7 @@ void PreviewAutoCacher::VideoDownloaded()
       if (watcher->Get().toBool()) {
         const QByteArray& hash = video_download_tasks_.value(watcher);
 
-        currently_caching_hashes_.removeOne(hash);
+        currently_caching_hashes_.remove(hash);
 
         viewer_node_->video_frame_cache()->ValidateFramesWithHash(hash);
       } else {
@@ -358,6 +366,13 @@ bool PreviewAutoCacher::HasActiveJobs() const
 
 void PreviewAutoCacher::SetPlayhead(const rational &playhead)
 {
+  if (playhead > playhead_) {
+    playhead_direction_ = 1;
+  } else if (playhead < playhead_) {
+    playhead_direction_ = -1;
+  }
+  playhead_ = playhead;
+
   cache_range_ = TimeRange(playhead - Config::Current()["DiskCacheBehind"].value<rational>(),
       playhead + Config::Current()["DiskCacheAhead"].value<rational>());
 
@@ -391,6 +406,9 @@ void PreviewAutoCacher::ClearHashQueue(bool wait)
 
 void PreviewAutoCacher::ClearVideoQueue(bool wait)
 {
+  // Drop anything that hasn't been submitted yet
+  video_queue_.clear();
+
   // Copy because tasks that cancel immediately will be automatically removed from the list
   auto copy = video_tasks_;
 
@@ -619,33 +637,88 @@ void PreviewAutoCacher::RequeueFrames()
 
     QVector<rational> invalidated_ranges = viewer_node_->video_frame_cache()->GetInvalidatedFrames(using_range);
 
-    ClearVideoQueue();
+    // Cancel any running tickets that have fallen out of the range, the rest can keep running.
+    // Copy because tasks that cancel immediately will be automatically removed from the list.
+    auto copy = video_tasks_;
+    for (auto it=copy.cbegin(); it!=copy.cend(); it++) {
+      rational t = it.key()->property("time").value<rational>();
+
+      if (t < using_range.in() || t >= using_range.out()) {
+        it.key()->Cancel();
+      }
+    }
+
+    // Rebuild the queue from scratch
+    video_queue_.clear();
+    video_queue_.reserve(invalidated_ranges.size());
+
+    QSet<QByteArray> queued_hashes;
 
     foreach (const rational& t, invalidated_ranges) {
       const QByteArray& hash = viewer_node_->video_frame_cache()->GetHash(t);
 
       if (t >= using_range.in()
           && t < using_range.out()
-          && !currently_caching_hashes_.contains(hash)) {
+          && !currently_caching_hashes_.contains(hash)
+          && !queued_hashes.contains(hash)) {
         // Don't render any hash more than once
-        currently_caching_hashes_.append(hash);
-
-        RenderTicketWatcher* watcher = new RenderTicketWatcher();
-        watcher->setProperty("hash", hash);
-        connect(watcher, &RenderTicketWatcher::Finished, this, &PreviewAutoCacher::VideoRendered);
-        video_tasks_.insert(watcher, hash);
-        watcher->SetTicket(RenderManager::instance()->RenderFrame(copied_viewer_node_,
-                                                                  color_manager_,
-                                                                  t, RenderMode::kOffline,
-                                                                  viewer_node_->video_frame_cache(),
-                                                                  false));
+        queued_hashes.insert(hash);
+        video_queue_.push_back({t, hash});
       }
     }
 
+    SortVideoQueue();
+
+    DispatchVideoQueue();
+
     has_changed_ = false;
   }
 }
 
+void PreviewAutoCacher::SortVideoQueue()
+{
+  const rational playhead = playhead_;
+  const int direction = playhead_direction_;
+
+  auto priority = [playhead, direction](const QueuedFrame& f){
+    double distance = (f.time - playhead).toDouble() * direction;
+
+    // Negative distance is behind the playhead, weigh it as further away
+    return (distance < 0) ? -distance * 2.0 : distance;
+  };
+
+  // Sort descending so the closest frame is at the back and can be popped cheaply
+  std::sort(video_queue_.begin(), video_queue_.end(), [&priority](const QueuedFrame& a, const QueuedFrame& b){
+    return priority(a) > priority(b);
+  });
+}
+
+void PreviewAutoCacher::DispatchVideoQueue()
+{
+  while (!video_queue_.empty() && video_tasks_.size() < max_video_tasks_) {
+    QueuedFrame f = video_queue_.back();
+    video_queue_.pop_back();
+
+    if (currently_caching_hashes_.contains(f.hash)) {
+      // Another frame with this hash was submitted since the queue was built
+      continue;
+    }
+
+    currently_caching_hashes_.insert(f.hash);
+
+    RenderTicketWatcher* watcher = new RenderTicketWatcher();
+    watcher->setProperty("hash", f.hash);
+    watcher->setProperty("time", QVariant::fromValue(f.time));
+    connect(watcher, &RenderTicketWatcher::Finished, this, &PreviewAutoCacher::VideoRendered);
+    video_tasks_.insert(watcher, f.hash);
+    watcher->SetTicket(RenderManager::instance()->RenderFrame(copied_viewer_node_,
+                                                              color_manager_,
+                                                              f.time, RenderMode::kOffline,
+                                                              viewer_node_->video_frame_cache(),
+                                                              false));
+  }
+}
+
 void PreviewAutoCacher::IgnoreNextMouseButton()
 {
   ignore_next_mouse_button_ = true;
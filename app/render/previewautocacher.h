@@ -2,6 +2,7 @@
 #define AUTOCACHER_H
 
 #include <QtConcurrent/QtConcurrent>
+#include <vector>
 
 #include "config/config.h"
 #include "node/node.h"
@@ -114,6 +115,23 @@ private:
 
   bool HasActiveJobs() const;
 
+  /**
+   * @brief Sorts the video queue so that the most important frame is at the back
+   *
+   * Frames are prioritized by distance from the playhead. Frames behind the playhead (relative to
+   * the direction it last moved in) count as further away than frames ahead of it, since those
+   * are the ones playback is about to need.
+   */
+  void SortVideoQueue();
+
+  /**
+   * @brief Submits frames from the video queue until enough tickets are in flight
+   *
+   * Only a few tickets are kept running at a time so that re-prioritizing the queue takes effect
+   * immediately rather than after everything already submitted has rendered.
+   */
+  void DispatchVideoQueue();
+
   QList<NodeInput*> graph_update_queue_;
   QHash<Node*, Node*> copy_map_;
   ViewerOutput* copied_viewer_node_;
@@ -124,6 +142,10 @@ private:
 
   TimeRange cache_range_;
 
+  rational playhead_;
+
+  int playhead_direction_;
+
   bool has_changed_;
 
   bool use_custom_range_;
@@ -139,7 +161,17 @@ private:
   QMap<RenderTicketWatcher*, QByteArray> video_tasks_;
   QMap<RenderTicketWatcher*, QByteArray> video_download_tasks_;
 
-  QVector<QByteArray> currently_caching_hashes_;
+  struct QueuedFrame {
+    rational time;
+    QByteArray hash;
+  };
+
+  /// Frames waiting to be rendered, most important at the back
+  std::vector<QueuedFrame> video_queue_;
+
+  int max_video_tasks_;
+
+  QSet<QByteArray> currently_caching_hashes_;
 
   qint64 last_update_time_;
 
@@ -40,7 +40,6 @@ private:
 
 };
 
-using DecoderCache = RenderCache<Stream*, DecoderPtr>;
 using ShaderCache = RenderCache<QString, QVariant>;
 
 }
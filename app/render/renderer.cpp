@@ -23,19 +23,42 @@
 #include <QFloat16>
 
 #include "common/ocioutils.h"
+#include "config/config.h"
 
 namespace olive {
 
-Renderer::Renderer(QObject *parent) :
-  QObject(parent)
+uint qHash(const Renderer::TexturePoolKey &key, uint seed)
 {
+  return ::qHash(key.width, seed) ^ ::qHash(key.height << 16 | key.depth, seed)
+      ^ ::qHash(key.format << 24 | key.channel_count << 8 | key.type, seed);
+}
 
+Renderer::Renderer(QObject *parent) :
+  QObject(parent),
+  texture_pool_size_(0)
+{
+  texture_pool_limit_ = qMax(0, Config::Current()[QStringLiteral("TexturePoolSize")].toInt()) * qint64(1048576);
 }
 
 TexturePtr Renderer::CreateTexture(const VideoParams &params, Texture::Type type, const void *data, int linesize)
 {
   QVariant v;
 
+  // 3D textures can't be uploaded to after creation, so only recycle them if there's no data
+  if (type == Texture::k2D || !data) {
+    v = AcquirePooledTexture(GetTexturePoolKey(params, type));
+
+    if (!v.isNull()) {
+      TexturePtr t = std::make_shared<Texture>(this, v, params, type);
+
+      if (data) {
+        UploadToTexture(t.get(), data, linesize);
+      }
+
+      return t;
+    }
+  }
+
   if (type == Texture::k3D) {
     v = CreateNativeTexture3D(params.effective_width(), params.effective_height(),
                               params.effective_depth(), params.format(), params.channel_count(), data, linesize);
@@ -56,6 +79,33 @@ TexturePtr Renderer::CreateTexture(const VideoParams &params, const void *data,
   return CreateTexture(params, Texture::k2D, data, linesize);
 }
 
+TexturePtr Renderer::CreateTexture(FramePtr frame)
+{
+  const VideoParams& params = frame->video_params();
+
+  QVariant v = AcquirePooledTexture(GetTexturePoolKey(params, Texture::k2D));
+
+  if (!v.isNull()) {
+    TexturePtr t = std::make_shared<Texture>(this, v, params, Texture::k2D);
+    UploadFrameToTexture(t.get(), frame);
+    return t;
+  }
+
+  v = CreateNativeTexture2D(params.effective_width(), params.effective_height(), params.format(),
+                            params.channel_count(), frame->const_data(), frame->linesize_pixels());
+
+  if (v.isNull()) {
+    return nullptr;
+  }
+
+  return std::make_shared<Texture>(this, v, params, Texture::k2D);
+}
+
+void Renderer::UploadFrameToTexture(Texture *texture, FramePtr frame)
+{
+  UploadToTexture(texture, frame->const_data(), frame->linesize_pixels());
+}
+
 void Renderer::BlitColorManaged(ColorProcessorPtr color_processor, TexturePtr source, bool source_is_premultiplied, Texture *destination, bool clear_destination, const QMatrix4x4 &matrix)
 {
   BlitColorManagedInternal(color_processor, source, source_is_premultiplied, destination, destination->params(), clear_destination, matrix);
@@ -66,10 +116,112 @@ void Renderer::BlitColorManaged(ColorProcessorPtr color_processor, TexturePtr so
   BlitColorManagedInternal(color_processor, source, source_is_premultiplied, nullptr, params, clear_destination, matrix);
 }
 
+void Renderer::ReleaseTexture(const QVariant &native, const VideoParams &params, Texture::Type type)
+{
+  TexturePoolKey key = GetTexturePoolKey(params, type);
+  qint64 size = qint64(key.width) * key.height * key.depth
+      * VideoParams::GetBytesPerPixel(key.format, key.channel_count);
+
+  QVector<QVariant> trimmed;
+
+  {
+    QMutexLocker locker(&texture_pool_lock_);
+
+    if (size > texture_pool_limit_) {
+      // Pool is disabled or this texture would never fit
+      trimmed.append(native);
+    } else {
+      texture_pool_.push_back({key, native, size});
+      texture_pool_index_[key].append(std::prev(texture_pool_.end()));
+      texture_pool_size_ += size;
+
+      // Trim least recently released textures until we're under the limit again
+      while (texture_pool_size_ > texture_pool_limit_) {
+        const PooledTexture& oldest = texture_pool_.front();
+
+        QVector<TexturePoolList::iterator>& same_key = texture_pool_index_[oldest.key];
+        same_key.removeFirst();
+        if (same_key.isEmpty()) {
+          texture_pool_index_.remove(oldest.key);
+        }
+
+        texture_pool_size_ -= oldest.size;
+        trimmed.append(oldest.native);
+        texture_pool_.pop_front();
+      }
+    }
+  }
+
+  // Destroy outside the lock since the renderer may need to wait on another thread
+  foreach (const QVariant& v, trimmed) {
+    DestroyNativeTexture(v);
+  }
+}
+
+void Renderer::ClearTexturePool()
+{
+  TexturePoolList pool;
+
+  {
+    QMutexLocker locker(&texture_pool_lock_);
+    pool.swap(texture_pool_);
+    texture_pool_index_.clear();
+    texture_pool_size_ = 0;
+  }
+
+  for (TexturePoolList::const_iterator it=pool.cbegin(); it!=pool.cend(); it++) {
+    DestroyNativeTexture(it->native);
+  }
+}
+
+Renderer::TexturePoolKey Renderer::GetTexturePoolKey(const VideoParams &params, Texture::Type type)
+{
+  return {params.effective_width(),
+          params.effective_height(),
+          (type == Texture::k3D) ? params.effective_depth() : 1,
+          params.format(),
+          params.channel_count(),
+          type};
+}
+
+QVariant Renderer::AcquirePooledTexture(const TexturePoolKey &key)
+{
+  QMutexLocker locker(&texture_pool_lock_);
+
+  QHash<TexturePoolKey, QVector<TexturePoolList::iterator> >::iterator same_key = texture_pool_index_.find(key);
+  if (same_key == texture_pool_index_.end()) {
+    return QVariant();
+  }
+
+  // Hand out the most recently released texture, it's the most likely to still be resident
+  TexturePoolList::iterator it = same_key->last();
+  same_key->removeLast();
+  if (same_key->isEmpty()) {
+    texture_pool_index_.erase(same_key);
+  }
+
+  QVariant native = it->native;
+  texture_pool_size_ -= it->size;
+  texture_pool_.erase(it);
+
+  return native;
+}
+
 void Renderer::Destroy()
 {
+  // Clear color cache first since its LUTs will be released into the pool
+  foreach (const CachedColorContext& cached, color_cache_) {
+    DestroyNativeShader(cached.context.compiled_shader);
+  }
   color_cache_.clear();
 
+  foreach (const ColorContext& retired, retired_color_contexts_) {
+    DestroyNativeShader(retired.compiled_shader);
+  }
+  retired_color_contexts_.clear();
+
+  ClearTexturePool();
+
   DestroyInternal();
 }
 
@@ -79,150 +231,173 @@ bool Renderer::GetColorContext(ColorProcessorPtr color_processor, Renderer::Colo
 
   ColorContext& color_ctx = *ctx;
 
-  if (color_cache_.contains(color_processor->id())) {
-    color_ctx = color_cache_.value(color_processor->id());
+  QHash<QString, CachedColorContext>::iterator cached = color_cache_.find(color_processor->id());
+
+  if (cached != color_cache_.end()) {
+    // A different instance that isn't newer was built from the same or an older config (e.g. an
+    // uncached one from ColorProcessor::Create() while the generation was stale), so the cached
+    // context is still the right one to use
+    if (cached->processor == color_processor
+        || color_processor->generation() <= cached->processor->generation()) {
+      color_ctx = cached->context;
+      return true;
+    }
+
+    // The config changed since this context was built. Copies of it may still be in use on other
+    // threads, so keep it alive until Destroy() rather than destroying its shader here.
+    retired_color_contexts_.append(cached->context);
+    color_cache_.erase(cached);
+  }
+
+  if (CreateColorContext(color_processor, &color_ctx)) {
+    color_cache_.insert(color_processor->id(), {color_processor, color_ctx});
     return true;
   } else {
-    // Create shader description
-    const char* ocio_func_name = "OCIODisplay";
-    auto shader_desc = OCIO::GpuShaderDesc::CreateShaderDesc();
-    shader_desc->setLanguage(OCIO::GPU_LANGUAGE_GLSL_1_3);
-    shader_desc->setFunctionName(ocio_func_name);
-    shader_desc->setResourcePrefix("ocio_");
-
-    // Generate shader
-    color_processor->GetProcessor()->getDefaultGPUProcessor()->extractGpuShaderInfo(shader_desc);
-
-    QString shader_frag;
-    shader_frag.append(QStringLiteral("// Main texture input\n"
-                                      "uniform sampler2D ove_maintex;\n"
-                                      "uniform int ove_maintex_alpha;\n"
-                                      "\n"
-                                      "// Macros defining `ove_maintex_alpha` state\n"
-                                      "// Matches `AlphaAssociated` C++ enum\n"
-                                      "#define ALPHA_NONE     0\n"
-                                      "#define ALPHA_UNASSOC  1\n"
-                                      "#define ALPHA_ASSOC    2\n"
-                                      "\n"
-                                      "// Macros so OCIO's shaders work on this GLSL version\n"
-                                      "#define texture2D texture\n"
-                                      "#define texture3D texture\n"
-                                      "\n"
-                                      "// Main texture coordinate\n"
-                                      "in vec2 ove_texcoord;\n"
-                                      "\n"
-                                      "// Texture output\n"
-                                      "out vec4 fragColor;\n"));
-    shader_frag.append(shader_desc->getShaderText());
-    shader_frag.append(QStringLiteral("\n"
-                                      "// Alpha association functions\n"
-                                      "vec4 assoc(vec4 c) {\n"
-                                      "  return vec4(c.rgb * c.a, c.a);\n"
-                                      "}\n"
-                                      "\n"
-                                      "vec4 reassoc(vec4 c) {\n"
-                                      "  return (c.a == 0.0) ? c : assoc(c);\n"
-                                      "}\n"
-                                      "\n"
-                                      "vec4 deassoc(vec4 c) {\n"
-                                      "  return (c.a == 0.0) ? c : vec4(c.rgb / c.a, c.a);\n"
-                                      "}\n"
-                                      "\n"
-                                      "void main() {\n"
-                                      "  vec4 col = texture(ove_maintex, ove_texcoord);\n"
-                                      "\n"
-                                      "  // If alpha is associated, de-associate now\n"
-                                      "  if (ove_maintex_alpha == ALPHA_ASSOC) {\n"
-                                      "    col = deassoc(col);\n"
-                                      "  }\n"
-                                      "\n"
-                                      "  // Perform color conversion\n"
-                                      "  col = %1(col);\n"
-                                      "\n"
-                                      "  // Associate or re-associate here\n"
-                                      "  if (ove_maintex_alpha == ALPHA_ASSOC) {\n"
-                                      "    col = reassoc(col);\n"
-                                      "  } else if (ove_maintex_alpha == ALPHA_UNASSOC) {\n"
-                                      "    col = assoc(col);\n"
-                                      "  }\n"
-                                      "\n"
-                                      "  fragColor = col;\n"
-                                      "}\n").arg(ocio_func_name));
-
-    // Try to compile shader
-    color_ctx.compiled_shader = CreateNativeShader(ShaderCode(shader_frag,
-                                                              FileFunctions::ReadFileAsString(QStringLiteral(":/shaders/default.vert"))));
-
-    if (color_ctx.compiled_shader.isNull()) {
-      return false;
-    }
+    return false;
+  }
+}
 
-    color_ctx.lut3d_textures.resize(shader_desc->getNum3DTextures());
-    for (unsigned int i=0; i<shader_desc->getNum3DTextures(); i++) {
-      const char* tex_name = nullptr;
-      const char* sampler_name = nullptr;
-      unsigned int edge_len = 0;
-      OCIO::Interpolation interpolation = OCIO::INTERP_LINEAR;
+bool Renderer::CreateColorContext(ColorProcessorPtr color_processor, ColorContext *ctx)
+{
+  ColorContext& color_ctx = *ctx;
 
-      shader_desc->get3DTexture(i, tex_name, sampler_name, edge_len, interpolation);
+  // Create shader description
+  const char* ocio_func_name = "OCIODisplay";
+  auto shader_desc = OCIO::GpuShaderDesc::CreateShaderDesc();
+  shader_desc->setLanguage(OCIO::GPU_LANGUAGE_GLSL_1_3);
+  shader_desc->setFunctionName(ocio_func_name);
+  shader_desc->setResourcePrefix("ocio_");
+
+  // Generate shader
+  color_processor->GetProcessor()->getDefaultGPUProcessor()->extractGpuShaderInfo(shader_desc);
+
+  QString shader_frag;
+  shader_frag.append(QStringLiteral("// Main texture input\n"
+                                    "uniform sampler2D ove_maintex;\n"
+                                    "uniform int ove_maintex_alpha;\n"
+                                    "\n"
+                                    "// Macros defining `ove_maintex_alpha` state\n"
+                                    "// Matches `AlphaAssociated` C++ enum\n"
+                                    "#define ALPHA_NONE     0\n"
+                                    "#define ALPHA_UNASSOC  1\n"
+                                    "#define ALPHA_ASSOC    2\n"
+                                    "\n"
+                                    "// Macros so OCIO's shaders work on this GLSL version\n"
+                                    "#define texture2D texture\n"
+                                    "#define texture3D texture\n"
+                                    "\n"
+                                    "// Main texture coordinate\n"
+                                    "in vec2 ove_texcoord;\n"
+                                    "\n"
+                                    "// Texture output\n"
+                                    "out vec4 fragColor;\n"));
+  shader_frag.append(shader_desc->getShaderText());
+  shader_frag.append(QStringLiteral("\n"
+                                    "// Alpha association functions\n"
+                                    "vec4 assoc(vec4 c) {\n"
+                                    "  return vec4(c.rgb * c.a, c.a);\n"
+                                    "}\n"
+                                    "\n"
+                                    "vec4 reassoc(vec4 c) {\n"
+                                    "  return (c.a == 0.0) ? c : assoc(c);\n"
+                                    "}\n"
+                                    "\n"
+                                    "vec4 deassoc(vec4 c) {\n"
+                                    "  return (c.a == 0.0) ? c : vec4(c.rgb / c.a, c.a);\n"
+                                    "}\n"
+                                    "\n"
+                                    "void main() {\n"
+                                    "  vec4 col = texture(ove_maintex, ove_texcoord);\n"
+                                    "\n"
+                                    "  // If alpha is associated, de-associate now\n"
+                                    "  if (ove_maintex_alpha == ALPHA_ASSOC) {\n"
+                                    "    col = deassoc(col);\n"
+                                    "  }\n"
+                                    "\n"
+                                    "  // Perform color conversion\n"
+                                    "  col = %1(col);\n"
+                                    "\n"
+                                    "  // Associate or re-associate here\n"
+                                    "  if (ove_maintex_alpha == ALPHA_ASSOC) {\n"
+                                    "    col = reassoc(col);\n"
+                                    "  } else if (ove_maintex_alpha == ALPHA_UNASSOC) {\n"
+                                    "    col = assoc(col);\n"
+                                    "  }\n"
+                                    "\n"
+                                    "  fragColor = col;\n"
+                                    "}\n").arg(ocio_func_name));
+
+  // Try to compile shader
+  color_ctx.compiled_shader = CreateNativeShader(ShaderCode(shader_frag,
+                                                            FileFunctions::ReadFileAsString(QStringLiteral(":/shaders/default.vert"))));
+
+  if (color_ctx.compiled_shader.isNull()) {
+    return false;
+  }
 
-      if (!tex_name || !*tex_name
-          || !sampler_name || !*sampler_name
-          || !edge_len) {
-        qCritical() << "3D LUT texture data is corrupted";
-        return false;
-      }
+  color_ctx.lut3d_textures.resize(shader_desc->getNum3DTextures());
+  for (unsigned int i=0; i<shader_desc->getNum3DTextures(); i++) {
+    const char* tex_name = nullptr;
+    const char* sampler_name = nullptr;
+    unsigned int edge_len = 0;
+    OCIO::Interpolation interpolation = OCIO::INTERP_LINEAR;
 
-      const float* values = nullptr;
-      shader_desc->get3DTextureValues(i, values);
-      if (!values) {
-        qCritical() << "3D LUT texture values are missing";
-        return false;
-      }
+    shader_desc->get3DTexture(i, tex_name, sampler_name, edge_len, interpolation);
 
-      // Allocate 3D LUT
-      color_ctx.lut3d_textures[i].texture = CreateTexture(VideoParams(edge_len, edge_len, edge_len, VideoParams::kFormatFloat32, VideoParams::kRGBChannelCount),
-                                                          Texture::k3D, values);
-      color_ctx.lut3d_textures[i].name = sampler_name;
-      color_ctx.lut3d_textures[i].interpolation = (interpolation == OCIO::INTERP_NEAREST) ? Texture::kNearest : Texture::kLinear;
+    if (!tex_name || !*tex_name
+        || !sampler_name || !*sampler_name
+        || !edge_len) {
+      qCritical() << "3D LUT texture data is corrupted";
+      return false;
     }
 
-    color_ctx.lut1d_textures.resize(shader_desc->getNumTextures());
-    for (unsigned int i=0; i<shader_desc->getNumTextures(); i++) {
-      const char* tex_name = nullptr;
-      const char* sampler_name = nullptr;
-      unsigned int width = 0, height = 0;
-      OCIO::GpuShaderDesc::TextureType channel = OCIO::GpuShaderDesc::TEXTURE_RGB_CHANNEL;
-      OCIO::Interpolation interpolation = OCIO::INTERP_LINEAR;
-
-      shader_desc->getTexture(i, tex_name, sampler_name, width, height, channel, interpolation);
-
-      if (!tex_name || !*tex_name
-          || !sampler_name || !*sampler_name
-          || !width) {
-        qCritical() << "1D LUT texture data is corrupted";
-        return false;
-      }
+    const float* values = nullptr;
+    shader_desc->get3DTextureValues(i, values);
+    if (!values) {
+      qCritical() << "3D LUT texture values are missing";
+      return false;
+    }
 
-      const float* values = nullptr;
-      shader_desc->getTextureValues(i, values);
-      if (!values) {
-        qCritical() << "1D LUT texture values are missing";
-        return false;
-      }
+    // Allocate 3D LUT
+    color_ctx.lut3d_textures[i].texture = CreateTexture(VideoParams(edge_len, edge_len, edge_len, VideoParams::kFormatFloat32, VideoParams::kRGBChannelCount),
+                                                        Texture::k3D, values);
+    color_ctx.lut3d_textures[i].name = sampler_name;
+    color_ctx.lut3d_textures[i].interpolation = (interpolation == OCIO::INTERP_NEAREST) ? Texture::kNearest : Texture::kLinear;
+  }
+
+  color_ctx.lut1d_textures.resize(shader_desc->getNumTextures());
+  for (unsigned int i=0; i<shader_desc->getNumTextures(); i++) {
+    const char* tex_name = nullptr;
+    const char* sampler_name = nullptr;
+    unsigned int width = 0, height = 0;
+    OCIO::GpuShaderDesc::TextureType channel = OCIO::GpuShaderDesc::TEXTURE_RGB_CHANNEL;
+    OCIO::Interpolation interpolation = OCIO::INTERP_LINEAR;
+
+    shader_desc->getTexture(i, tex_name, sampler_name, width, height, channel, interpolation);
 
-      // Allocate 1D LUT
-      color_ctx.lut1d_textures[i].texture = CreateTexture(VideoParams(width, height, VideoParams::kFormatFloat32, (channel == OCIO::GpuShaderDesc::TEXTURE_RED_CHANNEL) ? 1 : VideoParams::kRGBChannelCount),
-                                                          Texture::k2D,
-                                                          values);
-      color_ctx.lut1d_textures[i].name = sampler_name;
-      color_ctx.lut1d_textures[i].interpolation = (interpolation == OCIO::INTERP_NEAREST) ? Texture::kNearest : Texture::kLinear;
+    if (!tex_name || !*tex_name
+        || !sampler_name || !*sampler_name
+        || !width) {
+      qCritical() << "1D LUT texture data is corrupted";
+      return false;
     }
 
-    color_cache_.insert(color_processor->id(), color_ctx);
+    const float* values = nullptr;
+    shader_desc->getTextureValues(i, values);
+    if (!values) {
+      qCritical() << "1D LUT texture values are missing";
+      return false;
+    }
 
-    return true;
+    // Allocate 1D LUT
+    color_ctx.lut1d_textures[i].texture = CreateTexture(VideoParams(width, height, VideoParams::kFormatFloat32, (channel == OCIO::GpuShaderDesc::TEXTURE_RED_CHANNEL) ? 1 : VideoParams::kRGBChannelCount),
+                                                        Texture::k2D,
+                                                        values);
+    color_ctx.lut1d_textures[i].name = sampler_name;
+    color_ctx.lut1d_textures[i].interpolation = (interpolation == OCIO::INTERP_NEAREST) ? Texture::kNearest : Texture::kLinear;
   }
+
+  return true;
 }
 
 void Renderer::BlitColorManagedInternal(ColorProcessorPtr color_processor, TexturePtr source,
@@ -21,9 +21,11 @@
 #ifndef RENDERCONTEXT_H
 #define RENDERCONTEXT_H
 
+#include <list>
 #include <QObject>
 #include <QVariant>
 
+#include "codec/frame.h"
 #include "common/define.h"
 #include "common/timerange.h"
 #include "node/node.h"
@@ -46,6 +48,14 @@ public:
   TexturePtr CreateTexture(const VideoParams& params, Texture::Type type, const void* data = nullptr, int linesize = 0);
   TexturePtr CreateTexture(const VideoParams& params, const void *data = nullptr, int linesize = 0);
 
+  /**
+   * @brief Create a 2D texture holding the contents of `frame`
+   *
+   * Unlike passing the frame's data pointer, this lets a threaded renderer hold a reference to the
+   * frame until its upload has run instead of copying it. The frame must not be modified afterwards.
+   */
+  TexturePtr CreateTexture(FramePtr frame);
+
   void BlitToTexture(QVariant shader,
                      olive::ShaderJob job,
                      olive::Texture* destination,
@@ -69,6 +79,20 @@ public:
 
   virtual void PostDestroy() = 0;
 
+  /**
+   * @brief Called by Texture when it's deleted to recycle or destroy its native handle
+   *
+   * Released textures go back into a pool that CreateTexture() will hand out again for the same
+   * size, format and type, saving a native allocation. The pool is capped by the
+   * "TexturePoolSize" setting (in MiB) and trimmed least-recently-released first.
+   */
+  void ReleaseTexture(const QVariant& native, const VideoParams& params, Texture::Type type);
+
+  /**
+   * @brief Destroys all native textures currently held by the texture pool
+   */
+  void ClearTexturePool();
+
 public slots:
   virtual void PostInit() = 0;
 
@@ -87,6 +111,8 @@ public slots:
 
   virtual void UploadToTexture(olive::Texture* texture, const void* data, int linesize) = 0;
 
+  virtual void UploadFrameToTexture(olive::Texture* texture, olive::FramePtr frame);
+
   virtual void DownloadFromTexture(olive::Texture* texture, void* data, int linesize) = 0;
 
 protected slots:
@@ -96,7 +122,7 @@ protected slots:
                     olive::VideoParams destination_params,
                     bool clear_destination) = 0;
 
-private:
+protected:
   struct ColorContext {
     struct LUT {
       TexturePtr texture;
@@ -116,6 +142,45 @@ private:
     kAlphaAssociated
   };
 
+  /**
+   * @brief Build the shader and LUTs required to run `color_processor` on this renderer
+   *
+   * The default implementation compiles OCIO's GLSL shader through CreateNativeShader(). Backends
+   * that can't run GLSL can override this to provide their own native color shader. Results are
+   * cached by GetColorContext() so this is only called once per processor ID.
+   */
+  virtual bool CreateColorContext(ColorProcessorPtr color_processor, ColorContext* ctx);
+
+private:
+  struct TexturePoolKey {
+    int width;
+    int height;
+    int depth;
+    VideoParams::Format format;
+    int channel_count;
+    Texture::Type type;
+
+    bool operator==(const TexturePoolKey& rhs) const
+    {
+      return width == rhs.width && height == rhs.height && depth == rhs.depth
+          && format == rhs.format && channel_count == rhs.channel_count && type == rhs.type;
+    }
+  };
+
+  friend uint qHash(const TexturePoolKey& key, uint seed);
+
+  struct PooledTexture {
+    TexturePoolKey key;
+    QVariant native;
+    qint64 size;
+  };
+
+  using TexturePoolList = std::list<PooledTexture>;
+
+  static TexturePoolKey GetTexturePoolKey(const VideoParams& params, Texture::Type type);
+
+  QVariant AcquirePooledTexture(const TexturePoolKey& key);
+
   bool GetColorContext(ColorProcessorPtr color_processor, ColorContext* ctx);
 
   void BlitColorManagedInternal(ColorProcessorPtr color_processor, TexturePtr source,
@@ -123,10 +188,33 @@ private:
                                 Texture* destination, VideoParams params, bool clear_destination,
                                 const QMatrix4x4 &matrix);
 
-  QHash<QString, ColorContext> color_cache_;
+  struct CachedColorContext {
+    // Processors are shared through ColorProcessorCache, so a newer instance with the same ID means the config
+    // changed and the context has to be rebuilt
+    ColorProcessorPtr processor;
+    ColorContext context;
+  };
+
+  QHash<QString, CachedColorContext> color_cache_;
+
+  // Contexts replaced by a newer config. Other threads may still be blitting with copies of them,
+  // so their shaders are only destroyed in Destroy()
+  QVector<ColorContext> retired_color_contexts_;
 
   QMutex color_cache_mutex_;
 
+  /// Pooled textures, least recently released first
+  TexturePoolList texture_pool_;
+
+  /// Pooled textures of each key in the order they were released
+  QHash<TexturePoolKey, QVector<TexturePoolList::iterator> > texture_pool_index_;
+
+  qint64 texture_pool_size_;
+
+  qint64 texture_pool_limit_;
+
+  QMutex texture_pool_lock_;
+
 };
 
 }
@@ -20,13 +20,27 @@
 
 #include "rendererthreadwrapper.h"
 
+#include <QElapsedTimer>
+
 namespace olive {
 
 RendererThreadWrapper::RendererThreadWrapper(Renderer *inner, QObject *parent) :
   Renderer(parent),
   inner_(inner),
-  thread_(nullptr)
+  thread_(nullptr),
+  worker_(nullptr),
+  drain_queued_(false),
+  stats_()
+{
+}
+
+RendererThreadWrapper::Statistics RendererThreadWrapper::TakeStatistics()
 {
+  QMutexLocker locker(&queue_lock_);
+
+  Statistics s = stats_;
+  stats_ = Statistics();
+  return s;
 }
 
 bool RendererThreadWrapper::Init()
@@ -43,8 +57,14 @@ bool RendererThreadWrapper::Init()
   // Move context to thread
   inner_->moveToThread(thread_);
 
+  worker_ = new RendererThreadWrapperWorker(this);
+  worker_->moveToThread(thread_);
+
   // Queue post-init in new thread
-  QMetaObject::invokeMethod(inner_, "PostInit", Qt::BlockingQueuedConnection);
+  Renderer* inner = inner_;
+  SubmitAndWait([inner]{
+    inner->PostInit();
+  });
 
   return true;
 }
@@ -57,13 +77,19 @@ void RendererThreadWrapper::PostInit()
 void RendererThreadWrapper::DestroyInternal()
 {
   if (thread_) {
-    QMetaObject::invokeMethod(inner_, "DestroyInternal", Qt::BlockingQueuedConnection);
+    Renderer* inner = inner_;
+    SubmitAndWait([inner]{
+      inner->Destroy();
+    });
 
     thread_->quit();
     thread_->wait();
     delete thread_;
     thread_ = nullptr;
 
+    delete worker_;
+    worker_ = nullptr;
+
     // Destroy in main thread
     inner_->PostDestroy();
   }
@@ -71,25 +97,20 @@ void RendererThreadWrapper::DestroyInternal()
 
 void RendererThreadWrapper::ClearDestination(double r, double g, double b, double a)
 {
-  QMetaObject::invokeMethod(inner_, "ClearDestination", Qt::BlockingQueuedConnection,
-                            Q_ARG(double, r),
-                            Q_ARG(double, g),
-                            Q_ARG(double, b),
-                            Q_ARG(double, a));
+  Renderer* inner = inner_;
+  Submit([inner, r, g, b, a]{
+    inner->ClearDestination(r, g, b, a);
+  });
 }
 
 QVariant RendererThreadWrapper::CreateNativeTexture2D(int width, int height, VideoParams::Format format, int channel_count, const void *data, int linesize)
 {
   QVariant v;
 
-  QMetaObject::invokeMethod(inner_, "CreateNativeTexture2D", Qt::BlockingQueuedConnection,
-                            Q_RETURN_ARG(QVariant, v),
-                            Q_ARG(int, width),
-                            Q_ARG(int, height),
-                            OLIVE_NS_ARG(VideoParams::Format, format),
-                            Q_ARG(int, channel_count),
-                            Q_ARG(const void*, data),
-                            Q_ARG(int, linesize));
+  Renderer* inner = inner_;
+  SubmitAndWait([inner, &v, width, height, format, channel_count, data, linesize]{
+    v = inner->CreateNativeTexture2D(width, height, format, channel_count, data, linesize);
+  });
 
   return v;
 }
@@ -98,66 +119,169 @@ QVariant RendererThreadWrapper::CreateNativeTexture3D(int width, int height, int
 {
   QVariant v;
 
-  QMetaObject::invokeMethod(inner_, "CreateNativeTexture3D", Qt::BlockingQueuedConnection,
-                            Q_RETURN_ARG(QVariant, v),
-                            Q_ARG(int, width),
-                            Q_ARG(int, height),
-                            Q_ARG(int, depth),
-                            OLIVE_NS_ARG(VideoParams::Format, format),
-                            Q_ARG(int, channel_count),
-                            Q_ARG(const void*, data),
-                            Q_ARG(int, linesize));
+  Renderer* inner = inner_;
+  SubmitAndWait([inner, &v, width, height, depth, format, channel_count, data, linesize]{
+    v = inner->CreateNativeTexture3D(width, height, depth, format, channel_count, data, linesize);
+  });
 
   return v;
 }
 
 void RendererThreadWrapper::DestroyNativeTexture(QVariant texture)
 {
-  QMetaObject::invokeMethod(inner_, "DestroyNativeTexture", Qt::BlockingQueuedConnection,
-                            Q_ARG(QVariant, texture));
+  Renderer* inner = inner_;
+  Submit([inner, texture]{
+    inner->DestroyNativeTexture(texture);
+  });
 }
 
 QVariant RendererThreadWrapper::CreateNativeShader(ShaderCode code)
 {
   QVariant v;
 
-  QMetaObject::invokeMethod(inner_, "CreateNativeShader", Qt::BlockingQueuedConnection,
-                            Q_RETURN_ARG(QVariant, v),
-                            OLIVE_NS_ARG(ShaderCode, code));
+  Renderer* inner = inner_;
+  SubmitAndWait([inner, &v, &code]{
+    v = inner->CreateNativeShader(code);
+  });
 
   return v;
 }
 
 void RendererThreadWrapper::DestroyNativeShader(QVariant shader)
 {
-  QMetaObject::invokeMethod(inner_, "DestroyNativeShader", Qt::BlockingQueuedConnection,
-                            Q_ARG(QVariant, shader));
+  Renderer* inner = inner_;
+  Submit([inner, shader]{
+    inner->DestroyNativeShader(shader);
+  });
 }
 
 void RendererThreadWrapper::UploadToTexture(Texture *texture, const void *data, int linesize)
 {
-  QMetaObject::invokeMethod(inner_, "UploadToTexture", Qt::BlockingQueuedConnection,
-                            OLIVE_NS_ARG(Texture*, texture),
-                            Q_ARG(const void*, data),
-                            Q_ARG(int, linesize));
+  // The caller is free to reuse its buffer as soon as we return, so take a copy of it. The last
+  // row is only as long as the image itself, the source may not have any padding after it.
+  const VideoParams& p = texture->params();
+  int bpp = p.GetBytesPerPixel();
+  int row_pixels = qMax(linesize, p.effective_width());
+  qint64 sz = (qint64(row_pixels) * (p.effective_height() - 1) + p.effective_width()) * bpp;
+  QByteArray copy(static_cast<const char*>(data), int(sz));
+  Renderer* inner = inner_;
+  std::shared_ptr<Texture> view = CreateTextureView(texture);
+  Submit([inner, view, copy, linesize]{
+    inner->UploadToTexture(view.get(), copy.constData(), linesize);
+  });
+}
+
+void RendererThreadWrapper::UploadFrameToTexture(Texture *texture, FramePtr frame)
+{
+  // Holding the frame keeps its buffer alive until the upload runs, no copy needed
+  Renderer* inner = inner_;
+  std::shared_ptr<Texture> view = CreateTextureView(texture);
+  Submit([inner, view, frame]{
+    inner->UploadToTexture(view.get(), frame->const_data(), frame->linesize_pixels());
+  });
 }
 
 void RendererThreadWrapper::DownloadFromTexture(Texture *texture, void *data, int linesize)
 {
-  QMetaObject::invokeMethod(inner_, "DownloadFromTexture", Qt::BlockingQueuedConnection,
-                            OLIVE_NS_ARG(Texture*, texture),
-                            Q_ARG(void*, data),
-                            Q_ARG(int, linesize));
+  Renderer* inner = inner_;
+  SubmitAndWait([inner, texture, data, linesize]{
+    inner->DownloadFromTexture(texture, data, linesize);
+  });
 }
 
 void RendererThreadWrapper::Blit(QVariant shader, ShaderJob job, Texture *destination, VideoParams destination_params, bool clear_destination)
 {
-  QMetaObject::invokeMethod(inner_, "Blit", Qt::BlockingQueuedConnection,
-                            Q_ARG(QVariant, shader),
-                            OLIVE_NS_ARG(ShaderJob, job),
-                            OLIVE_NS_ARG(Texture*, destination),
-                            OLIVE_NS_ARG(VideoParams, destination_params),
-                            Q_ARG(bool, clear_destination));
+  Renderer* inner = inner_;
+  std::shared_ptr<Texture> view = CreateTextureView(destination);
+  Submit([inner, shader, job, view, destination_params, clear_destination]{
+    QMetaObject::invokeMethod(inner, "Blit", Qt::DirectConnection,
+                              Q_ARG(QVariant, shader),
+                              OLIVE_NS_ARG(ShaderJob, job),
+                              OLIVE_NS_ARG(Texture*, view.get()),
+                              OLIVE_NS_ARG(VideoParams, destination_params),
+                              Q_ARG(bool, clear_destination));
+  });
+}
+
+std::shared_ptr<Texture> RendererThreadWrapper::CreateTextureView(Texture *texture)
+{
+  if (!texture) {
+    return nullptr;
+  }
+
+  // A texture with no renderer doesn't destroy its native handle when it's deleted
+  return std::make_shared<Texture>(nullptr, texture->id(), texture->params(), texture->type());
+}
+
+void RendererThreadWrapper::Submit(const Command &command)
+{
+  QMutexLocker locker(&queue_lock_);
+
+  queue_.push_back(command);
+  stats_.commands++;
+
+  // Only wake the renderer thread if it isn't already going to drain the queue
+  if (!drain_queued_) {
+    drain_queued_ = true;
+    QMetaObject::invokeMethod(worker_, "ProcessCommands", Qt::QueuedConnection);
+  }
+}
+
+void RendererThreadWrapper::SubmitAndWait(const Command &command)
+{
+  QElapsedTimer timer;
+  timer.start();
+
+  bool done = false;
+
+  Submit([this, &command, &done]{
+    command();
+
+    QMutexLocker locker(&completion_lock_);
+    done = true;
+    completion_wait_.wakeAll();
+  });
+
+  completion_lock_.lock();
+  while (!done) {
+    completion_wait_.wait(&completion_lock_);
+  }
+  completion_lock_.unlock();
+
+  QMutexLocker locker(&queue_lock_);
+  stats_.blocking_calls++;
+  stats_.blocking_nsec += timer.nsecsElapsed();
+}
+
+void RendererThreadWrapper::ProcessCommands()
+{
+  std::deque<Command> batch;
+
+  forever {
+    {
+      QMutexLocker locker(&queue_lock_);
+
+      if (queue_.empty()) {
+        drain_queued_ = false;
+        return;
+      }
+
+      batch.swap(queue_);
+      stats_.batches++;
+    }
+
+    // Commands run without the lock held so other threads can keep queueing behind them
+    for (size_t i=0; i<batch.size(); i++) {
+      batch[i]();
+    }
+
+    batch.clear();
+  }
+}
+
+void RendererThreadWrapperWorker::ProcessCommands()
+{
+  wrapper_->ProcessCommands();
 }
 
 }
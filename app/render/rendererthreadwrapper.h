@@ -21,12 +21,47 @@
 #ifndef RENDERCONTEXTTHREADWRAPPER_H
 #define RENDERCONTEXTTHREADWRAPPER_H
 
+#include <deque>
+#include <functional>
+#include <QMutex>
 #include <QThread>
+#include <QWaitCondition>
 
 #include "renderer.h"
 
 namespace olive {
 
+class RendererThreadWrapper;
+
+/**
+ * @brief Receives RendererThreadWrapper's queued wake-ups in the renderer thread
+ */
+class RendererThreadWrapperWorker : public QObject
+{
+  Q_OBJECT
+public:
+  RendererThreadWrapperWorker(RendererThreadWrapper* wrapper) :
+    wrapper_(wrapper)
+  {
+  }
+
+public slots:
+  void ProcessCommands();
+
+private:
+  RendererThreadWrapper* wrapper_;
+
+};
+
+/**
+ * @brief Runs a renderer with thread affinity (e.g. OpenGLRenderer) on its own thread
+ *
+ * Calls from any number of render threads are recorded as commands in one FIFO queue which the
+ * renderer thread drains in batches, so a burst of calls costs a single wake-up rather than a
+ * BlockingQueuedConnection round-trip each. Calls that don't return anything (destroys, uploads,
+ * clears and blits) are fire-and-forget. Only calls that need a result (creates, shader compiles
+ * and downloads) block the caller until the queue has caught up to them.
+ */
 class RendererThreadWrapper : public Renderer
 {
 public:
@@ -39,6 +74,28 @@ public:
     delete inner_;
   }
 
+  struct Statistics {
+    /// Total commands submitted to the renderer thread
+    qint64 commands;
+
+    /// Number of times the renderer thread woke up to drain the queue
+    qint64 batches;
+
+    /// Number of commands that blocked the calling thread
+    qint64 blocking_calls;
+
+    /// Total time callers spent blocked, in nanoseconds
+    qint64 blocking_nsec;
+  };
+
+  /**
+   * @brief Returns the statistics collected since the last call and resets them
+   *
+   * Calls from every render thread go through one queue, so these are totals. ExportTask divides
+   * them by the frames it rendered to report per-frame figures.
+   */
+  Statistics TakeStatistics();
+
   virtual bool Init() override;
 
   virtual void PostDestroy() override {}
@@ -61,6 +118,8 @@ public slots:
 
   virtual void UploadToTexture(olive::Texture* texture, const void* data, int linesize) override;
 
+  virtual void UploadFrameToTexture(olive::Texture* texture, olive::FramePtr frame) override;
+
   virtual void DownloadFromTexture(olive::Texture* texture, void* data, int linesize) override;
 
 protected slots:
@@ -71,10 +130,43 @@ protected slots:
                     bool clear_destination) override;
 
 private:
+  using Command = std::function<void()>;
+
+  /**
+   * @brief Creates a non-owning copy of `texture` that remains valid after `texture` is deleted
+   *
+   * Fire-and-forget commands must not hold a raw pointer to a Texture the caller may free before
+   * the command runs. Deleting the original queues its destroy after any commands referencing
+   * it, so the native handle stays valid for as long as the copy is used.
+   */
+  static std::shared_ptr<Texture> CreateTextureView(Texture* texture);
+
+  void Submit(const Command& command);
+
+  void SubmitAndWait(const Command& command);
+
+  void ProcessCommands();
+
   Renderer* inner_;
 
   QThread* thread_;
 
+  RendererThreadWrapperWorker* worker_;
+
+  std::deque<Command> queue_;
+
+  bool drain_queued_;
+
+  QMutex queue_lock_;
+
+  QMutex completion_lock_;
+
+  QWaitCondition completion_wait_;
+
+  Statistics stats_;
+
+  friend class RendererThreadWrapperWorker;
+
 };
 
 }
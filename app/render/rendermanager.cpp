@@ -29,6 +29,7 @@
 #include "core.h"
 #include "render/opengl/openglrenderer.h"
 #include "render/rendererthreadwrapper.h"
+#include "render/software/softwarerenderer.h"
 #include "renderprocessor.h"
 #include "task/conform/conform.h"
 #include "task/taskmanager.h"
@@ -40,28 +41,35 @@ RenderManager* RenderManager::instance_ = nullptr;
 
 RenderManager::RenderManager(QObject *parent) :
   ThreadPool(QThread::IdlePriority, 0, parent),
-  backend_(kOpenGL)
+  context_(nullptr),
+  backend_(static_cast<Backend>(Config::Current()[QStringLiteral("RenderBackend")].toInt()))
 {
-  Renderer* graphics_renderer = nullptr;
-
-  if (backend_ == kOpenGL) {
-    graphics_renderer = new OpenGLRenderer();
+  switch (backend_) {
+  case kOpenGL:
+    // OpenGL contexts belong to one thread, so all calls are funneled through a wrapper
+    context_ = new RendererThreadWrapper(new OpenGLRenderer(), this);
+    break;
+  case kSoftware:
+    // The software renderer is thread-safe, so render threads can call into it directly
+    context_ = new SoftwareRenderer(this);
+    break;
+  case kDummy:
+    break;
   }
 
-  if (graphics_renderer) {
-    context_ = new RendererThreadWrapper(graphics_renderer, this);
+  if (context_) {
     context_->Init();
     context_->PostInit();
 
     still_cache_ = new StillImageCache();
-    decoder_cache_ = new DecoderCache();
+    decoder_pool_ = new DecoderPool(QThread::idealThreadCount());
     shader_cache_ = new ShaderCache();
     default_shader_ = context_->CreateNativeShader(ShaderCode(QString(), QString()));
   } else {
     qCritical() << "Tried to initialize unknown graphics backend";
     context_ = nullptr;
     still_cache_ = nullptr;
-    decoder_cache_ = nullptr;
+    decoder_pool_ = nullptr;
   }
 }
 
@@ -70,8 +78,12 @@ RenderManager::~RenderManager()
   if (context_) {
     context_->DestroyNativeShader(default_shader_);
 
+    foreach (const QVariant& shader, *shader_cache_) {
+      context_->DestroyNativeShader(shader);
+    }
+
     delete shader_cache_;
-    delete decoder_cache_;
+    delete decoder_pool_;
     delete still_cache_;
 
     context_->Destroy();
@@ -80,9 +92,9 @@ RenderManager::~RenderManager()
   }
 }
 
-QByteArray RenderManager::Hash(const Node *n, const VideoParams &params, const rational &time)
+QByteArray RenderManager::Hash(const Node *n, const VideoParams &params, const rational &time, Node::HashCache *cache)
 {
-  QCryptographicHash hasher(QCryptographicHash::Sha1);
+  Hash128 hasher;
 
   // Embed video parameters into this hash
   int width = params.effective_width();
@@ -94,12 +106,55 @@ QByteArray RenderManager::Hash(const Node *n, const VideoParams &params, const r
   hasher.addData(reinterpret_cast<const char*>(&format), sizeof(VideoParams::Format));
 
   if (n) {
-    n->Hash(hasher, time);
+    // Always hash through a cache, static nodes contribute their sub-hash rather than their data so
+    // hashes would otherwise differ depending on whether a cache was used
+    if (cache) {
+      Node::HashNode(n, hasher, time, cache);
+    } else {
+      Node::HashCache local_cache;
+      Node::HashNode(n, hasher, time, &local_cache);
+    }
   }
 
   return hasher.result();
 }
 
+QVector<QByteArray> RenderManager::HashFrames(const Node *n, const VideoParams &params, const QVector<rational> &times, const QAtomicInt *cancelled)
+{
+  QVector<QByteArray> hashes(times.size());
+
+  if (times.isEmpty()) {
+    return hashes;
+  }
+
+  // Split into more chunks than threads so uneven graphs still balance out. Each chunk has its own
+  // HashCache so threads don't contend on it, frames within a chunk still share static sub-hashes.
+  QVector<int> chunks(qMin(times.size(), QThread::idealThreadCount() * 4));
+  for (int i=0; i<chunks.size(); i++) {
+    chunks[i] = i;
+  }
+
+  QByteArray* output = hashes.data();
+  const int chunk_count = chunks.size();
+
+  QtConcurrent::blockingMap(chunks, [&](int chunk){
+    int start = static_cast<int>(static_cast<qint64>(times.size()) * chunk / chunk_count);
+    int end = static_cast<int>(static_cast<qint64>(times.size()) * (chunk + 1) / chunk_count);
+
+    Node::HashCache cache;
+
+    for (int i=start; i<end; i++) {
+      if (cancelled && *cancelled) {
+        return;
+      }
+
+      output[i] = Hash(n, params, times.at(i), &cache);
+    }
+  });
+
+  return hashes;
+}
+
 RenderTicketPtr RenderManager::RenderFrame(ViewerOutput* viewer, ColorManager* color_manager,
                                            const rational& time, RenderMode::Mode mode,
                                            FrameHashCache* cache, bool prioritize)
@@ -207,9 +262,21 @@ RenderTicketPtr RenderManager::SaveFrameToCache(FrameHashCache *cache, FramePtr
   return ticket;
 }
 
+bool RenderManager::TakeRendererStatistics(RendererThreadWrapper::Statistics *stats)
+{
+  RendererThreadWrapper* wrapper = dynamic_cast<RendererThreadWrapper*>(context_);
+
+  if (!wrapper) {
+    return false;
+  }
+
+  *stats = wrapper->TakeStatistics();
+  return true;
+}
+
 void RenderManager::RunTicket(RenderTicketPtr ticket) const
 {
-  RenderProcessor::Process(ticket, context_, still_cache_, decoder_cache_, shader_cache_, default_shader_);
+  RenderProcessor::Process(ticket, context_, still_cache_, decoder_pool_, shader_cache_, default_shader_);
 }
 
 }
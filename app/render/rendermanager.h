@@ -25,11 +25,13 @@
 
 #include "config/config.h"
 #include "colorprocessorcache.h"
+#include "decoderpool.h"
 #include "dialog/rendercancel/rendercancel.h"
 #include "node/graph.h"
 #include "node/output/viewer/viewer.h"
 #include "node/traverser.h"
 #include "render/renderer.h"
+#include "render/rendererthreadwrapper.h"
 #include "rendercache.h"
 #include "stillimagecache.h"
 #include "threading/threadpool.h"
@@ -45,7 +47,10 @@ public:
     kOpenGL,
 
     /// No graphics rendering - used to test core threading logic
-    kDummy
+    kDummy,
+
+    /// Multithreaded rendering on the CPU, for machines with no GPU or display
+    kSoftware
   };
 
   static void CreateInstance()
@@ -66,8 +71,19 @@ public:
 
   /**
    * @brief Generate a unique identifier for a certain node at a certain time
+   *
+   * When hashing several frames of an unchanged graph, pass the same `cache` to each call so that
+   * static parts of the graph are only hashed once.
+   */
+  static QByteArray Hash(const Node *n, const VideoParams &params, const rational &time, Node::HashCache* cache = nullptr);
+
+  /**
+   * @brief Generate hashes for several frames at once, split across the global thread pool
+   *
+   * Equivalent to calling Hash() for each time. If `cancelled` is set partway through, the
+   * remaining hashes are left empty.
    */
-  static QByteArray Hash(const Node *n, const VideoParams &params, const rational &time);
+  static QVector<QByteArray> HashFrames(const Node *n, const VideoParams &params, const QVector<rational>& times, const QAtomicInt* cancelled = nullptr);
 
   /**
    * @brief Asynchronously generate a frame at a given time
@@ -119,6 +135,13 @@ public:
     return backend_;
   }
 
+  /**
+   * @brief Retrieves and resets the renderer thread's call statistics
+   *
+   * Returns FALSE if the current backend doesn't run on a renderer thread.
+   */
+  bool TakeRendererStatistics(RendererThreadWrapper::Statistics* stats);
+
 signals:
 
 private:
@@ -134,7 +157,7 @@ private:
 
   StillImageCache* still_cache_;
 
-  DecoderCache* decoder_cache_;
+  DecoderPool* decoder_pool_;
 
   ShaderCache* shader_cache_;
 
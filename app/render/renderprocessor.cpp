@@ -30,14 +30,17 @@
 
 namespace olive {
 
-RenderProcessor::RenderProcessor(RenderTicketPtr ticket, Renderer *render_ctx, StillImageCache* still_image_cache, DecoderCache* decoder_cache, ShaderCache *shader_cache, QVariant default_shader) :
+RenderProcessor::RenderProcessor(RenderTicketPtr ticket, Renderer *render_ctx, StillImageCache* still_image_cache, DecoderPool* decoder_pool, ShaderCache *shader_cache, QVariant default_shader) :
   ticket_(ticket),
   render_ctx_(render_ctx),
   still_image_cache_(still_image_cache),
-  decoder_cache_(decoder_cache),
+  decoder_pool_(decoder_pool),
   shader_cache_(shader_cache),
   default_shader_(default_shader)
 {
+  // Decoding, uploading and rendering here are all thread-safe, so independent branches can run in parallel. Audio
+  // evaluates its inputs once per sample, which would dispatch far too many tiny tasks.
+  SetConcurrentInputs(ticket_->property("type").value<RenderManager::TicketType>() == RenderManager::kTypeVideo);
 }
 
 void RenderProcessor::Run()
@@ -153,36 +156,9 @@ void RenderProcessor::Run()
   }
 }
 
-DecoderPtr RenderProcessor::ResolveDecoderFromInput(StreamPtr stream)
+void RenderProcessor::Process(RenderTicketPtr ticket, Renderer *render_ctx, StillImageCache *still_image_cache, DecoderPool *decoder_pool, ShaderCache *shader_cache, QVariant default_shader)
 {
-  if (!stream) {
-    qWarning() << "Attempted to resolve the decoder of a null stream";
-    return nullptr;
-  }
-
-  QMutexLocker locker(decoder_cache_->mutex());
-
-  DecoderPtr decoder = decoder_cache_->value(stream.get());
-
-  if (!decoder) {
-    // No decoder
-    decoder = Decoder::CreateFromID(stream->footage()->decoder());
-
-    if (decoder->Open(stream)) {
-      decoder_cache_->insert(stream.get(), decoder);
-    } else {
-      qWarning() << "Failed to open decoder for" << stream->footage()->filename()
-                 << "::" << stream->index();
-      return nullptr;
-    }
-  }
-
-  return decoder;
-}
-
-void RenderProcessor::Process(RenderTicketPtr ticket, Renderer *render_ctx, StillImageCache *still_image_cache, DecoderCache *decoder_cache, ShaderCache *shader_cache, QVariant default_shader)
-{
-  RenderProcessor p(ticket, render_ctx, still_image_cache, decoder_cache, shader_cache, default_shader);
+  RenderProcessor p(ticket, render_ctx, still_image_cache, decoder_pool, shader_cache, default_shader);
   p.Run();
 }
 
@@ -325,7 +301,7 @@ QVariant RenderProcessor::ProcessVideoFootage(StreamPtr stream, const rational &
 
     still_image_cache_->mutex()->unlock();
 
-    DecoderPtr decoder = ResolveDecoderFromInput(stream);
+    DecoderPtr decoder = decoder_pool_->Acquire(stream, input_time);
 
     if (decoder) {
       FramePtr frame = decoder->RetrieveVideo(input_time,
@@ -333,9 +309,7 @@ QVariant RenderProcessor::ProcessVideoFootage(StreamPtr stream, const rational &
 
       if (frame) {
         // Return a texture from the derived class
-        TexturePtr unmanaged_texture = render_ctx_->CreateTexture(frame->video_params(),
-                                                                  frame->data(),
-                                                                  frame->linesize_pixels());
+        TexturePtr unmanaged_texture = render_ctx_->CreateTexture(frame);
 
         // We convert to our rendering pixel format, since that will always be float-based which
         // is necessary for correct color conversion
@@ -371,7 +345,7 @@ QVariant RenderProcessor::ProcessAudioFootage(StreamPtr stream, const TimeRange
 {
   QVariant value;
 
-  DecoderPtr decoder = ResolveDecoderFromInput(stream);
+  DecoderPtr decoder = decoder_pool_->Acquire(stream);
 
   if (decoder) {
     const AudioParams& audio_params = ticket_->property("aparam").value<AudioParams>();
@@ -392,17 +366,23 @@ QVariant RenderProcessor::ProcessShader(const Node *node, const TimeRange &range
 
   QString full_shader_id = QStringLiteral("%1:%2").arg(node->id(), job.GetShaderID());
 
-  QMutexLocker locker(shader_cache_->mutex());
+  QVariant shader;
 
-  QVariant shader = shader_cache_->value(full_shader_id);
+  {
+    QMutexLocker locker(shader_cache_->mutex());
 
-  if (shader.isNull()) {
-    // Since we have shader code, compile it now
-    shader = render_ctx_->CreateNativeShader(node->GetShaderCode(job.GetShaderID()));
+    shader = shader_cache_->value(full_shader_id);
 
     if (shader.isNull()) {
-      // Couldn't find or build the shader required
-      return QVariant();
+      // Since we have shader code, compile it now
+      shader = render_ctx_->CreateNativeShader(node->GetShaderCode(job.GetShaderID()));
+
+      if (shader.isNull()) {
+        // Couldn't find or build the shader required
+        return QVariant();
+      }
+
+      shader_cache_->insert(full_shader_id, shader);
     }
   }
 
@@ -444,6 +424,20 @@ QVariant RenderProcessor::ProcessSamples(const Node *node, const TimeRange &rang
 
   const AudioParams& audio_params = ticket_->property("aparam").value<AudioParams>();
 
+  // Unconnected inputs are only keyframes, so evaluate them for every sample in one pass rather than
+  // searching the keyframes again for each sample
+  rational sample_length(1, audio_params.sample_rate());
+  TimeRange sample_range(range.in(), range.in() + sample_length * job.samples()->sample_count());
+  QHash<QString, QVector<QVariant> > input_values;
+
+  for (NodeValueMap::const_iterator j=job.GetValues().constBegin(); j!=job.GetValues().constEnd(); j++) {
+    NodeInput* corresponding_input = node->GetInputWithID(j.key());
+
+    if (corresponding_input && !corresponding_input->is_connected() && !corresponding_input->IsArray()) {
+      input_values.insert(j.key(), corresponding_input->get_values_over_range(sample_range, sample_length));
+    }
+  }
+
   for (int i=0;i<job.samples()->sample_count();i++) {
     // Calculate the exact rational time at this sample
     double sample_to_second = static_cast<double>(i) / static_cast<double>(audio_params.sample_rate());
@@ -456,7 +450,11 @@ QVariant RenderProcessor::ProcessSamples(const Node *node, const TimeRange &rang
       NodeValueTable value;
       NodeInput* corresponding_input = node->GetInputWithID(j.key());
 
-      if (corresponding_input) {
+      QHash<QString, QVector<QVariant> >::const_iterator precalculated = input_values.constFind(j.key());
+
+      if (precalculated != input_values.constEnd() && i < precalculated->size()) {
+        value.Push(corresponding_input->data_type(), precalculated->at(i), corresponding_input->parentNode());
+      } else if (corresponding_input) {
         value = ProcessInput(corresponding_input, TimeRange(this_sample_time, this_sample_time));
       } else {
         value.Push(j.value(), node);
@@ -492,9 +490,7 @@ QVariant RenderProcessor::ProcessFrameGeneration(const Node *node, const Generat
 
   node->GenerateFrame(frame, job);
 
-  TexturePtr texture = render_ctx_->CreateTexture(frame->video_params(),
-                                                  frame->data(),
-                                                  frame->linesize_pixels());
+  TexturePtr texture = render_ctx_->CreateTexture(frame);
 
   return QVariant::fromValue(texture);
 }
@@ -519,7 +515,7 @@ QVariant RenderProcessor::GetCachedFrame(const Node *node, const rational &time)
 
       f->set_video_params(p);
 
-      TexturePtr texture = render_ctx_->CreateTexture(f->video_params(), f->data(), f->linesize_pixels());
+      TexturePtr texture = render_ctx_->CreateTexture(f);
       return QVariant::fromValue(texture);
     }
   }
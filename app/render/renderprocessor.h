@@ -22,6 +22,7 @@
 #define RENDERPROCESSOR_H
 
 #include "node/traverser.h"
+#include "render/decoderpool.h"
 #include "render/renderer.h"
 #include "rendercache.h"
 #include "stillimagecache.h"
@@ -32,7 +33,7 @@ namespace olive {
 class RenderProcessor : public NodeTraverser
 {
 public:
-  static void Process(RenderTicketPtr ticket, Renderer* render_ctx, StillImageCache* still_image_cache, DecoderCache* decoder_cache, ShaderCache* shader_cache, QVariant default_shader);
+  static void Process(RenderTicketPtr ticket, Renderer* render_ctx, StillImageCache* still_image_cache, DecoderPool* decoder_pool, ShaderCache* shader_cache, QVariant default_shader);
 
   struct RenderedWaveform {
     const TrackOutput* track;
@@ -58,19 +59,17 @@ protected:
   virtual QVector2D GenerateResolution() const override;
 
 private:
-  RenderProcessor(RenderTicketPtr ticket, Renderer* render_ctx, StillImageCache* still_image_cache, DecoderCache* decoder_cache, ShaderCache* shader_cache, QVariant default_shader);
+  RenderProcessor(RenderTicketPtr ticket, Renderer* render_ctx, StillImageCache* still_image_cache, DecoderPool* decoder_pool, ShaderCache* shader_cache, QVariant default_shader);
 
   void Run();
 
-  DecoderPtr ResolveDecoderFromInput(StreamPtr stream);
-
   RenderTicketPtr ticket_;
 
   Renderer* render_ctx_;
 
   StillImageCache* still_image_cache_;
 
-  DecoderCache* decoder_cache_;
+  DecoderPool* decoder_pool_;
 
   ShaderCache* shader_cache_;
 
@@ -0,0 +1,1170 @@
+/***
+
+  Olive - Non-Linear Video Editor
+  Copyright (C) 2020 Olive Team
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+***/
+
+#include "softwarerenderer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <QFloat16>
+#include <QtConcurrent/QtConcurrent>
+#include <QtMath>
+#include <QVector2D>
+
+#include "common/clamp.h"
+#include "render/job/shaderjob.h"
+
+namespace olive {
+
+// Below this many pixels, spreading a blit across threads costs more than it saves
+const qint64 kMinimumPixelsForThreading = 65536;
+
+/**
+ * @brief Run `func(start_row, end_row)` over `height` rows, split into bands across the global pool
+ */
+template <typename F>
+void ParallelRows(int width, int height, const F& func)
+{
+  int band_count = 1;
+
+  if (qint64(width) * qint64(height) >= kMinimumPixelsForThreading) {
+    band_count = qMin(height, QThreadPool::globalInstance()->maxThreadCount());
+  }
+
+  if (band_count <= 1) {
+    func(0, height);
+    return;
+  }
+
+  QVector< QPair<int, int> > bands(band_count);
+  int rows_per_band = height / band_count;
+  for (int i=0; i<band_count; i++) {
+    bands[i].first = i * rows_per_band;
+    bands[i].second = (i == band_count - 1) ? height : bands[i].first + rows_per_band;
+  }
+
+  QtConcurrent::blockingMap(bands, [&func](QPair<int, int>& band){
+    func(band.first, band.second);
+  });
+}
+
+/**
+ * @brief Maps destination pixels back to texture coordinates through the inverse of `ove_mvpmat`
+ *
+ * This reproduces what default.vert plus the rasterizer do on the GPU: the unit quad is transformed
+ * by the MVP matrix and every destination pixel whose center lands inside it is shaded with the
+ * interpolated texture coordinate.
+ */
+class Rasterizer
+{
+public:
+  Rasterizer(int width, int height, const QMatrix4x4& matrix) :
+    width_(width),
+    height_(height)
+  {
+    identity_ = matrix.isIdentity();
+
+    if (identity_) {
+      valid_ = true;
+      return;
+    }
+
+    // The quad lies on z = 0, so the 4x4 matrix reduces to a 2D homography
+    double h[9] = {matrix(0, 0), matrix(0, 1), matrix(0, 3),
+                   matrix(1, 0), matrix(1, 1), matrix(1, 3),
+                   matrix(3, 0), matrix(3, 1), matrix(3, 3)};
+
+    double det = h[0] * (h[4] * h[8] - h[5] * h[7])
+        - h[1] * (h[3] * h[8] - h[5] * h[6])
+        + h[2] * (h[3] * h[7] - h[4] * h[6]);
+
+    valid_ = !qFuzzyIsNull(det);
+
+    if (valid_) {
+      double inv_det = 1.0 / det;
+
+      inverse_[0] = (h[4] * h[8] - h[5] * h[7]) * inv_det;
+      inverse_[1] = (h[2] * h[7] - h[1] * h[8]) * inv_det;
+      inverse_[2] = (h[1] * h[5] - h[2] * h[4]) * inv_det;
+      inverse_[3] = (h[5] * h[6] - h[3] * h[8]) * inv_det;
+      inverse_[4] = (h[0] * h[8] - h[2] * h[6]) * inv_det;
+      inverse_[5] = (h[2] * h[3] - h[0] * h[5]) * inv_det;
+      inverse_[6] = (h[3] * h[7] - h[4] * h[6]) * inv_det;
+      inverse_[7] = (h[1] * h[6] - h[0] * h[7]) * inv_det;
+      inverse_[8] = (h[0] * h[4] - h[1] * h[3]) * inv_det;
+    }
+  }
+
+  int width() const
+  {
+    return width_;
+  }
+
+  int height() const
+  {
+    return height_;
+  }
+
+  bool valid() const
+  {
+    return valid_;
+  }
+
+  /**
+   * @brief Get the texture coordinate of a destination pixel, returns FALSE if the quad doesn't cover it
+   */
+  inline bool Map(int x, int y, float* tx, float* ty) const
+  {
+    if (identity_) {
+      *tx = (float(x) + 0.5f) / float(width_);
+      *ty = (float(y) + 0.5f) / float(height_);
+      return true;
+    }
+
+    double nx = (double(x) + 0.5) / double(width_) * 2.0 - 1.0;
+    double ny = (double(y) + 0.5) / double(height_) * 2.0 - 1.0;
+
+    double w = inverse_[6] * nx + inverse_[7] * ny + inverse_[8];
+
+    if (qFuzzyIsNull(w)) {
+      return false;
+    }
+
+    double px = (inverse_[0] * nx + inverse_[1] * ny + inverse_[2]) / w;
+    double py = (inverse_[3] * nx + inverse_[4] * ny + inverse_[5]) / w;
+
+    if (px < -1.0 || px > 1.0 || py < -1.0 || py > 1.0) {
+      return false;
+    }
+
+    *tx = float((px + 1.0) * 0.5);
+    *ty = float((py + 1.0) * 0.5);
+    return true;
+  }
+
+private:
+  int width_;
+
+  int height_;
+
+  bool identity_;
+
+  bool valid_;
+
+  double inverse_[9];
+
+};
+
+/**
+ * @brief Equivalent of a GLSL sampler2D with GL_CLAMP_TO_EDGE wrapping
+ */
+class Sampler
+{
+public:
+  Sampler() :
+    tex_(nullptr),
+    interpolation_(Texture::kLinear)
+  {
+  }
+
+  Sampler(const SoftwareRenderer::NativeTexture* tex, Texture::Interpolation interp) :
+    tex_(tex),
+    interpolation_(interp)
+  {
+  }
+
+  bool enabled() const
+  {
+    return tex_ != nullptr;
+  }
+
+  inline void Sample(float tx, float ty, float* out) const
+  {
+    if (!tex_ || tex_->pixels.empty()) {
+      out[0] = out[1] = out[2] = out[3] = 0.0f;
+      return;
+    }
+
+    const int w = tex_->width;
+    const int h = tex_->height;
+    const float* px = tex_->pixels.data();
+
+    if (interpolation_ == Texture::kNearest) {
+      int x = clamp(int(qFloor(tx * w)), 0, w - 1);
+      int y = clamp(int(qFloor(ty * h)), 0, h - 1);
+
+      const float* p = px + (y * w + x) * SoftwareRenderer::kPixelStride;
+      for (int i=0; i<SoftwareRenderer::kPixelStride; i++) {
+        out[i] = p[i];
+      }
+    } else {
+      // Mipmapped linear falls back to plain bilinear filtering since no mipmaps are generated here
+      float u = tx * w - 0.5f;
+      float v = ty * h - 0.5f;
+
+      int x0 = qFloor(u);
+      int y0 = qFloor(v);
+
+      float fx = u - x0;
+      float fy = v - y0;
+
+      int x1 = clamp(x0 + 1, 0, w - 1);
+      int y1 = clamp(y0 + 1, 0, h - 1);
+      x0 = clamp(x0, 0, w - 1);
+      y0 = clamp(y0, 0, h - 1);
+
+      const float* p00 = px + (y0 * w + x0) * SoftwareRenderer::kPixelStride;
+      const float* p10 = px + (y0 * w + x1) * SoftwareRenderer::kPixelStride;
+      const float* p01 = px + (y1 * w + x0) * SoftwareRenderer::kPixelStride;
+      const float* p11 = px + (y1 * w + x1) * SoftwareRenderer::kPixelStride;
+
+      for (int i=0; i<SoftwareRenderer::kPixelStride; i++) {
+        float top = p00[i] + (p10[i] - p00[i]) * fx;
+        float bottom = p01[i] + (p11[i] - p01[i]) * fx;
+        out[i] = top + (bottom - top) * fy;
+      }
+    }
+  }
+
+private:
+  const SoftwareRenderer::NativeTexture* tex_;
+
+  Texture::Interpolation interpolation_;
+
+};
+
+/**
+ * @brief Everything a kernel may read: the job's uniforms and textures
+ */
+class KernelInput
+{
+public:
+  KernelInput(const ShaderJob& job, int iteration, const SoftwareRenderer::NativeTexture* iterative_override) :
+    job_(job),
+    iteration_(iteration),
+    iterative_override_(iterative_override)
+  {
+  }
+
+  int iteration() const
+  {
+    return iteration_;
+  }
+
+  Sampler GetSampler(const QString& name) const
+  {
+    Texture::Interpolation interp = job_.GetInterpolation(name);
+
+    if (iterative_override_ && name == job_.GetIterativeInput()) {
+      return Sampler(iterative_override_, interp);
+    }
+
+    TexturePtr tex = job_.GetValue(name).data.value<TexturePtr>();
+
+    if (tex) {
+      return Sampler(Node::ValueToPtr<SoftwareRenderer::NativeTexture>(tex->id()), interp);
+    } else {
+      return Sampler();
+    }
+  }
+
+  float GetFloat(const QString& name) const
+  {
+    return job_.GetValue(name).data.toFloat();
+  }
+
+  int GetInt(const QString& name) const
+  {
+    return job_.GetValue(name).data.toInt();
+  }
+
+  bool GetBool(const QString& name) const
+  {
+    return job_.GetValue(name).data.toBool();
+  }
+
+  QVector2D GetVec2(const QString& name) const
+  {
+    return job_.GetValue(name).data.value<QVector2D>();
+  }
+
+  void GetColor(const QString& name, float* out) const
+  {
+    Color c = job_.GetValue(name).data.value<Color>();
+    out[0] = c.red();
+    out[1] = c.green();
+    out[2] = c.blue();
+    out[3] = c.alpha();
+  }
+
+private:
+  const ShaderJob& job_;
+
+  int iteration_;
+
+  const SoftwareRenderer::NativeTexture* iterative_override_;
+
+};
+
+/**
+ * @brief Base for kernels that shade one pixel at a time
+ */
+template <typename K>
+class PixelKernel
+{
+public:
+  void ShadeRow(const Rasterizer& r, int y, float* dst) const
+  {
+    float tx, ty;
+
+    for (int x=0; x<r.width(); x++) {
+      if (r.Map(x, y, &tx, &ty)) {
+        static_cast<const K*>(this)->Shade(tx, ty, dst + x * SoftwareRenderer::kPixelStride);
+      }
+    }
+  }
+};
+
+// Port of default.frag
+class DefaultKernel : public PixelKernel<DefaultKernel>
+{
+public:
+  DefaultKernel(const KernelInput& in) :
+    tex_(in.GetSampler(QStringLiteral("ove_maintex")))
+  {
+  }
+
+  inline void Shade(float tx, float ty, float* out) const
+  {
+    tex_.Sample(tx, ty, out);
+  }
+
+private:
+  Sampler tex_;
+
+};
+
+// Port of alphaover.frag
+class AlphaOverKernel : public PixelKernel<AlphaOverKernel>
+{
+public:
+  AlphaOverKernel(const KernelInput& in) :
+    base_(in.GetSampler(QStringLiteral("base_in"))),
+    blend_(in.GetSampler(QStringLiteral("blend_in")))
+  {
+  }
+
+  inline void Shade(float tx, float ty, float* out) const
+  {
+    if (!blend_.enabled()) {
+      base_.Sample(tx, ty, out);
+    } else if (!base_.enabled()) {
+      blend_.Sample(tx, ty, out);
+    } else {
+      float blend[SoftwareRenderer::kPixelStride];
+
+      base_.Sample(tx, ty, out);
+      blend_.Sample(tx, ty, blend);
+
+      float inv_alpha = 1.0f - blend[3];
+      for (int i=0; i<SoftwareRenderer::kPixelStride; i++) {
+        out[i] = out[i] * inv_alpha + blend[i];
+      }
+    }
+  }
+
+private:
+  Sampler base_;
+
+  Sampler blend_;
+
+};
+
+// Port of crossdissolve.frag
+class CrossDissolveKernel : public PixelKernel<CrossDissolveKernel>
+{
+public:
+  CrossDissolveKernel(const KernelInput& in) :
+    out_block_(in.GetSampler(QStringLiteral("out_block_in"))),
+    in_block_(in.GetSampler(QStringLiteral("in_block_in")))
+  {
+    int curve = in.GetInt(QStringLiteral("curve_in"));
+    float progress = in.GetFloat(QStringLiteral("ove_tprog_all"));
+
+    out_weight_ = TransformCurve(curve, 1.0f - progress);
+    in_weight_ = TransformCurve(curve, progress);
+  }
+
+  inline void Shade(float tx, float ty, float* out) const
+  {
+    float a[SoftwareRenderer::kPixelStride];
+    float b[SoftwareRenderer::kPixelStride];
+
+    out_block_.Sample(tx, ty, a);
+    in_block_.Sample(tx, ty, b);
+
+    for (int i=0; i<SoftwareRenderer::kPixelStride; i++) {
+      out[i] = a[i] * out_weight_ + b[i] * in_weight_;
+    }
+  }
+
+private:
+  static float TransformCurve(int curve, float linear)
+  {
+    switch (curve) {
+    case 1:
+      // Exponential
+      return linear * linear;
+    case 2:
+      // Logarithmic
+      return qSqrt(linear);
+    default:
+      return linear;
+    }
+  }
+
+  Sampler out_block_;
+
+  Sampler in_block_;
+
+  float out_weight_;
+
+  float in_weight_;
+
+};
+
+// Port of diptoblack.frag
+class DipToColorKernel : public PixelKernel<DipToColorKernel>
+{
+public:
+  DipToColorKernel(const KernelInput& in) :
+    out_block_(in.GetSampler(QStringLiteral("out_block_in"))),
+    in_block_(in.GetSampler(QStringLiteral("in_block_in")))
+  {
+    in.GetColor(QStringLiteral("color_in"), color_);
+    progress_all_ = in.GetFloat(QStringLiteral("ove_tprog_all"));
+    progress_out_ = in.GetFloat(QStringLiteral("ove_tprog_out"));
+    progress_in_ = in.GetFloat(QStringLiteral("ove_tprog_in"));
+  }
+
+  inline void Shade(float tx, float ty, float* out) const
+  {
+    float tmp[SoftwareRenderer::kPixelStride];
+
+    if (out_block_.enabled() && in_block_.enabled()) {
+      out_block_.Sample(tx, ty, out);
+      in_block_.Sample(tx, ty, tmp);
+
+      for (int i=0; i<SoftwareRenderer::kPixelStride; i++) {
+        out[i] = Mix(out[i], color_[i], progress_out_) + Mix(tmp[i], color_[i], 1.0f - progress_in_);
+      }
+    } else if (out_block_.enabled()) {
+      out_block_.Sample(tx, ty, out);
+
+      for (int i=0; i<SoftwareRenderer::kPixelStride; i++) {
+        out[i] = Mix(out[i], color_[i], progress_all_);
+      }
+    } else if (in_block_.enabled()) {
+      in_block_.Sample(tx, ty, out);
+
+      for (int i=0; i<SoftwareRenderer::kPixelStride; i++) {
+        out[i] = Mix(out[i], color_[i], 1.0f - progress_all_);
+      }
+    } else {
+      out[0] = out[1] = out[2] = out[3] = 0.0f;
+    }
+  }
+
+private:
+  static inline float Mix(float a, float b, float t)
+  {
+    return a + (b - a) * t;
+  }
+
+  Sampler out_block_;
+
+  Sampler in_block_;
+
+  float color_[SoftwareRenderer::kPixelStride];
+
+  float progress_all_;
+
+  float progress_out_;
+
+  float progress_in_;
+
+};
+
+// Port of blur.frag, weights are calculated once per blit rather than once per pixel
+class BlurKernel : public PixelKernel<BlurKernel>
+{
+public:
+  BlurKernel(const KernelInput& in) :
+    tex_(in.GetSampler(QStringLiteral("tex_in")))
+  {
+    float radius = in.GetFloat(QStringLiteral("radius_in"));
+    bool horiz = in.GetBool(QStringLiteral("horiz_in"));
+    bool vert = in.GetBool(QStringLiteral("vert_in"));
+
+    repeat_edge_pixels_ = in.GetBool(QStringLiteral("repeat_edge_pixels_in"));
+
+    // Equivalent of determine_mode()
+    horizontal_ = false;
+    enabled_ = true;
+    if (qIsNull(radius) || (!horiz && !vert)) {
+      enabled_ = false;
+    } else if (horiz && !vert) {
+      horizontal_ = true;
+    } else if (vert && !horiz) {
+      horizontal_ = false;
+    } else if (in.iteration() == 0) {
+      horizontal_ = true;
+    } else if (in.iteration() == 1) {
+      horizontal_ = false;
+    } else {
+      enabled_ = false;
+    }
+
+    if (!enabled_) {
+      return;
+    }
+
+    QVector2D resolution = in.GetVec2(QStringLiteral("resolution_in"));
+    float resolution_dim = horizontal_ ? resolution.x() : resolution.y();
+
+    // We only sample on hard pixels, so we don't accept decimal radii
+    float real_radius = qCeil(radius);
+
+    bool gaussian = (in.GetInt(QStringLiteral("method_in")) == 1);
+    float sigma = real_radius;
+    float divider = 0.0f;
+
+    if (gaussian) {
+      real_radius *= 3.0f;
+
+      for (float i = -real_radius + 0.5f; i <= real_radius; i += 2.0f) {
+        divider += Gaussian(i, sigma);
+      }
+    } else {
+      divider = 1.0f / real_radius;
+    }
+
+    for (float i = -real_radius + 0.5f; i <= real_radius; i += 2.0f) {
+      offsets_.push_back(i / resolution_dim);
+      weights_.push_back(gaussian ? Gaussian(i, sigma) / divider : divider);
+    }
+  }
+
+  inline void Shade(float tx, float ty, float* out) const
+  {
+    if (!enabled_) {
+      tex_.Sample(tx, ty, out);
+      return;
+    }
+
+    float composite[SoftwareRenderer::kPixelStride] = {0.0f, 0.0f, 0.0f, 0.0f};
+    float sample[SoftwareRenderer::kPixelStride];
+
+    for (size_t i=0; i<offsets_.size(); i++) {
+      float sx = tx;
+      float sy = ty;
+
+      if (horizontal_) {
+        sx += offsets_[i];
+      } else {
+        sy += offsets_[i];
+      }
+
+      if (repeat_edge_pixels_
+          || (sx >= 0.0f && sx < 1.0f && sy >= 0.0f && sy < 1.0f)) {
+        tex_.Sample(sx, sy, sample);
+
+        for (int j=0; j<SoftwareRenderer::kPixelStride; j++) {
+          composite[j] += sample[j] * weights_[i];
+        }
+      }
+    }
+
+    for (int j=0; j<SoftwareRenderer::kPixelStride; j++) {
+      out[j] = composite[j];
+    }
+  }
+
+private:
+  static float Gaussian(float x, float sigma)
+  {
+    return (1.0f / ((sigma * sigma) * 2.0f * float(M_PI))) * qExp(-0.5f * ((x * x) / (sigma * sigma)));
+  }
+
+  Sampler tex_;
+
+  bool enabled_;
+
+  bool horizontal_;
+
+  bool repeat_edge_pixels_;
+
+  std::vector<float> offsets_;
+
+  std::vector<float> weights_;
+
+};
+
+// Port of mosaic.frag
+class MosaicKernel : public PixelKernel<MosaicKernel>
+{
+public:
+  MosaicKernel(const KernelInput& in) :
+    tex_(in.GetSampler(QStringLiteral("tex_in"))),
+    horiz_(in.GetFloat(QStringLiteral("horiz_in"))),
+    vert_(in.GetFloat(QStringLiteral("vert_in")))
+  {
+  }
+
+  inline void Shade(float tx, float ty, float* out) const
+  {
+    if (horiz_ > 0.0f) {
+      tx = qFloor(tx * horiz_) / horiz_;
+    }
+
+    if (vert_ > 0.0f) {
+      ty = qFloor(ty * vert_) / vert_;
+    }
+
+    tex_.Sample(tx, ty, out);
+  }
+
+private:
+  Sampler tex_;
+
+  float horiz_;
+
+  float vert_;
+
+};
+
+// Port of crop.frag
+class CropKernel : public PixelKernel<CropKernel>
+{
+public:
+  CropKernel(const KernelInput& in) :
+    tex_(in.GetSampler(QStringLiteral("tex_in"))),
+    left_(in.GetFloat(QStringLiteral("left_in"))),
+    top_(in.GetFloat(QStringLiteral("top_in"))),
+    right_(in.GetFloat(QStringLiteral("right_in"))),
+    bottom_(in.GetFloat(QStringLiteral("bottom_in"))),
+    feather_(in.GetFloat(QStringLiteral("feather_in")))
+  {
+    QVector2D resolution = in.GetVec2(QStringLiteral("resolution_in"));
+    feather_x_ = feather_ / resolution.x();
+    feather_y_ = feather_ / resolution.y();
+  }
+
+  inline void Shade(float tx, float ty, float* out) const
+  {
+    float multiplier = 1.0f;
+
+    if (qIsNull(feather_)) {
+      if (tx < left_ || tx > (1.0f - right_) || ty < top_ || ty > (1.0f - bottom_)) {
+        multiplier = 0.0f;
+      }
+    } else {
+      multiplier *= clamp((tx - (left_ - feather_x_ * (1.0f - left_))) / feather_x_, 0.0f, 1.0f);
+      multiplier *= 1.0f - clamp((tx - ((1.0f - right_) - feather_x_ * right_)) / feather_x_, 0.0f, 1.0f);
+      multiplier *= clamp((ty - (top_ - feather_y_ * (1.0f - top_))) / feather_y_, 0.0f, 1.0f);
+      multiplier *= 1.0f - clamp((ty - ((1.0f - bottom_) - feather_y_ * bottom_)) / feather_y_, 0.0f, 1.0f);
+    }
+
+    if (multiplier > 0.0f) {
+      tex_.Sample(tx, ty, out);
+
+      for (int i=0; i<SoftwareRenderer::kPixelStride; i++) {
+        out[i] *= multiplier;
+      }
+    } else {
+      out[0] = out[1] = out[2] = out[3] = 0.0f;
+    }
+  }
+
+private:
+  Sampler tex_;
+
+  float left_;
+
+  float top_;
+
+  float right_;
+
+  float bottom_;
+
+  float feather_;
+
+  float feather_x_;
+
+  float feather_y_;
+
+};
+
+// Port of solid.frag
+class SolidKernel : public PixelKernel<SolidKernel>
+{
+public:
+  SolidKernel(const KernelInput& in)
+  {
+    in.GetColor(QStringLiteral("color_in"), color_);
+  }
+
+  inline void Shade(float, float, float* out) const
+  {
+    for (int i=0; i<SoftwareRenderer::kPixelStride; i++) {
+      out[i] = color_[i];
+    }
+  }
+
+private:
+  float color_[SoftwareRenderer::kPixelStride];
+
+};
+
+/**
+ * @brief Equivalent of the shader Renderer::CreateColorContext() generates, using OCIO's CPU processor
+ *
+ * OCIO works best on whole rows, so this kernel shades a row into a scratch buffer first and only
+ * then copies the pixels the quad covers into the destination.
+ */
+class ColorKernel
+{
+public:
+  ColorKernel(const KernelInput& in, ColorProcessorPtr processor) :
+    tex_(in.GetSampler(QStringLiteral("ove_maintex"))),
+    alpha_(in.GetInt(QStringLiteral("ove_maintex_alpha"))),
+    processor_(processor->GetCPUProcessor())
+  {
+  }
+
+  void ShadeRow(const Rasterizer& r, int y, float* dst) const
+  {
+    const int w = r.width();
+
+    std::vector<float> row(w * SoftwareRenderer::kPixelStride, 0.0f);
+    std::vector<char> covered(w);
+
+    float tx, ty;
+    for (int x=0; x<w; x++) {
+      covered[x] = r.Map(x, y, &tx, &ty);
+
+      if (covered[x]) {
+        tex_.Sample(tx, ty, &row[x * SoftwareRenderer::kPixelStride]);
+      }
+    }
+
+    // Matches `AlphaAssociated` C++ enum
+    if (alpha_ == 2) {
+      for (int x=0; x<w; x++) {
+        float* p = &row[x * SoftwareRenderer::kPixelStride];
+        if (!qIsNull(p[3])) {
+          p[0] /= p[3];
+          p[1] /= p[3];
+          p[2] /= p[3];
+        }
+      }
+    }
+
+    OCIO::PackedImageDesc img(row.data(), w, 1, SoftwareRenderer::kPixelStride);
+    processor_->apply(img);
+
+    if (alpha_ == 1 || alpha_ == 2) {
+      for (int x=0; x<w; x++) {
+        float* p = &row[x * SoftwareRenderer::kPixelStride];
+        p[0] *= p[3];
+        p[1] *= p[3];
+        p[2] *= p[3];
+      }
+    }
+
+    for (int x=0; x<w; x++) {
+      if (covered[x]) {
+        memcpy(dst + x * SoftwareRenderer::kPixelStride,
+               &row[x * SoftwareRenderer::kPixelStride],
+               SoftwareRenderer::kPixelStride * sizeof(float));
+      }
+    }
+  }
+
+private:
+  Sampler tex_;
+
+  int alpha_;
+
+  OCIO::ConstCPUProcessorRcPtr processor_;
+
+};
+
+template <typename K>
+void RunKernel(const K& kernel, const Rasterizer& r, SoftwareRenderer::NativeTexture* dst)
+{
+  float* pixels = dst->pixels.data();
+  const int stride = r.width() * SoftwareRenderer::kPixelStride;
+
+  ParallelRows(r.width(), r.height(), [&kernel, &r, pixels, stride](int start, int end){
+    for (int y=start; y<end; y++) {
+      kernel.ShadeRow(r, y, pixels + y * stride);
+    }
+  });
+}
+
+SoftwareRenderer::SoftwareRenderer(QObject *parent) :
+  Renderer(parent)
+{
+}
+
+SoftwareRenderer::~SoftwareRenderer()
+{
+  Destroy();
+  PostDestroy();
+}
+
+bool SoftwareRenderer::Init()
+{
+  return true;
+}
+
+void SoftwareRenderer::PostDestroy()
+{
+}
+
+void SoftwareRenderer::PostInit()
+{
+  // Built-in shaders we have native kernels for
+  builtin_shaders_.insert(FileFunctions::ReadFileAsString(QStringLiteral(":/shaders/default.frag")), kKernelDefault);
+  builtin_shaders_.insert(FileFunctions::ReadFileAsString(QStringLiteral(":/shaders/alphaover.frag")), kKernelAlphaOver);
+  builtin_shaders_.insert(FileFunctions::ReadFileAsString(QStringLiteral(":/shaders/crossdissolve.frag")), kKernelCrossDissolve);
+  builtin_shaders_.insert(FileFunctions::ReadFileAsString(QStringLiteral(":/shaders/diptoblack.frag")), kKernelDipToColor);
+  builtin_shaders_.insert(FileFunctions::ReadFileAsString(QStringLiteral(":/shaders/blur.frag")), kKernelBlur);
+  builtin_shaders_.insert(FileFunctions::ReadFileAsString(QStringLiteral(":/shaders/mosaic.frag")), kKernelMosaic);
+  builtin_shaders_.insert(FileFunctions::ReadFileAsString(QStringLiteral(":/shaders/crop.frag")), kKernelCrop);
+  builtin_shaders_.insert(FileFunctions::ReadFileAsString(QStringLiteral(":/shaders/solid.frag")), kKernelSolid);
+
+  default_vert_code_ = FileFunctions::ReadFileAsString(QStringLiteral(":/shaders/default.vert"));
+}
+
+void SoftwareRenderer::DestroyInternal()
+{
+  builtin_shaders_.clear();
+}
+
+void SoftwareRenderer::ClearDestination(double r, double g, double b, double a)
+{
+  // There's no bound framebuffer outside of Blit() for this to clear, destinations are cleared
+  // there instead
+  Q_UNUSED(r)
+  Q_UNUSED(g)
+  Q_UNUSED(b)
+  Q_UNUSED(a)
+}
+
+QVariant SoftwareRenderer::CreateNativeTexture2D(int width, int height, VideoParams::Format format, int channel_count, const void *data, int linesize)
+{
+  return CreateNativeTexture3D(width, height, 1, format, channel_count, data, linesize);
+}
+
+QVariant SoftwareRenderer::CreateNativeTexture3D(int width, int height, int depth, VideoParams::Format format, int channel_count, const void *data, int linesize)
+{
+  NativeTexture* tex = CreateNativeTextureInternal(width, height, depth, format, channel_count);
+
+  if (!tex) {
+    return QVariant();
+  }
+
+  if (data) {
+    ConvertToRGBA(data, linesize, format, channel_count, width, height * depth, tex->pixels.data());
+  }
+
+  return Node::PtrToValue(tex);
+}
+
+void SoftwareRenderer::DestroyNativeTexture(QVariant texture)
+{
+  delete Node::ValueToPtr<NativeTexture>(texture);
+}
+
+QVariant SoftwareRenderer::CreateNativeShader(ShaderCode code)
+{
+  if (code.vert_code() != default_vert_code_ || !builtin_shaders_.contains(code.frag_code())) {
+    qWarning() << "Software renderer has no native kernel for this shader";
+    return QVariant();
+  }
+
+  NativeShader* shader = new NativeShader();
+  shader->kernel = builtin_shaders_.value(code.frag_code());
+  return Node::PtrToValue(shader);
+}
+
+void SoftwareRenderer::DestroyNativeShader(QVariant shader)
+{
+  delete Node::ValueToPtr<NativeShader>(shader);
+}
+
+void SoftwareRenderer::UploadToTexture(Texture *texture, const void *data, int linesize)
+{
+  NativeTexture* tex = Node::ValueToPtr<NativeTexture>(texture->id());
+
+  ConvertToRGBA(data, linesize, tex->format, tex->channel_count, tex->width, tex->height * tex->depth, tex->pixels.data());
+}
+
+void SoftwareRenderer::DownloadFromTexture(Texture *texture, void *data, int linesize)
+{
+  NativeTexture* tex = Node::ValueToPtr<NativeTexture>(texture->id());
+
+  ConvertFromRGBA(tex->pixels.data(), tex->width, tex->height * tex->depth, tex->format, tex->channel_count, data, linesize);
+}
+
+bool SoftwareRenderer::CreateColorContext(ColorProcessorPtr color_processor, ColorContext *ctx)
+{
+  // OCIO's CPU processor needs no LUT textures, the kernel applies the processor directly
+  NativeShader* shader = new NativeShader();
+  shader->kernel = kKernelColor;
+  shader->color_processor = color_processor;
+
+  ctx->compiled_shader = Node::PtrToValue(shader);
+
+  return true;
+}
+
+void SoftwareRenderer::Blit(QVariant s, ShaderJob job, Texture *destination, VideoParams destination_params, bool clear_destination)
+{
+  NativeShader* shader = Node::ValueToPtr<NativeShader>(s);
+
+  if (!shader) {
+    return;
+  }
+
+  if (!destination) {
+    // No backbuffer to draw to without a display
+    qWarning() << "Software renderer can only blit to textures";
+    return;
+  }
+
+  NativeTexture* dst = Node::ValueToPtr<NativeTexture>(destination->id());
+
+  Rasterizer rasterizer(dst->width, dst->height, job.GetValue(QStringLiteral("ove_mvpmat")).data.value<QMatrix4x4>());
+
+  // See OpenGLRenderer::Blit() for how iterations ping-pong between textures
+  int real_iteration_count;
+  if (job.GetIterationCount() > 1 && !job.GetIterativeInput().isEmpty()) {
+    real_iteration_count = job.GetIterationCount();
+  } else {
+    real_iteration_count = 1;
+  }
+
+  std::unique_ptr<NativeTexture> output_tex, input_tex;
+  if (real_iteration_count > 1) {
+    output_tex.reset(CreateNativeTextureInternal(dst->width, dst->height, 1, destination_params.format(), dst->channel_count));
+
+    if (real_iteration_count > 2) {
+      input_tex.reset(CreateNativeTextureInternal(dst->width, dst->height, 1, destination_params.format(), dst->channel_count));
+    }
+  }
+
+  for (int iteration=0; iteration<real_iteration_count; iteration++) {
+    NativeTexture* target;
+
+    if (iteration == real_iteration_count-1) {
+      target = dst;
+
+      if (clear_destination) {
+        std::fill(target->pixels.begin(), target->pixels.end(), 0.0f);
+      }
+    } else {
+      target = output_tex.get();
+    }
+
+    KernelInput in(job, iteration, (iteration > 0) ? input_tex.get() : nullptr);
+
+    if (rasterizer.valid()) {
+      switch (shader->kernel) {
+      case kKernelDefault:
+        RunKernel(DefaultKernel(in), rasterizer, target);
+        break;
+      case kKernelColor:
+        RunKernel(ColorKernel(in, shader->color_processor), rasterizer, target);
+        break;
+      case kKernelAlphaOver:
+        RunKernel(AlphaOverKernel(in), rasterizer, target);
+        break;
+      case kKernelCrossDissolve:
+        RunKernel(CrossDissolveKernel(in), rasterizer, target);
+        break;
+      case kKernelDipToColor:
+        RunKernel(DipToColorKernel(in), rasterizer, target);
+        break;
+      case kKernelBlur:
+        RunKernel(BlurKernel(in), rasterizer, target);
+        break;
+      case kKernelMosaic:
+        RunKernel(MosaicKernel(in), rasterizer, target);
+        break;
+      case kKernelCrop:
+        RunKernel(CropKernel(in), rasterizer, target);
+        break;
+      case kKernelSolid:
+        RunKernel(SolidKernel(in), rasterizer, target);
+        break;
+      }
+    }
+
+    // Channels the target doesn't have read back as 0 (or 1 for alpha), same as a GL texture
+    if (target->channel_count < kPixelStride) {
+      float* p = target->pixels.data();
+      for (size_t i=0; i<target->pixels.size(); i+=kPixelStride) {
+        for (int j=target->channel_count; j<kPixelStride-1; j++) {
+          p[i + j] = 0.0f;
+        }
+        p[i + 3] = 1.0f;
+      }
+    }
+
+    // Swap so that the next iteration, the texture we draw now will be the input texture next
+    std::swap(output_tex, input_tex);
+  }
+}
+
+SoftwareRenderer::NativeTexture *SoftwareRenderer::CreateNativeTextureInternal(int width, int height, int depth, VideoParams::Format format, int channel_count)
+{
+  if (width <= 0 || height <= 0 || depth <= 0 || channel_count <= 0 || channel_count > kPixelStride) {
+    qCritical() << "Tried to create software texture with invalid parameters" << width << height << depth << channel_count;
+    return nullptr;
+  }
+
+  NativeTexture* tex = new NativeTexture();
+
+  tex->width = width;
+  tex->height = height;
+  tex->depth = depth;
+  tex->format = format;
+  tex->channel_count = channel_count;
+  tex->pixels.resize(size_t(width) * size_t(height) * size_t(depth) * kPixelStride, 0.0f);
+
+  return tex;
+}
+
+template <typename T>
+void ConvertRowToRGBA(const T* src, int channel_count, int width, float scale, float* dst)
+{
+  for (int x=0; x<width; x++) {
+    const T* s = src + x * channel_count;
+    float* d = dst + x * SoftwareRenderer::kPixelStride;
+
+    int c = 0;
+    for (; c<channel_count; c++) {
+      d[c] = float(s[c]) * scale;
+    }
+    for (; c<SoftwareRenderer::kPixelStride-1; c++) {
+      d[c] = 0.0f;
+    }
+    if (channel_count < SoftwareRenderer::kPixelStride) {
+      d[3] = 1.0f;
+    }
+  }
+}
+
+template <typename T>
+void ConvertRowFromRGBA(const float* src, int channel_count, int width, float max, T* dst)
+{
+  for (int x=0; x<width; x++) {
+    const float* s = src + x * SoftwareRenderer::kPixelStride;
+    T* d = dst + x * channel_count;
+
+    for (int c=0; c<channel_count; c++) {
+      if (max > 0.0f) {
+        // Integer formats, clamp and round the same way GL does
+        d[c] = T(clamp(s[c], 0.0f, 1.0f) * max + 0.5f);
+      } else {
+        d[c] = T(s[c]);
+      }
+    }
+  }
+}
+
+void SoftwareRenderer::ConvertToRGBA(const void *src, int linesize, VideoParams::Format format, int channel_count, int width, int rows, float *dst)
+{
+  // Linesize is in pixels like GL_UNPACK_ROW_LENGTH, 0 means tightly packed
+  const int src_stride = (linesize > 0 ? linesize : width) * VideoParams::GetBytesPerPixel(format, channel_count);
+  const int dst_stride = width * kPixelStride;
+
+  ParallelRows(width, rows, [=](int start, int end){
+    for (int y=start; y<end; y++) {
+      const char* s = static_cast<const char*>(src) + y * src_stride;
+      float* d = dst + y * dst_stride;
+
+      switch (format) {
+      case VideoParams::kFormatUnsigned8:
+        ConvertRowToRGBA(reinterpret_cast<const quint8*>(s), channel_count, width, 1.0f / 255.0f, d);
+        break;
+      case VideoParams::kFormatUnsigned16:
+        ConvertRowToRGBA(reinterpret_cast<const quint16*>(s), channel_count, width, 1.0f / 65535.0f, d);
+        break;
+      case VideoParams::kFormatFloat16:
+        ConvertRowToRGBA(reinterpret_cast<const qfloat16*>(s), channel_count, width, 1.0f, d);
+        break;
+      case VideoParams::kFormatFloat32:
+        ConvertRowToRGBA(reinterpret_cast<const float*>(s), channel_count, width, 1.0f, d);
+        break;
+      case VideoParams::kFormatInvalid:
+      case VideoParams::kFormatCount:
+        break;
+      }
+    }
+  });
+}
+
+void SoftwareRenderer::ConvertFromRGBA(const float *src, int width, int rows, VideoParams::Format format, int channel_count, void *dst, int linesize)
+{
+  // Linesize is in pixels like GL_PACK_ROW_LENGTH, 0 means tightly packed
+  const int src_stride = width * kPixelStride;
+  const int dst_stride = (linesize > 0 ? linesize : width) * VideoParams::GetBytesPerPixel(format, channel_count);
+
+  ParallelRows(width, rows, [=](int start, int end){
+    for (int y=start; y<end; y++) {
+      const float* s = src + y * src_stride;
+      char* d = static_cast<char*>(dst) + y * dst_stride;
+
+      switch (format) {
+      case VideoParams::kFormatUnsigned8:
+        ConvertRowFromRGBA(s, channel_count, width, 255.0f, reinterpret_cast<quint8*>(d));
+        break;
+      case VideoParams::kFormatUnsigned16:
+        ConvertRowFromRGBA(s, channel_count, width, 65535.0f, reinterpret_cast<quint16*>(d));
+        break;
+      case VideoParams::kFormatFloat16:
+        ConvertRowFromRGBA(s, channel_count, width, 0.0f, reinterpret_cast<qfloat16*>(d));
+        break;
+      case VideoParams::kFormatFloat32:
+        ConvertRowFromRGBA(s, channel_count, width, 0.0f, reinterpret_cast<float*>(d));
+        break;
+      case VideoParams::kFormatInvalid:
+      case VideoParams::kFormatCount:
+        break;
+      }
+    }
+  });
+}
+
+}
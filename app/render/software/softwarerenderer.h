@@ -0,0 +1,138 @@
+/***
+
+  Olive - Non-Linear Video Editor
+  Copyright (C) 2020 Olive Team
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+***/
+
+#ifndef SOFTWARERENDERER_H
+#define SOFTWARERENDERER_H
+
+#include <vector>
+
+#include "render/renderer.h"
+
+namespace olive {
+
+/**
+ * @brief Renderer that runs entirely on the CPU
+ *
+ * Intended for machines with no GPU or display (e.g. render farms). Textures are kept in system
+ * memory as packed float RGBA regardless of their declared format, and conversions only happen on
+ * upload and download.
+ *
+ * GLSL can't be executed here, so instead CreateNativeShader() matches the shader code against
+ * Olive's built-in shaders and returns a native C++ kernel that produces the same output. Shaders
+ * without a matching kernel fail to compile just like a broken GLSL shader would. Color management
+ * uses OCIO's CPU processor rather than its GPU shader.
+ *
+ * Unlike OpenGLRenderer, this renderer has no thread affinity and doesn't need to be wrapped in a
+ * RendererThreadWrapper. Every function is safe to call from multiple render threads at once and
+ * each blit is additionally split into row bands across the global thread pool.
+ */
+class SoftwareRenderer : public Renderer
+{
+  Q_OBJECT
+public:
+  SoftwareRenderer(QObject* parent = nullptr);
+
+  virtual ~SoftwareRenderer() override;
+
+  virtual bool Init() override;
+
+  virtual void PostDestroy() override;
+
+public slots:
+  virtual void PostInit() override;
+
+  virtual void DestroyInternal() override;
+
+  virtual void ClearDestination(double r = 0.0, double g = 0.0, double b = 0.0, double a = 0.0) override;
+
+  virtual QVariant CreateNativeTexture2D(int width, int height, olive::VideoParams::Format format, int channel_count, const void* data = nullptr, int linesize = 0) override;
+  virtual QVariant CreateNativeTexture3D(int width, int height, int depth, olive::VideoParams::Format format, int channel_count, const void* data = nullptr, int linesize = 0) override;
+
+  virtual void DestroyNativeTexture(QVariant texture) override;
+
+  virtual QVariant CreateNativeShader(olive::ShaderCode code) override;
+
+  virtual void DestroyNativeShader(QVariant shader) override;
+
+  virtual void UploadToTexture(olive::Texture* texture, const void* data, int linesize) override;
+
+  virtual void DownloadFromTexture(olive::Texture* texture, void* data, int linesize) override;
+
+protected:
+  virtual bool CreateColorContext(ColorProcessorPtr color_processor, ColorContext* ctx) override;
+
+protected slots:
+  virtual void Blit(QVariant shader,
+                    olive::ShaderJob job,
+                    olive::Texture* destination,
+                    olive::VideoParams destination_params,
+                    bool clear_destination) override;
+
+public:
+  enum Kernel {
+    kKernelDefault,
+    kKernelColor,
+    kKernelAlphaOver,
+    kKernelCrossDissolve,
+    kKernelDipToColor,
+    kKernelBlur,
+    kKernelMosaic,
+    kKernelCrop,
+    kKernelSolid
+  };
+
+  /**
+   * @brief Native texture storage, 4 floats per pixel (RGBA) with no row padding
+   */
+  struct NativeTexture {
+    int width;
+    int height;
+    int depth;
+    int channel_count;
+    VideoParams::Format format;
+    std::vector<float> pixels;
+  };
+
+  /**
+   * @brief Native "compiled shader", i.e. the kernel that will run and any state it needs
+   */
+  struct NativeShader {
+    Kernel kernel;
+    ColorProcessorPtr color_processor;
+  };
+
+  static const int kPixelStride = 4;
+
+private:
+  static NativeTexture* CreateNativeTextureInternal(int width, int height, int depth, VideoParams::Format format, int channel_count);
+
+  static void ConvertToRGBA(const void* src, int linesize, VideoParams::Format format, int channel_count, int width, int rows, float* dst);
+
+  static void ConvertFromRGBA(const float* src, int width, int rows, VideoParams::Format format, int channel_count, void* dst, int linesize);
+
+  QHash<QString, Kernel> builtin_shaders_;
+
+  QString default_vert_code_;
+
+};
+
+}
+
+#endif // SOFTWARERENDERER_H
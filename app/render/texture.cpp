@@ -28,7 +28,9 @@ const Texture::Interpolation Texture::kDefaultInterpolation = Texture::kMipmappe
 
 Texture::~Texture()
 {
-  renderer_->DestroyNativeTexture(id_);
+  if (renderer_) {
+    renderer_->ReleaseTexture(id_, params_, type_);
+  }
 }
 
 void Texture::Upload(void *data, int linesize)
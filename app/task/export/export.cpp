@@ -20,8 +20,13 @@
 
 #include "export.h"
 
+#include <QElapsedTimer>
+#include <QtConcurrent/QtConcurrent>
+
+#include "common/bufferpool.h"
 #include "common/timecodefunctions.h"
 #include "render/colormanager.h"
+#include "render/rendermanager.h"
 
 namespace olive {
 
@@ -29,10 +34,17 @@ ExportTask::ExportTask(ViewerOutput* viewer_node,
                        ColorManager* color_manager,
                        const ExportParams& params) :
   RenderTask(viewer_node, params.video_params(), params.audio_params()),
+  queued_frames_(0),
+  render_finished_(false),
+  prepare_finished_(false),
+  pipeline_failed_(false),
   color_manager_(color_manager),
   params_(params)
 {
   SetTitle(tr("Exporting \"%1\"").arg(viewer_node->media_name()));
+
+  // One thread for each stage
+  pipeline_pool_.setMaxThreadCount(2);
 }
 
 bool ExportTask::Run()
@@ -69,6 +81,7 @@ bool ExportTask::Run()
   }
 
   frame_time_ = 0;
+  audio_time_ = 0;
 
   QSize video_force_size;
   QMatrix4x4 video_force_matrix;
@@ -98,10 +111,6 @@ bool ExportTask::Run()
                                               params_.color_transform());
   }
 
-  if (params_.audio_enabled()) {
-    audio_data_.SetParameters(audio_params());
-  }
-
   // Start render process
   TimeRangeList video_range, audio_range;
 
@@ -111,24 +120,65 @@ bool ExportTask::Run()
 
   if (params_.audio_enabled()) {
     audio_range = {range};
-    audio_data_.SetLength(range.length());
   }
 
+  // Start encoding pipeline so that rendering never waits for conversion or compression
+  render_finished_ = false;
+  prepare_finished_ = false;
+  pipeline_failed_ = false;
+  stats_ = PipelineStatistics();
+
+  // Reset the renderer's counters so they only cover this export
+  RendererThreadWrapper::Statistics renderer_stats;
+  RenderManager::instance()->TakeRendererStatistics(&renderer_stats);
+
+  BufferPool::Statistics buffer_stats_start = BufferPool::GetStatistics();
+
+  QElapsedTimer pipeline_timer;
+  pipeline_timer.start();
+
+  QFuture<void> prepare_future = QtConcurrent::run(&pipeline_pool_, this, &ExportTask::PrepareLoop);
+  QFuture<void> write_future = QtConcurrent::run(&pipeline_pool_, this, &ExportTask::WriteLoop);
+
   Render(color_manager_, video_range, audio_range, RenderMode::kOnline, nullptr,
          video_force_size, video_force_matrix, encoder_->GetDesiredPixelFormat(),
          color_processor_);
 
-  bool success = true;
+  // Let the pipeline drain (or just stop if we were cancelled)
+  pipeline_lock_.lock();
+  render_finished_ = true;
+  pipeline_wait_.wakeAll();
+  pipeline_lock_.unlock();
 
-  if (params_.audio_enabled()) {
-    // Write audio data now
-    encoder_->WriteAudio(audio_params(), audio_data_.CreatePlaybackDevice(encoder_));
+  prepare_future.waitForFinished();
+  write_future.waitForFinished();
+
+  stats_.total_nsec = pipeline_timer.nsecsElapsed();
+
+  BufferPool::Statistics buffer_stats_end = BufferPool::GetStatistics();
+  stats_.buffer_pool_hits = buffer_stats_end.hits - buffer_stats_start.hits;
+  stats_.buffer_pool_misses = buffer_stats_end.misses - buffer_stats_start.misses;
+
+  if (RenderManager::instance()->TakeRendererStatistics(&renderer_stats)) {
+    stats_.renderer_statistics_valid = true;
+    stats_.renderer_commands = renderer_stats.commands;
+    stats_.renderer_blocking_calls = renderer_stats.blocking_calls;
+    stats_.renderer_blocking_nsec = renderer_stats.blocking_nsec;
   }
 
+  bool success = true;
+
+  // Both stages have finished, so nothing else is using the encoder. Video frames and audio chunks were encoded as
+  // they arrived, closing writes anything still buffered.
   encoder_->Close();
 
   delete encoder_;
 
+  if (pipeline_failed_) {
+    SetError(tr("Failed to encode \"%1\"").arg(real_filename));
+    success = false;
+  }
+
   // If cancelled, delete the file we made, which is always a file we created since we write to a
   // temp file during the actual encoding process
   if (IsCancelled()) {
@@ -160,6 +210,16 @@ void ExportTask::FrameDownloaded(FramePtr f, const QByteArray &hash, const QVect
     time_map_.insert(actual_time, f);
   }
 
+  pipeline_lock_.lock();
+  bool failed = pipeline_failed_;
+  pipeline_lock_.unlock();
+
+  if (failed) {
+    // Nothing will encode these, don't hold on to them
+    time_map_.clear();
+    return;
+  }
+
   forever {
     rational real_time = Timecode::timestamp_to_time(frame_time_,
                                                      viewer()->video_params().time_base());
@@ -168,25 +228,244 @@ void ExportTask::FrameDownloaded(FramePtr f, const QByteArray &hash, const QVect
       break;
     }
 
-    // Unfortunately this can't be done in another thread since the frames need to be sent
-    // one after the other chronologically.
-    encoder_->WriteFrame(time_map_.take(real_time), real_time);
+    // Frames are queued in chronological order and the pipeline keeps that order
+    EncodeJob job;
+    job.frame = time_map_.take(real_time);
+    job.time = real_time;
+
+    pipeline_lock_.lock();
+    prepare_queue_.push_back(job);
+    queued_frames_++;
+    pipeline_wait_.wakeAll();
+    pipeline_lock_.unlock();
 
     frame_time_++;
   }
 }
 
+void ExportTask::PrepareLoop()
+{
+  // Several consecutive times often share one frame (e.g. a still image), only convert it once
+  FramePtr last_frame;
+  QVariant last_prepared;
+
+  QElapsedTimer timer;
+
+  pipeline_lock_.lock();
+
+  while (true) {
+    while (prepare_queue_.empty() && !render_finished_ && !pipeline_failed_) {
+      pipeline_wait_.wait(&pipeline_lock_);
+    }
+
+    if (prepare_queue_.empty() || pipeline_failed_ || IsCancelled()) {
+      break;
+    }
+
+    EncodeJob job = prepare_queue_.front();
+    prepare_queue_.pop_front();
+
+    pipeline_lock_.unlock();
+
+    if (job.frame == last_frame) {
+      job.prepared = last_prepared;
+      stats_.frames_reused++;
+    } else {
+      timer.start();
+
+      job.prepared = encoder_->PrepareFrame(job.frame);
+
+      stats_.prepare_nsec += timer.nsecsElapsed();
+      stats_.frames_prepared++;
+
+      last_frame = job.frame;
+      last_prepared = job.prepared;
+    }
+
+    // The converted frame is all the writer needs, let the original go as soon as possible
+    job.frame = nullptr;
+
+    pipeline_lock_.lock();
+
+    write_queue_.push_back(job);
+    pipeline_wait_.wakeAll();
+  }
+
+  prepare_finished_ = true;
+  pipeline_wait_.wakeAll();
+
+  pipeline_lock_.unlock();
+}
+
+void ExportTask::WriteLoop()
+{
+  QElapsedTimer timer;
+
+  pipeline_lock_.lock();
+
+  while (true) {
+    timer.start();
+
+    while (write_queue_.empty() && !prepare_finished_ && !pipeline_failed_) {
+      pipeline_wait_.wait(&pipeline_lock_);
+    }
+
+    stats_.render_wait_nsec += timer.nsecsElapsed();
+
+    if (write_queue_.empty() || pipeline_failed_ || IsCancelled()) {
+      break;
+    }
+
+    EncodeJob job = write_queue_.front();
+    write_queue_.pop_front();
+
+    pipeline_lock_.unlock();
+
+    timer.start();
+
+    bool written;
+
+    if (job.audio) {
+      written = encoder_->WriteAudio(job.audio);
+      stats_.audio_written++;
+    } else {
+      written = encoder_->WritePreparedFrame(job.prepared, job.time);
+      stats_.frames_written++;
+    }
+
+    stats_.write_nsec += timer.nsecsElapsed();
+
+    if (!written) {
+      // Stop both stages, the encoder is closed by Run() once they've both finished
+      pipeline_lock_.lock();
+      pipeline_failed_ = true;
+      pipeline_wait_.wakeAll();
+      pipeline_lock_.unlock();
+
+      // Rendering more would be pointless. Not under our lock since this wakes RenderTask, which takes our lock while
+      // holding its own.
+      Cancel();
+
+      pipeline_lock_.lock();
+      break;
+    }
+
+    if (!job.audio) {
+      pipeline_lock_.lock();
+      queued_frames_--;
+      pipeline_lock_.unlock();
+
+      // There may be room for RenderTask to render another frame now
+      BufferedFramesReleased();
+    }
+
+    pipeline_lock_.lock();
+  }
+
+  // If we were cancelled or failed, discard anything left over
+  write_queue_.clear();
+  prepare_queue_.clear();
+  queued_frames_ = 0;
+
+  pipeline_lock_.unlock();
+
+  // RenderTask may be waiting for those frames to be released
+  BufferedFramesReleased();
+}
+
+QString ExportTask::GetStatisticsReport() const
+{
+  qint64 total_nsec = qMax(Q_INT64_C(1), stats_.total_nsec);
+
+  QString report = tr("Encoded %n frame(s) in %1 seconds. Conversion busy %2%, compression busy %3%, "
+                      "compression waiting for frames %4%.", nullptr, stats_.frames_written)
+      .arg(QString::number(static_cast<double>(stats_.total_nsec) / 1000000000.0, 'f', 1),
+           QString::number(stats_.prepare_nsec * 100 / total_nsec),
+           QString::number(stats_.write_nsec * 100 / total_nsec),
+           QString::number(stats_.render_wait_nsec * 100 / total_nsec));
+
+  if (stats_.renderer_statistics_valid && stats_.frames_written > 0) {
+    double frames = stats_.frames_written;
+
+    report.append(' ');
+    report.append(tr("Renderer: %1 calls per frame, %2 blocking, %3 ms blocked per frame.")
+                  .arg(QString::number(stats_.renderer_commands / frames, 'f', 1),
+                       QString::number(stats_.renderer_blocking_calls / frames, 'f', 1),
+                       QString::number(stats_.renderer_blocking_nsec / 1000000.0 / frames, 'f', 2)));
+  }
+
+  quint64 buffer_allocations = stats_.buffer_pool_hits + stats_.buffer_pool_misses;
+  if (buffer_allocations > 0) {
+    report.append(' ');
+    report.append(tr("%1% of frame and sample buffers were recycled.")
+                  .arg(QString::number(stats_.buffer_pool_hits * 100 / buffer_allocations)));
+  }
+
+  return report;
+}
+
+int ExportTask::GetBufferedFrameCount() const
+{
+  QMutexLocker locker(&pipeline_lock_);
+
+  return queued_frames_;
+}
+
+int ExportTask::GetReorderedFrameCount() const
+{
+  // Several times can share one frame, only count each frame once
+  QSet<Frame*> unique_frames;
+
+  for (auto it=time_map_.cbegin(); it!=time_map_.cend(); it++) {
+    unique_frames.insert(it.value().get());
+  }
+
+  return unique_frames.size();
+}
+
 void ExportTask::AudioDownloaded(const TimeRange &range, SampleBufferPtr samples, qint64 job_time)
 {
   Q_UNUSED(job_time)
 
+  pipeline_lock_.lock();
+  bool failed = pipeline_failed_;
+  pipeline_lock_.unlock();
+
+  if (failed) {
+    return;
+  }
+
   TimeRange adjusted_range = range;
 
   if (params_.has_custom_range()) {
     adjusted_range -= params_.custom_range().in();
   }
 
-  audio_data_.WritePCM(adjusted_range, samples, QDateTime::currentMSecsSinceEpoch());
+  audio_map_.insert(adjusted_range.in(), qMakePair(adjusted_range, samples));
+
+  // Audio must reach the encoder in order with no gaps, so send whatever is now contiguous
+  while (!audio_map_.isEmpty() && audio_map_.firstKey() == audio_time_) {
+    QPair<TimeRange, SampleBufferPtr> chunk = audio_map_.take(audio_time_);
+
+    SampleBufferPtr chunk_samples = chunk.second;
+
+    if (!chunk_samples) {
+      // Nothing was rendered here, substitute silence so the audio stays in sync
+      chunk_samples = SampleBuffer::CreateAllocated(audio_params(), chunk.first.length());
+      chunk_samples->fill(0.0f);
+    }
+
+    // Audio skips the conversion stage and goes straight to the writer, which interleaves it with the video
+    EncodeJob job;
+    job.audio = chunk_samples;
+
+    pipeline_lock_.lock();
+    write_queue_.push_back(job);
+    pipeline_wait_.wakeAll();
+    pipeline_lock_.unlock();
+
+    audio_time_ = chunk.first.out();
+  }
 }
 
 }
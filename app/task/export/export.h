@@ -21,6 +21,11 @@
 #ifndef EXPORTTASK_H
 #define EXPORTTASK_H
 
+#include <deque>
+#include <QMutex>
+#include <QThreadPool>
+#include <QWaitCondition>
+
 #include "exportparams.h"
 #include "node/output/viewer/viewer.h"
 #include "render/colorprocessor.h"
@@ -35,6 +40,63 @@ class ExportTask : public RenderTask
 public:
   ExportTask(ViewerOutput *viewer_node, ColorManager *color_manager, const ExportParams &params);
 
+  /**
+   * @brief Per-stage statistics for the encoding pipeline
+   */
+  struct PipelineStatistics {
+    PipelineStatistics() :
+      frames_prepared(0),
+      frames_reused(0),
+      frames_written(0),
+      audio_written(0),
+      prepare_nsec(0),
+      write_nsec(0),
+      render_wait_nsec(0),
+      total_nsec(0),
+      renderer_statistics_valid(false),
+      renderer_commands(0),
+      renderer_blocking_calls(0),
+      renderer_blocking_nsec(0),
+      buffer_pool_hits(0),
+      buffer_pool_misses(0)
+    {
+    }
+
+    int frames_prepared;
+    int frames_reused;
+    int frames_written;
+    int audio_written;
+    qint64 prepare_nsec;
+    qint64 write_nsec;
+    qint64 render_wait_nsec;
+
+    /// Time from starting the pipeline until both stages finished
+    qint64 total_nsec;
+
+    /// Whether the renderer_* members were filled in, only if the renderer runs on its own thread
+    bool renderer_statistics_valid;
+    qint64 renderer_commands;
+    qint64 renderer_blocking_calls;
+    qint64 renderer_blocking_nsec;
+
+    /// BufferPool allocations during the export that reused a block or needed a new one
+    quint64 buffer_pool_hits;
+    quint64 buffer_pool_misses;
+  };
+
+  /**
+   * @brief Returns statistics of the last export, only valid once the task has finished
+   */
+  const PipelineStatistics& GetPipelineStatistics() const
+  {
+    return stats_;
+  }
+
+  /**
+   * @brief Returns a one-line summary of GetPipelineStatistics() to show once the export is done
+   */
+  QString GetStatisticsReport() const;
+
 protected:
   virtual bool Run() override;
 
@@ -47,9 +109,68 @@ protected:
     return false;
   }
 
+  virtual int GetBufferedFrameCount() const override;
+
+  virtual int GetReorderedFrameCount() const override;
+
 private:
+  /**
+   * @brief One unit of work for the encoding pipeline
+   */
+  struct EncodeJob {
+    FramePtr frame;
+    QVariant prepared;
+    rational time;
+    SampleBufferPtr audio;
+  };
+
+  /**
+   * @brief Conversion stage, turns frames into whatever the encoder compresses (Encoder::PrepareFrame())
+   */
+  void PrepareLoop();
+
+  /**
+   * @brief Compression stage, the only thread that writes to the encoder while rendering is in progress
+   */
+  void WriteLoop();
+
+  /**
+   * @brief Frames that arrived out of order and are waiting for earlier frames to be encoded
+   */
   QHash<rational, FramePtr> time_map_;
 
+  /**
+   * @brief In-order video waiting to be converted
+   */
+  std::deque<EncodeJob> prepare_queue_;
+
+  /**
+   * @brief Converted video and in-order audio waiting to be compressed
+   */
+  std::deque<EncodeJob> write_queue_;
+
+  /**
+   * @brief Video frames in either queue, which count towards RenderTask's frames in flight
+   */
+  int queued_frames_;
+
+  bool render_finished_;
+
+  bool prepare_finished_;
+
+  /**
+   * @brief Set if the encoder failed to write, stops both stages
+   */
+  bool pipeline_failed_;
+
+  mutable QMutex pipeline_lock_;
+
+  QWaitCondition pipeline_wait_;
+
+  QThreadPool pipeline_pool_;
+
+  PipelineStatistics stats_;
+
   ColorManager* color_manager_;
 
   ExportParams params_;
@@ -60,7 +181,15 @@ private:
 
   int64_t frame_time_;
 
-  AudioPlaybackCache audio_data_;
+  /**
+   * @brief Audio chunks that arrived out of order, keyed by in point, waiting for earlier audio to be encoded
+   */
+  QMap<rational, QPair<TimeRange, SampleBufferPtr> > audio_map_;
+
+  /**
+   * @brief Time up to which audio has been sent to the encoder
+   */
+  rational audio_time_;
 
 };
 
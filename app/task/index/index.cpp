@@ -0,0 +1,60 @@
+/***
+
+  Olive - Non-Linear Video Editor
+  Copyright (C) 2020 Olive Team
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+***/
+
+#include "index.h"
+
+#include "codec/decoder.h"
+
+namespace olive {
+
+IndexTask::IndexTask(StreamPtr stream) :
+  stream_(stream)
+{
+  SetTitle(tr("Indexing %1:%2").arg(stream_->footage()->filename(), QString::number(stream_->index())));
+}
+
+bool IndexTask::Run()
+{
+  if (!stream_->footage()->project()) {
+    // Footage was removed (e.g. the import was undone) before we got to it
+    return true;
+  }
+
+  DecoderPtr decoder = Decoder::CreateFromID(stream_->footage()->decoder());
+
+  if (!decoder || !decoder->Open(stream_)) {
+    SetError(tr("Failed to open decoder to index footage"));
+    return false;
+  }
+
+  connect(decoder.get(), &Decoder::IndexProgress, this, &IndexTask::ProgressChanged);
+
+  bool success = decoder->Index(&IsCancelled());
+
+  decoder->Close();
+
+  if (!success) {
+    SetError(tr("Failed to index footage"));
+  }
+
+  return success;
+}
+
+}
@@ -0,0 +1,50 @@
+/***
+
+  Olive - Non-Linear Video Editor
+  Copyright (C) 2020 Olive Team
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+***/
+
+#ifndef INDEXTASK_H
+#define INDEXTASK_H
+
+#include "project/item/footage/stream.h"
+#include "task/task.h"
+
+namespace olive {
+
+/**
+ * @brief Builds a decoder's seek index for a stream in the background
+ *
+ * \see Decoder::Index()
+ */
+class IndexTask : public Task
+{
+  Q_OBJECT
+public:
+  IndexTask(StreamPtr stream);
+
+protected:
+  virtual bool Run() override;
+
+private:
+  StreamPtr stream_;
+
+};
+
+}
+
+#endif // INDEXTASK_H
@@ -122,6 +122,8 @@ void ProjectImportTask::Import(Folder *folder, QFileInfoList import, int &counte
                                              folder,
                                              item,
                                              parent_command);
+
+        imported_footage_.append(item);
       } else {
         // Add to list so we can tell the user about it later
         invalid_files_.append(file_info.absoluteFilePath());
@@ -53,6 +53,11 @@ public:
     return !invalid_files_.isEmpty();
   }
 
+  const QVector<FootagePtr>& GetImportedFootage() const
+  {
+    return imported_footage_;
+  }
+
 protected:
   virtual bool Run() override;
 
@@ -79,6 +84,8 @@ private:
 
   QStringList invalid_files_;
 
+  QVector<FootagePtr> imported_footage_;
+
   QList<QString> image_sequence_ignore_files_;
 
 };
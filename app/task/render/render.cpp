@@ -25,11 +25,14 @@
 
 namespace olive {
 
+const rational RenderTask::kAudioChunkLength = rational(1);
+
 RenderTask::RenderTask(ViewerOutput* viewer, const VideoParams &vparams, const AudioParams &aparams) :
   viewer_(viewer),
   video_params_(vparams),
   audio_params_(aparams),
-  running_tickets_(0)
+  running_tickets_(0),
+  buffered_frames_released_(false)
 {
 }
 
@@ -56,36 +59,52 @@ bool RenderTask::Render(ColorManager* manager,
   // Store real time before any rendering takes place
   qint64 job_time = QDateTime::currentMSecsSinceEpoch();
 
-  // Queue audio jobs
+  // Audio is split into chunks and queued alongside video rather than all at once, so that a
+  // subclass consuming both in order (e.g. an encoder interleaving them) receives them at roughly
+  // the same pace and never has to hold the entire soundtrack in memory
+  QVector<TimeRange> audio_chunks;
+
   foreach (const TimeRange& r, audio_range) {
-    // Don't count audio progress, since it's generally a lot faster than video and is weighted at
-    // 50%, which makes the progress bar look weird to the uninitiated
-    //total_length += r.length().toDouble();
+    for (rational chunk_in=r.in(); chunk_in<r.out(); chunk_in+=kAudioChunkLength) {
+      audio_chunks.append(TimeRange(chunk_in, qMin(chunk_in + kAudioChunkLength, r.out())));
+    }
+  }
 
-    IncrementRunningTickets();
+  int next_audio = 0;
 
-    RenderTicketWatcher* watcher = new RenderTicketWatcher();
-    watcher->setProperty("range", QVariant::fromValue(r));
-    PrepareWatcher(watcher, &watcher_thread);
-    watcher->SetTicket(RenderManager::instance()->RenderAudio(viewer_, r, audio_params_, false));
-  }
+  auto submit_audio = [&](const rational& up_to){
+    while (next_audio < audio_chunks.size()
+           && !IsCancelled()
+           && audio_chunks.at(next_audio).in() <= up_to) {
+      const TimeRange& r = audio_chunks.at(next_audio);
+
+      // Don't count audio progress, since it's generally a lot faster than video and is weighted at
+      // 50%, which makes the progress bar look weird to the uninitiated
+      //total_length += r.length().toDouble();
+
+      IncrementRunningTickets();
+
+      RenderTicketWatcher* watcher = new RenderTicketWatcher();
+      watcher->setProperty("range", QVariant::fromValue(r));
+      PrepareWatcher(watcher, &watcher_thread);
+      watcher->SetTicket(RenderManager::instance()->RenderAudio(viewer_, r, audio_params_, false));
+
+      next_audio++;
+    }
+  };
 
   // Look up hashes
   QMap<QByteArray, QVector<rational> > time_map;
 
+  // Unique hashes in the order they first appear in the timeline
+  QVector<QByteArray> unique_hashes;
+
   if (!video_range.isEmpty()) {
     // Get list of discrete frames from range
     QVector<rational> times = viewer()->video_frame_cache()->GetFrameListFromTimeRange(video_range);
-    QVector<QByteArray> hashes(times.size());
 
     // Generate hashes
-    for (int i=0; i<times.size(); i++) {
-      if (IsCancelled()) {
-        return true;
-      }
-
-      hashes[i] = RenderManager::instance()->Hash(viewer(), video_params_, times.at(i));
-    }
+    QVector<QByteArray> hashes = RenderManager::HashFrames(viewer(), video_params_, times, &IsCancelled());
 
     // Filter out duplicates
     for (int i=0; i<hashes.size(); i++) {
@@ -98,18 +117,8 @@ bool RenderTask::Render(ColorManager* manager,
       time_map[hash].append(times.at(i));
 
       if (time_map[hash].size() == 1) {
-        // This is the first frame with this hash, so we signal a render
-        RenderTicketWatcher* watcher = new RenderTicketWatcher();
-        watcher->setProperty("hash", hash);
-        PrepareWatcher(watcher, &watcher_thread);
-
-        IncrementRunningTickets();
-
-        watcher->SetTicket(RenderManager::instance()->RenderFrame(viewer_, manager, times.at(i),
-                                                                  mode, video_params_, audio_params_,
-                                                                  force_size, force_matrix,
-                                                                  force_format, force_color_output,
-                                                                  cache));
+        // This is the first frame with this hash, so it'll need to be rendered
+        unique_hashes.append(hash);
       }
     }
 
@@ -117,6 +126,50 @@ bool RenderTask::Render(ColorManager* manager,
     total_length += video_frame_sz * time_map.size();
   }
 
+  // Rather than queueing every frame at once, keep a sliding window of frames in flight so memory
+  // usage stays bounded regardless of the length of the range. Frames the subclass is still holding
+  // on to (e.g. waiting to be encoded) count towards the window too, which lets a slow consumer hold
+  // back rendering.
+  const int max_frames_in_flight = qMax(2, QThread::idealThreadCount() * 2);
+  int frames_in_flight = 0;
+  int next_hash = 0;
+
+  auto submit_frames = [&](){
+    // Reordered frames are only counted while something is rendering, otherwise a subclass holding
+    // a full window of them could wait forever for a frame that never gets submitted
+    while (next_hash < unique_hashes.size()
+           && !IsCancelled()
+           && frames_in_flight + GetBufferedFrameCount() < max_frames_in_flight
+           && (frames_in_flight == 0
+               || frames_in_flight + GetBufferedFrameCount() + GetReorderedFrameCount() < max_frames_in_flight)) {
+      const QByteArray& hash = unique_hashes.at(next_hash);
+
+      RenderTicketWatcher* watcher = new RenderTicketWatcher();
+      watcher->setProperty("hash", hash);
+      PrepareWatcher(watcher, &watcher_thread);
+
+      IncrementRunningTickets();
+
+      watcher->SetTicket(RenderManager::instance()->RenderFrame(viewer_, manager, time_map.value(hash).first(),
+                                                                mode, video_params_, audio_params_,
+                                                                force_size, force_matrix,
+                                                                force_format, force_color_output,
+                                                                cache));
+
+      frames_in_flight++;
+      next_hash++;
+
+      submit_audio(time_map.value(hash).first());
+    }
+
+    if (next_hash == unique_hashes.size()) {
+      // No more video to pace against, queue whatever audio is left
+      submit_audio(RATIONAL_MAX);
+    }
+  };
+
+  submit_frames();
+
   finished_watcher_mutex_.lock();
 
   while (!IsCancelled()) {
@@ -157,6 +210,10 @@ bool RenderTask::Render(ColorManager* manager,
         QByteArray rendered_hash = watcher->property("hash").toByteArray();
         FrameDownloaded(watcher->Get().value<FramePtr>(), rendered_hash, time_map.value(rendered_hash), job_time);
 
+        // This frame has left the window, so another can take its place
+        frames_in_flight--;
+        submit_frames();
+
         double progress_to_add = video_frame_sz;
         if (TwoStepFrameRendering()) {
           progress_to_add *= 0.5;
@@ -177,9 +234,20 @@ bool RenderTask::Render(ColorManager* manager,
       break;
     }
 
-    // Run out of finished watchers. If we still have running tickets, wait for the next one to finish.
-    if (running_tickets_ > 0) {
-      finished_watcher_wait_cond_.wait(&finished_watcher_mutex_);
+    // Run out of finished watchers. If we still have running tickets, wait for the next one to
+    // finish. If frames are left to submit, the subclass is holding the window and we wait for it
+    // to release some.
+    if (running_tickets_ > 0 || next_hash < unique_hashes.size()) {
+      if (!buffered_frames_released_) {
+        finished_watcher_wait_cond_.wait(&finished_watcher_mutex_);
+      }
+      buffered_frames_released_ = false;
+
+      // We may have been woken because the subclass released buffered frames rather than a ticket
+      // finishing, in which case there may be room for more
+      finished_watcher_mutex_.unlock();
+      submit_frames();
+      finished_watcher_mutex_.lock();
     } else {
       // No more running tickets or finished tickets, wem ust be
       break;
@@ -80,6 +80,49 @@ protected:
     return true;
   }
 
+  /**
+   * @brief Number of rendered frames the subclass is still holding in memory
+   *
+   * These count towards the limit of frames in flight during Render(), so a subclass that can't
+   * consume frames as quickly as they're rendered should override this to apply backpressure.
+   * Render() won't submit more frames while these fill the window, until BufferedFramesReleased()
+   * is called.
+   */
+  virtual int GetBufferedFrameCount() const
+  {
+    return 0;
+  }
+
+  /**
+   * @brief Number of rendered frames the subclass is holding until an earlier frame arrives
+   *
+   * These count towards the limit of frames in flight too, except when nothing is rendering, since
+   * the frame they're waiting on may not have been submitted yet.
+   */
+  virtual int GetReorderedFrameCount() const
+  {
+    return 0;
+  }
+
+  /**
+   * @brief Notify Render() that GetBufferedFrameCount() went down, may be called from any thread
+   *
+   * Without this, a subclass that releases frames asynchronously would only let new frames through
+   * when a ticket finishes.
+   */
+  void BufferedFramesReleased()
+  {
+    finished_watcher_mutex_.lock();
+    buffered_frames_released_ = true;
+    finished_watcher_wait_cond_.wakeAll();
+    finished_watcher_mutex_.unlock();
+  }
+
+  /**
+   * @brief Maximum length of audio rendered by a single ticket, AudioDownloaded() receives chunks of this size
+   */
+  static const rational kAudioChunkLength;
+
 private:
   void PrepareWatcher(RenderTicketWatcher* watcher, QThread *thread);
 
@@ -96,6 +139,7 @@ private:
   int running_tickets_;
   QMutex finished_watcher_mutex_;
   QWaitCondition finished_watcher_wait_cond_;
+  bool buffered_frames_released_;
 
 private slots:
   void TicketDone(RenderTicketWatcher *watcher);
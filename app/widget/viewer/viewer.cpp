@@ -27,6 +27,7 @@
 #include <QMessageBox>
 #include <QResizeEvent>
 #include <QScreen>
+#include <QStatusBar>
 #include <QtMath>
 #include <QVBoxLayout>
 
@@ -35,6 +36,7 @@
 #include "common/ratiodialog.h"
 #include "common/timecodefunctions.h"
 #include "config/config.h"
+#include "core.h"
 #include "project/item/sequence/sequence.h"
 #include "project/project.h"
 #include "render/rendermanager.h"
@@ -46,8 +48,6 @@ namespace olive {
 
 QVector<ViewerWidget*> ViewerWidget::instances_;
 
-const int kMaxPreQueueSize = 16;
-
 ViewerWidget::ViewerWidget(QWidget *parent) :
   TimeBasedWidget(false, true, parent),
   playback_speed_(0),
@@ -56,6 +56,9 @@ ViewerWidget::ViewerWidget(QWidget *parent) :
   override_color_manager_(nullptr),
   time_changed_from_timer_(false),
   pause_autocache_during_playback_(false),
+  playback_queue_depth_(0),
+  playback_dropped_frames_(0),
+  playback_late_frames_(0),
   prequeuing_(false)
 {
   // Set up main layout
@@ -374,9 +377,9 @@ void ViewerWidget::SetGizmos(Node *node)
   display_widget_->SetGizmos(node);
 }
 
-FramePtr ViewerWidget::DecodeCachedImage(const QString &fn, const rational& time) const
+FramePtr ViewerWidget::DecodeCachedImage(const QByteArray &hash, const rational& time) const
 {
-  FramePtr frame = GetConnectedNode()->video_frame_cache()->LoadCacheFrame(fn);
+  FramePtr frame = GetConnectedNode()->video_frame_cache()->LoadCacheFrame(hash);
 
   if (frame) {
     frame->set_timestamp(time);
@@ -387,10 +390,10 @@ FramePtr ViewerWidget::DecodeCachedImage(const QString &fn, const rational& time
   return frame;
 }
 
-void ViewerWidget::DecodeCachedImage(RenderTicketPtr ticket, const QString &fn, const rational& time) const
+void ViewerWidget::DecodeCachedImage(RenderTicketPtr ticket, const QByteArray &hash, const rational& time) const
 {
   ticket->Start();
-  ticket->Finish(QVariant::fromValue(DecodeCachedImage(fn, time)), false);
+  ticket->Finish(QVariant::fromValue(DecodeCachedImage(hash, time)), false);
 }
 
 bool ViewerWidget::ShouldForceWaveform() const
@@ -424,13 +427,14 @@ void ViewerWidget::UpdateTextureFromNode(const rational& time)
 
         // Skip this frame
         PopOldestFrameFromPlaybackQueue();
+        playback_dropped_frames_++;
 
       }
     }
 
-    // Only show warning if frame actually exists
+    // Only count as late if frame actually exists
     if (frame_exists_at_time) {
-      qWarning() << "Playback queue failed to keep up";
+      playback_late_frames_++;
     }
 
   }
@@ -483,6 +487,9 @@ void ViewerWidget::PlayInternal(int speed, bool in_to_out_only)
   play_in_to_out_only_ = in_to_out_only;
 
   playback_queue_next_frame_ = ruler()->GetTime();
+  playback_queue_depth_ = qMax(1, Config::Current()[QStringLiteral("PlaybackReadahead")].toInt());
+  playback_dropped_frames_ = 0;
+  playback_late_frames_ = 0;
 
   controls_->ShowPauseButton();
 
@@ -493,9 +500,7 @@ void ViewerWidget::PlayInternal(int speed, bool in_to_out_only)
     if (prequeue_length_ > 0) {
       prequeuing_ = true;
 
-      for (int i=0; i<prequeue_length_; i++) {
-        RequestNextFrameForQueue();
-      }
+      FillPlaybackQueue();
     }
   }
 
@@ -519,8 +524,17 @@ void ViewerWidget::PauseInternal()
 
     playback_queue_.clear();
     playback_backup_timer_.stop();
+
+    if (playback_dropped_frames_ > 0 || playback_late_frames_ > 0) {
+      Core::instance()->main_window()->statusBar()->showMessage(
+            tr("Playback: %1, %2").arg(tr("%n frame(s) dropped", nullptr, playback_dropped_frames_),
+                                       tr("%n frame(s) late", nullptr, playback_late_frames_)));
+    }
   }
 
+  // Any requests still in flight belong to this playback and will be ignored when they return
+  queue_watchers_.clear();
+
   prequeuing_ = false;
 }
 
@@ -610,16 +624,26 @@ void ViewerWidget::RequestNextFrameForQueue()
 
   RenderTicketWatcher* watcher = new RenderTicketWatcher();
   connect(watcher, &RenderTicketWatcher::Finished, this, &ViewerWidget::RendererGeneratedFrameForQueue);
+  queue_watchers_.append(watcher);
   watcher->SetTicket(GetFrame(next_time, false));
 }
 
+void ViewerWidget::FillPlaybackQueue()
+{
+  // Frames that are still being read count towards the depth too, otherwise a slow disk would lead
+  // to more and more requests piling up behind each other
+  int target = DeterminePlaybackQueueSize();
+
+  while (int(playback_queue_.size()) + queue_watchers_.size() < target) {
+    RequestNextFrameForQueue();
+  }
+}
+
 RenderTicketPtr ViewerWidget::GetFrame(const rational &t, bool clear_render_queue)
 {
   QByteArray cached_hash = GetConnectedNode()->video_frame_cache()->GetHash(t);
 
-  QString cache_fn = GetConnectedNode()->video_frame_cache()->CachePathName(cached_hash);
-
-  if (cached_hash.isEmpty() || !QFileInfo::exists(cache_fn)) {
+  if (!GetConnectedNode()->video_frame_cache()->HasCachedFrame(cached_hash)) {
     // Frame hasn't been cached, start render job
     if (clear_render_queue) {
       auto_cacher_.ClearVideoQueue();
@@ -630,7 +654,7 @@ RenderTicketPtr ViewerWidget::GetFrame(const rational &t, bool clear_render_queu
     // Frame has been cached, grab the frame
     RenderTicketPtr ticket = std::make_shared<RenderTicket>();
     ticket->setProperty("time", QVariant::fromValue(t));
-    QtConcurrent::run(this, &ViewerWidget::DecodeCachedImage, ticket, cache_fn, t);
+    QtConcurrent::run(&cache_read_pool_, this, &ViewerWidget::DecodeCachedImage, ticket, cached_hash, t);
 
     return ticket;
   }
@@ -673,16 +697,14 @@ int ViewerWidget::DeterminePlaybackQueueSize()
 
   int remaining_frames = (end_ts - GetTimestamp()) * playback_speed_;
 
-  return qMin(kMaxPreQueueSize, remaining_frames);
+  return qMin(playback_queue_depth_, remaining_frames);
 }
 
 void ViewerWidget::PopOldestFrameFromPlaybackQueue()
 {
   playback_queue_.pop_front();
 
-  if (int(playback_queue_.size()) < DeterminePlaybackQueueSize()) {
-    RequestNextFrameForQueue();
-  }
+  FillPlaybackQueue();
 }
 
 void ViewerWidget::UpdateStack()
@@ -770,22 +792,42 @@ void ViewerWidget::RendererGeneratedFrameForQueue()
 {
   RenderTicketWatcher* watcher = static_cast<RenderTicketWatcher*>(sender());
 
+  // Ignore this signal if we've paused (or restarted playback) since it was requested
+  if (!queue_watchers_.removeOne(watcher)) {
+    delete watcher;
+    return;
+  }
+
   if (!watcher->WasCancelled()) {
     FramePtr frame = watcher->Get().value<FramePtr>();
 
-    // Ignore this signal if we've paused now
-    if (IsPlaying() || prequeuing_) {
+    if (frame && IsPlaying() && !prequeuing_
+        && ((playback_speed_ > 0) ? (frame->timestamp() < GetTime()) : (frame->timestamp() > GetTime()))) {
+
+      // Playback has already passed this frame, no point queueing it
+      playback_dropped_frames_++;
+      FillPlaybackQueue();
+
+    } else if (frame && (IsPlaying() || prequeuing_)) {
       playback_queue_.AppendTimewise({frame->timestamp(), frame}, playback_speed_);
 
       foreach (ViewerWindow* window, windows_) {
         window->queue()->AppendTimewise({frame->timestamp(), frame}, playback_speed_);
       }
-
-      if (prequeuing_ && int(playback_queue_.size()) == prequeue_length_) {
-        prequeuing_ = false;
-        FinishPlayPreprocess();
-      }
+    } else if (!frame && IsPlaying() && !prequeuing_) {
+      // The read failed, request the next frame in its place so the readahead doesn't shrink
+      FillPlaybackQueue();
     }
+  } else if (IsPlaying() && !prequeuing_) {
+    // Same for a request that was cancelled
+    FillPlaybackQueue();
+  }
+
+  // Start playing once the queue is full, or once every request has returned even if some failed
+  if (prequeuing_
+      && (int(playback_queue_.size()) == prequeue_length_ || queue_watchers_.isEmpty())) {
+    prequeuing_ = false;
+    FinishPlayPreprocess();
   }
 
   delete watcher;
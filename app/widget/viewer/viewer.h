@@ -25,6 +25,7 @@
 #include <QLabel>
 #include <QPushButton>
 #include <QScrollBar>
+#include <QThreadPool>
 #include <QTimer>
 #include <QWidget>
 
@@ -191,6 +192,8 @@ private:
 
   void RequestNextFrameForQueue();
 
+  void FillPlaybackQueue();
+
   RenderTicketPtr GetFrame(const rational& t, bool clear_render_queue);
 
   void FinishPlayPreprocess();
@@ -199,9 +202,9 @@ private:
 
   void PopOldestFrameFromPlaybackQueue();
 
-  FramePtr DecodeCachedImage(const QString &fn, const rational& time) const;
+  FramePtr DecodeCachedImage(const QByteArray &hash, const rational& time) const;
 
-  void DecodeCachedImage(RenderTicketPtr ticket, const QString &fn, const rational& time) const;
+  void DecodeCachedImage(RenderTicketPtr ticket, const QByteArray &hash, const rational& time) const;
 
   bool ShouldForceWaveform() const;
 
@@ -239,6 +242,34 @@ private:
   ViewerQueue playback_queue_;
   int64_t playback_queue_next_frame_;
 
+  /**
+   * @brief Requests for the playback queue that haven't come back yet
+   */
+  QList<RenderTicketWatcher*> queue_watchers_;
+
+  /**
+   * @brief Maximum number of frames to have decoded or decoding ahead of the playhead
+   */
+  int playback_queue_depth_;
+
+  /**
+   * @brief Frames that were ready but never shown because playback had already passed them
+   */
+  int playback_dropped_frames_;
+
+  /**
+   * @brief Frames that weren't ready in time and had to be requested while playing
+   */
+  int playback_late_frames_;
+
+  /**
+   * @brief Threads used for reading frames from the disk cache
+   *
+   * Kept separate from the global pool so that reads during playback never wait behind unrelated
+   * work like hashing or cache deletions.
+   */
+  QThreadPool cache_read_pool_;
+
   bool prequeuing_;
 
   QList<RenderTicketWatcher*> nonqueue_watchers_;